@@ -141,6 +141,13 @@ typedef intptr_t        ngx_flag_t; //一般用用配置项中的 ON | OFF选项
 #define ngx_abort       abort
 
 
+#if (NGX_HAVE_GCC_PREFETCH)
+#define ngx_prefetch(p)     __builtin_prefetch(p)
+#else
+#define ngx_prefetch(p)
+#endif
+
+
 /* TODO: platform specific: array[NGX_INVALID_ARRAY_INDEX] must cause SIGSEGV */
 #define NGX_INVALID_ARRAY_INDEX 0x80000000
 
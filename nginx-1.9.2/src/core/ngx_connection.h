@@ -124,6 +124,14 @@ struct ngx_listening_s { //初始化及赋值见ngx_http_add_listening    热升
     int                 fastopen;
 #endif
 
+#if (NGX_HAVE_IO_URING)
+    /* the result of IORING_OP_ACCEPT, see ngx_io_uring_module.c */
+    int                 ring_res;
+    socklen_t           ring_socklen;
+    u_char              ring_sockaddr[NGX_SOCKADDRLEN];
+    unsigned            ring_accepted:1;
+#endif
+
 };
 
 //本连接记录日志时的级别，它占用了3位，取值范围是0-7，但实际上目前只定义了5个值。见ngx_connection_s->log_error
@@ -396,6 +404,9 @@ struct ngx_connection_s {  //cycle->read_events和cycle->write_events这两个
 
     unsigned            need_last_buf:1;
 
+    /* a stream that shares the socket of a multiplexed upstream connection */
+    unsigned            multiplexed:1;
+
 #if (NGX_HAVE_IOCP)
     unsigned            accept_context_updated:1;
 #endif
@@ -26,6 +26,7 @@ typedef struct ngx_connection_s  ngx_connection_t;
 
 #if (NGX_THREADS)
 typedef struct ngx_thread_task_s  ngx_thread_task_t;
+typedef struct ngx_thread_pool_s  ngx_thread_pool_t;
 #endif
 
 /*
@@ -119,8 +120,13 @@ NGX_ERROR：表示错误。这时会调用ngx_http_terminate_request终止请求
 #define ngx_max(val1, val2)  ((val1 < val2) ? (val2) : (val1))
 #define ngx_min(val1, val2)  ((val1 > val2) ? (val2) : (val1))
 
+#define NGX_CPU_SSE42  0x01
+#define NGX_CPU_AVX2   0x02
+
 void ngx_cpuinfo(void);
 
+extern ngx_uint_t  ngx_cpu_features;
+
 #if (NGX_HAVE_OPENAT)
 #define NGX_DISABLE_SYMLINKS_OFF        0
 #define NGX_DISABLE_SYMLINKS_ON         1
@@ -9,6 +9,9 @@
 #include <ngx_core.h>
 
 
+ngx_uint_t  ngx_cpu_features;
+
+
 #if (( __i386__ || __amd64__ ) && ( __GNUC__ || __INTEL_COMPILER ))
 
 
@@ -31,6 +34,7 @@ ngx_cpuid(uint32_t i, uint32_t *buf)
 
     "    mov    %%ebx, %%esi;  "
 
+    "    xor    %%ecx, %%ecx;  "
     "    cpuid;                "
     "    mov    %%eax, (%1);   "
     "    mov    %%ebx, 4(%1);  "
@@ -55,7 +59,7 @@ ngx_cpuid(uint32_t i, uint32_t *buf)
 
         "cpuid"
 
-    : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (i) );
+    : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (i), "c" (0) );
 
     buf[0] = eax;
     buf[1] = ebx;
@@ -67,13 +71,30 @@ ngx_cpuid(uint32_t i, uint32_t *buf)
 #endif
 
 
+static ngx_inline uint32_t
+ngx_xgetbv(void)
+{
+    uint32_t  eax, edx;
+
+    /* xgetbv with %ecx = 0, encoded for old assemblers */
+
+    __asm__ (
+
+        ".byte 0x0f, 0x01, 0xd0"
+
+    : "=a" (eax), "=d" (edx) : "c" (0) );
+
+    return eax;
+}
+
+
 /* auto detect the L2 cache line size of modern and widespread CPUs */
 //这个函数便是在获取CPU的信息，根据CPU的型号对ngx_cacheline_size进行设置
 void
 ngx_cpuinfo(void)
 {
     u_char    *vendor;
-    uint32_t   vbuf[5], cpu[4], model;
+    uint32_t   vbuf[5], cpu[4], ext[4], model;
 
     vbuf[0] = 0;
     vbuf[1] = 0;
@@ -91,6 +112,27 @@ ngx_cpuinfo(void)
 
     ngx_cpuid(1, cpu);
 
+    /*
+     * detect the SIMD extensions used by the http parser fast path,
+     * AVX2 also requires the OS to save the YMM state (OSXSAVE and XCR0)
+     */
+
+    if (cpu[3] & (1 << 20)) {
+        ngx_cpu_features |= NGX_CPU_SSE42;
+    }
+
+    if (vbuf[0] >= 7
+        && (cpu[3] & (1 << 27))
+        && (cpu[3] & (1 << 28))
+        && (ngx_xgetbv() & 0x6) == 0x6)
+    {
+        ngx_cpuid(7, ext);
+
+        if (ext[1] & (1 << 5)) {
+            ngx_cpu_features |= NGX_CPU_AVX2;
+        }
+    }
+
     if (ngx_strcmp(vendor, "GenuineIntel") == 0) {
 
         switch ((cpu[0] & 0xf00) >> 8) {
@@ -272,6 +272,8 @@ typedef struct { //从ngx_cycle_s->conf_ctx[ngx_core_module.index]指向这里
      //修改工作进程的core文件尺寸的最大值限制(RLIMIT_CORE)，用于在不重启主进程的情况下增大该限制。
      off_t                    rlimit_core;//worker_rlimit_core 1024k;  coredump文件大小
 
+     ngx_int_t                slab_magazine_size; //slab_magazine_size配置
+
      int                      priority;
 
      /*
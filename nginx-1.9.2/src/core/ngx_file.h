@@ -147,6 +147,8 @@ typedef struct {
     //ngx_http_file_cache_set_slot中设置为ngx_http_file_cache_loader   ngx_cache_loader_process_handler中执行
     ngx_path_loader_pt         loader; //决定是否启用cache loader进程  参考ngx_start_cache_manager_processes
     void                      *data; //ngx_http_file_cache_set_slot中设置为ngx_http_file_cache_t
+    //manager交给线程池还未完成的任务数，cache manager进程退出前等待其归零，见ngx_cache_manager_process_cycle
+    ngx_uint_t                 busy;
 
     u_char                    *conf_file; //所在的配置文件 见ngx_http_file_cache_set_slot
     ngx_uint_t                 line; //在配置文件中的行号，见ngx_http_file_cache_set_slot
@@ -64,6 +64,36 @@
 
 #endif
 
+/*
+ * magazine是每个worker进程私有的obj缓存，每个slot一个，分配和释放优先在
+ * magazine中完成，只有magazine空了或者满了才加锁批量向共享内存申请或者归还
+ */
+
+typedef struct {
+    ngx_uint_t            n;
+    ngx_uint_t            reported; //已经计入stat->cached的obj个数，补充和归还时更新
+    ngx_slab_stat_t      *stat;
+    void                **chunks;
+} ngx_slab_magazine_t;
+
+
+typedef struct ngx_slab_cache_s  ngx_slab_cache_t;
+
+struct ngx_slab_cache_s {
+    ngx_slab_pool_t      *pool;
+    ngx_slab_cache_t     *next;
+    ngx_slab_magazine_t  *mags;
+};
+
+
+static void *ngx_slab_alloc_raw(ngx_slab_pool_t *pool, size_t size);
+static void ngx_slab_free_raw(ngx_slab_pool_t *pool, void *p);
+static ngx_slab_magazine_t *ngx_slab_magazine(ngx_slab_pool_t *pool,
+    size_t size);
+static ngx_slab_magazine_t *ngx_slab_chunk_magazine(ngx_slab_pool_t *pool,
+    void *p);
+static ngx_slab_magazine_t *ngx_slab_get_magazine(ngx_slab_pool_t *pool,
+    ngx_uint_t slot);
 static ngx_slab_page_t *ngx_slab_alloc_pages(ngx_slab_pool_t *pool,
     ngx_uint_t pages);
 static void ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
@@ -84,6 +114,12 @@ static ngx_uint_t  ngx_slab_max_size;//设置ngx_slab_max_size = 2048B。如果
 static ngx_uint_t  ngx_slab_exact_size;//设置ngx_slab_exact_size = 128B。分界是否要在缓存区分配额外空间给bitmap  
 static ngx_uint_t  ngx_slab_exact_shift;//ngx_slab_exact_shift = 7，即128的位表示 //每个slot块大小的位移是ngx_slab_exact_shift  
 
+static ngx_uint_t         ngx_slab_magazine_size; //slab_magazine_size配置，0表示不启用
+static ngx_slab_cache_t  *ngx_slab_caches;
+#if (NGX_THREADS)
+static pthread_t          ngx_slab_magazine_thread; //magazine所属的事件循环线程
+#endif
+
 /*
 注意，在ngx_slab_pool_t里面有两种类型的slab page，虽然都是ngx_slab_page_t定义的结构，但是功能不尽相同。一种是slots，用来表示存
 放较小obj的内存块(如果页大小是 4096B，则是<2048B的obj，即小于1/2页)，另一种来表示所要分配的空间在缓存区的位置。Nginx把缓存obj分
@@ -147,6 +183,13 @@ ngx_slab_init(ngx_slab_pool_t *pool)//pool指向的是整个共享内存空间
 
     p += n * sizeof(ngx_slab_page_t); //跳过上面那些slab page  
 
+    pool->stats = (ngx_slab_stat_t *) p;
+    ngx_memzero(pool->stats, n * sizeof(ngx_slab_stat_t));
+
+    p += n * sizeof(ngx_slab_stat_t);
+
+    size -= n * (sizeof(ngx_slab_page_t) + sizeof(ngx_slab_stat_t));
+
     //**计算这个空间总共可以分配的缓存页(4KB)的数量，每个页的overhead是一个slab page的大小  
     //**这儿的overhead还不包括之后给<128B物体分配的bitmap的损耗  
 
@@ -185,6 +228,7 @@ ngx_slab_init(ngx_slab_pool_t *pool)//pool指向的是整个共享内存空间
 
     //跳过pages * sizeof(ngx_slab_page_t)，也就是指向实际的数据页pages*ngx_pagesize
     pool->last = pool->pages + pages;
+    pool->pfree = pages;
 
     pool->log_nomem = 1;
     pool->log_ctx = &pool->zero;
@@ -195,7 +239,19 @@ ngx_slab_init(ngx_slab_pool_t *pool)//pool指向的是整个共享内存空间
 void *
 ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size)
 {
-    void  *p;
+    void                 *p;
+    ngx_slab_magazine_t  *mag;
+
+    mag = ngx_slab_magazine(pool, size);
+
+    /*
+     * magazine中有缓存的obj，不需要加锁；stat->cached在共享内存中，不加锁
+     * 不能更新，所以只在加锁补充或者归还magazine时更新
+     */
+
+    if (mag && mag->n) {
+        return mag->chunks[--mag->n];
+    }
 
     ngx_shmtx_lock(&pool->mutex);
 
@@ -247,8 +303,57 @@ page[]都会和对应的slots[]关联，如果是分配大于2048的空间，则
 当该page页用完后，则会重新把page[]的next和prev置为NULL，同时把对应的slot[]的next和prev指向slot[]本身
 当page用完后释放其中一个obj后，有恢复为page->next = &slots[slot]; page->prev = &slots[slot]，slots[slot].next = page;
 */
-void * 
+void *
 ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
+{
+    void                 *p, *c;
+    ngx_uint_t            n, nomem;
+    ngx_slab_magazine_t  *mag;
+
+    mag = ngx_slab_magazine(pool, size);
+
+    if (mag == NULL) {
+        return ngx_slab_alloc_raw(pool, size);
+    }
+
+    if (mag->n) { //与ngx_slab_alloc的快速路径一样，stat->cached不在这里更新
+        return mag->chunks[--mag->n];
+    }
+
+    p = ngx_slab_alloc_raw(pool, size);
+
+    if (p) {
+        /*
+         * 已经持有锁，顺便把magazine补充到一半，内存不足时不重复打印
+         * "no memory"日志
+         */
+
+        nomem = pool->log_nomem;
+        pool->log_nomem = 0;
+
+        for (n = ngx_slab_magazine_size / 2; n; n--) {
+            c = ngx_slab_alloc_raw(pool, size);
+            if (c == NULL) {
+                break;
+            }
+
+            mag->chunks[mag->n++] = c;
+        }
+
+        pool->log_nomem = nomem;
+    }
+
+    /* 补充时把快速路径以来magazine中obj个数的变化一并计入stat->cached */
+
+    mag->stat->cached += mag->n - mag->reported;
+    mag->reported = mag->n;
+
+    return p;
+}
+
+
+static void *
+ngx_slab_alloc_raw(ngx_slab_pool_t *pool, size_t size)
 { //这儿假设page_size是4KB  
     size_t            s;
     uintptr_t         p, n, m, mask, *bitmap;
@@ -292,6 +397,8 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
     //ngx_slab_pool_t + 9 * sizeof(ngx_slab_page_t) + pages * sizeof(ngx_slab_page_t) +pages*ngx_pagesize(这是实际的数据部分)
     ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
                    "slab alloc: %uz slot: %ui", size, slot);
+
+    pool->stats[slot].reqs++;
                    
     //指向9 * sizeof(ngx_slab_page_t) ，也就是slots[0-8]数组 = 8 - 2048
     slots = (ngx_slab_page_t *) ((u_char *) pool + sizeof(ngx_slab_pool_t));
@@ -335,6 +442,8 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
                                      if (bitmap[n] != NGX_SLAB_BUSY) {//如果该bitmap后面的几个bitmap还没有用完，则直接返回该bitmap地址
                                          p = (uintptr_t) bitmap + i;
 
+                                         pool->stats[slot].used++;
+
                                          goto done;
                                      }
                                 }
@@ -352,6 +461,8 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 
                             p = (uintptr_t) bitmap + i;
 
+                            pool->stats[slot].used++;
+
                             goto done;
                         }
                     }
@@ -390,7 +501,9 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
                         p += i << shift;
                         p += (uintptr_t) pool->start; //返回该obj对应的地址
 
-                        goto done; 
+                        pool->stats[slot].used++;
+
+                        goto done;
                     }
                 }
 
@@ -433,6 +546,8 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
                         p += i << shift;
                         p += (uintptr_t) pool->start;
 
+                        pool->stats[slot].used++;
+
                         goto done;
                     }
                 }
@@ -491,6 +606,9 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
             //返回对应地址.  例如为64字节obj，则返回的start为第二个开始处obj，下次分配从第二个开始获取地址空间obj
             p += (uintptr_t) pool->start;//返回对应地址.,
 
+            pool->stats[slot].total += (ngx_pagesize >> shift) - n;
+            pool->stats[slot].used++;
+
             goto done;
 
         } else if (shift == ngx_slab_exact_shift) {
@@ -508,6 +626,9 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
             p = (page - pool->pages) << ngx_pagesize_shift;
             p += (uintptr_t) pool->start;//返回对应地址.  
 
+            pool->stats[slot].total += 8 * sizeof(uintptr_t);
+            pool->stats[slot].used++;
+
             goto done;
 
         } else { /* shift > ngx_slab_exact_shift */
@@ -523,12 +644,17 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
             p = (page - pool->pages) << ngx_pagesize_shift;
             p += (uintptr_t) pool->start;
 
+            pool->stats[slot].total += ngx_pagesize >> shift;
+            pool->stats[slot].used++;
+
             goto done;
         }
     }
 
     p = 0;
 
+    pool->stats[slot].fails++;
+
 done:
 
     ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0, "slab alloc: %p", p);
@@ -542,11 +668,10 @@ ngx_slab_calloc(ngx_slab_pool_t *pool, size_t size)
 {
     void  *p;
 
-    ngx_shmtx_lock(&pool->mutex);
-
-    p = ngx_slab_calloc_locked(pool, size);
-
-    ngx_shmtx_unlock(&pool->mutex);
+    p = ngx_slab_alloc(pool, size);
+    if (p) {
+        ngx_memzero(p, size);
+    }
 
     return p;
 }
@@ -569,6 +694,17 @@ ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size)
 void
 ngx_slab_free(ngx_slab_pool_t *pool, void *p)
 {
+    ngx_slab_magazine_t  *mag;
+
+    mag = ngx_slab_chunk_magazine(pool, p);
+
+    /* 直接放回本进程的magazine，不加锁，所以不更新stat->cached */
+
+    if (mag && mag->n < ngx_slab_magazine_size) {
+        mag->chunks[mag->n++] = p;
+        return;
+    }
+
     ngx_shmtx_lock(&pool->mutex);
 
     ngx_slab_free_locked(pool, p);
@@ -595,10 +731,41 @@ b.将页面归入free中
 */
 void
 ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
+{
+    ngx_uint_t            n;
+    ngx_slab_magazine_t  *mag;
+
+    mag = ngx_slab_chunk_magazine(pool, p);
+
+    if (mag == NULL) {
+        ngx_slab_free_raw(pool, p);
+        return;
+    }
+
+    if (mag->n < ngx_slab_magazine_size) {
+        mag->chunks[mag->n++] = p;
+        return;
+    }
+
+    /* magazine满了，归还一半，同时更新stat->cached */
+
+    for (n = (ngx_slab_magazine_size + 1) / 2; n; n--) {
+        ngx_slab_free_raw(pool, mag->chunks[--mag->n]);
+    }
+
+    mag->chunks[mag->n++] = p;
+
+    mag->stat->cached += mag->n - mag->reported;
+    mag->reported = mag->n;
+}
+
+
+static void
+ngx_slab_free_raw(ngx_slab_pool_t *pool, void *p)
 {
     size_t            size;
     uintptr_t         slab, m, *bitmap;
-    ngx_uint_t        n, type, slot, shift, map;
+    ngx_uint_t        i, n, type, slot, shift, map;
     ngx_slab_page_t  *slots, *page;
 
     ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0, "slab free: %p", p);
@@ -635,13 +802,13 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
                              ((uintptr_t) p & ~((uintptr_t) ngx_pagesize - 1));//求出p对应的page页所在位图的位置  
 
         if (bitmap[n] & m) {//如果第m位确实为1,  
+            slot = shift - pool->min_shift;
 
             if (page->next == NULL) { //如果页面的当前状态是全部已使用,就把他链入slot_m[]中
                 slots = (ngx_slab_page_t *)
                                    ((u_char *) pool + sizeof(ngx_slab_pool_t));//定位slot_m数组  
 
                 //找到对应的slot_m[]的元素  
-                slot = shift - pool->min_shift;
 
                 //链入对应的slot[]中，表示该页可以继续使用了，在ngx_slab_calloc_locked又可以遍历到该页，从中分配obj
                 page->next = slots[slot].next;
@@ -655,6 +822,8 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
              //页面的当前状态是部分已使用,即已经在slot中  设置slot对应位置为可用,即0  
             bitmap[n] &= ~m;
 
+            pool->stats[slot].used--;
+
             //下面的操作主要是查看这个页面是否都没用, 如果都没使用,则将页面归入free中  
             
             n = (1 << (ngx_pagesize_shift - shift)) / 8 / (1 << shift);
@@ -671,14 +840,16 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
              //计算位图使用了多少个uintptr_t来存储
             map = (1 << (ngx_pagesize_shift - shift)) / (sizeof(uintptr_t) * 8);
 
-            for (n = 1; n < map; n++) {//查看其他uintptr_t是否都没使用  
-                if (bitmap[n]) {
+            for (i = 1; i < map; i++) {//查看其他uintptr_t是否都没使用  
+                if (bitmap[i]) {
                     goto done;
                 }
             }
 
             ngx_slab_free_pages(pool, page, 1); //整个页面都没有使用，归还给free 
 
+            pool->stats[slot].total -= (ngx_pagesize >> shift) - n;
+
             goto done;
         }
 
@@ -695,11 +866,12 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
         }
 
         if (slab & m) {//slab(位图)中对应的位为1  
+            slot = ngx_slab_exact_shift - pool->min_shift;//计算该页面要链入slot[]的哪个槽中  
+
             if (slab == NGX_SLAB_BUSY) {//如果整个页面中的所有obj块都被使用,则该页page[]和slot[]没有对应关系,因此需要把页page[]和slot[]对应关系加上
                  //定位slot[]数组  
                 slots = (ngx_slab_page_t *)
                                    ((u_char *) pool + sizeof(ngx_slab_pool_t));
-                slot = ngx_slab_exact_shift - pool->min_shift;//计算该页面要链入slot[]的哪个槽中  
 
                 //设置page[]元素和slot[]的对应关系，通过prev和next指向
                 page->next = slots[slot].next;
@@ -711,12 +883,16 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
             page->slab &= ~m;//将slab块对应位置设置为0  
 
+            pool->stats[slot].used--;
+
             if (page->slab) {//page页面中还有正在使用的obj块,因为slab位图不为0
                 goto done;
             }
 
             ngx_slab_free_pages(pool, page, 1);//page页面中所有slab块都没有使用  
 
+            pool->stats[slot].total -= 8 * sizeof(uintptr_t);
+
             goto done;
         }
 
@@ -737,12 +913,12 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
                               + NGX_SLAB_MAP_SHIFT);
 
         if (slab & m) {//该slab块确实正在被使用  
+            slot = shift - pool->min_shift;
 
             if (page->next == NULL) {//如果整个页面中的所有obj块都被使用,则该页page[]和slot[]没有对应关系,因此需要把页page[]和slot[]对应关系加上
                 //定位slot[]数组  
                 slots = (ngx_slab_page_t *)
                                    ((u_char *) pool + sizeof(ngx_slab_pool_t));
-                slot = shift - pool->min_shift;
                 //找到slot[]数组中对应的位置,添加slot[]和page[]的对应关系
                 page->next = slots[slot].next;
                 slots[slot].next = page;
@@ -752,6 +928,8 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
             }
 
             page->slab &= ~m;//设置slab块对应的位图位置为0,即可用  
+
+            pool->stats[slot].used--;
             
             //如果slab页中有slot块还在被使用  
             if (page->slab & NGX_SLAB_MAP_MASK) {
@@ -761,6 +939,8 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
             //如果page页中所有slab块都不在使用就将该页面链入free中  
             ngx_slab_free_pages(pool, page, 1);
 
+            pool->stats[slot].total -= ngx_pagesize >> shift;
+
             goto done;
         }
 
@@ -824,6 +1004,184 @@ fail:
     return;
 }
 
+static ngx_slab_magazine_t *
+ngx_slab_magazine(ngx_slab_pool_t *pool, size_t size)
+{
+    size_t      s;
+    ngx_uint_t  shift;
+
+    if (ngx_slab_magazine_size == 0 || size > ngx_slab_max_size) {
+        return NULL;
+    }
+
+    if (size > pool->min_size) { //与ngx_slab_alloc_raw中计算slot的方法一致
+        shift = 1;
+        for (s = size - 1; s >>= 1; shift++) { /* void */ }
+
+    } else {
+        shift = pool->min_shift;
+    }
+
+    return ngx_slab_get_magazine(pool, shift - pool->min_shift);
+}
+
+
+static ngx_slab_magazine_t *
+ngx_slab_chunk_magazine(ngx_slab_pool_t *pool, void *p)
+{
+    ngx_uint_t        shift;
+    ngx_slab_page_t  *page;
+
+    if (ngx_slab_magazine_size == 0
+        || (u_char *) p < pool->start || (u_char *) p >= pool->end)
+    {
+        return NULL;
+    }
+
+    page = &pool->pages[((u_char *) p - pool->start) >> ngx_pagesize_shift];
+
+    switch (page->prev & NGX_SLAB_PAGE_MASK) {
+
+    case NGX_SLAB_SMALL:
+    case NGX_SLAB_BIG:
+        shift = page->slab & NGX_SLAB_SHIFT_MASK;
+        break;
+
+    case NGX_SLAB_EXACT:
+        shift = ngx_slab_exact_shift;
+        break;
+
+    default: /* NGX_SLAB_PAGE */
+        return NULL;
+    }
+
+    /*
+     * the page type and the shift stay the same while any chunk of the page
+     * is allocated, so they can be read without the pool lock
+     */
+
+    if ((uintptr_t) p & (((uintptr_t) 1 << shift) - 1)) {
+        /* let ngx_slab_free_raw() report the wrong chunk */
+        return NULL;
+    }
+
+    return ngx_slab_get_magazine(pool, shift - pool->min_shift);
+}
+
+
+static ngx_slab_magazine_t *
+ngx_slab_get_magazine(ngx_slab_pool_t *pool, ngx_uint_t slot)
+{
+    u_char            *p;
+    ngx_uint_t         i, n;
+    ngx_slab_cache_t  *cache;
+
+#if (NGX_THREADS)
+
+    /*
+     * magazine和ngx_slab_caches链表都是worker事件循环线程私有的，没有加锁。
+     * 线程池里的调用(例如在线程中做SSL握手时的session回调)直接走加锁的
+     * ngx_slab_alloc_raw/ngx_slab_free_raw
+     */
+
+    if (!pthread_equal(pthread_self(), ngx_slab_magazine_thread)) {
+        return NULL;
+    }
+
+#endif
+
+    for (cache = ngx_slab_caches; cache; cache = cache->next) {
+        if (cache->pool == pool) {
+            return &cache->mags[slot];
+        }
+    }
+
+    n = ngx_pagesize_shift - pool->min_shift;
+
+    p = ngx_alloc(sizeof(ngx_slab_cache_t)
+                  + n * sizeof(ngx_slab_magazine_t)
+                  + n * ngx_slab_magazine_size * sizeof(void *),
+                  ngx_cycle->log);
+    if (p == NULL) {
+        return NULL;
+    }
+
+    cache = (ngx_slab_cache_t *) p;
+    p += sizeof(ngx_slab_cache_t);
+
+    cache->pool = pool;
+    cache->mags = (ngx_slab_magazine_t *) p;
+    p += n * sizeof(ngx_slab_magazine_t);
+
+    for (i = 0; i < n; i++) {
+        cache->mags[i].n = 0;
+        cache->mags[i].reported = 0;
+        cache->mags[i].stat = &pool->stats[i];
+        cache->mags[i].chunks = (void **) p;
+        p += ngx_slab_magazine_size * sizeof(void *);
+    }
+
+    cache->next = ngx_slab_caches;
+    ngx_slab_caches = cache;
+
+    return &cache->mags[slot];
+}
+
+
+/*
+ * magazine只能在worker进程中启用: master进程里缓存的obj会被fork出来的每个
+ * worker继承，导致同一块共享内存被多个进程分配出去。调用本函数的线程即
+ * worker的事件循环线程，只有它使用magazine
+ */
+
+void
+ngx_slab_magazines_init(ngx_uint_t size)
+{
+    ngx_slab_magazine_size = size;
+
+#if (NGX_THREADS)
+    ngx_slab_magazine_thread = pthread_self();
+#endif
+}
+
+
+void
+ngx_slab_magazines_flush(void)
+{
+    ngx_uint_t            i, n;
+    ngx_slab_pool_t      *pool;
+    ngx_slab_cache_t     *cache, *next;
+    ngx_slab_magazine_t  *mag;
+
+    for (cache = ngx_slab_caches; cache; cache = next) {
+        next = cache->next;
+        pool = cache->pool;
+
+        ngx_shmtx_lock(&pool->mutex);
+
+        n = ngx_pagesize_shift - pool->min_shift;
+
+        for (i = 0; i < n; i++) {
+            mag = &cache->mags[i];
+
+            while (mag->n) {
+                ngx_slab_free_raw(pool, mag->chunks[--mag->n]);
+            }
+
+            mag->stat->cached -= mag->reported;
+            mag->reported = 0;
+        }
+
+        ngx_shmtx_unlock(&pool->mutex);
+
+        ngx_free(cache);
+    }
+
+    ngx_slab_caches = NULL;
+    ngx_slab_magazine_size = 0;
+}
+
+
 /*
 返回一个slab page，这个slab page之后会被用来确定所需分配的空间在内存缓存的位置 
 
@@ -910,6 +1268,8 @@ ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages) //与ngx_slab_free
             page->next = NULL; 
             page->prev = NGX_SLAB_PAGE; //page页面不划分slot时候,即将整个页面分配给用户,pre的后两位为NGX_SLAB_PAGE
 
+            pool->pfree -= pages;
+
             if (--pages == 0) { //pages为1。则直接返回该page
                 return page;
             }
@@ -944,6 +1304,8 @@ ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
     ngx_uint_t        type;
     ngx_slab_page_t  *prev, *join;
 
+    pool->pfree += pages;
+
     page->slab = pages--; //释放的pages页数-1，这是要干嘛?
 
     if (pages) {
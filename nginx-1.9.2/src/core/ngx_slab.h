@@ -52,6 +52,21 @@ m_page[k]对应page[k]页面
 
 */
 //图形化理解参考:http://blog.csdn.net/u013009575/article/details/17743261
+typedef struct {
+    ngx_uint_t        total; //该slot已经划分出来的obj总数
+    ngx_uint_t        used;  //已经分配出去的obj个数(包括缓存在worker magazine中的)
+
+    ngx_uint_t        reqs;
+    ngx_uint_t        fails;
+
+    /*
+     * 缓存在各worker magazine中尚未交给调用者的obj个数，只在加锁补充或归还
+     * magazine时更新，不反映此后无锁快速路径中的分配和释放
+     */
+    ngx_uint_t        cached;
+} ngx_slab_stat_t;
+
+
 typedef struct { //初始化赋值在ngx_slab_init  slab结构是配合共享内存使用的  可以以limit req模块为例，参考ngx_http_limit_req_module
     ngx_shmtx_sh_t    lock; //mutex的锁  
 
@@ -68,6 +83,9 @@ typedef struct { //初始化赋值在ngx_slab_init  slab结构是配合共享内
     //管理free的页面   是一个链表头,用于连接空闲页面.
     ngx_slab_page_t   free; //初始化赋值在ngx_slab_init  free->next指向pages * sizeof(ngx_slab_page_t)  下次从free.next是下次分配页时候的入口开始分配页空间
 
+    ngx_slab_stat_t  *stats; //每个slot一个统计项，紧跟在slots[]后面
+    ngx_uint_t        pfree; //空闲页个数
+
     u_char           *start; //实际缓存obj的空间的开头   这个是对地址空间进行ngx_pagesize对齐后的起始地址，见ngx_slab_init
     u_char           *end;
 
@@ -91,6 +109,8 @@ void *ngx_slab_calloc(ngx_slab_pool_t *pool, size_t size);
 void *ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size);
 void ngx_slab_free(ngx_slab_pool_t *pool, void *p);
 void ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p);
+void ngx_slab_magazines_init(ngx_uint_t size);
+void ngx_slab_magazines_flush(void);
 
 
 #endif /* _NGX_SLAB_H_INCLUDED_ */
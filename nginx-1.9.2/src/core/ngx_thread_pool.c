@@ -18,30 +18,34 @@ typedef struct {
 } ngx_thread_pool_conf_t;//创建空间在ngx_thread_pool_create_conf
 
 
-typedef struct { //见ngx_thread_pool_done
-    ngx_thread_task_t        *first;
+/*
+ * the task queue is a bounded lock-free MPMC ring (D. Vyukov): every cell
+ * has a sequence number which tells whether the cell can be filled for
+ * the current lap of tail or taken for the current lap of head
+ */
 
-    /*
-     *ngx_thread_pool_t->queue.last = task;  新添加的任务通过last连接在一起
-     ngx_thread_pool_t->queue.last = &task->next;  下次在添加新任务就让task->next指向新任务了
-     */
-    ngx_thread_task_t       **last;
-} ngx_thread_pool_queue_t; //线程池队列  初始化在ngx_thread_pool_queue_init
+typedef struct {
+    ngx_atomic_t              sequence;
+    ngx_thread_task_t        *task;
+} ngx_thread_pool_cell_t;
 
-#define ngx_thread_pool_queue_init(q)                                         \
-    (q)->first = NULL;                                                        \
-    (q)->last = &(q)->first
 
 //一个该结构对应一个threads_pool配置
 struct ngx_thread_pool_s {//该结构式存放在ngx_thread_pool_conf_t->pool数组中的，见ngx_thread_pool_init_worker
+    //任务队列，无锁环形队列，ngx_thread_task_post入队，ngx_thread_pool_cycle出队
+    ngx_thread_pool_cell_t   *cells;
+    ngx_atomic_uint_t         mask;
+    ngx_atomic_t              head;
+    ngx_atomic_t              tail;
+
+    //空闲线程只在队列为空时才在mtx+cond上睡眠，sleeping为睡眠的线程数，
+    //ngx_thread_task_post只有在sleeping不为0时才需要加锁唤醒线程
+    ngx_atomic_t              sleeping;
     ngx_thread_mutex_t        mtx; //线程锁  ngx_thread_pool_init中初始化
-    //ngx_thread_task_post中添加的任务被添加到该队列中
-    ngx_thread_pool_queue_t   queue;//ngx_thread_pool_init  ngx_thread_pool_queue_init中初始化
-    //在该线程池poll中每添加一个线程，waiting子减，当线程全部正在执行任务后，waiting会恢复到0
-    //如果所有线程都已经在执行任务(也就是waiting>-0)，又来了任务，那么任务就只能等待。所以waiting表示等待被执行的任务数
-    ngx_int_t                 waiting;//等待的任务数   ngx_thread_task_post加1   ngx_thread_pool_cycle减1
     ngx_thread_cond_t         cond;//条件变量  ngx_thread_pool_init中初始化
 
+    ngx_thread_pool_stat_t    stat;//队列深度、任务延时等统计，见ngx_thread_pool_get_stat
+
     ngx_log_t                *log;//ngx_thread_pool_init中初始化
 
     ngx_str_t                 name;//thread_pool name threads=number [max_queue=number];中的name  ngx_thread_pool
@@ -53,6 +57,9 @@ struct ngx_thread_pool_s {//该结构式存放在ngx_thread_pool_conf_t->pool数
 
     u_char                   *file;//配置文件名
     ngx_uint_t                line;//thread_pool配置在配置文件中的行号
+
+    /* the pool is also run in the cache manager and loader processes */
+    ngx_uint_t                helper;
 };
 
 
@@ -63,6 +70,11 @@ static void ngx_thread_pool_exit_handler(void *data, ngx_log_t *log);
 
 static void *ngx_thread_pool_cycle(void *data);
 static void ngx_thread_pool_handler(ngx_event_t *ev);
+static ngx_int_t ngx_thread_pool_enqueue(ngx_thread_pool_t *tp,
+    ngx_thread_task_t *task);
+static ngx_thread_task_t *ngx_thread_pool_dequeue(ngx_thread_pool_t *tp);
+static void ngx_thread_pool_update_max(ngx_atomic_t *max,
+    ngx_atomic_uint_t value);
 
 static char *ngx_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
@@ -121,8 +133,8 @@ ngx_module_t  ngx_thread_pool_module = {
 static ngx_str_t  ngx_thread_pool_default = ngx_string("default");
 
 static ngx_uint_t               ngx_thread_pool_task_id;
-static ngx_atomic_t             ngx_thread_pool_done_lock;//为0，可以获取锁，不为0，则不能获取到该锁
-static ngx_thread_pool_queue_t  ngx_thread_pool_done; //所有的
+//已完成任务的无锁栈(通过task->next链接)，线程压栈，ngx_thread_pool_handler一次取走全部
+static ngx_atomic_t             ngx_thread_pool_done;
 
 //根据thread_pool name threads=number [max_queue=number];中的number来创建这么多个线程
 static ngx_int_t
@@ -139,7 +151,28 @@ ngx_thread_pool_init(ngx_thread_pool_t *tp, ngx_log_t *log, ngx_pool_t *pool)
         return NGX_ERROR;
     }
 
-    ngx_thread_pool_queue_init(&tp->queue);
+    n = 1;
+
+    while (n < (ngx_uint_t) tp->max_queue) {
+        n <<= 1;
+    }
+
+    tp->cells = ngx_alloc(n * sizeof(ngx_thread_pool_cell_t), log);
+    if (tp->cells == NULL) {
+        return NGX_ERROR;
+    }
+
+    tp->mask = n - 1;
+    tp->head = 0;
+    tp->tail = 0;
+    tp->sleeping = 0;
+
+    while (n--) {
+        tp->cells[n].sequence = n;
+        tp->cells[n].task = NULL;
+    }
+
+    ngx_memzero(&tp->stat, sizeof(ngx_thread_pool_stat_t));
 
     if (ngx_thread_mutex_create(&tp->mtx, log) != NGX_OK) {
         return NGX_ERROR;
@@ -221,6 +254,18 @@ ngx_thread_pool_destroy(ngx_thread_pool_t *tp)
     (void) ngx_thread_cond_destroy(&tp->cond, tp->log);
 
     (void) ngx_thread_mutex_destroy(&tp->mtx, tp->log);
+
+    ngx_log_error(NGX_LOG_INFO, tp->log, 0,
+                  "thread pool \"%V\": %uA tasks, %uA overflows, "
+                  "max queue %uA, latency avg %uAms max %uAms",
+                  &tp->name, tp->stat.completed, tp->stat.overflows,
+                  tp->stat.max_waiting,
+                  tp->stat.completed ? tp->stat.latency / tp->stat.completed
+                                     : 0,
+                  tp->stat.max_latency);
+
+    ngx_free(tp->cells);
+    tp->cells = NULL;
 }
 
 
@@ -259,22 +304,20 @@ ngx_thread_task_alloc(ngx_pool_t *pool, size_t size)
 ngx_int_t //ngx_thread_pool_cycle和ngx_thread_task_post配合阅读
 ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task)
 {
+    ngx_atomic_uint_t  waiting;
+
     if (task->event.active) {
         ngx_log_error(NGX_LOG_ALERT, tp->log, 0,
                       "task #%ui already active", task->id);
         return NGX_ERROR;
     }
-    
-    if (ngx_thread_mutex_lock(&tp->mtx, tp->log) != NGX_OK) {
-        return NGX_ERROR;
-    }
 
-    if (tp->waiting >= tp->max_queue) {
-        (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+    if ((ngx_int_t) tp->stat.waiting >= tp->max_queue) {
+        (void) ngx_atomic_fetch_add(&tp->stat.overflows, 1);
 
         ngx_log_error(NGX_LOG_ERR, tp->log, 0,
-                      "thread pool \"%V\" queue overflow: %i tasks waiting",
-                      &tp->name, tp->waiting);
+                      "thread pool \"%V\" queue overflow: %uA tasks waiting",
+                      &tp->name, tp->stat.waiting);
         return NGX_ERROR;
     }
 
@@ -282,20 +325,43 @@ ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task)
 
     task->id = ngx_thread_pool_task_id++;
     task->next = NULL;
+    task->posted = ngx_current_msec;
     ngx_log_debugall(tp->log, 0, "ngx add task to thread, task id:%ui", task->id);
 
-    if (ngx_thread_cond_signal(&tp->cond, tp->log) != NGX_OK) {
-        (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+    waiting = ngx_atomic_fetch_add(&tp->stat.waiting, 1) + 1;
+
+    if (ngx_thread_pool_enqueue(tp, task) != NGX_OK) {
+        (void) ngx_atomic_fetch_add(&tp->stat.waiting, -1);
+        task->event.active = 0;
+
+        ngx_log_error(NGX_LOG_ALERT, tp->log, 0,
+                      "thread pool \"%V\" queue is full", &tp->name);
         return NGX_ERROR;
     }
 
-    //添加到任务队列
-    *tp->queue.last = task;
-    tp->queue.last = &task->next;
+    (void) ngx_atomic_fetch_add(&tp->stat.posted, 1);
+    ngx_thread_pool_update_max(&tp->stat.max_waiting, waiting);
+
+    /*
+     * the barrier orders the enqueue before the sleeping check,
+     * a thread going to sleep increments sleeping before it checks
+     * the queue for the last time, so the wakeup cannot be lost
+     */
 
-    tp->waiting++;
+    ngx_memory_barrier();
 
-    (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+    if (tp->sleeping) {
+        if (ngx_thread_mutex_lock(&tp->mtx, tp->log) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (ngx_thread_cond_signal(&tp->cond, tp->log) != NGX_OK) {
+            (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+            return NGX_ERROR;
+        }
+
+        (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+    }
 
     ngx_log_debug2(NGX_LOG_DEBUG_CORE, tp->log, 0,
                    "task #%ui added to thread pool name: \"%V\" complete",
@@ -304,7 +370,127 @@ ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task)
     return NGX_OK;
 }
 
-//ngx_thread_pool_cycle和ngx_thread_task_post配合阅读
+
+static ngx_int_t
+ngx_thread_pool_enqueue(ngx_thread_pool_t *tp, ngx_thread_task_t *task)
+{
+    ngx_atomic_int_t         diff;
+    ngx_atomic_uint_t        pos, seq;
+    ngx_thread_pool_cell_t  *cell;
+
+    pos = tp->tail;
+
+    for ( ;; ) {
+        cell = &tp->cells[pos & tp->mask];
+        seq = cell->sequence;
+
+        diff = (ngx_atomic_int_t) (seq - pos);
+
+        if (diff == 0) {
+            if (ngx_atomic_cmp_set(&tp->tail, pos, pos + 1)) {
+                break;
+            }
+
+        } else if (diff < 0) {
+            return NGX_ERROR;
+        }
+
+        pos = tp->tail;
+    }
+
+    cell->task = task;
+
+    ngx_memory_barrier();
+
+    cell->sequence = pos + 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_thread_task_t *
+ngx_thread_pool_dequeue(ngx_thread_pool_t *tp)
+{
+    ngx_atomic_int_t         diff;
+    ngx_atomic_uint_t        pos, seq;
+    ngx_thread_task_t       *task;
+    ngx_thread_pool_cell_t  *cell;
+
+    pos = tp->head;
+
+    for ( ;; ) {
+        cell = &tp->cells[pos & tp->mask];
+        seq = cell->sequence;
+
+        diff = (ngx_atomic_int_t) (seq - (pos + 1));
+
+        if (diff == 0) {
+            if (ngx_atomic_cmp_set(&tp->head, pos, pos + 1)) {
+                break;
+            }
+
+        } else if (diff < 0) {
+            return NULL;
+        }
+
+        pos = tp->head;
+    }
+
+    ngx_memory_barrier();
+
+    task = cell->task;
+
+    ngx_memory_barrier();
+
+    cell->sequence = pos + tp->mask + 1;
+
+    return task;
+}
+
+
+static void
+ngx_thread_pool_update_max(ngx_atomic_t *max, ngx_atomic_uint_t value)
+{
+    ngx_atomic_uint_t  old;
+
+    for ( ;; ) {
+        old = *max;
+
+        if (old >= value || ngx_atomic_cmp_set(max, old, value)) {
+            return;
+        }
+    }
+}
+
+
+/*
+ * the counters of the n-th pool in the current process,
+ * NGX_DECLINED after the last pool
+ */
+
+ngx_int_t
+ngx_thread_pool_get_stat(ngx_cycle_t *cycle, ngx_uint_t n, ngx_str_t *name,
+    ngx_thread_pool_stat_t *stat)
+{
+    ngx_thread_pool_t       **tpp;
+    ngx_thread_pool_conf_t   *tcf;
+
+    tcf = (ngx_thread_pool_conf_t *) ngx_get_conf(cycle->conf_ctx,
+                                                  ngx_thread_pool_module);
+
+    if (n >= tcf->pools.nelts) {
+        return NGX_DECLINED;
+    }
+
+    tpp = tcf->pools.elts;
+
+    *name = tpp[n]->name;
+    *stat = tpp[n]->stat;
+
+    return NGX_OK;
+}
+
+
 static void *
 ngx_thread_pool_cycle(void *data)
 {
@@ -312,6 +498,8 @@ ngx_thread_pool_cycle(void *data)
 
     int                 err;
     sigset_t            set;
+    ngx_msec_t          latency;
+    ngx_atomic_uint_t   done;
     ngx_thread_task_t  *task;
 
 #if 0
@@ -340,37 +528,45 @@ ngx_thread_pool_cycle(void *data)
     20090#20090前面是进程号，后面是主线程号，他们相同
     */
     for ( ;; ) {//一次任务执行完后又会走到这里，循环
-        if (ngx_thread_mutex_lock(&tp->mtx, tp->log) != NGX_OK) {
-            return NULL;
-        }
 
-        /* the number may become negative */
-        tp->waiting--;
+        task = ngx_thread_pool_dequeue(tp);
+
+        if (task == NULL) {
 
-        //如果队列中有任务，则直接执行任务，不会在while中等待conf signal
-        while (tp->queue.first == NULL) { //此时任务队列为空，在条件变量上等待  配合ngx_thread_task_post阅读
-            //在添加任务的时候唤醒ngx_thread_task_post -> ngx_thread_cond_signal
-            if (ngx_thread_cond_wait(&tp->cond, &tp->mtx, tp->log) //等待ngx_thread_cond_signal后才会返回
-                != NGX_OK)
-            {
-                (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+            //队列为空，在条件变量上等待  配合ngx_thread_task_post阅读
+            if (ngx_thread_mutex_lock(&tp->mtx, tp->log) != NGX_OK) {
                 return NULL;
             }
-        }
 
-        //取出队首任务，然后执行
-        task = tp->queue.first;
-        tp->queue.first = task->next;
+            /* a full barrier, see ngx_thread_task_post() */
+            (void) ngx_atomic_fetch_add(&tp->sleeping, 1);
 
-        if (tp->queue.first == NULL) {
-            tp->queue.last = &tp->queue.first;
-        }
+            for ( ;; ) {
+                task = ngx_thread_pool_dequeue(tp);
 
-        //这一段加锁是因为线程池是共享资源，多个线程都从队列中取线程，并且主线程会添加任务到队列中
-        if (ngx_thread_mutex_unlock(&tp->mtx, tp->log) != NGX_OK) {
-            return NULL;
+                if (task) {
+                    break;
+                }
+
+                //在添加任务的时候唤醒ngx_thread_task_post -> ngx_thread_cond_signal
+                if (ngx_thread_cond_wait(&tp->cond, &tp->mtx, tp->log)
+                    != NGX_OK)
+                {
+                    (void) ngx_atomic_fetch_add(&tp->sleeping, -1);
+                    (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+                    return NULL;
+                }
+            }
+
+            (void) ngx_atomic_fetch_add(&tp->sleeping, -1);
+
+            if (ngx_thread_mutex_unlock(&tp->mtx, tp->log) != NGX_OK) {
+                return NULL;
+            }
         }
 
+        (void) ngx_atomic_fetch_add(&tp->stat.waiting, -1);
+
 #if 0
         ngx_time_update();
 #endif
@@ -385,18 +581,31 @@ ngx_thread_pool_cycle(void *data)
                        "complete task #%ui in thread pool name: \"%V\"",
                        task->id, &tp->name);
 
-        task->next = NULL;
+        /* ngx_current_msec is updated by the event loop, it is precise enough */
 
-        ngx_spinlock(&ngx_thread_pool_done_lock, 1, 2048);
+        latency = ngx_current_msec - task->posted;
 
-        //task添加到队列尾部，同时可以保证多次添加的时候，让新task和以前的task形成一个还，first执行第一个task，last指向最后一个task
-        *ngx_thread_pool_done.last = task;
-        ngx_thread_pool_done.last = &task->next;
+        (void) ngx_atomic_fetch_add(&tp->stat.completed, 1);
+        (void) ngx_atomic_fetch_add(&tp->stat.latency, latency);
+        ngx_thread_pool_update_max(&tp->stat.max_latency, latency);
 
-        ngx_unlock(&ngx_thread_pool_done_lock);
+        /*
+         * push the task to the done stack, only the push to an empty stack
+         * notifies the event loop: ngx_thread_pool_handler() takes all the
+         * completed tasks at once, so completions are handled in batches
+         */
 
+        do {
+            done = ngx_thread_pool_done;
+            task->next = (ngx_thread_task_t *) done;
+
+        } while (!ngx_atomic_cmp_set(&ngx_thread_pool_done, done,
+                                     (ngx_atomic_uint_t) task));
+
+        if (done == 0) {
 //ngx_notify通告主线程，该任务处理完毕，ngx_thread_pool_handler由主线程执行，也就是进程cycle{}通过epoll_wait返回执行，而不是由线程池中的线程执行
-        (void) ngx_notify(ngx_thread_pool_handler); 
+            (void) ngx_notify(ngx_thread_pool_handler);
+        }
     }
 }
 
@@ -406,26 +615,27 @@ static void
 ngx_thread_pool_handler(ngx_event_t *ev)
 {
     ngx_event_t        *event;
-    ngx_thread_task_t  *task;
+    ngx_atomic_uint_t   done;
+    ngx_thread_task_t  *task, *next, *first;
 
     ngx_log_debug0(NGX_LOG_DEBUG_CORE, ev->log, 0, "thread pool handler");
 
-    ngx_spinlock(&ngx_thread_pool_done_lock, 1, 2048);
+    do {
+        done = ngx_thread_pool_done;
 
-    /* 这里是不是有问题?
-        如果线程池中的线程执行任务比较快，而主进程在执行epoll_wait过程中有点阻塞，那么就检测不到ngx_notify中的epoll事件，有可能下次检测到该事件的时候
-        ngx_thread_pool_done上已经积累了很多执行完的任务事件，见ngx_thread_pool_cycle。
-        单这里好像只取了队列首部的任务啊?????? 队首外的任务丢弃了???????????不对吧
+    } while (!ngx_atomic_cmp_set(&ngx_thread_pool_done, done, 0));
 
-        答案是，这里面所有的任务都在下面的while{}中得到了执行
-     */
+    /* the stack is LIFO, restore the completion order */
 
-    task = ngx_thread_pool_done.first;
-    ngx_thread_pool_done.first = NULL;
-    //尾部指向头，但是头已经变为空，即不执行任务  
-    ngx_thread_pool_done.last = &ngx_thread_pool_done.first;
+    first = NULL;
 
-    ngx_unlock(&ngx_thread_pool_done_lock);
+    for (task = (ngx_thread_task_t *) done; task; task = next) {
+        next = task->next;
+        task->next = first;
+        first = task;
+    }
+
+    task = first;
 
     while (task) {//遍历执行前面队列ngx_thread_pool_done中的每一个任务  
         ngx_log_debug1(NGX_LOG_DEBUG_CORE, ev->log, 0,
@@ -611,6 +821,21 @@ ngx_thread_pool_add(ngx_conf_t *cf, ngx_str_t *name)
     return tp;
 }
 
+
+ngx_thread_pool_t *
+ngx_thread_pool_add_helper(ngx_conf_t *cf, ngx_str_t *name)
+{
+    ngx_thread_pool_t  *tp;
+
+    tp = ngx_thread_pool_add(cf, name);
+
+    if (tp) {
+        tp->helper = 1;
+    }
+
+    return tp;
+}
+
 //检查该名字的线程池是否已经存在，存在则直接返回以前的线程池ngx_thread_pool_t，没有返回NULL
 ngx_thread_pool_t *
 ngx_thread_pool_get(ngx_cycle_t *cycle, ngx_str_t *name)
@@ -645,7 +870,8 @@ ngx_thread_pool_init_worker(ngx_cycle_t *cycle)
     ngx_thread_pool_conf_t   *tcf;
 
     if (ngx_process != NGX_PROCESS_WORKER
-        && ngx_process != NGX_PROCESS_SINGLE)
+        && ngx_process != NGX_PROCESS_SINGLE
+        && ngx_process != NGX_PROCESS_HELPER)
     {
         return NGX_OK;
     }
@@ -657,11 +883,16 @@ ngx_thread_pool_init_worker(ngx_cycle_t *cycle)
         return NGX_OK;
     }
 
-    ngx_thread_pool_queue_init(&ngx_thread_pool_done);
+    ngx_thread_pool_done = 0;
 
     tpp = tcf->pools.elts;
 
     for (i = 0; i < tcf->pools.nelts; i++) { //遍历所有的线程池
+
+        if (ngx_process == NGX_PROCESS_HELPER && !tpp[i]->helper) {
+            continue;
+        }
+
         if (ngx_thread_pool_init(tpp[i], cycle->log, cycle->pool) != NGX_OK) {
             return NGX_ERROR;
         }
@@ -679,7 +910,8 @@ ngx_thread_pool_exit_worker(ngx_cycle_t *cycle)
     ngx_thread_pool_conf_t   *tcf;
 
     if (ngx_process != NGX_PROCESS_WORKER
-        && ngx_process != NGX_PROCESS_SINGLE)
+        && ngx_process != NGX_PROCESS_SINGLE
+        && ngx_process != NGX_PROCESS_HELPER)
     {
         return;
     }
@@ -694,6 +926,11 @@ ngx_thread_pool_exit_worker(ngx_cycle_t *cycle)
     tpp = tcf->pools.elts;
 
     for (i = 0; i < tcf->pools.nelts; i++) {
+
+        if (ngx_process == NGX_PROCESS_HELPER && !tpp[i]->helper) {
+            continue;
+        }
+
         ngx_thread_pool_destroy(tpp[i]);
     }
 }
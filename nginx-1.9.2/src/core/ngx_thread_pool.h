@@ -22,16 +22,31 @@ struct ngx_thread_task_s {
     void               (*handler)(void *data, ngx_log_t *log); //回调函数   执行完handler后会通过ngx_notify执行event->handler 
     //执行完handler后会通过ngx_notify执行event->handler 
     ngx_event_t          event; //一个任务和一个事件对应  事件在通过ngx_notify在ngx_thread_pool_handler中执行
+    ngx_msec_t           posted; //ngx_thread_task_post添加任务的时间，用于统计任务延时
 };
 
 
-typedef struct ngx_thread_pool_s  ngx_thread_pool_t;//一个该结构对应一个threads_pool线程池配置
+/* per pool counters, the latency is from posting a task to its completion */
+
+typedef struct {
+    ngx_atomic_t         waiting;      /* tasks in the queue now */
+    ngx_atomic_t         max_waiting;
+    ngx_atomic_t         posted;
+    ngx_atomic_t         completed;
+    ngx_atomic_t         overflows;
+    ngx_atomic_t         latency;      /* total, in milliseconds */
+    ngx_atomic_t         max_latency;
+} ngx_thread_pool_stat_t;
+
 
 ngx_thread_pool_t *ngx_thread_pool_add(ngx_conf_t *cf, ngx_str_t *name);
+ngx_thread_pool_t *ngx_thread_pool_add_helper(ngx_conf_t *cf, ngx_str_t *name);
 ngx_thread_pool_t *ngx_thread_pool_get(ngx_cycle_t *cycle, ngx_str_t *name);
 
 ngx_thread_task_t *ngx_thread_task_alloc(ngx_pool_t *pool, size_t size);
 ngx_int_t ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task);
+ngx_int_t ngx_thread_pool_get_stat(ngx_cycle_t *cycle, ngx_uint_t n,
+    ngx_str_t *name, ngx_thread_pool_stat_t *stat);
 
 
 #endif /* _NGX_THREAD_POOL_H_INCLUDED_ */
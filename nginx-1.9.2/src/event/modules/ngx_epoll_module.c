@@ -745,6 +745,7 @@ typedef struct {
      */
     ngx_uint_t  events; // "epoll_events"参数设置  默认512 见ngx_epoll_init_conf
     ngx_uint_t  aio_requests; // "worker_aio_requests"参数设置  默认32 见ngx_epoll_init_conf
+    ngx_flag_t  batch; // "epoll_batch"参数设置  默认off
 } ngx_epoll_conf_t;
 
 
@@ -822,6 +823,17 @@ static ngx_command_t  ngx_epoll_commands[] = {
       offsetof(ngx_epoll_conf_t, aio_requests),
       NULL },
 
+    /*
+    一次epoll_wait返回的所有事件都放入post队列，处理前先预取这批事件对应的ngx_connection_t，
+    已有数据的连接的读写事件先于新连接的accept事件处理，见ngx_process_events_and_timers
+     */
+    { ngx_string("epoll_batch"),
+      NGX_EVENT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_epoll_conf_t, batch),
+      NULL },
+
       ngx_null_command
 };
 
@@ -1153,6 +1165,10 @@ ngx_epoll_init(ngx_cycle_t *cycle, ngx_msec_t timer)
                       |NGX_USE_GREEDY_EVENT
                       |NGX_USE_EPOLL_EVENT;
 
+    if (epcf->batch) {
+        ngx_event_flags |= NGX_USE_BATCH_EVENT;
+    }
+
     return NGX_OK;
 }
 
@@ -1616,8 +1632,10 @@ ngx_epoll_process_events(ngx_cycle_t *cycle, ngx_msec_t timer, ngx_uint_t flags)
     ngx_err_t          err;
     ngx_event_t       *rev, *wev;
     ngx_queue_t       *queue;
-    ngx_connection_t  *c;
+    ngx_connection_t  *c, *next;
+#if (NGX_DEBUG)
     char epollbuf[256];
+#endif
     
     /* NGX_TIMER_INFINITE == INFTIM */
 
@@ -1677,6 +1695,21 @@ ngx_notify->ngx_epoll_notify只会触发epoll_in，不会同时引发epoll_out
         return NGX_ERROR;
     }
 
+    if (ngx_event_flags & NGX_USE_BATCH_EVENT) {
+
+        /*
+         * all events of the batch are posted, and the connections
+         * are prefetched while the epoll_event array is still hot
+         */
+
+        flags |= NGX_POST_EVENTS;
+
+        for (i = 0; i < events; i++) {
+            ngx_prefetch((void *) ((uintptr_t) event_list[i].data.ptr
+                                   & (uintptr_t) ~1));
+        }
+    }
+
     //遍历本次epoll_wait返回的所有事件
     for (i = 0; i < events; i++) { //和ngx_epoll_add_event配合使用
         /*
@@ -1691,6 +1724,13 @@ ngx_notify->ngx_epoll_notify只会触发epoll_in，不会同时引发epoll_out
           */ //注意这里的c有可能是accept前的c，用于检测是否客户端发起tcp连接事件,accept返回成功后会重新创建一个ngx_connection_t，用来读写客户端的数据
         c = (ngx_connection_t *) ((uintptr_t) c & (uintptr_t) ~1);
 
+        if ((ngx_event_flags & NGX_USE_BATCH_EVENT) && i + 1 < events) {
+            next = (ngx_connection_t *) ((uintptr_t) event_list[i + 1].data.ptr
+                                         & (uintptr_t) ~1);
+            ngx_prefetch(next->read);
+            ngx_prefetch(next->write);
+        }
+
         rev = c->read; //取出读事件 //注意这里的c有可能是accept前的c，用于检测是否客户端发起tcp连接事件,accept返回成功后会重新创建一个ngx_connection_t，用来读写客户端的数据
 
         if (c->fd == -1 || rev->instance != instance) { //判断这个读事件是否为过期事件
@@ -1706,13 +1746,14 @@ ngx_notify->ngx_epoll_notify只会触发epoll_in，不会同时引发epoll_out
         }
 
         revents = event_list[i].events; //取出事件类型
-        ngx_epoll_event_2str(revents, epollbuf);
 
+#if (NGX_DEBUG)
         memset(epollbuf, 0, sizeof(epollbuf));
         ngx_epoll_event_2str(revents, epollbuf);
         ngx_log_debug4(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
                        "epoll: fd:%d %s(ev:%04XD) d:%p",
                        c->fd, epollbuf, revents, event_list[i].data.ptr);
+#endif
 
         if (revents & (EPOLLERR|EPOLLHUP)) { //例如对方close掉套接字，这里会感应到
             ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
@@ -1917,6 +1958,7 @@ ngx_epoll_create_conf(ngx_cycle_t *cycle)
 
     epcf->events = NGX_CONF_UNSET;
     epcf->aio_requests = NGX_CONF_UNSET;
+    epcf->batch = NGX_CONF_UNSET;
 
     return epcf;
 }
@@ -1929,6 +1971,7 @@ ngx_epoll_init_conf(ngx_cycle_t *cycle, void *conf)
 
     ngx_conf_init_uint_value(epcf->events, 512);
     ngx_conf_init_uint_value(epcf->aio_requests, 32);
+    ngx_conf_init_value(epcf->batch, 0);
 
     return NGX_CONF_OK;
 }
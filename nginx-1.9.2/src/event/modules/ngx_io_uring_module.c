@@ -0,0 +1,1049 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+/*
+ * Sockets are driven by multishot IORING_OP_POLL_ADD requests, so the
+ * readiness model and ngx_os_io_t stay the same as with epoll in the ET mode:
+ * a completion is posted for every wakeup and the poll stays armed.
+ *
+ * Listening sockets use oneshot IORING_OP_ACCEPT requests that are rearmed
+ * after every completion.  The accepted socket and its address are stored
+ * in ngx_listening_t and are taken by ngx_event_accept() before it falls
+ * back to accept4() to drain the backlog with multi_accept.  Only one
+ * accept is pending per listening socket, so the address buffer is not
+ * overwritten before the result is consumed.
+ *
+ * Reads and writes on sockets are not submitted to the ring: the callers
+ * of ngx_os_io_t expect the result synchronously and own the buffers only
+ * for the duration of the call, so readiness polls are used instead.
+ *
+ * All requests, including file reads, are queued to the submission ring
+ * and are passed to the kernel by the single io_uring_enter() call in
+ * ngx_io_uring_process_events() that also waits for completions.
+ *
+ * The low bits of user_data tell the completion type.  A connection
+ * completion also has bit 2 set for an accept, as the accepted socket
+ * has to be closed even if the listening connection is already stale.
+ */
+
+#define NGX_IO_URING_CONNECTION  0    /* bit 0 is the instance */
+#define NGX_IO_URING_EVENT       2
+#define NGX_IO_URING_AIO         3
+#define NGX_IO_URING_TYPE_MASK   3
+#define NGX_IO_URING_ACCEPT      4
+
+#define NGX_IO_URING_ADD         0
+#define NGX_IO_URING_MOD         1
+#define NGX_IO_URING_DEL         2
+
+#define NGX_IO_URING_READ        (POLLIN|POLLRDHUP)
+#define NGX_IO_URING_WRITE       POLLOUT
+
+
+typedef struct {
+    ngx_uint_t  entries;
+} ngx_io_uring_conf_t;
+
+
+typedef struct {
+    unsigned              *head;
+    unsigned              *tail;
+    unsigned              *array;
+    unsigned               mask;
+    unsigned               entries;
+    unsigned               local_tail;
+    size_t                 size;
+    void                  *ring;
+    struct io_uring_sqe   *sqes;
+} ngx_io_uring_sq_t;
+
+
+typedef struct {
+    unsigned              *head;
+    unsigned              *tail;
+    unsigned               mask;
+    size_t                 size;
+    void                  *ring;
+    struct io_uring_cqe   *cqes;
+} ngx_io_uring_cq_t;
+
+
+static ngx_int_t ngx_io_uring_init(ngx_cycle_t *cycle, ngx_msec_t timer);
+#if (NGX_HAVE_EVENTFD)
+static ngx_int_t ngx_io_uring_notify_init(ngx_log_t *log);
+static void ngx_io_uring_notify_handler(ngx_event_t *ev);
+#endif
+static void ngx_io_uring_done(ngx_cycle_t *cycle);
+static ngx_int_t ngx_io_uring_add_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_io_uring_del_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+#if (NGX_HAVE_EVENTFD)
+static ngx_int_t ngx_io_uring_notify(ngx_event_handler_pt handler);
+#endif
+static ngx_int_t ngx_io_uring_process_events(ngx_cycle_t *cycle,
+    ngx_msec_t timer, ngx_uint_t flags);
+
+static ngx_int_t ngx_io_uring_poll(ngx_fd_t fd, ngx_uint_t op,
+    uint32_t events, ngx_uint_t multishot, uintptr_t data, ngx_log_t *log);
+static ngx_int_t ngx_io_uring_accept(ngx_connection_t *c, ngx_uint_t op,
+    uintptr_t data, ngx_log_t *log);
+static struct io_uring_sqe *ngx_io_uring_get_sqe(ngx_log_t *log);
+static int ngx_io_uring_enter(unsigned to_submit, unsigned min_complete,
+    unsigned flags, void *arg, size_t argsz);
+static ngx_int_t ngx_io_uring_submit(ngx_log_t *log);
+
+static void *ngx_io_uring_create_conf(ngx_cycle_t *cycle);
+static char *ngx_io_uring_init_conf(ngx_cycle_t *cycle, void *conf);
+
+
+static int                ring = -1;
+static ngx_io_uring_sq_t  sq;
+static ngx_io_uring_cq_t  cq;
+
+#if (NGX_HAVE_EVENTFD)
+static int                notify_fd = -1;
+static ngx_event_t        notify_event;
+#endif
+
+static ngx_str_t          io_uring_name = ngx_string("io_uring");
+
+
+static ngx_command_t  ngx_io_uring_commands[] = {
+
+    { ngx_string("io_uring_entries"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_io_uring_conf_t, entries),
+      NULL },
+
+      ngx_null_command
+};
+
+
+ngx_event_module_t  ngx_io_uring_module_ctx = {
+    &io_uring_name,
+    ngx_io_uring_create_conf,            /* create configuration */
+    ngx_io_uring_init_conf,              /* init configuration */
+
+    {
+        ngx_io_uring_add_event,          /* add an event */
+        ngx_io_uring_del_event,          /* delete an event */
+        ngx_io_uring_add_event,          /* enable an event */
+        ngx_io_uring_del_event,          /* disable an event */
+        NULL,                            /* add an connection */
+        NULL,                            /* delete an connection */
+#if (NGX_HAVE_EVENTFD)
+        ngx_io_uring_notify,             /* trigger a notify */
+#else
+        NULL,                            /* trigger a notify */
+#endif
+        ngx_io_uring_process_events,     /* process the events */
+        ngx_io_uring_init,               /* init the events */
+        ngx_io_uring_done,               /* done the events */
+    }
+};
+
+ngx_module_t  ngx_io_uring_module = {
+    NGX_MODULE_V1,
+    &ngx_io_uring_module_ctx,            /* module context */
+    ngx_io_uring_commands,               /* module directives */
+    NGX_EVENT_MODULE,                    /* module type */
+    NULL,                                /* init master */
+    NULL,                                /* init module */
+    NULL,                                /* init process */
+    NULL,                                /* init thread */
+    NULL,                                /* exit thread */
+    NULL,                                /* exit process */
+    NULL,                                /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_io_uring_init(ngx_cycle_t *cycle, ngx_msec_t timer)
+{
+    u_char                  *p;
+    unsigned                 i;
+    struct io_uring_params   params;
+    ngx_io_uring_conf_t     *iucf;
+
+    iucf = ngx_event_get_conf(cycle->conf_ctx, ngx_io_uring_module);
+
+    if (ring == -1) {
+        ngx_memzero(&params, sizeof(struct io_uring_params));
+
+        ring = syscall(SYS_io_uring_setup, iucf->entries, &params);
+
+        if (ring == -1) {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                          "io_uring_setup(%ui) failed", iucf->entries);
+            return NGX_ERROR;
+        }
+
+        if (!(params.features & IORING_FEAT_NODROP)
+            || !(params.features & IORING_FEAT_EXT_ARG))
+        {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                          "io_uring is not supported by the kernel, "
+                          "at least Linux 5.13 is required");
+            goto failed;
+        }
+
+        sq.size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq.size = params.cq_off.cqes
+                  + params.cq_entries * sizeof(struct io_uring_cqe);
+
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            sq.size = ngx_max(sq.size, cq.size);
+            cq.size = 0;
+        }
+
+        sq.ring = mmap(NULL, sq.size, PROT_READ|PROT_WRITE,
+                       MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+
+        if (sq.ring == MAP_FAILED) {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                          "mmap(IORING_OFF_SQ_RING) failed");
+            sq.ring = NULL;
+            goto failed;
+        }
+
+        if (cq.size) {
+            cq.ring = mmap(NULL, cq.size, PROT_READ|PROT_WRITE,
+                           MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+
+            if (cq.ring == MAP_FAILED) {
+                ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                              "mmap(IORING_OFF_CQ_RING) failed");
+                cq.ring = NULL;
+                goto failed;
+            }
+
+        } else {
+            cq.ring = sq.ring;
+        }
+
+        sq.sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+                       PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                       ring, IORING_OFF_SQES);
+
+        if (sq.sqes == MAP_FAILED) {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                          "mmap(IORING_OFF_SQES) failed");
+            sq.sqes = NULL;
+            goto failed;
+        }
+
+        p = sq.ring;
+
+        sq.head = (unsigned *) (p + params.sq_off.head);
+        sq.tail = (unsigned *) (p + params.sq_off.tail);
+        sq.array = (unsigned *) (p + params.sq_off.array);
+        sq.mask = *(unsigned *) (p + params.sq_off.ring_mask);
+        sq.entries = *(unsigned *) (p + params.sq_off.ring_entries);
+        sq.local_tail = *sq.tail;
+
+        /* the sqes are used in the ring order */
+
+        for (i = 0; i < sq.entries; i++) {
+            sq.array[i] = i;
+        }
+
+        p = cq.ring;
+
+        cq.head = (unsigned *) (p + params.cq_off.head);
+        cq.tail = (unsigned *) (p + params.cq_off.tail);
+        cq.mask = *(unsigned *) (p + params.cq_off.ring_mask);
+        cq.cqes = (struct io_uring_cqe *) (p + params.cq_off.cqes);
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring: fd:%d sq:%ud cq:%ud",
+                       ring, params.sq_entries, params.cq_entries);
+
+#if (NGX_HAVE_EVENTFD)
+        if (ngx_io_uring_notify_init(cycle->log) != NGX_OK) {
+            ngx_io_uring_module_ctx.actions.notify = NULL;
+        }
+#endif
+    }
+
+    ngx_io = ngx_os_io;
+
+    ngx_event_actions = ngx_io_uring_module_ctx.actions;
+
+    ngx_event_flags = NGX_USE_CLEAR_EVENT|NGX_USE_IO_URING_EVENT;
+
+    return NGX_OK;
+
+failed:
+
+    ngx_io_uring_done(cycle);
+
+    return NGX_ERROR;
+}
+
+
+#if (NGX_HAVE_EVENTFD)
+
+static ngx_int_t
+ngx_io_uring_notify_init(ngx_log_t *log)
+{
+#if (NGX_HAVE_SYS_EVENTFD_H)
+    notify_fd = eventfd(0, 0);
+#else
+    notify_fd = syscall(SYS_eventfd, 0);
+#endif
+
+    if (notify_fd == -1) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno, "eventfd() failed");
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "notify eventfd: %d", notify_fd);
+
+    notify_event.handler = ngx_io_uring_notify_handler;
+    notify_event.log = log;
+    notify_event.active = 1;
+
+    if (ngx_io_uring_poll(notify_fd, NGX_IO_URING_ADD, POLLIN, 1,
+                          (uintptr_t) &notify_event | NGX_IO_URING_EVENT, log)
+        != NGX_OK)
+    {
+        if (close(notify_fd) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          "eventfd close() failed");
+        }
+
+        notify_fd = -1;
+
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_io_uring_notify_handler(ngx_event_t *ev)
+{
+    ssize_t               n;
+    uint64_t              count;
+    ngx_err_t             err;
+    ngx_event_handler_pt  handler;
+
+    if (++ev->index == NGX_MAX_UINT32_VALUE) {
+        ev->index = 0;
+
+        n = read(notify_fd, &count, sizeof(uint64_t));
+
+        err = ngx_errno;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "read() eventfd %d: %z count:%uL", notify_fd, n, count);
+
+        if ((size_t) n != sizeof(uint64_t)) {
+            ngx_log_error(NGX_LOG_ALERT, ev->log, err,
+                          "read() eventfd %d failed", notify_fd);
+        }
+    }
+
+    handler = ev->data;
+    handler(ev);
+}
+
+#endif
+
+
+static void
+ngx_io_uring_done(ngx_cycle_t *cycle)
+{
+    if (sq.sqes) {
+        if (munmap(sq.sqes, sq.entries * sizeof(struct io_uring_sqe)) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "munmap(IORING_OFF_SQES) failed");
+        }
+    }
+
+    if (cq.ring && cq.ring != sq.ring) {
+        if (munmap(cq.ring, cq.size) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "munmap(IORING_OFF_CQ_RING) failed");
+        }
+    }
+
+    if (sq.ring) {
+        if (munmap(sq.ring, sq.size) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "munmap(IORING_OFF_SQ_RING) failed");
+        }
+    }
+
+    ngx_memzero(&sq, sizeof(ngx_io_uring_sq_t));
+    ngx_memzero(&cq, sizeof(ngx_io_uring_cq_t));
+
+    if (close(ring) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "io_uring close() failed");
+    }
+
+    ring = -1;
+
+#if (NGX_HAVE_EVENTFD)
+
+    if (notify_fd != -1) {
+        if (close(notify_fd) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "eventfd close() failed");
+        }
+
+        notify_fd = -1;
+    }
+
+#endif
+}
+
+
+static ngx_int_t
+ngx_io_uring_add_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    uint32_t           events, prev;
+    ngx_uint_t         op;
+    ngx_event_t       *e;
+    ngx_connection_t  *c;
+
+    c = ev->data;
+
+    if (ev->accept) {
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "io_uring add accept: fd:%d", c->fd);
+
+        if (ngx_io_uring_accept(c, NGX_IO_URING_ADD,
+                                (uintptr_t) c | ev->instance, ev->log)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        ev->active = 1;
+
+        return NGX_OK;
+    }
+
+    if (event == NGX_READ_EVENT) {
+        e = c->write;
+        prev = NGX_IO_URING_WRITE;
+        events = NGX_IO_URING_READ;
+
+    } else {
+        e = c->read;
+        prev = NGX_IO_URING_READ;
+        events = NGX_IO_URING_WRITE;
+    }
+
+    if (e->active) {
+        op = NGX_IO_URING_MOD;
+        events |= prev;
+
+    } else {
+        op = NGX_IO_URING_ADD;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring add event: fd:%d op:%ui ev:%08XD",
+                   c->fd, op, events);
+
+    if (ngx_io_uring_poll(c->fd, op, events, 1,
+                          (uintptr_t) c | ev->instance, ev->log)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    ev->active = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_del_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    uint32_t           events;
+    ngx_uint_t         op;
+    ngx_event_t       *e;
+    ngx_connection_t  *c;
+
+    /*
+     * unlike epoll, a pending poll request holds a reference to the file,
+     * so the poll has to be removed even if the descriptor is being closed
+     */
+
+    c = ev->data;
+
+    if (ev->accept) {
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "io_uring del accept: fd:%d", c->fd);
+
+        if (ngx_io_uring_accept(c, NGX_IO_URING_DEL,
+                                (uintptr_t) c | ev->instance, ev->log)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        ev->active = 0;
+
+        return NGX_OK;
+    }
+
+    if (event == NGX_READ_EVENT) {
+        e = c->write;
+        events = NGX_IO_URING_WRITE;
+
+    } else {
+        e = c->read;
+        events = NGX_IO_URING_READ;
+    }
+
+    op = e->active ? NGX_IO_URING_MOD : NGX_IO_URING_DEL;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring del event: fd:%d op:%ui ev:%08XD",
+                   c->fd, op, events);
+
+    if (ngx_io_uring_poll(c->fd, op, events, 1,
+                          (uintptr_t) c | ev->instance, ev->log)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    ev->active = 0;
+
+    return NGX_OK;
+}
+
+
+#if (NGX_HAVE_EVENTFD)
+
+static ngx_int_t
+ngx_io_uring_notify(ngx_event_handler_pt handler)
+{
+    static uint64_t inc = 1;
+
+    notify_event.data = handler;
+
+    if ((size_t) write(notify_fd, &inc, sizeof(uint64_t)) != sizeof(uint64_t)) {
+        ngx_log_error(NGX_LOG_ALERT, notify_event.log, ngx_errno,
+                      "write() to eventfd %d failed", notify_fd);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
+#if (NGX_HAVE_FILE_AIO)
+
+ngx_int_t
+ngx_io_uring_aio_read(ngx_event_t *ev, ngx_fd_t fd, u_char *buf, size_t size,
+    off_t offset)
+{
+    struct io_uring_sqe  *sqe;
+
+    if (size > NGX_MAX_INT32_VALUE) {
+        return NGX_DECLINED;
+    }
+
+    sqe = ngx_io_uring_get_sqe(ev->log);
+    if (sqe == NULL) {
+        return NGX_DECLINED;
+    }
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t) buf;
+    sqe->len = (uint32_t) size;
+    sqe->off = offset;
+    sqe->user_data = (uintptr_t) ev | NGX_IO_URING_AIO;
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_io_uring_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
+    ngx_uint_t flags)
+{
+    int                             n, res;
+    uint32_t                        revents, events;
+    unsigned                        head, tail, more;
+    uintptr_t                       data;
+    ngx_int_t                       instance;
+    ngx_uint_t                      level;
+    ngx_err_t                       err;
+    ngx_event_t                    *ev, *rev, *wev;
+    ngx_connection_t               *c;
+    struct timespec                 ts;
+    struct io_uring_cqe            *cqe;
+    struct io_uring_getevents_arg   arg;
+
+    ngx_memzero(&arg, sizeof(struct io_uring_getevents_arg));
+
+    if (timer != NGX_TIMER_INFINITE) {
+        ts.tv_sec = timer / 1000;
+        ts.tv_nsec = (timer % 1000) * 1000000;
+        arg.ts = (uintptr_t) &ts;
+    }
+
+    ngx_memory_barrier();
+
+    *sq.tail = sq.local_tail;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring timer: %M, submit: %ud",
+                   timer, sq.local_tail - *sq.head);
+
+    n = ngx_io_uring_enter(sq.local_tail - *sq.head, 1,
+                           IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG,
+                           &arg, sizeof(struct io_uring_getevents_arg));
+
+    err = (n == -1) ? ngx_errno : 0;
+
+    if (flags & NGX_UPDATE_TIME || ngx_event_timer_alarm) {
+        ngx_time_update();
+    }
+
+    if (err && err != ETIME && err != NGX_EBUSY && err != NGX_EAGAIN) {
+        if (err == NGX_EINTR) {
+
+            if (ngx_event_timer_alarm) {
+                ngx_event_timer_alarm = 0;
+                return NGX_OK;
+            }
+
+            level = NGX_LOG_INFO;
+
+        } else {
+            level = NGX_LOG_ALERT;
+        }
+
+        ngx_log_error(level, cycle->log, err, "io_uring_enter() failed");
+        return NGX_ERROR;
+    }
+
+    head = *cq.head;
+    tail = *cq.tail;
+
+    ngx_memory_barrier();
+
+    for ( /* void */ ; head != tail; head++) {
+
+        cqe = &cq.cqes[head & cq.mask];
+
+        data = (uintptr_t) cqe->user_data;
+        res = cqe->res;
+        more = cqe->flags & IORING_CQE_F_MORE;
+
+        if (data == 0) {
+
+            /* poll update, poll or accept removal */
+
+            if (res < 0 && res != -ENOENT && res != -EALREADY) {
+                ngx_log_error(NGX_LOG_ALERT, cycle->log, -res,
+                              "io_uring poll update failed");
+            }
+
+            continue;
+        }
+
+        switch (data & NGX_IO_URING_TYPE_MASK) {
+
+        case NGX_IO_URING_EVENT:
+
+            ev = (ngx_event_t *) (data & ~NGX_IO_URING_TYPE_MASK);
+
+#if (NGX_HAVE_EVENTFD)
+            if (!more && ev == &notify_event) {
+                (void) ngx_io_uring_poll(notify_fd, NGX_IO_URING_ADD, POLLIN,
+                                         1, data, cycle->log);
+            }
+#endif
+
+            if (res < 0) {
+                ngx_log_error(NGX_LOG_ALERT, cycle->log, -res,
+                              "io_uring event poll failed");
+                continue;
+            }
+
+            ev->handler(ev);
+
+            continue;
+
+#if (NGX_HAVE_FILE_AIO)
+
+        case NGX_IO_URING_AIO:
+
+            ev = (ngx_event_t *) (data & ~NGX_IO_URING_TYPE_MASK);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring aio: %p res:%d", ev, res);
+
+            ev->complete = 1;
+            ev->active = 0;
+            ev->ready = 1;
+
+            ((ngx_event_aio_t *) ev->data)->res = res;
+
+            ngx_post_event(ev, &ngx_posted_events);
+
+            continue;
+
+#endif
+        }
+
+        c = (ngx_connection_t *)
+                (data & ~(NGX_IO_URING_TYPE_MASK|NGX_IO_URING_ACCEPT));
+
+        instance = data & 1;
+
+        rev = c->read;
+        wev = c->write;
+
+        if (c->fd == -1 || rev->instance != instance || res == -ECANCELED) {
+
+            /*
+             * the stale event from a file descriptor
+             * that was just closed in this iteration
+             */
+
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring: stale event %p", c);
+
+            if ((data & NGX_IO_URING_ACCEPT) && res >= 0) {
+                if (ngx_close_socket(res) == -1) {
+                    ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                                  ngx_close_socket_n " failed");
+                }
+            }
+
+            continue;
+        }
+
+        if (rev->accept) {
+
+            /* the oneshot accept of a listening socket has completed */
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring accept: fd:%d res:%d", c->fd, res);
+
+            c->listening->ring_res = res;
+            c->listening->ring_accepted = 1;
+
+            rev->ready = 1;
+
+            if (flags & NGX_POST_EVENTS) {
+
+                /* the accept is rearmed on the next accept mutex lock */
+
+                rev->active = 0;
+                ngx_accept_events = 1;
+
+                ngx_post_event(rev, &ngx_posted_accept_events);
+
+                continue;
+            }
+
+            rev->handler(rev);
+
+            /* the handler deletes the event to stop accepting */
+
+            if (c->fd != -1 && rev->instance == instance && rev->active
+                && ngx_io_uring_accept(c, NGX_IO_URING_ADD, data, cycle->log)
+                   != NGX_OK)
+            {
+                rev->active = 0;
+            }
+
+            continue;
+        }
+
+        if (res < 0) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, -res,
+                          "io_uring poll(%d) failed", c->fd);
+
+            revents = POLLERR;
+
+        } else {
+            revents = (uint32_t) res;
+        }
+
+        ngx_log_debug4(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring: fd:%d ev:%04XD more:%ud d:%p",
+                       c->fd, revents, more, data);
+
+        if (res >= 0 && !more) {
+
+            /* the multishot poll was terminated by the kernel */
+
+            events = (rev->active ? NGX_IO_URING_READ : 0)
+                     | (wev->active ? NGX_IO_URING_WRITE : 0);
+
+            if (events
+                && ngx_io_uring_poll(c->fd, NGX_IO_URING_ADD, events, 1,
+                                     data, cycle->log)
+                   != NGX_OK)
+            {
+                rev->active = 0;
+                wev->active = 0;
+            }
+        }
+
+        if (revents & (POLLERR|POLLHUP)) {
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring error on fd:%d ev:%04XD",
+                           c->fd, revents);
+        }
+
+        if ((revents & (POLLERR|POLLHUP))
+             && (revents & (POLLIN|POLLOUT)) == 0)
+        {
+            /*
+             * if the error events were returned without POLLIN or POLLOUT,
+             * then add these flags to handle the events at least in one
+             * active handler
+             */
+
+            revents |= POLLIN|POLLOUT;
+        }
+
+        if ((revents & POLLIN) && rev->active) {
+
+            if (revents & POLLRDHUP) {
+                rev->pending_eof = 1;
+            }
+
+            rev->ready = 1;
+
+            if (flags & NGX_POST_EVENTS) {
+                ngx_post_event(rev, &ngx_posted_events);
+
+            } else {
+                rev->handler(rev);
+            }
+        }
+
+        if ((revents & POLLOUT) && wev->active) {
+
+            if (c->fd == -1 || wev->instance != instance) {
+
+                /*
+                 * the stale event from a file descriptor
+                 * that was just closed in this iteration
+                 */
+
+                ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                               "io_uring: stale event %p", c);
+                continue;
+            }
+
+            wev->ready = 1;
+
+            if (flags & NGX_POST_EVENTS) {
+                ngx_post_event(wev, &ngx_posted_events);
+
+            } else {
+                wev->handler(wev);
+            }
+        }
+
+        if (res < 0 && c->fd != -1 && rev->instance == instance) {
+
+            /* the poll is not armed, let the handlers add it again */
+
+            rev->active = 0;
+            wev->active = 0;
+        }
+    }
+
+    ngx_memory_barrier();
+
+    *cq.head = tail;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_poll(ngx_fd_t fd, ngx_uint_t op, uint32_t events,
+    ngx_uint_t multishot, uintptr_t data, ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_io_uring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+#if !(NGX_HAVE_LITTLE_ENDIAN)
+    events = (events << 16) | (events >> 16);
+#endif
+
+    switch (op) {
+
+    case NGX_IO_URING_ADD:
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->len = multishot ? IORING_POLL_ADD_MULTI : 0;
+        sqe->poll32_events = events;
+        sqe->user_data = data;
+        break;
+
+    case NGX_IO_URING_MOD:
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = data;
+        sqe->len = IORING_POLL_UPDATE_EVENTS|IORING_POLL_ADD_MULTI;
+        sqe->poll32_events = events;
+        break;
+
+    default: /* NGX_IO_URING_DEL */
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = data;
+        break;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_accept(ngx_connection_t *c, ngx_uint_t op, uintptr_t data,
+    ngx_log_t *log)
+{
+    ngx_listening_t      *ls;
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_io_uring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    data |= NGX_IO_URING_ACCEPT;
+
+    if (op == NGX_IO_URING_DEL) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = data;
+        return NGX_OK;
+    }
+
+    ls = c->listening;
+    ls->ring_socklen = NGX_SOCKADDRLEN;
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = c->fd;
+    sqe->addr = (uintptr_t) ls->ring_sockaddr;
+    sqe->addr2 = (uintptr_t) &ls->ring_socklen;
+    sqe->accept_flags = SOCK_NONBLOCK;
+    sqe->user_data = data;
+
+    return NGX_OK;
+}
+
+
+static struct io_uring_sqe *
+ngx_io_uring_get_sqe(ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    if (sq.local_tail - *sq.head >= sq.entries) {
+
+        /* the submission ring is full, pass the queued requests now */
+
+        if (ngx_io_uring_submit(log) != NGX_OK
+            || sq.local_tail - *sq.head >= sq.entries)
+        {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          "io_uring submission ring overflow, "
+                          "consider increasing \"io_uring_entries\"");
+            return NULL;
+        }
+    }
+
+    sqe = &sq.sqes[sq.local_tail & sq.mask];
+    sq.local_tail++;
+
+    ngx_memzero(sqe, sizeof(struct io_uring_sqe));
+
+    return sqe;
+}
+
+
+static int
+ngx_io_uring_enter(unsigned to_submit, unsigned min_complete, unsigned flags,
+    void *arg, size_t argsz)
+{
+    return syscall(SYS_io_uring_enter, ring, to_submit, min_complete, flags,
+                   arg, argsz);
+}
+
+
+static ngx_int_t
+ngx_io_uring_submit(ngx_log_t *log)
+{
+    ngx_memory_barrier();
+
+    *sq.tail = sq.local_tail;
+
+    if (ngx_io_uring_enter(sq.local_tail - *sq.head, 0, 0, NULL, 0) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "io_uring_enter() failed");
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_io_uring_create_conf(ngx_cycle_t *cycle)
+{
+    ngx_io_uring_conf_t  *iucf;
+
+    iucf = ngx_palloc(cycle->pool, sizeof(ngx_io_uring_conf_t));
+    if (iucf == NULL) {
+        return NULL;
+    }
+
+    iucf->entries = NGX_CONF_UNSET;
+
+    return iucf;
+}
+
+
+static char *
+ngx_io_uring_init_conf(ngx_cycle_t *cycle, void *conf)
+{
+    ngx_io_uring_conf_t *iucf = conf;
+
+    ngx_conf_init_uint_value(iucf->entries, 1024);
+
+    return NGX_CONF_OK;
+}
@@ -23,6 +23,9 @@ extern ngx_module_t ngx_select_module;
 static char *ngx_event_init_conf(ngx_cycle_t *cycle, void *conf);
 static ngx_int_t ngx_event_module_init(ngx_cycle_t *cycle);
 static ngx_int_t ngx_event_process_init(ngx_cycle_t *cycle);
+#if (NGX_HAVE_REUSEPORT && NGX_HAVE_INCOMING_CPU)
+static ngx_int_t ngx_event_steering_cpu(ngx_cycle_t *cycle);
+#endif
 static char *ngx_events_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
 static char *ngx_event_connections(ngx_conf_t *cf, ngx_command_t *cmd,
@@ -86,6 +89,9 @@ ngx_accept_disabled表示此时满负荷，没必要再处理新连接了，我
 当达到最大数的7/8时，ngx_accept_disabled为正，说明本nginx worker进程非常繁忙，将不再去处理新连接，这也是个简单的负载均衡
 */
 ngx_int_t             ngx_accept_disabled; //赋值地方在ngx_event_accept
+ngx_int_t             ngx_accept_cpu = -1; //reuseport_cpu_steering生效时worker所绑定的CPU
+ngx_uint_t            ngx_accept_limit; //multi_accept_limit配置
+ngx_uint_t            ngx_accept_count; //本轮事件循环已经accept的连接数
 
 /*
    作为Web服务器，Nginx具有统计整个服务器中HTTP连接状况的功能（不是某一个Nginx worker进程的状况，而是所有worker进程连接状况的总和）。
@@ -130,6 +136,13 @@ ngx_atomic_t  *ngx_stat_writing = &ngx_stat_writing0;
 ngx_atomic_t   ngx_stat_waiting0;
 ngx_atomic_t  *ngx_stat_waiting = &ngx_stat_waiting0;
 
+//每个worker一个slot，没有master进程时只有一个
+ngx_stat_accept_t   ngx_stat_accepts0;
+ngx_stat_accept_t  *ngx_stat_accepts = &ngx_stat_accepts0;
+ngx_stat_loop_t     ngx_stat_loops0;
+ngx_stat_loop_t    *ngx_stat_loops = &ngx_stat_loops0;
+ngx_uint_t          ngx_stat_accepts_n = 1;
+
 #endif
 
 
@@ -207,6 +220,13 @@ static ngx_command_t  ngx_event_core_commands[] = {
       offsetof(ngx_event_conf_t, multi_accept),
       NULL },
 
+    { ngx_string("multi_accept_limit"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_event_conf_t, multi_accept_limit),
+      NULL },
+
     //accept_mutex on|off是否打开accept进程锁，是为了实现worker进程接收连接的负载均衡、打开后让多个worker进程轮流的序列号的接收TCP连接
     //默认是打开的，如果关闭的话TCP连接会更快，但worker间的连接不会那么均匀。
     { ngx_string("accept_mutex"),
@@ -226,6 +246,20 @@ static ngx_command_t  ngx_event_core_commands[] = {
       NULL },
     //debug_connection 1.2.2.2则在收到该IP地址请求的时候，使用debug级别打印。其他的还是沿用error_log中的设置
     //需要对来自指定IP的TCP连接打印debug级别的调斌日志
+    { ngx_string("timer_wheel"),
+      NGX_EVENT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_event_conf_t, timer_wheel),
+      NULL },
+
+    { ngx_string("reuseport_cpu_steering"),
+      NGX_EVENT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_event_conf_t, cpu_steering),
+      NULL },
+
     { ngx_string("debug_connection"),
       NGX_EVENT_CONF|NGX_CONF_TAKE1,
       ngx_event_debug_connection,
@@ -282,8 +316,15 @@ nginx就是这样，master进程监听端口号（例如80），所有的nginx w
 void
 ngx_process_events_and_timers(ngx_cycle_t *cycle)  
 {
-    ngx_uint_t  flags;
-    ngx_msec_t  timer, delta;
+    ngx_uint_t       flags;
+    ngx_msec_t       timer, delta;
+#if (NGX_STAT_STUB)
+    ngx_uint_t       n;
+    uint64_t         busy;
+    struct timeval   tv;
+
+    busy = 0;
+#endif
     
     /*nginx提供参数timer_resolution，设置缓存时间更新的间隔；
     配置该项后，nginx将使用中断机制，而非使用定时器红黑树中的最小时间为epoll_wait的超时时间，即此时定时器将定期被中断。
@@ -313,7 +354,6 @@ ngx_process_events_and_timers(ngx_cycle_t *cycle)
 #endif
     }
 
-    ngx_use_accept_mutex = 1;
    //ngx_use_accept_mutex表示是否需要通过对accept加锁来解决惊群问题。当nginx worker进程数>1时且配置文件中打开accept_mutex时，这个标志置为1   
     if (ngx_use_accept_mutex) {
         /*
@@ -368,6 +408,24 @@ ngx_process_events_and_timers(ngx_cycle_t *cycle)
         }
     }
 
+    /*
+     * the accept events deferred by the accept limit are run with the new
+     * accept events, that is under the accept mutex if it is used
+     */
+
+    if (!ngx_queue_empty(&ngx_posted_next_events)) {
+
+        if (ngx_use_accept_mutex && !(flags & NGX_POST_EVENTS)) {
+            ngx_event_drop_posted_next(cycle);
+
+        } else {
+            ngx_event_move_posted_next(cycle);
+            timer = 0;
+        }
+    }
+
+    ngx_accept_count = 0;
+
     delta = ngx_current_msec;
 
     /*
@@ -394,6 +452,24 @@ epoll_wait返回，可以是读写事件触发返回，也可能是因为没获
     delta = ngx_current_msec - delta; //(void) ngx_process_events(cycle, timer, flags)中epoll等待事件触发过程花费的时间
 
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0, "epoll_wait timer range(delta): %M", delta);
+
+#if (NGX_STAT_STUB)
+    if (ngx_event_flags & NGX_USE_BATCH_EVENT) {
+        ngx_gettimeofday(&tv);
+        busy = (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+    }
+#endif
+
+    if ((ngx_event_flags & NGX_USE_BATCH_EVENT) && !ngx_accept_mutex_held) {
+
+        /*
+         * the connections that already have data are served before
+         * the new ones, with the accept mutex held the new connections
+         * are accepted first to release the mutex as soon as possible
+         */
+
+        ngx_event_process_posted(cycle, &ngx_posted_events);
+    }
              
     //当感应到来自于客户端的accept事件，epoll_wait返回后加入到post队列，执行完所有accpet连接事件后，立马释放ngx_accept_mutex锁，这样其他进程就可以立马获得锁accept客户端连接
     ngx_event_process_posted(cycle, &ngx_posted_accept_events); //一般执行ngx_event_accept
@@ -412,6 +488,20 @@ epoll_wait返回，可以是读写事件触发返回，也可能是因为没获
      链表中，延迟到锁释放了再处理。 
      */
     ngx_event_process_posted(cycle, &ngx_posted_events); //普通读写事件放在释放ngx_accept_mutex锁后执行，提高客户端accept性能
+
+#if (NGX_STAT_STUB)
+    if (ngx_event_flags & NGX_USE_BATCH_EVENT) {
+        ngx_gettimeofday(&tv);
+        busy = (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec - busy;
+
+        for (n = 0, busy >>= 6; busy && n < NGX_STAT_LOOP_BUCKETS - 1; n++) {
+            busy >>= 1;
+        }
+
+        ngx_stat_loops[ngx_worker < ngx_stat_accepts_n ? ngx_worker : 0]
+            .time[n]++;
+    }
+#endif
 }
 
 /*
@@ -776,7 +866,9 @@ ngx_event_module_init(ngx_cycle_t *cycle)
            + cl          /* ngx_stat_active */
            + cl          /* ngx_stat_reading */
            + cl          /* ngx_stat_writing */
-           + cl;         /* ngx_stat_waiting */
+           + cl          /* ngx_stat_waiting */
+           + NGX_MAX_PROCESSES * sizeof(ngx_stat_accept_t)
+           + NGX_MAX_PROCESSES * sizeof(ngx_stat_loop_t);
 
 #endif
 
@@ -833,6 +925,11 @@ ngx_event_module_init(ngx_cycle_t *cycle)
     ngx_stat_writing = (ngx_atomic_t *) (shared + 8 * cl);
     ngx_stat_waiting = (ngx_atomic_t *) (shared + 9 * cl);
 
+    ngx_stat_accepts = (ngx_stat_accept_t *) (shared + 10 * cl);
+    ngx_stat_loops = (ngx_stat_loop_t *) (shared + 10 * cl
+                          + NGX_MAX_PROCESSES * sizeof(ngx_stat_accept_t));
+    ngx_stat_accepts_n = NGX_MAX_PROCESSES;
+
 #endif
 
     return NGX_OK;
@@ -899,6 +996,19 @@ ngx_event_process_init(ngx_cycle_t *cycle)
 
     ngx_queue_init(&ngx_posted_accept_events);
     ngx_queue_init(&ngx_posted_events);
+    ngx_queue_init(&ngx_posted_next_events);
+
+    ngx_accept_limit = ecf->multi_accept_limit;
+
+    ngx_event_timer_wheel = ecf->timer_wheel;
+
+    ngx_accept_cpu = -1;
+
+#if (NGX_HAVE_REUSEPORT && NGX_HAVE_INCOMING_CPU)
+    if (ecf->cpu_steering) {
+        ngx_accept_cpu = ngx_event_steering_cpu(cycle);
+    }
+#endif
 
     //初始化红黑树实现的定时器。
     if (ngx_event_timer_init(cycle->log) == NGX_ERROR) {
@@ -1053,6 +1163,29 @@ ngx_event_process_init(ngx_cycle_t *cycle)
         }
 #endif
 
+#if (NGX_HAVE_REUSEPORT && NGX_HAVE_INCOMING_CPU)
+        /*
+         * the reuseport socket is used by this worker only, so the kernel
+         * may steer to it the connections whose packets are processed by
+         * the CPU the worker is bound to
+         */
+
+        if (ls[i].reuseport && ngx_accept_cpu != -1) {
+            int  cpu;
+
+            cpu = (int) ngx_accept_cpu;
+
+            if (setsockopt(ls[i].fd, SOL_SOCKET, SO_INCOMING_CPU,
+                           (const void *) &cpu, sizeof(int))
+                == -1)
+            {
+                ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                              "setsockopt(SO_INCOMING_CPU, %d) for %V failed, "
+                              "ignored", cpu, &ls[i].addr_text);
+            }
+        }
+#endif
+
         c = ngx_get_connection(ls[i].fd, cycle->log); //从连接池中获取一个ngx_connection_t
 
         if (c == NULL) {
@@ -1168,6 +1301,42 @@ ngx_event_process_init(ngx_cycle_t *cycle)
 }
 
 
+#if (NGX_HAVE_REUSEPORT && NGX_HAVE_INCOMING_CPU)
+
+static ngx_int_t
+ngx_event_steering_cpu(ngx_cycle_t *cycle)
+{
+    ngx_int_t  cpu;
+    uint64_t   cpu_affinity;
+
+    if (ngx_process != NGX_PROCESS_WORKER) {
+        return -1;
+    }
+
+    cpu_affinity = ngx_get_cpu_affinity(ngx_worker);
+
+    if (cpu_affinity == 0 || (cpu_affinity & (cpu_affinity - 1))) {
+        ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                      "\"reuseport_cpu_steering\" is ignored, worker %ui "
+                      "is not bound to a single CPU by \"worker_cpu_affinity\"",
+                      ngx_worker);
+        return -1;
+    }
+
+    for (cpu = 0; !(cpu_affinity & 1); cpu++) {
+        cpu_affinity >>= 1;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "worker %ui steers reuseport connections to cpu %i",
+                   ngx_worker, cpu);
+
+    return cpu;
+}
+
+#endif
+
+
 ngx_int_t
 ngx_send_lowat(ngx_connection_t *c, size_t lowat)
 {
@@ -1182,7 +1351,7 @@ ngx_send_lowat(ngx_connection_t *c, size_t lowat)
 
 #endif
 
-    if (lowat == 0 || c->sndlowat) {
+    if (lowat == 0 || c->sndlowat || c->multiplexed) {
         return NGX_OK;
     }
 
@@ -1499,8 +1668,11 @@ ngx_event_core_create_conf(ngx_cycle_t *cycle)
     ecf->connections = NGX_CONF_UNSET_UINT;
     ecf->use = NGX_CONF_UNSET_UINT;
     ecf->multi_accept = NGX_CONF_UNSET;
+    ecf->multi_accept_limit = NGX_CONF_UNSET_UINT;
     ecf->accept_mutex = NGX_CONF_UNSET;
     ecf->accept_mutex_delay = NGX_CONF_UNSET_MSEC;
+    ecf->timer_wheel = NGX_CONF_UNSET;
+    ecf->cpu_steering = NGX_CONF_UNSET;
     ecf->name = (void *) NGX_CONF_UNSET;
 
 #if (NGX_DEBUG)
@@ -1599,8 +1771,11 @@ ngx_event_core_init_conf(ngx_cycle_t *cycle, void *conf)
     ngx_conf_init_ptr_value(ecf->name, event_module->name->data);
 
     ngx_conf_init_value(ecf->multi_accept, 0);
+    ngx_conf_init_uint_value(ecf->multi_accept_limit, 0);
     ngx_conf_init_value(ecf->accept_mutex, 1);
     ngx_conf_init_msec_value(ecf->accept_mutex_delay, 500);
+    ngx_conf_init_value(ecf->timer_wheel, 0);
+    ngx_conf_init_value(ecf->cpu_steering, 0);
 
     return NGX_CONF_OK;
 }
@@ -330,6 +330,11 @@ typedef struct {
 
 extern ngx_event_actions_t   ngx_event_actions;
 
+#if (NGX_HAVE_IO_URING && NGX_HAVE_FILE_AIO)
+ngx_int_t ngx_io_uring_aio_read(ngx_event_t *ev, ngx_fd_t fd, u_char *buf,
+    size_t size, off_t offset);
+#endif
+
 
 /*
  * The event filter requires to read/write the whole data:
@@ -410,6 +415,18 @@ extern ngx_event_actions_t   ngx_event_actions;
  */
 #define NGX_USE_VNODE_EVENT      0x00002000
 
+/*
+ * The event filter is io_uring, it also handles the file AIO.
+ */
+#define NGX_USE_IO_URING_EVENT   0x00004000
+
+/*
+ * The event filter posts all events of a batch: epoll with "epoll_batch".
+ * The read and write events are handled before the new connections
+ * unless the accept mutex is held.
+ */
+#define NGX_USE_BATCH_EVENT      0x00008000
+
 
 /*
  * The event filter is deleted just before the closing file.
@@ -590,6 +607,7 @@ typedef struct {
     事件的available标志位对应着multi_accept配置项。当available为l时，告诉Nginx -次性尽量多地建立新连接，它的实现原理也就在这里
      */ //默认0
     ngx_flag_t    multi_accept; //标志位，如果为1，则表示在接收到一个新连接事件时，一次性建立尽可能多的连接
+    ngx_uint_t    multi_accept_limit; //每轮事件循环最多accept的连接数，0表示不限制，默认0
 
     /*
      如果ccf->worker_processes > 1 && ecf->accept_mutex，则在创建进程后，调用ngx_event_process_init把accept添加到epoll事件驱动中，
@@ -602,6 +620,14 @@ typedef struct {
      */ //默认500ms，也就是0.5s
     ngx_msec_t    accept_mutex_delay; //单位ms  如果没获取到mutex锁，则延迟这么多毫秒重新获取
 
+    ngx_flag_t    timer_wheel;
+
+    /*
+     * 开启后绑定在单个CPU上的worker会对自己的reuseport监听socket设置
+     * SO_INCOMING_CPU，内核优先把在该CPU上收到的连接交给这个socket
+     */
+    ngx_flag_t    cpu_steering;
+
     u_char       *name;//所选用事件模块的名字，它与use成员是匹配的  epoll select
 
 /*
@@ -639,6 +665,9 @@ extern ngx_uint_t             ngx_accept_events;
 extern ngx_uint_t             ngx_accept_mutex_held;
 extern ngx_msec_t             ngx_accept_mutex_delay;
 extern ngx_int_t              ngx_accept_disabled;
+extern ngx_int_t              ngx_accept_cpu;
+extern ngx_uint_t             ngx_accept_limit;
+extern ngx_uint_t             ngx_accept_count;
 
 
 #if (NGX_STAT_STUB)
@@ -651,6 +680,39 @@ extern ngx_atomic_t  *ngx_stat_reading;
 extern ngx_atomic_t  *ngx_stat_writing;
 extern ngx_atomic_t  *ngx_stat_waiting;
 
+
+/*
+ * per worker accept statistics, each worker updates only its own slot,
+ * the slot is padded to a cache line to avoid false sharing
+ */
+
+typedef struct {
+    ngx_atomic_t   wakeups;   /* ngx_event_accept() calls */
+    ngx_atomic_t   accepted;
+    ngx_atomic_t   batch;     /* the most connections accepted per wakeup */
+    ngx_atomic_t   local;     /* connections received on the worker's CPU */
+    ngx_atomic_t   padding[12];
+} ngx_stat_accept_t;
+
+
+/*
+ * per worker histogram of the event loop iteration time spent on handling
+ * events and timers, time[n] counts iterations that took less than
+ * 64 << n microseconds, the last bucket counts the rest
+ */
+
+#define NGX_STAT_LOOP_BUCKETS  16
+
+typedef struct {
+    ngx_atomic_t   time[NGX_STAT_LOOP_BUCKETS];
+    ngx_atomic_t   padding[16];
+} ngx_stat_loop_t;
+
+
+extern ngx_stat_accept_t  *ngx_stat_accepts;
+extern ngx_stat_loop_t    *ngx_stat_loops;
+extern ngx_uint_t          ngx_stat_accepts_n;
+
 #endif
 
 
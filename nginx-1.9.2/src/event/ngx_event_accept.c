@@ -49,6 +49,10 @@ ngx_event_accept(ngx_event_t *ev) //在ngx_process_events_and_timers中执行
 #if (NGX_HAVE_ACCEPT4)
     static ngx_uint_t  use_accept4 = 1;
 #endif
+#if (NGX_STAT_STUB)
+    ngx_uint_t          n;
+    ngx_stat_accept_t  *st;
+#endif
 
     if (ev->timedout) {
         if (ngx_enable_accept_events((ngx_cycle_t *) ngx_cycle) != NGX_OK) {
@@ -68,12 +72,59 @@ ngx_event_accept(ngx_event_t *ev) //在ngx_process_events_and_timers中执行
     ls = lc->listening;
     ev->ready = 0;
 
+#if (NGX_STAT_STUB)
+    st = &ngx_stat_accepts[ngx_worker < ngx_stat_accepts_n ? ngx_worker : 0];
+    st->wakeups++;
+    n = 0;
+#endif
+
     ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
                    "accept on %V, ready: %d", &ls->addr_text, ev->available);
 
     do { /* 如果是一次读取一个accept事件的话，循环体只执行一次， 如果是一次性可以读取所有的accept事件，则这个循环体执行次数为accept事件数*/
+        if (ngx_accept_limit && ngx_accept_count >= ngx_accept_limit
+#if (NGX_HAVE_IO_URING)
+            && !ls->ring_accepted
+#endif
+           )
+        {
+
+            /*
+             * the limit of connections accepted per event loop iteration
+             * is reached, the pending ones are accepted in the next one
+             */
+
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                           "accept limit %ui reached", ngx_accept_limit);
+
+            ngx_post_event(ev, &ngx_posted_next_events);
+            return;
+        }
+
         socklen = NGX_SOCKADDRLEN;
 
+#if (NGX_HAVE_IO_URING)
+        if (ls->ring_accepted) {
+
+            /*
+             * the connection has been already accepted by io_uring,
+             * it is taken even if the accept limit is reached
+             */
+
+            ls->ring_accepted = 0;
+
+            if (ls->ring_res >= 0) {
+                s = ls->ring_res;
+                socklen = ls->ring_socklen;
+                ngx_memcpy(sa, ls->ring_sockaddr, socklen);
+
+            } else {
+                s = (ngx_socket_t) -1;
+                ngx_set_socket_errno(-ls->ring_res);
+            }
+
+        } else
+#endif
 #if (NGX_HAVE_ACCEPT4) //ngx_close_socket可以关闭套接字
         if (use_accept4) {
             s = accept4(lc->fd, (struct sockaddr *) sa, &socklen,
@@ -156,8 +207,32 @@ ngx_event_accept(ngx_event_t *ev) //在ngx_process_events_and_timers中执行
             return;
         }
 
+        ngx_accept_count++;
+
 #if (NGX_STAT_STUB)
         (void) ngx_atomic_fetch_add(ngx_stat_accepted, 1);
+
+        st->accepted++;
+
+        if (++n > st->batch) {
+            st->batch = n;
+        }
+
+#if (NGX_HAVE_INCOMING_CPU)
+        if (ngx_accept_cpu != -1) {
+            int        cpu;
+            socklen_t  len;
+
+            len = sizeof(int);
+
+            if (getsockopt(s, SOL_SOCKET, SO_INCOMING_CPU, (void *) &cpu, &len)
+                == 0
+                && cpu == ngx_accept_cpu)
+            {
+                st->local++;
+            }
+        }
+#endif
 #endif
         //设置负载均衡阀值 最开始free_connection_n=connection_n，见ngx_event_process_init
         ngx_accept_disabled = ngx_cycle->connection_n / 8
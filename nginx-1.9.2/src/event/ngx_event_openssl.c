@@ -8,6 +8,9 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_event.h>
+#if (NGX_THREADS)
+#include <ngx_thread_pool.h>
+#endif
 
 
 #define NGX_SSL_PASSWORD_BUFFER_SIZE  4096
@@ -18,15 +21,54 @@ typedef struct {
 } ngx_openssl_conf_t;
 
 
+#if (NGX_THREADS)
+
+typedef struct {
+    ngx_connection_t     *connection;
+
+    /* set by the thread */
+    int                   n;
+    int                   sslerr;
+    ngx_uint_t            closed;
+    ngx_uint_t            running;
+
+    /* left by a callback in the thread for the event loop */
+    ngx_ssl_deferred_pt   deferred;
+    void                 *deferred_data;
+
+    /* set by the event loop while the task is in the thread */
+    unsigned              read_event:1;
+    unsigned              write_event:1;
+} ngx_ssl_handshake_ctx_t;
+
+#endif
+
+
 static int ngx_ssl_password_callback(char *buf, int size, int rwflag,
     void *userdata);
 static int ngx_ssl_verify_callback(int ok, X509_STORE_CTX *x509_store);
 static void ngx_ssl_info_callback(const ngx_ssl_conn_t *ssl_conn, int where,
     int ret);
 static void ngx_ssl_passwords_cleanup(void *data);
+static ngx_int_t ngx_ssl_handshake_result(ngx_connection_t *c, int n,
+    int sslerr, ngx_uint_t closed);
+static ngx_uint_t ngx_ssl_handshake_error(ngx_connection_t *c, int sslerr);
 static void ngx_ssl_handshake_handler(ngx_event_t *ev);
+#if (NGX_THREADS)
+static ngx_int_t ngx_ssl_handshake_post(ngx_connection_t *c);
+static void ngx_ssl_handshake_thread(void *data, ngx_log_t *log);
+static void ngx_ssl_handshake_thread_handler(ngx_event_t *ev);
+static void ngx_ssl_handshake_busy_handler(ngx_event_t *ev);
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+static void ngx_ssl_locking_callback(int mode, int n, const char *file,
+    int line);
+#endif
+#endif
 static ngx_int_t ngx_ssl_handle_recv(ngx_connection_t *c, int n);
 static void ngx_ssl_write_handler(ngx_event_t *wev);
+static ssize_t ngx_ssl_sendfile(ngx_connection_t *c, ngx_buf_t *file,
+    size_t size);
+static size_t ngx_ssl_record_size(ngx_connection_t *c);
 static void ngx_ssl_read_handler(ngx_event_t *rev);
 static void ngx_ssl_shutdown_handler(ngx_event_t *ev);
 static void ngx_ssl_connection_error(ngx_connection_t *c, int sslerr,
@@ -41,8 +83,10 @@ static int ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn,
 static ngx_ssl_session_t *ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
     u_char *id, int len, int *copy);
 static void ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess);
-static void ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
-    ngx_slab_pool_t *shpool, ngx_uint_t n);
+static ngx_slab_pool_t *ngx_ssl_session_shard_pool(ngx_slab_pool_t *shpool,
+    size_t size);
+static void ngx_ssl_expire_sessions(ngx_ssl_session_shard_t *shard,
+    ngx_uint_t n);
 static void ngx_ssl_session_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 
@@ -104,6 +148,12 @@ int  ngx_ssl_session_ticket_keys_index;
 int  ngx_ssl_certificate_index;
 int  ngx_ssl_stapling_index;
 
+#if (NGX_THREADS)
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+static ngx_thread_mutex_t  *ngx_ssl_locks;
+#endif
+#endif
+
 
 ngx_int_t
 ngx_ssl_init(ngx_log_t *log)
@@ -188,6 +238,63 @@ ngx_ssl_init(ngx_log_t *log)
 }
 
 
+/*
+ * OpenSSL prior to 1.1.0 is thread-safe only with the locking callback
+ * set; it is needed when handshakes are done in a thread pool
+ */
+
+ngx_int_t
+ngx_ssl_threads_init(ngx_log_t *log)
+{
+#if (NGX_THREADS)
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+
+    int  i, n;
+
+    if (ngx_ssl_locks) {
+        return NGX_OK;
+    }
+
+    n = CRYPTO_num_locks();
+
+    ngx_ssl_locks = ngx_alloc(n * sizeof(ngx_thread_mutex_t), log);
+    if (ngx_ssl_locks == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (ngx_thread_mutex_create(&ngx_ssl_locks[i], log) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    CRYPTO_set_locking_callback(ngx_ssl_locking_callback);
+
+#endif
+#endif
+
+    return NGX_OK;
+}
+
+
+#if (NGX_THREADS)
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+
+static void
+ngx_ssl_locking_callback(int mode, int n, const char *file, int line)
+{
+    if (mode & CRYPTO_LOCK) {
+        (void) ngx_thread_mutex_lock(&ngx_ssl_locks[n], ngx_cycle->log);
+
+    } else {
+        (void) ngx_thread_mutex_unlock(&ngx_ssl_locks[n], ngx_cycle->log);
+    }
+}
+
+#endif
+#endif
+
+
 ngx_int_t
 ngx_ssl_create(ngx_ssl_t *ssl, ngx_uint_t protocols, void *data)
 {
@@ -205,6 +312,8 @@ ngx_ssl_create(ngx_ssl_t *ssl, ngx_uint_t protocols, void *data)
     }
 
     ssl->buffer_size = NGX_SSL_BUFSIZE;
+    ssl->dyn_rec_threshold = 0;
+    ssl->dyn_rec_timeout = 0;
 
     /* client side options */
 
@@ -1037,6 +1146,8 @@ ngx_ssl_create_connection(ngx_ssl_t *ssl, ngx_connection_t *c, ngx_uint_t flags)
 
     sc->buffer = ((flags & NGX_SSL_BUFFER) != 0);
     sc->buffer_size = ssl->buffer_size;
+    sc->dyn_rec_threshold = ssl->dyn_rec_threshold;
+    sc->dyn_rec_timeout = ssl->dyn_rec_timeout;
 
     sc->connection = SSL_new(ssl->ctx);
 
@@ -1055,6 +1166,10 @@ ngx_ssl_create_connection(ngx_ssl_t *ssl, ngx_connection_t *c, ngx_uint_t flags)
 
     } else {
         SSL_set_accept_state(sc->connection);
+
+#if (NGX_THREADS)
+        sc->thread_pool = ssl->thread_pool;
+#endif
     }
 
     if (SSL_set_ex_data(sc->connection, ngx_ssl_connection_index, c) == 0) {
@@ -1086,8 +1201,27 @@ ngx_ssl_set_session(ngx_connection_t *c, ngx_ssl_session_t *session)
 ngx_int_t
 ngx_ssl_handshake(ngx_connection_t *c)
 {
-    int        n, sslerr;
-    ngx_err_t  err;
+    int         n, sslerr;
+    ngx_uint_t  closed;
+
+#if (NGX_THREADS)
+
+    if (c->ssl->thread_pool) {
+
+        switch (ngx_ssl_handshake_post(c)) {
+
+        case NGX_OK:
+            return NGX_AGAIN;
+
+        case NGX_ERROR:
+            return NGX_ERROR;
+
+        default: /* NGX_DECLINED */
+            break;
+        }
+    }
+
+#endif
 
     ngx_ssl_clear_error(c->log);
 
@@ -1097,6 +1231,28 @@ ngx_ssl_handshake(ngx_connection_t *c)
     //0x80:SSLv2  0x16:SSLv3/TLSv1 
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_do_handshake: %d", n);
 
+    sslerr = 0;
+    closed = 0;
+
+    if (n != 1) {
+        sslerr = SSL_get_error(c->ssl->connection, n);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "SSL_get_error: %d", sslerr);
+
+        if (sslerr != SSL_ERROR_WANT_READ && sslerr != SSL_ERROR_WANT_WRITE) {
+            closed = ngx_ssl_handshake_error(c, sslerr);
+        }
+    }
+
+    return ngx_ssl_handshake_result(c, n, sslerr, closed);
+}
+
+
+static ngx_int_t
+ngx_ssl_handshake_result(ngx_connection_t *c, int n, int sslerr,
+    ngx_uint_t closed)
+{
     if (n == 1) { //
 
         if (ngx_handle_read_event(c->read, 0, NGX_FUNC_LINE) != NGX_OK) {
@@ -1162,6 +1318,23 @@ ngx_ssl_handshake(ngx_connection_t *c)
         c->recv_chain = ngx_ssl_recv_chain;
         c->send_chain = ngx_ssl_send_chain;
 
+#ifdef BIO_get_ktls_send
+
+        /*
+         * OpenSSL enables kernel TLS during the handshake if it was
+         * requested with SSL_OP_ENABLE_KTLS and the kernel supports
+         * the negotiated cipher, otherwise records are still encrypted
+         * in user space and file buffers are read into memory
+         */
+
+        if (BIO_get_ktls_send(SSL_get_wbio(c->ssl->connection)) == 1) {
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "BIO_get_ktls_send(): 1");
+            c->ssl->sendfile = 1;
+        }
+
+#endif
+
 #ifdef SSL3_FLAGS_NO_RENEGOTIATE_CIPHERS
 
         /* initial handshake done, disable renegotiation (CVE-2009-3555) */
@@ -1174,11 +1347,6 @@ ngx_ssl_handshake(ngx_connection_t *c)
         return NGX_OK;//
     }
 
-    sslerr = SSL_get_error(c->ssl->connection, n);
-    
-    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_get_error: %d", sslerr);
-    //Ӧ½һκNGINXһ,ȴһѭepollٽУͬʱöдԱ´ζȡʱֱӽ
-    //֤Ĵֹ̻ûɣҪ
     if (sslerr == SSL_ERROR_WANT_READ) {  //# define SSL_ERROR_WANT_READ             2
         c->read->ready = 0;
         c->read->handler = ngx_ssl_handshake_handler;
@@ -1211,24 +1379,40 @@ ngx_ssl_handshake(ngx_connection_t *c)
         return NGX_AGAIN; //Ҫ
     }
 
-    err = (sslerr == SSL_ERROR_SYSCALL) ? ngx_errno : 0;
-
     c->ssl->no_wait_shutdown = 1;
     c->ssl->no_send_shutdown = 1;
     c->read->eof = 1;
 
+    if (!closed) {
+        c->read->error = 1;
+    }
+
+    return NGX_ERROR; //ʧ
+}
+
+
+/*
+ * the OpenSSL error queue is per thread, so the error is logged
+ * by the thread which called SSL_do_handshake()
+ */
+
+static ngx_uint_t
+ngx_ssl_handshake_error(ngx_connection_t *c, int sslerr)
+{
+    ngx_err_t  err;
+
+    err = (sslerr == SSL_ERROR_SYSCALL) ? ngx_errno : 0;
+
     if (sslerr == SSL_ERROR_ZERO_RETURN || ERR_peek_error() == 0) {
         ngx_connection_error(c, err,
                              "peer closed connection in SSL handshake");
 
-        return NGX_ERROR;
+        return 1;
     }
 
-    c->read->error = 1;
-
     ngx_ssl_connection_error(c, sslerr, err, "SSL_do_handshake() failed");
 
-    return NGX_ERROR; //ʧ
+    return 0;
 }
 
 
@@ -1256,6 +1440,207 @@ ngx_ssl_handshake_handler(ngx_event_t *ev)
 }
 
 
+#if (NGX_THREADS)
+
+/*
+ * with a thread pool SSL_do_handshake() and the private key operations
+ * in it are done in the pool; the connection events that occur meanwhile
+ * are only noted, and the result is handled when the task completes.
+ *
+ * The callbacks called by OpenSSL during the handshake run in the pool too:
+ * the session cache new, get and remove callbacks, the session ticket key
+ * callback, the info and verify callbacks, and the servername, ALPN, NPN
+ * and certificate status callbacks.  They may only use the connection,
+ * the configuration, and shared memory under its lock; slab magazines are
+ * not used in threads.  Work with events, timers or other connections is
+ * passed to the event loop with ngx_ssl_handshake_defer().
+ */
+
+static ngx_int_t
+ngx_ssl_handshake_post(ngx_connection_t *c)
+{
+    ngx_thread_task_t        *task;
+    ngx_ssl_handshake_ctx_t  *ctx;
+
+    task = c->ssl->handshake_task;
+
+    if (task == NULL) {
+        task = ngx_thread_task_alloc(c->pool, sizeof(ngx_ssl_handshake_ctx_t));
+        if (task == NULL) {
+            return NGX_ERROR;
+        }
+
+        ctx = task->ctx;
+        ctx->connection = c;
+
+        task->handler = ngx_ssl_handshake_thread;
+        task->event.data = c;
+        task->event.handler = ngx_ssl_handshake_thread_handler;
+        task->event.log = c->log;
+
+        c->ssl->handshake_task = task;
+    }
+
+    ctx = task->ctx;
+
+    ctx->n = 0;
+    ctx->sslerr = 0;
+    ctx->closed = 0;
+    ctx->deferred = NULL;
+    ctx->read_event = 0;
+    ctx->write_event = 0;
+
+    if (ngx_thread_task_post(c->ssl->thread_pool, task) != NGX_OK) {
+
+        /* the queue is full, the handshake is done in place */
+
+        return NGX_DECLINED;
+    }
+
+    c->read->handler = ngx_ssl_handshake_busy_handler;
+    c->write->handler = ngx_ssl_handshake_busy_handler;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_ssl_handshake_thread(void *data, ngx_log_t *log)
+{
+    ngx_ssl_handshake_ctx_t  *ctx = data;
+
+    ngx_connection_t  *c;
+
+    c = ctx->connection;
+
+    ngx_ssl_clear_error(c->log);
+
+    ctx->running = 1;
+
+    ctx->n = SSL_do_handshake(c->ssl->connection);
+
+    ctx->running = 0;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL_do_handshake in thread: %d", ctx->n);
+
+    if (ctx->n == 1) {
+        return;
+    }
+
+    ctx->sslerr = SSL_get_error(c->ssl->connection, ctx->n);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL_get_error: %d", ctx->sslerr);
+
+    if (ctx->sslerr != SSL_ERROR_WANT_READ
+        && ctx->sslerr != SSL_ERROR_WANT_WRITE)
+    {
+        ctx->closed = ngx_ssl_handshake_error(c, ctx->sslerr);
+    }
+}
+
+
+static void
+ngx_ssl_handshake_thread_handler(ngx_event_t *ev)
+{
+    ngx_int_t                 rc;
+    ngx_connection_t         *c;
+    ngx_ssl_handshake_ctx_t  *ctx;
+
+    c = ev->data;
+    ctx = c->ssl->handshake_task->ctx;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL handshake thread handler: %d %d", ctx->n, ctx->sslerr);
+
+    c->read->handler = ngx_ssl_handshake_handler;
+    c->write->handler = ngx_ssl_handshake_handler;
+
+    if (ctx->deferred) {
+        ctx->deferred(ctx->deferred_data);
+        ctx->deferred = NULL;
+    }
+
+    if (c->read->timedout || c->write->timedout) {
+        c->ssl->handler(c);
+        return;
+    }
+
+    if ((ctx->sslerr == SSL_ERROR_WANT_READ && ctx->read_event)
+        || (ctx->sslerr == SSL_ERROR_WANT_WRITE && ctx->write_event))
+    {
+        /* the event might have been reported after the thread got EAGAIN */
+
+        rc = ngx_ssl_handshake(c);
+
+    } else {
+        rc = ngx_ssl_handshake_result(c, ctx->n, ctx->sslerr, ctx->closed);
+    }
+
+    if (rc == NGX_AGAIN) {
+        return;
+    }
+
+    c->ssl->handler(c);
+}
+
+
+ngx_int_t
+ngx_ssl_handshake_defer(ngx_connection_t *c, ngx_ssl_deferred_pt handler,
+    void *data)
+{
+    ngx_ssl_handshake_ctx_t  *ctx;
+
+    if (c->ssl->handshake_task == NULL) {
+        return NGX_DECLINED;
+    }
+
+    ctx = c->ssl->handshake_task->ctx;
+
+    if (!ctx->running) {
+        /* the callback is called in the event loop */
+        return NGX_DECLINED;
+    }
+
+    ctx->deferred = handler;
+    ctx->deferred_data = data;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_ssl_handshake_busy_handler(ngx_event_t *ev)
+{
+    ngx_connection_t         *c;
+    ngx_ssl_handshake_ctx_t  *ctx;
+
+    c = ev->data;
+    ctx = c->ssl->handshake_task->ctx;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL handshake busy handler: %d", ev->write);
+
+    if (ev->write) {
+        ctx->write_event = 1;
+
+    } else {
+        ctx->read_event = 1;
+    }
+
+    if (ev->active && !(ngx_event_flags & NGX_USE_CLEAR_EVENT)) {
+
+        /* a level-triggered event would be reported again and again */
+
+        (void) ngx_del_event(ev, ev->write ? NGX_WRITE_EVENT : NGX_READ_EVENT,
+                             0);
+    }
+}
+
+#endif
+
+
 ssize_t
 ngx_ssl_recv_chain(ngx_connection_t *c, ngx_chain_t *cl, off_t limit)
 {
@@ -1523,6 +1908,23 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
                 continue;
             }
 
+            if (in->buf->in_file && c->ssl->sendfile) {
+                n = ngx_ssl_sendfile(c, in->buf,
+                                     in->buf->file_last - in->buf->file_pos);
+
+                if (n == NGX_ERROR) {
+                    return NGX_CHAIN_ERROR;
+                }
+
+                if (n == NGX_AGAIN) {
+                    return in;
+                }
+
+                in = ngx_chain_update_sent(in, n);
+
+                continue;
+            }
+
             n = ngx_ssl_write(c, in->buf->pos, in->buf->last - in->buf->pos);
 
             if (n == NGX_ERROR) {
@@ -1577,6 +1979,18 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 
     for ( ;; ) {
 
+        /*
+         * the buffer is written by one SSL_write() call, so its size
+         * is the record size; the data already buffered is never cut
+         * as SSL_write() must be retried with the same data
+         */
+
+        buf->end = buf->start + ngx_ssl_record_size(c);
+
+        if (buf->end < buf->last) {
+            buf->end = buf->last;
+        }
+
         while (in && buf->last < buf->end && send < limit) {
             if (in->buf->last_buf || in->buf->flush) {
                 flush = 1;
@@ -1587,6 +2001,14 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
                 continue;
             }
 
+            if (in->buf->in_file && c->ssl->sendfile) {
+
+                /* flush the buffered data before the file is sent */
+
+                flush = 1;
+                break;
+            }
+
             size = in->buf->last - in->buf->pos;
 
             if (size > buf->end - buf->last) {
@@ -1618,6 +2040,26 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
         size = buf->last - buf->pos;
 
         if (size == 0) {
+
+            if (in && in->buf->in_file && c->ssl->sendfile && send < limit) {
+
+                n = ngx_ssl_sendfile(c, in->buf, (size_t) (limit - send));
+
+                if (n == NGX_ERROR) {
+                    return NGX_CHAIN_ERROR;
+                }
+
+                if (n == NGX_AGAIN) {
+                    break;
+                }
+
+                in = ngx_chain_update_sent(in, n);
+                send += n;
+                flush = 0;
+
+                continue;
+            }
+
             buf->flush = 0;
             c->buffered &= ~NGX_SSL_BUFFERED;
             return in;
@@ -1693,6 +2135,12 @@ ngx_ssl_write(ngx_connection_t *c, u_char *data, size_t size)
 
         c->sent += n;
 
+        if (c->ssl->dyn_rec_sent < c->ssl->dyn_rec_threshold) {
+            c->ssl->dyn_rec_sent += n;
+        }
+
+        c->ssl->dyn_rec_last = ngx_current_msec;
+
         return n;
     }
 
@@ -1741,6 +2189,152 @@ ngx_ssl_write(ngx_connection_t *c, u_char *data, size_t size)
 }
 
 
+/*
+ * Dynamic record sizing: a new connection, or one which has been idle
+ * for dyn_rec_timeout, sends records which fit in one TCP segment, so
+ * the client can decrypt the first bytes without waiting for the rest
+ * of a 16k record; after dyn_rec_threshold bytes are sent the records
+ * grow to the buffer size for throughput.
+ */
+
+static size_t
+ngx_ssl_record_size(ngx_connection_t *c)
+{
+    ngx_ssl_connection_t  *sc;
+
+    sc = c->ssl;
+
+    if (sc->dyn_rec_threshold == 0 || sc->buffer_size <= NGX_SSL_DYN_REC_SIZE)
+    {
+        return sc->buffer_size;
+    }
+
+    if (ngx_current_msec - sc->dyn_rec_last > sc->dyn_rec_timeout) {
+        sc->dyn_rec_sent = 0;
+    }
+
+    if (sc->dyn_rec_sent < sc->dyn_rec_threshold) {
+        return NGX_SSL_DYN_REC_SIZE;
+    }
+
+    return sc->buffer_size;
+}
+
+
+/*
+ * with kernel TLS the file is encrypted by the kernel while it is sent,
+ * so file buffers are passed to SSL_sendfile() instead of being read
+ * into memory
+ */
+
+static ssize_t
+ngx_ssl_sendfile(ngx_connection_t *c, ngx_buf_t *file, size_t size)
+{
+#ifdef BIO_get_ktls_send
+
+    int        sslerr;
+    ssize_t    n;
+    ngx_err_t  err;
+
+    if (size > (size_t) (file->file_last - file->file_pos)) {
+        size = (size_t) (file->file_last - file->file_pos);
+    }
+
+    ngx_ssl_clear_error(c->log);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL to sendfile: @%O %uz", file->file_pos, size);
+
+    ngx_set_errno(0);
+
+    n = SSL_sendfile(c->ssl->connection, file->file->fd, file->file_pos,
+                     size, 0);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_sendfile: %z", n);
+
+    if (n > 0) {
+
+        if (c->ssl->saved_read_handler) {
+
+            c->read->handler = c->ssl->saved_read_handler;
+            c->ssl->saved_read_handler = NULL;
+            c->read->ready = 1;
+
+            if (ngx_handle_read_event(c->read, 0, NGX_FUNC_LINE) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            ngx_post_event(c->read, &ngx_posted_events);
+        }
+
+        c->sent += n;
+
+        return n;
+    }
+
+    if (n == 0) {
+
+        /* the file was truncated */
+
+        ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                      "SSL_sendfile() reported that \"%s\" was truncated at %O",
+                      file->file->name.data, file->file_pos);
+
+        return NGX_ERROR;
+    }
+
+    sslerr = SSL_get_error(c->ssl->connection, n);
+
+    err = (sslerr == SSL_ERROR_SYSCALL) ? ngx_errno : 0;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_get_error: %d", sslerr);
+
+    if (sslerr == SSL_ERROR_WANT_WRITE) {
+        c->write->ready = 0;
+        return NGX_AGAIN;
+    }
+
+    if (sslerr == SSL_ERROR_WANT_READ) {
+
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "peer started SSL renegotiation");
+
+        c->read->ready = 0;
+
+        if (ngx_handle_read_event(c->read, 0, NGX_FUNC_LINE) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        /*
+         * we do not set the timer because there is already
+         * the write event timer
+         */
+
+        if (c->ssl->saved_read_handler == NULL) {
+            c->ssl->saved_read_handler = c->read->handler;
+            c->read->handler = ngx_ssl_read_handler;
+        }
+
+        return NGX_AGAIN;
+    }
+
+    c->ssl->no_wait_shutdown = 1;
+    c->ssl->no_send_shutdown = 1;
+    c->write->error = 1;
+
+    ngx_ssl_connection_error(c, sslerr, err, "SSL_sendfile() failed");
+
+#else
+
+    ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                  "SSL_sendfile() is not available");
+
+#endif
+
+    return NGX_ERROR;
+}
+
+
 static void
 ngx_ssl_read_handler(ngx_event_t *rev)
 {
@@ -2219,8 +2813,10 @@ failed:
 ngx_int_t
 ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 {
-    size_t                    len;
-    ngx_slab_pool_t          *shpool;
+    size_t                    len, size;
+    ngx_uint_t                i, n;
+    ngx_slab_pool_t          *shpool, *sp;
+    ngx_ssl_session_shard_t  *shard;
     ngx_ssl_session_cache_t  *cache;
 
     if (data) {
@@ -2235,7 +2831,7 @@ ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
         return NGX_OK;
     }
 
-    cache = ngx_slab_alloc(shpool, sizeof(ngx_ssl_session_cache_t));
+    cache = ngx_slab_calloc(shpool, sizeof(ngx_ssl_session_cache_t));
     if (cache == NULL) {
         return NGX_ERROR;
     }
@@ -2243,11 +2839,6 @@ ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
     shpool->data = cache;
     shm_zone->data = cache;
 
-    ngx_rbtree_init(&cache->session_rbtree, &cache->sentinel,
-                    ngx_ssl_session_rbtree_insert_value);
-
-    ngx_queue_init(&cache->expire_queue);
-
     len = sizeof(" in SSL session shared cache \"\"") + shm_zone->shm.name.len;
 
     shpool->log_ctx = ngx_slab_alloc(shpool, len);
@@ -2260,6 +2851,104 @@ ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 
     shpool->log_nomem = 0;
 
+    /*
+     * the rest of the zone is split into shards, each shard is a slab pool
+     * of its own with its own mutex, so sessions with different hashes
+     * are stored and looked up in parallel; without atomic operations
+     * the shard mutexes would need lock files, so there is one shard
+     */
+
+#if (NGX_HAVE_ATOMIC_OPS)
+    n = NGX_SSL_SESSION_CACHE_SHARDS;
+
+    while (n > 1 && shpool->pfree / n < NGX_SSL_SESSION_SHARD_PAGES) {
+        n /= 2;
+    }
+#else
+    n = 1;
+#endif
+
+    cache->nshards = n;
+
+    size = shpool->pfree / n * ngx_pagesize;
+
+    for (i = 0; i < n; i++) {
+        shard = &cache->shards[i];
+
+        if (n == 1) {
+            sp = shpool;
+
+        } else {
+            sp = ngx_ssl_session_shard_pool(shpool, size);
+            if (sp == NULL) {
+                return NGX_ERROR;
+            }
+
+            sp->data = shard;
+        }
+
+        shard->shpool = sp;
+
+        ngx_rbtree_init(&shard->session_rbtree, &shard->sentinel,
+                        ngx_ssl_session_rbtree_insert_value);
+
+        ngx_queue_init(&shard->expire_queue);
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, shm_zone->shm.log, 0,
+                   "ssl session cache \"%V\": %ui shards of %uz",
+                   &shm_zone->shm.name, n, size);
+
+    return NGX_OK;
+}
+
+
+static ngx_slab_pool_t *
+ngx_ssl_session_shard_pool(ngx_slab_pool_t *shpool, size_t size)
+{
+    u_char           *p;
+    ngx_slab_pool_t  *sp;
+
+    /* an allocation of whole pages is page aligned */
+
+    p = ngx_slab_alloc(shpool, size);
+    if (p == NULL) {
+        return NULL;
+    }
+
+    sp = (ngx_slab_pool_t *) p;
+
+    sp->end = p + size;
+    sp->min_shift = 3;
+    sp->addr = p;
+
+    if (ngx_shmtx_create(&sp->mutex, &sp->lock, NULL) != NGX_OK) {
+        return NULL;
+    }
+
+    ngx_slab_init(sp);
+
+    sp->log_ctx = shpool->log_ctx;
+    sp->log_nomem = 0;
+
+    return sp;
+}
+
+
+ngx_int_t
+ngx_ssl_session_cache_get_stat(ngx_shm_zone_t *shm_zone, ngx_uint_t n,
+    ngx_ssl_session_cache_stat_t *stat)
+{
+    ngx_ssl_session_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (n >= cache->nshards) {
+        return NGX_DECLINED;
+    }
+
+    *stat = cache->shards[n].stat;
+
     return NGX_OK;
 }
 
@@ -2278,7 +2967,7 @@ ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
  * and an ASN1 representation, they take accordingly 128 and 128 bytes.
  *
  * OpenSSL's i2d_SSL_SESSION() and d2i_SSL_SESSION are slow,
- * so they are outside the code locked by shared pool mutex
+ * so they are outside the code locked by shard mutex
  */
 
 static int
@@ -2293,6 +2982,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
     ngx_connection_t         *c;
     ngx_slab_pool_t          *shpool;
     ngx_ssl_sess_id_t        *sess_id;
+    ngx_ssl_session_shard_t  *shard;
     ngx_ssl_session_cache_t  *cache;
     u_char                    buf[NGX_SSL_MAX_SESSION_SIZE];
 
@@ -2312,13 +3002,27 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
     ssl_ctx = SSL_get_SSL_CTX(ssl_conn);
     shm_zone = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_cache_index);
 
+#if OPENSSL_VERSION_NUMBER >= 0x0090800fL
+
+    session_id = (u_char *) SSL_SESSION_get_id(sess, &session_id_length);
+
+#else
+
+    session_id = sess->session_id;
+    session_id_length = sess->session_id_length;
+
+#endif
+
+    hash = ngx_crc32_short(session_id, session_id_length);
+
     cache = shm_zone->data;
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    shard = &cache->shards[hash % cache->nshards];
+    shpool = shard->shpool;
 
     ngx_shmtx_lock(&shpool->mutex);
 
     /* drop one or two expired sessions */
-    ngx_ssl_expire_sessions(cache, shpool, 1);
+    ngx_ssl_expire_sessions(shard, 1);
 
     cached_sess = ngx_slab_alloc_locked(shpool, len);
 
@@ -2326,7 +3030,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
         /* drop the oldest non-expired session and try once more */
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+        ngx_ssl_expire_sessions(shard, 0);
 
         cached_sess = ngx_slab_alloc_locked(shpool, len);
 
@@ -2342,7 +3046,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
         /* drop the oldest non-expired session and try once more */
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+        ngx_ssl_expire_sessions(shard, 0);
 
         sess_id = ngx_slab_alloc_locked(shpool, sizeof(ngx_ssl_sess_id_t));
 
@@ -2351,17 +3055,6 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
         }
     }
 
-#if OPENSSL_VERSION_NUMBER >= 0x0090800fL
-
-    session_id = (u_char *) SSL_SESSION_get_id(sess, &session_id_length);
-
-#else
-
-    session_id = sess->session_id;
-    session_id_length = sess->session_id_length;
-
-#endif
-
 #if (NGX_PTR_SIZE == 8)
 
     id = sess_id->sess_id;
@@ -2374,7 +3067,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
         /* drop the oldest non-expired session and try once more */
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+        ngx_ssl_expire_sessions(shard, 0);
 
         id = ngx_slab_alloc_locked(shpool, session_id_length);
 
@@ -2389,11 +3082,9 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
     ngx_memcpy(id, session_id, session_id_length);
 
-    hash = ngx_crc32_short(session_id, session_id_length);
-
-    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                   "ssl new session: %08XD:%ud:%d",
-                   hash, session_id_length, len);
+    ngx_log_debug4(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "ssl new session: %08XD:%ud:%d shard:%ui",
+                   hash, session_id_length, len, shard - cache->shards);
 
     sess_id->node.key = hash;
     sess_id->node.data = (u_char) session_id_length;
@@ -2403,9 +3094,9 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
     sess_id->expire = ngx_time() + SSL_CTX_get_timeout(ssl_ctx);
 
-    ngx_queue_insert_head(&cache->expire_queue, &sess_id->queue);
+    ngx_queue_insert_head(&shard->expire_queue, &sess_id->queue);
 
-    ngx_rbtree_insert(&cache->session_rbtree, &sess_id->node);
+    ngx_rbtree_insert(&shard->session_rbtree, &sess_id->node);
 
     ngx_shmtx_unlock(&shpool->mutex);
 
@@ -2445,6 +3136,7 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn, u_char *id, int len,
     ngx_rbtree_node_t        *node, *sentinel;
     ngx_ssl_session_t        *sess;
     ngx_ssl_sess_id_t        *sess_id;
+    ngx_ssl_session_shard_t  *shard;
     ngx_ssl_session_cache_t  *cache;
     u_char                    buf[NGX_SSL_MAX_SESSION_SIZE];
 #if (NGX_DEBUG)
@@ -2465,15 +3157,16 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn, u_char *id, int len,
                                    ngx_ssl_session_cache_index);
 
     cache = shm_zone->data;
+    shard = &cache->shards[hash % cache->nshards];
 
     sess = NULL;
 
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    shpool = shard->shpool;
 
     ngx_shmtx_lock(&shpool->mutex);
 
-    node = cache->session_rbtree.root;
-    sentinel = cache->session_rbtree.sentinel;
+    node = shard->session_rbtree.root;
+    sentinel = shard->session_rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -2498,6 +3191,8 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn, u_char *id, int len,
             if (sess_id->expire > ngx_time()) {
                 ngx_memcpy(buf, sess_id->session, sess_id->len);
 
+                shard->stat.hits++;
+
                 ngx_shmtx_unlock(&shpool->mutex);
 
                 p = buf;
@@ -2508,7 +3203,7 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn, u_char *id, int len,
 
             ngx_queue_remove(&sess_id->queue);
 
-            ngx_rbtree_delete(&cache->session_rbtree, node);
+            ngx_rbtree_delete(&shard->session_rbtree, node);
 
             ngx_slab_free_locked(shpool, sess_id->session);
 #if (NGX_PTR_SIZE == 4)
@@ -2526,6 +3221,8 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn, u_char *id, int len,
 
 done:
 
+    shard->stat.misses++;
+
     ngx_shmtx_unlock(&shpool->mutex);
 
     return sess;
@@ -2552,6 +3249,7 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
     ngx_slab_pool_t          *shpool;
     ngx_rbtree_node_t        *node, *sentinel;
     ngx_ssl_sess_id_t        *sess_id;
+    ngx_ssl_session_shard_t  *shard;
     ngx_ssl_session_cache_t  *cache;
 
     shm_zone = SSL_CTX_get_ex_data(ssl, ngx_ssl_session_cache_index);
@@ -2578,12 +3276,13 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
     ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
                    "ssl remove session: %08XD:%ud", hash, len);
 
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    shard = &cache->shards[hash % cache->nshards];
+    shpool = shard->shpool;
 
     ngx_shmtx_lock(&shpool->mutex);
 
-    node = cache->session_rbtree.root;
-    sentinel = cache->session_rbtree.sentinel;
+    node = shard->session_rbtree.root;
+    sentinel = shard->session_rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -2607,7 +3306,7 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
 
             ngx_queue_remove(&sess_id->queue);
 
-            ngx_rbtree_delete(&cache->session_rbtree, node);
+            ngx_rbtree_delete(&shard->session_rbtree, node);
 
             ngx_slab_free_locked(shpool, sess_id->session);
 #if (NGX_PTR_SIZE == 4)
@@ -2628,8 +3327,7 @@ done:
 
 
 static void
-ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
-    ngx_slab_pool_t *shpool, ngx_uint_t n)
+ngx_ssl_expire_sessions(ngx_ssl_session_shard_t *shard, ngx_uint_t n)
 {
     time_t              now;
     ngx_queue_t        *q;
@@ -2639,11 +3337,11 @@ ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
 
     while (n < 3) {
 
-        if (ngx_queue_empty(&cache->expire_queue)) {
+        if (ngx_queue_empty(&shard->expire_queue)) {
             return;
         }
 
-        q = ngx_queue_last(&cache->expire_queue);
+        q = ngx_queue_last(&shard->expire_queue);
 
         sess_id = ngx_queue_data(q, ngx_ssl_sess_id_t, queue);
 
@@ -2651,18 +3349,22 @@ ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
             return;
         }
 
+        if (sess_id->expire > now) {
+            shard->stat.evictions++;
+        }
+
         ngx_queue_remove(q);
 
         ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
                        "expire session: %08Xi", sess_id->node.key);
 
-        ngx_rbtree_delete(&cache->session_rbtree, &sess_id->node);
+        ngx_rbtree_delete(&shard->session_rbtree, &sess_id->node);
 
-        ngx_slab_free_locked(shpool, sess_id->session);
+        ngx_slab_free_locked(shard->shpool, sess_id->session);
 #if (NGX_PTR_SIZE == 4)
-        ngx_slab_free_locked(shpool, sess_id->id);
+        ngx_slab_free_locked(shard->shpool, sess_id->id);
 #endif
-        ngx_slab_free_locked(shpool, sess_id);
+        ngx_slab_free_locked(shard->shpool, sess_id);
     }
 }
 
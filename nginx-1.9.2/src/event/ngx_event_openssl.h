@@ -36,10 +36,20 @@
 #define ngx_ssl_session_t       SSL_SESSION
 #define ngx_ssl_conn_t          SSL
 
+
+#if (NGX_THREADS)
+typedef void (*ngx_ssl_deferred_pt)(void *data);
+#endif
+
 //ngx_http_ssl_srv_conf_t->sslԱڸýṹ
 typedef struct {
     SSL_CTX                    *ctx;
     ngx_log_t                  *log;
+#if (NGX_THREADS)
+    ngx_thread_pool_t          *thread_pool;
+#endif
+    size_t                      dyn_rec_threshold;
+    ngx_msec_t                  dyn_rec_timeout;
     size_t                      buffer_size; /* ĬNGX_SSL_BUFSIZE, ֵngx_ssl_create */
 } ngx_ssl_t;
 
@@ -51,6 +61,12 @@ typedef struct {
     ngx_buf_t                  *buf;
     size_t                      buffer_size;
 
+    /* dynamic record sizing, see ngx_ssl_record_size() */
+    size_t                      dyn_rec_threshold;
+    ngx_msec_t                  dyn_rec_timeout;
+    size_t                      dyn_rec_sent;
+    ngx_msec_t                  dyn_rec_last;
+
     /* ngx_ssl_handshakeΪɵʱngx_http_ssl_handshakeֵΪngx_http_ssl_handshake_handler
        Ǻͺ˽sslִΪngx_http_upstream_ssl_handshake
        ssl֣Ϊngx_http_close_connection
@@ -60,12 +76,18 @@ typedef struct {
     ngx_event_handler_pt        saved_read_handler;
     ngx_event_handler_pt        saved_write_handler;
 
+#if (NGX_THREADS)
+    ngx_thread_pool_t          *thread_pool;
+    ngx_thread_task_t          *handshake_task;
+#endif
+
     unsigned                    handshaked:1;
     unsigned                    renegotiation:1;
     unsigned                    buffer:1;
     unsigned                    no_wait_shutdown:1;
     unsigned                    no_send_shutdown:1;
     unsigned                    handshake_buffer_set:1;
+    unsigned                    sendfile:1;
 } ngx_ssl_connection_t;
 
 
@@ -93,10 +115,30 @@ struct ngx_ssl_sess_id_s {
 };
 
 
+/* the most shards of a zone and the least pages in a shard */
+#define NGX_SSL_SESSION_CACHE_SHARDS  16
+#define NGX_SSL_SESSION_SHARD_PAGES   8
+
+
 typedef struct {
+    ngx_atomic_t                hits;
+    ngx_atomic_t                misses;
+    ngx_atomic_t                evictions;  /* not expired sessions dropped */
+} ngx_ssl_session_cache_stat_t;
+
+
+typedef struct {
+    ngx_slab_pool_t            *shpool;
     ngx_rbtree_t                session_rbtree;
     ngx_rbtree_node_t           sentinel;
     ngx_queue_t                 expire_queue;
+    ngx_ssl_session_cache_stat_t  stat;
+} ngx_ssl_session_shard_t;
+
+
+typedef struct {
+    ngx_uint_t                  nshards;
+    ngx_ssl_session_shard_t     shards[NGX_SSL_SESSION_CACHE_SHARDS];
 } ngx_ssl_session_cache_t;
 
 
@@ -123,8 +165,12 @@ typedef struct {
 
 #define NGX_SSL_BUFSIZE  16384
 
+/* a record with the TLS overhead fits in a 1400 bytes TCP segment */
+#define NGX_SSL_DYN_REC_SIZE  1369
+
 
 ngx_int_t ngx_ssl_init(ngx_log_t *log);
+ngx_int_t ngx_ssl_threads_init(ngx_log_t *log);
 ngx_int_t ngx_ssl_create(ngx_ssl_t *ssl, ngx_uint_t protocols, void *data);
 ngx_int_t ngx_ssl_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_str_t *cert, ngx_str_t *key, ngx_array_t *passwords);
@@ -147,6 +193,8 @@ ngx_int_t ngx_ssl_session_cache(ngx_ssl_t *ssl, ngx_str_t *sess_ctx,
 ngx_int_t ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_array_t *paths);
 ngx_int_t ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data);
+ngx_int_t ngx_ssl_session_cache_get_stat(ngx_shm_zone_t *shm_zone,
+    ngx_uint_t n, ngx_ssl_session_cache_stat_t *stat);
 ngx_int_t ngx_ssl_create_connection(ngx_ssl_t *ssl, ngx_connection_t *c,
     ngx_uint_t flags);
 
@@ -196,6 +244,10 @@ ngx_int_t ngx_ssl_get_client_verify(ngx_connection_t *c, ngx_pool_t *pool,
 
 
 ngx_int_t ngx_ssl_handshake(ngx_connection_t *c);
+#if (NGX_THREADS)
+ngx_int_t ngx_ssl_handshake_defer(ngx_connection_t *c,
+    ngx_ssl_deferred_pt handler, void *data);
+#endif
 ssize_t ngx_ssl_recv(ngx_connection_t *c, u_char *buf, size_t size);
 ssize_t ngx_ssl_write(ngx_connection_t *c, u_char *data, size_t size);
 ssize_t ngx_ssl_recv_chain(ngx_connection_t *c, ngx_chain_t *cl, off_t limit);
@@ -36,6 +36,11 @@ typedef struct {
 
     unsigned                     verify:1;
     unsigned                     loading:1;
+
+#if (NGX_THREADS)
+    /* the response is copied in the handshake thread pool */
+    ngx_thread_mutex_t           mutex;
+#endif
 } ngx_ssl_stapling_t;
 
 
@@ -92,6 +97,9 @@ static ngx_int_t ngx_ssl_stapling_responder(ngx_conf_t *cf, ngx_ssl_t *ssl,
 static int ngx_ssl_certificate_status_callback(ngx_ssl_conn_t *ssl_conn,
     void *data);
 static void ngx_ssl_stapling_update(ngx_ssl_stapling_t *staple);
+#if (NGX_THREADS)
+static void ngx_ssl_stapling_update_handler(void *data);
+#endif
 static void ngx_ssl_stapling_ocsp_handler(ngx_ssl_ocsp_ctx_t *ctx);
 
 static time_t ngx_ssl_stapling_time(ASN1_GENERALIZEDTIME *asn1time);
@@ -130,6 +138,12 @@ ngx_ssl_stapling(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *file,
         return NGX_ERROR;
     }
 
+#if (NGX_THREADS)
+    if (ngx_thread_mutex_create(&staple->mutex, cf->log) != NGX_OK) {
+        return NGX_ERROR;
+    }
+#endif
+
     cln = ngx_pool_cleanup_add(cf->pool, 0);
     if (cln == NULL) {
         return NGX_ERROR;
@@ -465,30 +479,56 @@ ngx_ssl_certificate_status_callback(ngx_ssl_conn_t *ssl_conn, void *data)
     staple = data;
     rc = SSL_TLSEXT_ERR_NOACK;
 
+#if (NGX_THREADS)
+    (void) ngx_thread_mutex_lock(&staple->mutex, c->log);
+#endif
+
     if (staple->staple.len
         && staple->valid >= ngx_time())
     {
         /* we have to copy ocsp response as OpenSSL will free it by itself */
 
         p = OPENSSL_malloc(staple->staple.len);
+
         if (p == NULL) {
             ngx_ssl_error(NGX_LOG_ALERT, c->log, 0, "OPENSSL_malloc() failed");
-            return SSL_TLSEXT_ERR_NOACK;
-        }
 
-        ngx_memcpy(p, staple->staple.data, staple->staple.len);
+        } else {
+            ngx_memcpy(p, staple->staple.data, staple->staple.len);
 
-        SSL_set_tlsext_status_ocsp_resp(ssl_conn, p, staple->staple.len);
+            SSL_set_tlsext_status_ocsp_resp(ssl_conn, p, staple->staple.len);
 
-        rc = SSL_TLSEXT_ERR_OK;
+            rc = SSL_TLSEXT_ERR_OK;
+        }
     }
 
+#if (NGX_THREADS)
+    (void) ngx_thread_mutex_unlock(&staple->mutex, c->log);
+
+    if (ngx_ssl_handshake_defer(c, ngx_ssl_stapling_update_handler, staple)
+        == NGX_OK)
+    {
+        return rc;
+    }
+#endif
+
     ngx_ssl_stapling_update(staple);
 
     return rc;
 }
 
 
+#if (NGX_THREADS)
+
+static void
+ngx_ssl_stapling_update_handler(void *data)
+{
+    ngx_ssl_stapling_update(data);
+}
+
+#endif
+
+
 static void
 ngx_ssl_stapling_update(ngx_ssl_stapling_t *staple)
 {
@@ -538,7 +578,7 @@ ngx_ssl_stapling_ocsp_handler(ngx_ssl_ocsp_ctx_t *ctx)
     int                    n;
     size_t                 len;
     time_t                 now, valid;
-    ngx_str_t              response;
+    ngx_str_t              response, old;
     X509_STORE            *store;
     STACK_OF(X509)        *chain;
     OCSP_CERTID           *id;
@@ -666,13 +706,23 @@ ngx_ssl_stapling_ocsp_handler(ngx_ssl_ocsp_ctx_t *ctx)
                    "ssl ocsp response, %s, %uz",
                    OCSP_cert_status_str(n), response.len);
 
-    if (staple->staple.data) {
-        ngx_free(staple->staple.data);
-    }
+#if (NGX_THREADS)
+    (void) ngx_thread_mutex_lock(&staple->mutex, ctx->log);
+#endif
+
+    old = staple->staple;
 
     staple->staple = response;
     staple->valid = valid;
 
+#if (NGX_THREADS)
+    (void) ngx_thread_mutex_unlock(&staple->mutex, ctx->log);
+#endif
+
+    if (old.data) {
+        ngx_free(old.data);
+    }
+
     /*
      * refresh before the response expires,
      * but not earlier than in 5 minutes, and at least in an hour
@@ -751,6 +801,10 @@ ngx_ssl_stapling_cleanup(void *data)
     if (staple->staple.data) {
         ngx_free(staple->staple.data);
     }
+
+#if (NGX_THREADS)
+    (void) ngx_thread_mutex_destroy(&staple->mutex, ngx_cycle->log);
+#endif
 }
 
 
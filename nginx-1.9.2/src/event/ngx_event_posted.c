@@ -19,6 +19,7 @@
 */
 ngx_queue_t  ngx_posted_accept_events; //延后处理的新建连接accept事件
 ngx_queue_t  ngx_posted_events; //普通延后连接建立成功后的读写事件
+ngx_queue_t  ngx_posted_next_events; //超出multi_accept_limit而推迟到下一轮事件循环处理的accept事件
 
 /*
 post事件队列的操作方法
@@ -47,6 +48,53 @@ post事件队列的操作方法
 ┗━━━━━━━━━━━━━━━━━━━━━━━━━┻━━━━━━━━━━━━━━━┻━━━━━━━━━━━━━━━━━━┛
 */
 //从posted队列中却出所有ev并执行各个事件的handler
+void
+ngx_event_move_posted_next(ngx_cycle_t *cycle)
+{
+    ngx_queue_t  *q;
+    ngx_event_t  *ev;
+
+    for (q = ngx_queue_head(&ngx_posted_next_events);
+         q != ngx_queue_sentinel(&ngx_posted_next_events);
+         q = ngx_queue_next(q))
+    {
+        ev = ngx_queue_data(q, ngx_event_t, queue);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                      "posted next event %p", ev);
+
+        ev->ready = 1;
+    }
+
+    ngx_queue_add(&ngx_posted_accept_events, &ngx_posted_next_events);
+    ngx_queue_init(&ngx_posted_next_events);
+}
+
+
+/*
+ * without the accept mutex the deferred accept events are dropped,
+ * the listening sockets are reported again to the worker holding it
+ */
+
+void
+ngx_event_drop_posted_next(ngx_cycle_t *cycle)
+{
+    ngx_queue_t  *q;
+    ngx_event_t  *ev;
+
+    while (!ngx_queue_empty(&ngx_posted_next_events)) {
+
+        q = ngx_queue_head(&ngx_posted_next_events);
+        ev = ngx_queue_data(q, ngx_event_t, queue);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                      "drop posted next event %p", ev);
+
+        ngx_delete_posted_event(ev);
+    }
+}
+
+
 void
 ngx_event_process_posted(ngx_cycle_t *cycle, ngx_queue_t *posted)
 {
@@ -63,11 +63,14 @@ post
 
 
 
+void ngx_event_move_posted_next(ngx_cycle_t *cycle);
+void ngx_event_drop_posted_next(ngx_cycle_t *cycle);
 void ngx_event_process_posted(ngx_cycle_t *cycle, ngx_queue_t *posted);
 
 
 extern ngx_queue_t  ngx_posted_accept_events;
 extern ngx_queue_t  ngx_posted_events;
+extern ngx_queue_t  ngx_posted_next_events;
 
 
 #endif /* _NGX_EVENT_POSTED_H_INCLUDED_ */
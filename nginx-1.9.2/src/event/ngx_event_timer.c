@@ -55,6 +55,88 @@
 */
 ngx_rbtree_t              ngx_event_timer_rbtree;
 static ngx_rbtree_node_t  ngx_event_timer_sentinel;
+
+
+/*
+ * the hierarchical timing wheel, enabled by the "timer_wheel" directive:
+ *
+ * 4 levels of 256 slots each, a level 0 slot is one millisecond wide and
+ * a level N slot covers 256^N milliseconds.  A timer is placed on the level
+ * of the highest 8-bit group in which its key differs from the wheel time,
+ * so all timers with the same key always share one slot and are kept in
+ * the insertion order, as the rbtree does for duplicate keys.  When the
+ * wheel time enters a new block, the slot of the upper level that covers
+ * the block is cascaded down.
+ *
+ * The ev->timer node is reused: key is the expiration time, left and right
+ * link the timer into the slot list, and parent points to the slot head.
+ */
+
+#define NGX_TIMER_WHEEL_BITS    8
+#define NGX_TIMER_WHEEL_SIZE    (1 << NGX_TIMER_WHEEL_BITS)
+#define NGX_TIMER_WHEEL_MASK    (NGX_TIMER_WHEEL_SIZE - 1)
+#define NGX_TIMER_WHEEL_LEVELS  4
+
+
+typedef struct {
+    /* the wheel time, all slots before it are expired */
+    ngx_msec_t                time;
+    ngx_uint_t                count;
+
+    ngx_rbtree_node_t         slots[NGX_TIMER_WHEEL_LEVELS]
+                                   [NGX_TIMER_WHEEL_SIZE];
+    uint32_t                  bitmap[NGX_TIMER_WHEEL_LEVELS]
+                                    [NGX_TIMER_WHEEL_SIZE / 32];
+
+    /* timers being expired, and timers beyond the last level */
+    ngx_rbtree_node_t         expired;
+    ngx_rbtree_node_t         overflow;
+} ngx_event_timer_wheel_t;
+
+
+static void ngx_event_timer_wheel_init(void);
+static void ngx_event_timer_wheel_insert(ngx_rbtree_node_t *node);
+static void ngx_event_timer_wheel_cascade(ngx_rbtree_node_t *head);
+static void ngx_event_timer_wheel_advance(ngx_msec_t now);
+static void ngx_event_timer_wheel_enter_block(void);
+static ngx_uint_t ngx_event_timer_wheel_next(uint32_t *bitmap,
+    ngx_uint_t slot);
+static ngx_msec_t ngx_event_timer_wheel_find(void);
+static void ngx_event_timer_wheel_expire(void);
+static void ngx_event_timer_wheel_cancel(void);
+static void ngx_event_timer_wheel_collect(ngx_rbtree_node_t *head,
+    ngx_rbtree_node_t *list);
+
+
+ngx_uint_t                       ngx_event_timer_wheel;
+static ngx_event_timer_wheel_t   ngx_event_timer_wheel_data;
+
+
+#define ngx_event_timer_list_init(head)                                       \
+    (head)->left = head;                                                      \
+    (head)->right = head
+
+#define ngx_event_timer_list_empty(head)                                      \
+    ((head)->right == head)
+
+#define ngx_event_timer_list_append(head, node)                               \
+    (node)->left = (head)->left;                                              \
+    (node)->right = head;                                                     \
+    (node)->parent = head;                                                    \
+    (head)->left->right = node;                                               \
+    (head)->left = node
+
+#define ngx_event_timer_list_move(to, from)                                   \
+    if (ngx_event_timer_list_empty(from)) {                                   \
+        ngx_event_timer_list_init(to);                                        \
+    } else {                                                                  \
+        (to)->right = (from)->right;                                          \
+        (to)->left = (from)->left;                                            \
+        (to)->right->left = to;                                               \
+        (to)->left->right = to;                                               \
+        ngx_event_timer_list_init(from);                                      \
+    }
+
 //哨兵节点是所有最下层的叶子节点都指向一个NULL空节点，图形化参考:http://blog.csdn.net/xzongyuan/article/details/22389185
 
 /*
@@ -69,6 +151,10 @@ ngx_event_timer_init(ngx_log_t *log)
     ngx_rbtree_init(&ngx_event_timer_rbtree, &ngx_event_timer_sentinel,
                     ngx_rbtree_insert_timer_value);
 
+    if (ngx_event_timer_wheel) {
+        ngx_event_timer_wheel_init();
+    }
+
     return NGX_OK;
 }
 
@@ -79,6 +165,10 @@ ngx_event_find_timer(void)
     ngx_msec_int_t      timer;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_wheel) {
+        return ngx_event_timer_wheel_find();
+    }
+
     if (ngx_event_timer_rbtree.root == &ngx_event_timer_sentinel) {
         return NGX_TIMER_INFINITE;
     }
@@ -109,6 +199,11 @@ ngx_event_expire_timers(void)
     ngx_event_t        *ev;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_wheel) {
+        ngx_event_timer_wheel_expire();
+        return;
+    }
+
     sentinel = ngx_event_timer_rbtree.sentinel;
 
     for ( ;; ) {
@@ -155,6 +250,11 @@ ngx_event_cancel_timers(void)
     ngx_event_t        *ev;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_wheel) {
+        ngx_event_timer_wheel_cancel();
+        return;
+    }
+
     sentinel = ngx_event_timer_rbtree.sentinel;
 
     for ( ;; ) {
@@ -189,3 +289,436 @@ ngx_event_cancel_timers(void)
         ev->handler(ev);
     }
 }
+
+
+ngx_uint_t
+ngx_event_timers_empty(void)
+{
+    if (ngx_event_timer_wheel) {
+        return ngx_event_timer_wheel_data.count == 0;
+    }
+
+    return ngx_event_timer_rbtree.root == ngx_event_timer_rbtree.sentinel;
+}
+
+
+static void
+ngx_event_timer_wheel_init(void)
+{
+    ngx_uint_t                level, slot;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel_data;
+
+    w->time = ngx_current_msec;
+    w->count = 0;
+
+    for (level = 0; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+        for (slot = 0; slot < NGX_TIMER_WHEEL_SIZE; slot++) {
+            ngx_event_timer_list_init(&w->slots[level][slot]);
+        }
+    }
+
+    ngx_memzero(w->bitmap, sizeof(w->bitmap));
+
+    ngx_event_timer_list_init(&w->expired);
+    ngx_event_timer_list_init(&w->overflow);
+}
+
+
+void
+ngx_event_timer_wheel_add(ngx_event_t *ev)
+{
+    ngx_event_timer_wheel_data.count++;
+
+    ngx_event_timer_wheel_insert(&ev->timer);
+}
+
+
+void
+ngx_event_timer_wheel_del(ngx_event_t *ev)
+{
+    ngx_uint_t                n;
+    ngx_rbtree_node_t        *node, *head;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel_data;
+
+    node = &ev->timer;
+    head = node->parent;
+
+    node->left->right = node->right;
+    node->right->left = node->left;
+
+    w->count--;
+
+    if (ngx_event_timer_list_empty(head)
+        && head >= &w->slots[0][0]
+        && head <= &w->slots[NGX_TIMER_WHEEL_LEVELS - 1]
+                            [NGX_TIMER_WHEEL_SIZE - 1])
+    {
+        n = head - &w->slots[0][0];
+
+        w->bitmap[n / NGX_TIMER_WHEEL_SIZE][(n & NGX_TIMER_WHEEL_MASK) / 32]
+            &= ~(1U << (n & 31));
+    }
+}
+
+
+static void
+ngx_event_timer_wheel_insert(ngx_rbtree_node_t *node)
+{
+    ngx_msec_t                key, diff;
+    ngx_uint_t                level, slot, shift;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel_data;
+
+    key = node->key;
+
+    /* the expired timers go to the current slot */
+
+    if ((ngx_msec_int_t) (key - w->time) < 0) {
+        key = w->time;
+    }
+
+    diff = key ^ w->time;
+
+    for (level = 0; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+        shift = (level + 1) * NGX_TIMER_WHEEL_BITS;
+
+        if (shift >= sizeof(ngx_msec_t) * 8 || (diff >> shift) == 0) {
+            break;
+        }
+    }
+
+    if (level == NGX_TIMER_WHEEL_LEVELS) {
+        ngx_event_timer_list_append(&w->overflow, node);
+        return;
+    }
+
+    slot = (key >> (level * NGX_TIMER_WHEEL_BITS)) & NGX_TIMER_WHEEL_MASK;
+
+    ngx_event_timer_list_append(&w->slots[level][slot], node);
+
+    w->bitmap[level][slot / 32] |= 1U << (slot & 31);
+}
+
+
+static void
+ngx_event_timer_wheel_cascade(ngx_rbtree_node_t *head)
+{
+    ngx_rbtree_node_t  list, *node;
+
+    ngx_event_timer_list_move(&list, head);
+
+    while (!ngx_event_timer_list_empty(&list)) {
+        node = list.right;
+
+        list.right = node->right;
+        node->right->left = &list;
+
+        ngx_event_timer_wheel_insert(node);
+    }
+}
+
+
+static void
+ngx_event_timer_wheel_advance(ngx_msec_t now)
+{
+    ngx_uint_t                slot, next;
+    ngx_msec_t                skip;
+    ngx_rbtree_node_t        *node, *head;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel_data;
+
+    while ((ngx_msec_int_t) (now - w->time) >= 0) {
+
+        slot = w->time & NGX_TIMER_WHEEL_MASK;
+        next = ngx_event_timer_wheel_next(w->bitmap[0], slot);
+
+        if (next == slot) {
+
+            /* the whole slot is expired in one batch */
+
+            w->bitmap[0][slot / 32] &= ~(1U << (slot & 31));
+
+            head = &w->slots[0][slot];
+
+            for (node = head->right; node != head; node = node->right) {
+                node->parent = &w->expired;
+            }
+
+            w->expired.left->right = head->right;
+            head->right->left = w->expired.left;
+            w->expired.left = head->left;
+            w->expired.left->right = &w->expired;
+
+            ngx_event_timer_list_init(head);
+
+            w->time++;
+
+        } else {
+            skip = next - slot;
+
+            /* a skip never crosses a block boundary, at most it ends on it */
+
+            if ((ngx_msec_t) (now - w->time) < skip) {
+                w->time = now + 1;
+
+            } else {
+                w->time += skip;
+            }
+        }
+
+        /*
+         * the block is cascaded as soon as the wheel time enters it,
+         * before any timer can be added to it directly on level 0
+         */
+
+        if ((w->time & NGX_TIMER_WHEEL_MASK) == 0) {
+            ngx_event_timer_wheel_enter_block();
+        }
+    }
+}
+
+
+static void
+ngx_event_timer_wheel_enter_block(void)
+{
+    ngx_uint_t                level, slot;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel_data;
+
+    /* cascade the upper levels, the highest first */
+
+    for (level = 1; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+        if ((w->time >> (level * NGX_TIMER_WHEEL_BITS))
+            & NGX_TIMER_WHEEL_MASK)
+        {
+            break;
+        }
+    }
+
+    if (level == NGX_TIMER_WHEEL_LEVELS) {
+        ngx_event_timer_wheel_cascade(&w->overflow);
+        level--;
+    }
+
+    for ( /* void */ ; level > 0; level--) {
+        slot = (w->time >> (level * NGX_TIMER_WHEEL_BITS))
+               & NGX_TIMER_WHEEL_MASK;
+
+        w->bitmap[level][slot / 32] &= ~(1U << (slot & 31));
+
+        ngx_event_timer_wheel_cascade(&w->slots[level][slot]);
+    }
+}
+
+
+static ngx_uint_t
+ngx_event_timer_wheel_next(uint32_t *bitmap, ngx_uint_t slot)
+{
+    uint32_t    word;
+    ngx_uint_t  i;
+
+    i = slot / 32;
+    word = bitmap[i] & ~((1U << (slot & 31)) - 1);
+
+    for ( ;; ) {
+        if (word) {
+            slot = i * 32;
+
+            while ((word & 1) == 0) {
+                word >>= 1;
+                slot++;
+            }
+
+            return slot;
+        }
+
+        if (++i == NGX_TIMER_WHEEL_SIZE / 32) {
+            return NGX_TIMER_WHEEL_SIZE;
+        }
+
+        word = bitmap[i];
+    }
+}
+
+
+static ngx_msec_t
+ngx_event_timer_wheel_find(void)
+{
+    ngx_msec_t                block, timer;
+    ngx_uint_t                level, slot, next, shift;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel_data;
+
+    if (w->count == 0) {
+        return NGX_TIMER_INFINITE;
+    }
+
+    if (!ngx_event_timer_list_empty(&w->expired)) {
+        return 0;
+    }
+
+    /*
+     * the first non-empty level 0 slot gives the exact expiration time,
+     * otherwise wake up when the next non-empty upper slot is cascaded
+     */
+
+    for (level = 0; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+        shift = level * NGX_TIMER_WHEEL_BITS;
+        slot = (w->time >> shift) & NGX_TIMER_WHEEL_MASK;
+
+        next = ngx_event_timer_wheel_next(w->bitmap[level], slot);
+
+        if (next != NGX_TIMER_WHEEL_SIZE) {
+            block = (w->time >> shift >> NGX_TIMER_WHEEL_BITS)
+                    << NGX_TIMER_WHEEL_BITS;
+
+            timer = (block + next) << shift;
+
+            timer = (ngx_msec_int_t) (timer - ngx_current_msec) > 0
+                    ? timer - ngx_current_msec : 0;
+
+            return timer;
+        }
+    }
+
+    /*
+     * the overflow list only, it is cascaded when the wheel time crosses
+     * the boundary of the whole wheel span; all overflow timers expire
+     * past the boundary, so it is never later than the nearest of them
+     */
+
+    shift = (NGX_TIMER_WHEEL_LEVELS - 1) * NGX_TIMER_WHEEL_BITS;
+
+    block = ((w->time >> shift >> NGX_TIMER_WHEEL_BITS) + 1)
+            << NGX_TIMER_WHEEL_BITS;
+
+    timer = block << shift;
+
+    timer = (ngx_msec_int_t) (timer - ngx_current_msec) > 0
+            ? timer - ngx_current_msec : 0;
+
+    return timer;
+}
+
+
+static void
+ngx_event_timer_wheel_expire(void)
+{
+    ngx_event_t              *ev;
+    ngx_rbtree_node_t        *node;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel_data;
+
+    ngx_event_timer_wheel_advance(ngx_current_msec);
+
+    /*
+     * the handlers may add and delete timers, including the ones
+     * which are still in the expired list
+     */
+
+    while (!ngx_event_timer_list_empty(&w->expired)) {
+        node = w->expired.right;
+
+        ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "event timer del: %d: %M",
+                       ngx_event_ident(ev->data), ev->timer.key);
+
+        ngx_event_timer_wheel_del(ev);
+
+#if (NGX_DEBUG)
+        ev->timer.left = NULL;
+        ev->timer.right = NULL;
+        ev->timer.parent = NULL;
+#endif
+
+        ev->timer_set = 0;
+
+        ev->timedout = 1;
+
+        ev->handler(ev);
+    }
+}
+
+
+static void
+ngx_event_timer_wheel_cancel(void)
+{
+    ngx_uint_t                level, slot;
+    ngx_event_t              *ev;
+    ngx_rbtree_node_t         list, *node;
+    ngx_event_timer_wheel_t  *w;
+
+    w = &ngx_event_timer_wheel_data;
+
+    /* collect the cancelable timers first, the handlers may add new ones */
+
+    ngx_event_timer_list_init(&list);
+
+    ngx_event_timer_wheel_collect(&w->expired, &list);
+
+    for (level = 0; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+        for (slot = 0; slot < NGX_TIMER_WHEEL_SIZE; slot++) {
+            ngx_event_timer_wheel_collect(&w->slots[level][slot], &list);
+        }
+    }
+
+    ngx_event_timer_wheel_collect(&w->overflow, &list);
+
+    while (!ngx_event_timer_list_empty(&list)) {
+        node = list.right;
+
+        ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "event timer cancel: %d: %M",
+                       ngx_event_ident(ev->data), ev->timer.key);
+
+        ngx_event_timer_wheel_del(ev);
+
+#if (NGX_DEBUG)
+        ev->timer.left = NULL;
+        ev->timer.right = NULL;
+        ev->timer.parent = NULL;
+#endif
+
+        ev->timer_set = 0;
+
+        ev->handler(ev);
+    }
+}
+
+
+static void
+ngx_event_timer_wheel_collect(ngx_rbtree_node_t *head, ngx_rbtree_node_t *list)
+{
+    ngx_event_t        *ev;
+    ngx_rbtree_node_t  *node, *next;
+
+    for (node = head->right; node != head; node = next) {
+        next = node->right;
+
+        ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+        if (!ev->cancelable) {
+            continue;
+        }
+
+        /* the timer is still counted while it is in the list */
+
+        ngx_event_timer_wheel_del(ev);
+        ngx_event_timer_wheel_data.count++;
+
+        ngx_event_timer_list_append(list, node);
+    }
+}
@@ -23,9 +23,13 @@ ngx_int_t ngx_event_timer_init(ngx_log_t *log);
 ngx_msec_t ngx_event_find_timer(void);
 void ngx_event_expire_timers(void);
 void ngx_event_cancel_timers(void);
+void ngx_event_timer_wheel_add(ngx_event_t *ev);
+void ngx_event_timer_wheel_del(ngx_event_t *ev);
+ngx_uint_t ngx_event_timers_empty(void);
 
 
 extern ngx_rbtree_t  ngx_event_timer_rbtree;
+extern ngx_uint_t    ngx_event_timer_wheel;
 
 
 static ngx_inline void
@@ -37,8 +41,13 @@ ngx_event_del_timer(ngx_event_t *ev, const char *func, unsigned int line)
     ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
                    "%s event timer del: %d: %M", tmpbuf,
                     ngx_event_ident(ev->data), ev->timer.key);
-                    
-    ngx_rbtree_delete(&ngx_event_timer_rbtree, &ev->timer);
+
+    if (ngx_event_timer_wheel) {
+        ngx_event_timer_wheel_del(ev);
+
+    } else {
+        ngx_rbtree_delete(&ngx_event_timer_rbtree, &ev->timer);
+    }
 
 #if (NGX_DEBUG)
     ev->timer.left = NULL;
@@ -99,7 +108,12 @@ ngx_event_add_timer(ngx_event_t *ev, ngx_msec_t timer, const char *func, unsigne
                    "%s event timer add fd:%d, expire-time:%M s, timer.key:%M", tmpbuf,
                     ngx_event_ident(ev->data), timer / 1000, ev->timer.key);
 
-    ngx_rbtree_insert(&ngx_event_timer_rbtree, &ev->timer);
+    if (ngx_event_timer_wheel) {
+        ngx_event_timer_wheel_add(ev);
+
+    } else {
+        ngx_rbtree_insert(&ngx_event_timer_rbtree, &ev->timer);
+    }
 
     ev->timer_set = 1;
 }
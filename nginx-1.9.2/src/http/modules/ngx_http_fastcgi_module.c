@@ -57,6 +57,9 @@ typedef struct {
 
     ngx_flag_t                     keep_conn; //fastcgi_keep_conn  on | off  默认off
 
+    ngx_flag_t                     multiplex;
+    ngx_uint_t                     multiplex_requests;
+
 #if (NGX_HTTP_CACHE)
     ngx_http_complex_value_t       cache_key;
     //fastcgi_cache_key proxy_cache_key指令的时候计算出来的复杂表达式结构，存放在flcf->cache_key中 ngx_http_fastcgi_cache_key ngx_http_proxy_cache_key
@@ -129,6 +132,9 @@ typedef struct { //ngx_http_fastcgi_handler分配空间
 #define NGX_HTTP_FASTCGI_STDERR         7 //后端到nginx 参考ngx_http_fastcgi_process_record
 #define NGX_HTTP_FASTCGI_DATA           8  
 
+/* protocol_status of NGX_HTTP_FASTCGI_END_REQUEST */
+#define NGX_HTTP_FASTCGI_CANT_MPX_CONN  1
+
 
 /*
 typedef struct {     
@@ -184,6 +190,116 @@ typedef struct {
 } ngx_http_fastcgi_request_start_t; //见ngx_http_fastcgi_request_start
 
 
+typedef struct {
+    u_char  app_status[4];
+    u_char  protocol_status;
+    u_char  reserved[3];
+} ngx_http_fastcgi_end_request_t;
+
+
+#define NGX_HTTP_FASTCGI_MUX_BUFFER_SIZE      16384
+#define NGX_HTTP_FASTCGI_MUX_OUTPUT_LIMIT     (64 * 1024)
+#define NGX_HTTP_FASTCGI_MUX_INPUT_LIMIT      (256 * 1024)
+#define NGX_HTTP_FASTCGI_MUX_FREE_BUFS        8
+#define NGX_HTTP_FASTCGI_MUX_IDLE_TIMEOUT     60000
+
+
+typedef struct ngx_http_fastcgi_mux_buf_s  ngx_http_fastcgi_mux_buf_t;
+
+/* the data immediately follows the structure */
+
+struct ngx_http_fastcgi_mux_buf_s {
+    ngx_http_fastcgi_mux_buf_t       *next;
+    u_char                           *pos;
+    u_char                           *last;
+    u_char                           *end;
+};
+
+
+typedef struct ngx_http_fastcgi_mux_stream_s  ngx_http_fastcgi_mux_stream_t;
+
+typedef struct {
+    ngx_connection_t                 *connection;
+    ngx_queue_t                       queue;
+
+    ngx_queue_t                       streams;
+    ngx_uint_t                        nstreams;
+
+    /* streams or ngx_http_fastcgi_mux_draining, indexed by request id */
+    void                            **requests;
+    ngx_uint_t                        nslots;
+    ngx_uint_t                        nused;
+    ngx_uint_t                        max_requests;
+
+    /* the request in the middle of a record */
+    ngx_http_fastcgi_mux_stream_t    *owner;
+
+    ngx_http_fastcgi_mux_buf_t       *out;
+    ngx_http_fastcgi_mux_buf_t       *last_out;
+    size_t                            out_size;
+
+    ngx_http_fastcgi_mux_buf_t       *free;
+    ngx_uint_t                        nfree;
+
+    /* the record being received */
+    u_char                            in_header[8];
+    size_t                            in_header_len;
+    ngx_uint_t                        in_id;
+    ngx_uint_t                        in_type;
+    size_t                            in_pos;
+    size_t                            in_rest;
+    ngx_http_fastcgi_end_request_t    in_end;
+
+    struct sockaddr                  *sockaddr;
+    socklen_t                         socklen;
+    ngx_str_t                         name;
+
+    unsigned                          connected:1;
+    unsigned                          input_blocked:1;
+} ngx_http_fastcgi_mux_conn_t;
+
+
+struct ngx_http_fastcgi_mux_stream_s {
+    /* the fake connection must be the first member */
+    ngx_connection_t                  c;
+    ngx_event_t                       read;
+    ngx_event_t                       write;
+
+    ngx_http_fastcgi_mux_conn_t      *hc;
+    ngx_queue_t                       queue;
+
+    ngx_uint_t                        id;
+
+    u_char                            out_header[8];
+    size_t                            out_header_len;
+    size_t                            out_rest;
+
+    ngx_http_fastcgi_mux_buf_t       *in;
+    ngx_http_fastcgi_mux_buf_t       *last_in;
+    size_t                            in_size;
+
+    unsigned                          out_closed:1;
+    unsigned                          in_closed:1;
+    unsigned                          reset:1;
+    unsigned                          blocked:1;
+};
+
+
+typedef struct {
+    ngx_http_upstream_t              *upstream;
+    ngx_uint_t                        max_requests;
+
+    void                             *data;
+
+    ngx_event_get_peer_pt             original_get_peer;
+    ngx_event_free_peer_pt            original_free_peer;
+} ngx_http_fastcgi_mux_peer_data_t;
+
+
+#define ngx_http_fastcgi_mux_buf_start(b)                                    \
+    ((u_char *) (b) + sizeof(ngx_http_fastcgi_mux_buf_t))
+
+
 static ngx_int_t ngx_http_fastcgi_eval(ngx_http_request_t *r,
     ngx_http_fastcgi_loc_conf_t *flcf);
 #if (NGX_HTTP_CACHE)
@@ -205,6 +321,53 @@ static void ngx_http_fastcgi_abort_request(ngx_http_request_t *r);
 static void ngx_http_fastcgi_finalize_request(ngx_http_request_t *r,
     ngx_int_t rc);
 
+static ngx_int_t ngx_http_fastcgi_mux_init_peer(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_fastcgi_mux_get_peer(ngx_peer_connection_t *pc,
+    void *data);
+static void ngx_http_fastcgi_mux_free_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+static ngx_http_fastcgi_mux_conn_t *ngx_http_fastcgi_mux_connect(
+    ngx_peer_connection_t *pc, ngx_uint_t max_requests, ngx_msec_t timeout);
+static ngx_int_t ngx_http_fastcgi_mux_test_connect(ngx_connection_t *c);
+static void ngx_http_fastcgi_mux_read_handler(ngx_event_t *rev);
+static void ngx_http_fastcgi_mux_write_handler(ngx_event_t *wev);
+static ngx_int_t ngx_http_fastcgi_mux_send(ngx_http_fastcgi_mux_conn_t *hc);
+static void ngx_http_fastcgi_mux_post(ngx_http_fastcgi_mux_conn_t *hc);
+static void ngx_http_fastcgi_mux_close(ngx_http_fastcgi_mux_conn_t *hc);
+static void ngx_http_fastcgi_mux_idle(ngx_http_fastcgi_mux_conn_t *hc);
+static ngx_int_t ngx_http_fastcgi_mux_demux(ngx_http_fastcgi_mux_conn_t *hc,
+    u_char *pos, size_t len);
+static ngx_int_t ngx_http_fastcgi_mux_end_request(
+    ngx_http_fastcgi_mux_conn_t *hc);
+static ngx_int_t ngx_http_fastcgi_mux_input(ngx_http_fastcgi_mux_stream_t *st,
+    u_char *pos, size_t len);
+static ngx_http_fastcgi_mux_stream_t *ngx_http_fastcgi_mux_find(
+    ngx_http_fastcgi_mux_conn_t *hc, ngx_uint_t id);
+static ssize_t ngx_http_fastcgi_mux_recv(ngx_connection_t *c, u_char *buf,
+    size_t size);
+static ssize_t ngx_http_fastcgi_mux_recv_chain(ngx_connection_t *c,
+    ngx_chain_t *cl, off_t limit);
+static ngx_chain_t *ngx_http_fastcgi_mux_send_chain(ngx_connection_t *c,
+    ngx_chain_t *in, off_t limit);
+static ngx_int_t ngx_http_fastcgi_mux_output(ngx_http_fastcgi_mux_stream_t *st,
+    ngx_buf_t *b);
+static ngx_int_t ngx_http_fastcgi_mux_copy(ngx_http_fastcgi_mux_stream_t *st,
+    ngx_buf_t *b, u_char *p, size_t size);
+static void ngx_http_fastcgi_mux_close_stream(
+    ngx_http_fastcgi_mux_stream_t *st);
+static ngx_int_t ngx_http_fastcgi_mux_finish_record(
+    ngx_http_fastcgi_mux_stream_t *st);
+static void ngx_http_fastcgi_mux_unblock_input(
+    ngx_http_fastcgi_mux_conn_t *hc);
+static void ngx_http_fastcgi_mux_wake(ngx_event_t *ev);
+static void ngx_http_fastcgi_mux_wake_blocked(ngx_http_fastcgi_mux_conn_t *hc);
+static u_char *ngx_http_fastcgi_mux_reserve(ngx_http_fastcgi_mux_conn_t *hc,
+    ngx_http_fastcgi_mux_buf_t **first, ngx_http_fastcgi_mux_buf_t **last,
+    size_t size);
+static void ngx_http_fastcgi_mux_free_buf(ngx_http_fastcgi_mux_conn_t *hc,
+    ngx_http_fastcgi_mux_buf_t *b);
+
 static ngx_int_t ngx_http_fastcgi_add_variables(ngx_conf_t *cf);
 static void *ngx_http_fastcgi_create_main_conf(ngx_conf_t *cf);
 static void *ngx_http_fastcgi_create_loc_conf(ngx_conf_t *cf);
@@ -242,6 +405,18 @@ static ngx_conf_post_t  ngx_http_fastcgi_lowat_post =
     { ngx_http_fastcgi_lowat_check };
 
 
+static ngx_conf_num_bounds_t  ngx_http_fastcgi_multiplex_requests_bounds = {
+    ngx_conf_check_num_bounds, 1, 65535
+};
+
+
+/* shared connections of the worker process */
+static ngx_queue_t  ngx_http_fastcgi_mux_conns;
+
+/* marks the ids of aborted requests until the application ends them */
+static u_char       ngx_http_fastcgi_mux_draining;
+
+
 static ngx_conf_bitmask_t  ngx_http_fastcgi_next_upstream_masks[] = {
     { ngx_string("error"), NGX_HTTP_UPSTREAM_FT_ERROR },
     { ngx_string("timeout"), NGX_HTTP_UPSTREAM_FT_TIMEOUT },
@@ -746,6 +921,13 @@ fastcgi_cache_methods  POST;
       offsetof(ngx_http_fastcgi_loc_conf_t, upstream.cache_revalidate),
       NULL },
 
+    { ngx_string("fastcgi_cache_background_update"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_fastcgi_loc_conf_t, upstream.cache_background_update),
+      NULL },
+
 #endif
         /*
     默认情况下p->temp_file->path = u->conf->temp_path; 也就是由ngx_http_fastcgi_temp_path指定路径，但是如果是缓存方式(p->cacheable=1)并且配置
@@ -905,6 +1087,20 @@ location /php {
       offsetof(ngx_http_fastcgi_loc_conf_t, keep_conn),
       NULL },
 
+    { ngx_string("fastcgi_multiplex"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_fastcgi_loc_conf_t, multiplex),
+      NULL },
+
+    { ngx_string("fastcgi_multiplex_requests"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_fastcgi_loc_conf_t, multiplex_requests),
+      &ngx_http_fastcgi_multiplex_requests_bounds },
+
       ngx_null_command
 };
 
@@ -1077,6 +1273,11 @@ ngx_http_fastcgi_handler(ngx_http_request_t *r)
     u->process_header = ngx_http_fastcgi_process_header; //在ngx_http_upstream_process_header中执行
     u->abort_request = ngx_http_fastcgi_abort_request;  
     u->finalize_request = ngx_http_fastcgi_finalize_request; //在ngx_http_upstream_finalize_request中执行
+
+    if (flcf->multiplex) {
+        u->init_peer = ngx_http_fastcgi_mux_init_peer;
+    }
+
     r->state = 0;
 
     //下面的数据结构是给event_pipe用的，用来对FCGI的数据进行buffering处理的。
@@ -3224,212 +3425,1641 @@ ngx_http_fastcgi_finalize_request(ngx_http_request_t *r, ngx_int_t rc)
 }
 
 
+/*
+ * Request multiplexing, "fastcgi_multiplex".
+ *
+ * The module itself always speaks with request id 1 over a connection of
+ * its own: every request gets a fake connection, its send_chain() assigns
+ * the request an id of a shared connection and rewrites the id of the
+ * records passing through, records received on the shared connection are
+ * demultiplexed by their ids and returned by recv() of the corresponding
+ * fake connection with the id changed back to 1.
+ *
+ * Records of different requests are never interleaved: a request that has
+ * started a record owns the output until the record is complete.  FastCGI
+ * has no flow control, so the shared connection is not read while one of
+ * the requests has too much input queued.
+ */
+
+
 static ngx_int_t
-ngx_http_fastcgi_add_variables(ngx_conf_t *cf)
+ngx_http_fastcgi_mux_init_peer(ngx_http_request_t *r, ngx_http_upstream_t *u)
 {
-   ngx_http_variable_t  *var, *v;
+    ngx_http_fastcgi_loc_conf_t        *flcf;
+    ngx_http_fastcgi_mux_peer_data_t   *mp;
 
-    for (v = ngx_http_fastcgi_vars; v->name.len; v++) {
-        var = ngx_http_add_variable(cf, &v->name, v->flags);
-        if (var == NULL) {
-            return NGX_ERROR;
-        }
+    if (!(ngx_event_flags & NGX_USE_CLEAR_EVENT)) {
 
-        var->get_handler = v->get_handler;
-        var->data = v->data;
+        /*
+         * the fake connections pretend to be always active,
+         * which only works with edge-triggered notification methods
+         */
+
+        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                      "fastcgi multiplexing requires an edge-triggered "
+                      "event method, ignored");
+        return NGX_OK;
     }
 
+    flcf = ngx_http_get_module_loc_conf(r, ngx_http_fastcgi_module);
+
+    mp = ngx_palloc(r->pool, sizeof(ngx_http_fastcgi_mux_peer_data_t));
+    if (mp == NULL) {
+        return NGX_ERROR;
+    }
+
+    mp->upstream = u;
+    mp->max_requests = flcf->multiplex_requests;
+    mp->data = u->peer.data;
+    mp->original_get_peer = u->peer.get;
+    mp->original_free_peer = u->peer.free;
+
+    u->peer.data = mp;
+    u->peer.get = ngx_http_fastcgi_mux_get_peer;
+    u->peer.free = ngx_http_fastcgi_mux_free_peer;
+
     return NGX_OK;
 }
 
 
-static void *
-ngx_http_fastcgi_create_main_conf(ngx_conf_t *cf)
+static ngx_int_t
+ngx_http_fastcgi_mux_get_peer(ngx_peer_connection_t *pc, void *data)
 {
-    ngx_http_fastcgi_main_conf_t  *conf;
+    ngx_http_fastcgi_mux_peer_data_t  *mp = data;
 
-    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_fastcgi_main_conf_t));
-    if (conf == NULL) {
-        return NULL;
+    ngx_int_t                        rc;
+    ngx_uint_t                       id;
+    ngx_queue_t                     *q;
+    ngx_connection_t                *c;
+    ngx_http_fastcgi_mux_conn_t     *hc, *found;
+    ngx_http_fastcgi_mux_stream_t   *st;
+
+    rc = mp->original_get_peer(pc, mp->data);
+
+    if (rc != NGX_OK) {
+        return rc;
     }
 
-#if (NGX_HTTP_CACHE)
-    if (ngx_array_init(&conf->caches, cf->pool, 4,
-                       sizeof(ngx_http_file_cache_t *))
-        != NGX_OK)
+    if (ngx_http_fastcgi_mux_conns.next == NULL) {
+        ngx_queue_init(&ngx_http_fastcgi_mux_conns);
+    }
+
+    found = NULL;
+
+    for (q = ngx_queue_head(&ngx_http_fastcgi_mux_conns);
+         q != ngx_queue_sentinel(&ngx_http_fastcgi_mux_conns);
+         q = ngx_queue_next(q))
     {
-        return NULL;
+        hc = ngx_queue_data(q, ngx_http_fastcgi_mux_conn_t, queue);
+
+        if (hc->nused >= ngx_min(hc->max_requests, mp->max_requests)
+            || ngx_cmp_sockaddr(hc->sockaddr, hc->socklen,
+                                pc->sockaddr, pc->socklen, 1)
+               != NGX_OK)
+        {
+            continue;
+        }
+
+        /* the busiest connection that still has room */
+
+        if (found == NULL || hc->nused > found->nused) {
+            found = hc;
+        }
     }
-#endif
 
-    return conf;
-}
+    hc = found;
 
+    if (hc == NULL) {
+        hc = ngx_http_fastcgi_mux_connect(pc, mp->max_requests,
+                                          mp->upstream->conf->connect_timeout);
+        if (hc == NULL) {
+            return NGX_DECLINED;
+        }
 
-static void *
-ngx_http_fastcgi_create_loc_conf(ngx_conf_t *cf)
-{
-    ngx_http_fastcgi_loc_conf_t  *conf;
+    } else {
+        pc->cached = hc->connected;
+    }
 
-    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_fastcgi_loc_conf_t));
-    if (conf == NULL) {
-        return NULL;
+    st = ngx_calloc(sizeof(ngx_http_fastcgi_mux_stream_t), pc->log);
+    if (st == NULL) {
+        if (hc->nstreams == 0) {
+            ngx_http_fastcgi_mux_idle(hc);
+        }
+
+        return NGX_ERROR;
     }
 
-    /*
-     * set by ngx_pcalloc():
-     *
-     *     conf->upstream.bufs.num = 0;
-     *     conf->upstream.ignore_headers = 0;
-     *     conf->upstream.next_upstream = 0;
-     *     conf->upstream.cache_zone = NULL;
-     *     conf->upstream.cache_use_stale = 0;
-     *     conf->upstream.cache_methods = 0;
-     *     conf->upstream.temp_path = NULL;
-     *     conf->upstream.hide_headers_hash = { NULL, 0 };
-     *     conf->upstream.uri = { 0, NULL };
-     *     conf->upstream.location = NULL;
-     *     conf->upstream.store_lengths = NULL;
-     *     conf->upstream.store_values = NULL;
-     *
-     *     conf->index.len = { 0, NULL };
-     */
+    /* the lowest free request id */
 
-    conf->upstream.store = NGX_CONF_UNSET;
-    conf->upstream.store_access = NGX_CONF_UNSET_UINT;
-    conf->upstream.next_upstream_tries = NGX_CONF_UNSET_UINT;
-    conf->upstream.buffering = NGX_CONF_UNSET;
-    conf->upstream.request_buffering = NGX_CONF_UNSET;
-    conf->upstream.ignore_client_abort = NGX_CONF_UNSET;
-    conf->upstream.force_ranges = NGX_CONF_UNSET;
+    for (id = 1; hc->requests[id]; id++) { /* void */ }
 
-    conf->upstream.local = NGX_CONF_UNSET_PTR;
+    hc->requests[id] = st;
+    hc->nused++;
 
-    conf->upstream.connect_timeout = NGX_CONF_UNSET_MSEC;
-    conf->upstream.send_timeout = NGX_CONF_UNSET_MSEC;
-    conf->upstream.read_timeout = NGX_CONF_UNSET_MSEC;
-    conf->upstream.next_upstream_timeout = NGX_CONF_UNSET_MSEC;
+    c = &st->c;
 
-    conf->upstream.send_lowat = NGX_CONF_UNSET_SIZE;
-    conf->upstream.buffer_size = NGX_CONF_UNSET_SIZE;
-    conf->upstream.limit_rate = NGX_CONF_UNSET_SIZE;
+    c->read = &st->read;
+    c->write = &st->write;
 
-    conf->upstream.busy_buffers_size_conf = NGX_CONF_UNSET_SIZE;
-    conf->upstream.max_temp_file_size_conf = NGX_CONF_UNSET_SIZE;
-    conf->upstream.temp_file_write_size_conf = NGX_CONF_UNSET_SIZE;
+    c->fd = hc->connection->fd;
+    c->number = hc->connection->number;
+    c->multiplexed = 1;
 
-    conf->upstream.pass_request_headers = NGX_CONF_UNSET;
-    conf->upstream.pass_request_body = NGX_CONF_UNSET;
+    c->recv = ngx_http_fastcgi_mux_recv;
+    c->recv_chain = ngx_http_fastcgi_mux_recv_chain;
+    c->send_chain = ngx_http_fastcgi_mux_send_chain;
 
-#if (NGX_HTTP_CACHE)
-    conf->upstream.cache = NGX_CONF_UNSET;
-    conf->upstream.cache_min_uses = NGX_CONF_UNSET_UINT;
-    conf->upstream.cache_bypass = NGX_CONF_UNSET_PTR;
-    conf->upstream.no_cache = NGX_CONF_UNSET_PTR;
-    conf->upstream.cache_valid = NGX_CONF_UNSET_PTR;
-    conf->upstream.cache_lock = NGX_CONF_UNSET;
-    conf->upstream.cache_lock_timeout = NGX_CONF_UNSET_MSEC;
-    conf->upstream.cache_lock_age = NGX_CONF_UNSET_MSEC;
-    conf->upstream.cache_revalidate = NGX_CONF_UNSET;
-#endif
+    c->log = pc->log;
+    c->sockaddr = hc->sockaddr;
+    c->socklen = hc->socklen;
+    c->addr_text = hc->name;
 
-    conf->upstream.hide_headers = NGX_CONF_UNSET_PTR;
-    conf->upstream.pass_headers = NGX_CONF_UNSET_PTR;
+    c->tcp_nopush = NGX_TCP_NOPUSH_DISABLED;
+    c->tcp_nodelay = NGX_TCP_NODELAY_DISABLED;
 
-    conf->upstream.intercept_errors = NGX_CONF_UNSET;
+    st->read.data = c;
+    st->read.log = pc->log;
+    st->read.active = 1;
 
-    /* "fastcgi_cyclic_temp_file" is disabled */
-    conf->upstream.cyclic_temp_file = 0;
+    st->write.data = c;
+    st->write.log = pc->log;
+    st->write.write = 1;
+    st->write.active = 1;
+    st->write.ready = 1;
 
-    conf->upstream.change_buffering = 1;
+    st->hc = hc;
+    st->id = id;
 
-    conf->catch_stderr = NGX_CONF_UNSET_PTR;
+    ngx_queue_insert_tail(&hc->streams, &st->queue);
+    hc->nstreams++;
 
-    conf->keep_conn = NGX_CONF_UNSET;
+    if (hc->connection->idle) {
+        hc->connection->idle = 0;
 
-    ngx_str_set(&conf->upstream.module, "fastcgi");
+        if (hc->connection->read->timer_set) {
+            ngx_del_timer(hc->connection->read, NGX_FUNC_LINE);
+        }
+    }
 
-    return conf;
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "fastcgi mux request id:%ui on connection %p, used:%ui",
+                   id, hc, hc->nused);
+
+    pc->connection = c;
+
+    return NGX_DONE;
 }
 
 
-static char *
-ngx_http_fastcgi_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
+static void
+ngx_http_fastcgi_mux_free_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t state)
 {
-    ngx_http_fastcgi_loc_conf_t *prev = parent;
-    ngx_http_fastcgi_loc_conf_t *conf = child;
+    ngx_http_fastcgi_mux_peer_data_t  *mp = data;
 
-    size_t                        size;
-    ngx_int_t                     rc;
-    ngx_hash_init_t               hash;
-    ngx_http_core_loc_conf_t     *clcf;
+    ngx_connection_t  *c;
 
-#if (NGX_HTTP_CACHE)
+    c = pc->connection;
 
-    if (conf->upstream.store > 0) {
-        conf->upstream.cache = 0;
+    if (c && c->send_chain == ngx_http_fastcgi_mux_send_chain) {
+        ngx_http_fastcgi_mux_close_stream((ngx_http_fastcgi_mux_stream_t *) c);
+        pc->connection = NULL;
     }
 
-    if (conf->upstream.cache > 0) {
-        conf->upstream.store = 0;
-    }
+    mp->original_free_peer(pc, mp->data, state);
+}
 
-#endif
 
-    if (conf->upstream.store == NGX_CONF_UNSET) {
-        ngx_conf_merge_value(conf->upstream.store,
-                              prev->upstream.store, 0);
+static ngx_http_fastcgi_mux_conn_t *
+ngx_http_fastcgi_mux_connect(ngx_peer_connection_t *pc,
+    ngx_uint_t max_requests, ngx_msec_t timeout)
+{
+    ngx_int_t                     rc;
+    ngx_pool_t                   *pool;
+    ngx_connection_t             *c;
+    ngx_peer_connection_t         peer;
+    ngx_http_fastcgi_mux_conn_t  *hc;
 
-        conf->upstream.store_lengths = prev->upstream.store_lengths;
-        conf->upstream.store_values = prev->upstream.store_values;
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ngx_cycle->log);
+    if (pool == NULL) {
+        return NULL;
     }
 
-    ngx_conf_merge_uint_value(conf->upstream.store_access,
-                              prev->upstream.store_access, 0600);
+    hc = ngx_pcalloc(pool, sizeof(ngx_http_fastcgi_mux_conn_t));
+    if (hc == NULL) {
+        goto failed;
+    }
 
-    ngx_conf_merge_uint_value(conf->upstream.next_upstream_tries,
-                              prev->upstream.next_upstream_tries, 0);
+    /* request ids start from 1, the last slot is a sentinel */
 
-    ngx_conf_merge_value(conf->upstream.buffering,
-                              prev->upstream.buffering, 1);
+    hc->requests = ngx_pcalloc(pool, (max_requests + 2) * sizeof(void *));
+    if (hc->requests == NULL) {
+        goto failed;
+    }
 
-    ngx_conf_merge_value(conf->upstream.request_buffering,
-                              prev->upstream.request_buffering, 1);
+    hc->requests[max_requests + 1] = &ngx_http_fastcgi_mux_draining;
+    hc->nslots = max_requests;
+    hc->max_requests = max_requests;
 
-    ngx_conf_merge_value(conf->upstream.ignore_client_abort,
-                              prev->upstream.ignore_client_abort, 0);
+    hc->sockaddr = ngx_palloc(pool, pc->socklen);
+    if (hc->sockaddr == NULL) {
+        goto failed;
+    }
 
-    ngx_conf_merge_value(conf->upstream.force_ranges,
-                              prev->upstream.force_ranges, 0);
+    ngx_memcpy(hc->sockaddr, pc->sockaddr, pc->socklen);
+    hc->socklen = pc->socklen;
 
-    ngx_conf_merge_ptr_value(conf->upstream.local,
-                              prev->upstream.local, NULL);
+    hc->name.data = ngx_pnalloc(pool, pc->name->len);
+    if (hc->name.data == NULL) {
+        goto failed;
+    }
 
-    ngx_conf_merge_msec_value(conf->upstream.connect_timeout,
-                              prev->upstream.connect_timeout, 60000);
+    ngx_memcpy(hc->name.data, pc->name->data, pc->name->len);
+    hc->name.len = pc->name->len;
 
-    ngx_conf_merge_msec_value(conf->upstream.send_timeout,
-                              prev->upstream.send_timeout, 60000);
+    ngx_memzero(&peer, sizeof(ngx_peer_connection_t));
 
-    ngx_conf_merge_msec_value(conf->upstream.read_timeout,
-                              prev->upstream.read_timeout, 60000);
+    peer.sockaddr = hc->sockaddr;
+    peer.socklen = hc->socklen;
+    peer.name = &hc->name;
+    peer.get = ngx_event_get_peer;
+    peer.log = ngx_cycle->log;
+    peer.log_error = NGX_ERROR_ERR;
 
-    ngx_conf_merge_msec_value(conf->upstream.next_upstream_timeout,
-                              prev->upstream.next_upstream_timeout, 0);
+    rc = ngx_event_connect_peer(&peer);
 
-    ngx_conf_merge_size_value(conf->upstream.send_lowat,
-                              prev->upstream.send_lowat, 0);
-                              
-    ngx_conf_merge_size_value(conf->upstream.buffer_size,
-                              prev->upstream.buffer_size,
-                              (size_t) ngx_pagesize);
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        if (peer.connection) {
+            ngx_close_connection(peer.connection);
+        }
 
-    ngx_conf_merge_size_value(conf->upstream.limit_rate,
-                              prev->upstream.limit_rate, 0);
+        goto failed;
+    }
 
+    c = peer.connection;
 
-    ngx_conf_merge_bufs_value(conf->upstream.bufs, prev->upstream.bufs,
-                              8, ngx_pagesize);
+    c->data = hc;
+    c->pool = pool;
+
+    c->read->handler = ngx_http_fastcgi_mux_read_handler;
+    c->write->handler = ngx_http_fastcgi_mux_write_handler;
+
+    hc->connection = c;
+
+    ngx_queue_init(&hc->streams);
+
+    if (ngx_http_fastcgi_mux_conns.next == NULL) {
+        ngx_queue_init(&ngx_http_fastcgi_mux_conns);
+    }
+
+    ngx_queue_insert_tail(&ngx_http_fastcgi_mux_conns, &hc->queue);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "fastcgi mux connection %p to %V", hc, &hc->name);
+
+    if (rc == NGX_AGAIN) {
+        ngx_add_timer(c->write, timeout, NGX_FUNC_LINE);
+        return hc;
+    }
+
+    hc->connected = 1;
+
+    return hc;
+
+failed:
+
+    ngx_destroy_pool(pool);
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_http_fastcgi_mux_test_connect(ngx_connection_t *c)
+{
+    int        err;
+    socklen_t  len;
+
+#if (NGX_HAVE_KQUEUE)
+
+    if (ngx_event_flags & NGX_USE_KQUEUE_EVENT)  {
+        if (c->write->pending_eof || c->read->pending_eof) {
+            if (c->write->pending_eof) {
+                err = c->write->kq_errno;
+
+            } else {
+                err = c->read->kq_errno;
+            }
+
+            c->log->action = "connecting to upstream";
+            (void) ngx_connection_error(c, err,
+                                    "kevent() reported that connect() failed");
+            return NGX_ERROR;
+        }
+
+    } else
+#endif
+    {
+        err = 0;
+        len = sizeof(int);
+
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len)
+            == -1)
+        {
+            err = ngx_socket_errno;
+        }
+
+        if (err) {
+            c->log->action = "connecting to upstream";
+            (void) ngx_connection_error(c, err, "connect() failed");
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_fastcgi_mux_read_handler(ngx_event_t *rev)
+{
+    ssize_t                       n;
+    ngx_connection_t             *c;
+    ngx_http_fastcgi_mux_conn_t  *hc;
+
+    u_char  buf[NGX_HTTP_FASTCGI_MUX_BUFFER_SIZE];
+
+    c = rev->data;
+    hc = c->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "fastcgi mux read");
+
+    if (rev->timedout || c->close) {
+        ngx_http_fastcgi_mux_close(hc);
+        return;
+    }
+
+    while (!hc->input_blocked) {
+        n = c->recv(c, buf, NGX_HTTP_FASTCGI_MUX_BUFFER_SIZE);
+
+        if (n == NGX_AGAIN) {
+            break;
+        }
+
+        if (n == 0 || n == NGX_ERROR) {
+            if (n == 0 && hc->nused) {
+                ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                              "upstream \"%V\" closed fastcgi connection",
+                              &hc->name);
+            }
+
+            ngx_http_fastcgi_mux_close(hc);
+            return;
+        }
+
+        if (ngx_http_fastcgi_mux_demux(hc, buf, n) != NGX_OK) {
+            ngx_http_fastcgi_mux_close(hc);
+            return;
+        }
+    }
+
+    if (ngx_handle_read_event(rev, 0, NGX_FUNC_LINE) != NGX_OK) {
+        ngx_http_fastcgi_mux_close(hc);
+        return;
+    }
+
+    if (ngx_http_fastcgi_mux_send(hc) != NGX_OK) {
+        ngx_http_fastcgi_mux_close(hc);
+    }
+}
+
+
+static void
+ngx_http_fastcgi_mux_write_handler(ngx_event_t *wev)
+{
+    ngx_connection_t             *c;
+    ngx_http_fastcgi_mux_conn_t  *hc;
+
+    c = wev->data;
+    hc = c->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "fastcgi mux write");
+
+    if (!hc->connected) {
+
+        if (wev->timedout) {
+            ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT,
+                          "upstream \"%V\" timed out while connecting",
+                          &hc->name);
+            ngx_http_fastcgi_mux_close(hc);
+            return;
+        }
+
+        if (ngx_http_fastcgi_mux_test_connect(c) != NGX_OK) {
+            ngx_http_fastcgi_mux_close(hc);
+            return;
+        }
+
+        if (wev->timer_set) {
+            ngx_del_timer(wev, NGX_FUNC_LINE);
+        }
+
+        hc->connected = 1;
+
+        ngx_http_fastcgi_mux_wake_blocked(hc);
+    }
+
+    if (ngx_http_fastcgi_mux_send(hc) != NGX_OK) {
+        ngx_http_fastcgi_mux_close(hc);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_fastcgi_mux_send(ngx_http_fastcgi_mux_conn_t *hc)
+{
+    ssize_t                      n;
+    ngx_connection_t            *c;
+    ngx_http_fastcgi_mux_buf_t  *b;
+
+    if (!hc->connected) {
+        return NGX_OK;
+    }
+
+    c = hc->connection;
+
+    while (hc->out) {
+        b = hc->out;
+
+        n = c->send(c, b->pos, b->last - b->pos);
+
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (n == NGX_AGAIN) {
+            break;
+        }
+
+        b->pos += n;
+        hc->out_size -= n;
+
+        if (b->pos != b->last) {
+            break;
+        }
+
+        hc->out = b->next;
+
+        if (hc->out == NULL) {
+            hc->last_out = NULL;
+        }
+
+        ngx_http_fastcgi_mux_free_buf(hc, b);
+    }
+
+    if (ngx_handle_write_event(c->write, 0, NGX_FUNC_LINE) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (hc->out_size < NGX_HTTP_FASTCGI_MUX_OUTPUT_LIMIT) {
+        ngx_http_fastcgi_mux_wake_blocked(hc);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_fastcgi_mux_post(ngx_http_fastcgi_mux_conn_t *hc)
+{
+    ngx_event_t  *wev;
+
+    wev = hc->connection->write;
+
+    if (hc->connected && hc->out && !wev->posted) {
+        ngx_post_event(wev, &ngx_posted_events);
+    }
+}
+
+
+static void
+ngx_http_fastcgi_mux_close(ngx_http_fastcgi_mux_conn_t *hc)
+{
+    ngx_pool_t                     *pool;
+    ngx_queue_t                    *q;
+    ngx_http_fastcgi_mux_buf_t     *b, *next;
+    ngx_http_fastcgi_mux_stream_t  *st;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, hc->connection->log, 0,
+                   "close fastcgi mux connection %p", hc);
+
+    while (!ngx_queue_empty(&hc->streams)) {
+        q = ngx_queue_head(&hc->streams);
+        ngx_queue_remove(q);
+
+        st = ngx_queue_data(q, ngx_http_fastcgi_mux_stream_t, queue);
+
+        /* the input buffers are freed by the stream itself */
+
+        st->hc = NULL;
+        st->c.fd = (ngx_socket_t) -1;
+
+        if (!st->in_closed) {
+            st->reset = 1;
+        }
+
+        ngx_http_fastcgi_mux_wake(&st->read);
+        ngx_http_fastcgi_mux_wake(&st->write);
+    }
+
+    ngx_queue_remove(&hc->queue);
+
+    for (b = hc->out; b; b = next) {
+        next = b->next;
+        ngx_free(b);
+    }
+
+    for (b = hc->free; b; b = next) {
+        next = b->next;
+        ngx_free(b);
+    }
+
+    /* hc itself is allocated from the pool */
+
+    pool = hc->connection->pool;
+
+    ngx_close_connection(hc->connection);
+    ngx_destroy_pool(pool);
+}
+
+
+static void
+ngx_http_fastcgi_mux_idle(ngx_http_fastcgi_mux_conn_t *hc)
+{
+    ngx_connection_t  *c;
+
+    c = hc->connection;
+
+    c->idle = 1;
+    c->log = ngx_cycle->log;
+    c->read->log = ngx_cycle->log;
+    c->write->log = ngx_cycle->log;
+    c->pool->log = ngx_cycle->log;
+
+    ngx_add_timer(c->read, NGX_HTTP_FASTCGI_MUX_IDLE_TIMEOUT, NGX_FUNC_LINE);
+}
+
+
+/*
+ * The records received are passed to the requests byte by byte as they
+ * arrive, only the record header is collected to find out the request.
+ */
+
+static ngx_int_t
+ngx_http_fastcgi_mux_demux(ngx_http_fastcgi_mux_conn_t *hc, u_char *pos,
+    size_t len)
+{
+    u_char                         *p;
+    size_t                          n;
+    ngx_http_fastcgi_header_t      *h;
+    ngx_http_fastcgi_mux_stream_t  *st;
+
+    while (len) {
+
+        if (hc->in_rest == 0) {
+
+            /* the record header */
+
+            n = ngx_min(len, sizeof(ngx_http_fastcgi_header_t)
+                             - hc->in_header_len);
+
+            ngx_memcpy(hc->in_header + hc->in_header_len, pos, n);
+
+            hc->in_header_len += n;
+            pos += n;
+            len -= n;
+
+            if (hc->in_header_len < sizeof(ngx_http_fastcgi_header_t)) {
+                return NGX_OK;
+            }
+
+            hc->in_header_len = 0;
+
+            h = (ngx_http_fastcgi_header_t *) hc->in_header;
+
+            if (h->version != 1) {
+                ngx_log_error(NGX_LOG_ERR, hc->connection->log, 0,
+                              "upstream \"%V\" sent unsupported FastCGI "
+                              "protocol version: %d", &hc->name, h->version);
+                return NGX_ERROR;
+            }
+
+            hc->in_id = (h->request_id_hi << 8) | h->request_id_lo;
+            hc->in_type = h->type;
+            hc->in_pos = 0;
+            ngx_memzero(&hc->in_end, sizeof(ngx_http_fastcgi_end_request_t));
+
+            hc->in_rest = ((h->content_length_hi << 8) | h->content_length_lo)
+                          + h->padding_length;
+
+            st = ngx_http_fastcgi_mux_find(hc, hc->in_id);
+
+            ngx_log_debug4(NGX_LOG_DEBUG_HTTP, hc->connection->log, 0,
+                           "fastcgi mux record type:%ui id:%ui l:%uz st:%p",
+                           hc->in_type, hc->in_id, hc->in_rest, st);
+
+            if (st && hc->in_type != NGX_HTTP_FASTCGI_END_REQUEST) {
+
+                /* the module only knows its own request id */
+
+                h->request_id_hi = 0;
+                h->request_id_lo = 1;
+
+                if (ngx_http_fastcgi_mux_input(st, hc->in_header,
+                                               sizeof(ngx_http_fastcgi_header_t))
+                    != NGX_OK)
+                {
+                    return NGX_ERROR;
+                }
+            }
+
+        } else {
+            n = ngx_min(len, hc->in_rest);
+
+            st = ngx_http_fastcgi_mux_find(hc, hc->in_id);
+
+            if (hc->in_type == NGX_HTTP_FASTCGI_END_REQUEST) {
+
+                /* the body is checked before the record is passed */
+
+                if (hc->in_pos < sizeof(ngx_http_fastcgi_end_request_t)) {
+                    p = (u_char *) &hc->in_end;
+                    ngx_memcpy(p + hc->in_pos, pos,
+                               ngx_min(n, sizeof(ngx_http_fastcgi_end_request_t)
+                                          - hc->in_pos));
+                }
+
+            } else if (st) {
+                if (ngx_http_fastcgi_mux_input(st, pos, n) != NGX_OK) {
+                    return NGX_ERROR;
+                }
+            }
+
+            hc->in_pos += n;
+            hc->in_rest -= n;
+            pos += n;
+            len -= n;
+        }
+
+        if (hc->in_rest == 0 && hc->in_header_len == 0
+            && hc->in_type == NGX_HTTP_FASTCGI_END_REQUEST)
+        {
+            if (ngx_http_fastcgi_mux_end_request(hc) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            /* the header of the next record is expected */
+
+            hc->in_type = 0;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_fastcgi_mux_end_request(ngx_http_fastcgi_mux_conn_t *hc)
+{
+    ngx_uint_t                      id;
+    ngx_http_fastcgi_header_t      *h;
+    ngx_http_fastcgi_mux_stream_t  *st;
+
+    id = hc->in_id;
+
+    if (id == 0 || id > hc->nslots || hc->requests[id] == NULL) {
+        ngx_log_error(NGX_LOG_ERR, hc->connection->log, 0,
+                      "upstream \"%V\" sent FastCGI end request for "
+                      "unknown request id %ui", &hc->name, id);
+        return NGX_OK;
+    }
+
+    st = ngx_http_fastcgi_mux_find(hc, id);
+
+    /* the request id may be reused now */
+
+    hc->requests[id] = NULL;
+    hc->nused--;
+
+    if (st == NULL) {
+        /* an aborted request */
+        return NGX_OK;
+    }
+
+    st->id = 0;
+
+    /* the application will not read the rest of the request */
+
+    st->out_closed = 1;
+
+    if (hc->owner == st && ngx_http_fastcgi_mux_finish_record(st) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (hc->in_pos >= sizeof(ngx_http_fastcgi_end_request_t)
+        && hc->in_end.protocol_status == NGX_HTTP_FASTCGI_CANT_MPX_CONN)
+    {
+        /*
+         * the application does not multiplex, the request will be
+         * retried on another connection
+         */
+
+        if (hc->max_requests != 1) {
+            ngx_log_error(NGX_LOG_WARN, hc->connection->log, 0,
+                          "upstream \"%V\" cannot multiplex "
+                          "FastCGI connection", &hc->name);
+
+            hc->max_requests = 1;
+        }
+
+        st->reset = 1;
+
+        ngx_http_fastcgi_mux_wake(&st->read);
+        ngx_http_fastcgi_mux_wake(&st->write);
+
+        return NGX_OK;
+    }
+
+    /* the whole record as received, with the id changed */
+
+    h = (ngx_http_fastcgi_header_t *) hc->in_header;
+
+    h->version = 1;
+    h->type = NGX_HTTP_FASTCGI_END_REQUEST;
+    h->request_id_hi = 0;
+    h->request_id_lo = 1;
+    h->content_length_hi = 0;
+    h->content_length_lo = sizeof(ngx_http_fastcgi_end_request_t);
+    h->padding_length = 0;
+    h->reserved = 0;
+
+    if (ngx_http_fastcgi_mux_input(st, hc->in_header,
+                                   sizeof(ngx_http_fastcgi_header_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (ngx_http_fastcgi_mux_input(st, (u_char *) &hc->in_end,
+                                   sizeof(ngx_http_fastcgi_end_request_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    st->in_closed = 1;
+
+    ngx_http_fastcgi_mux_wake(&st->read);
+
+    if (st->blocked) {
+        st->blocked = 0;
+        ngx_http_fastcgi_mux_wake(&st->write);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_fastcgi_mux_input(ngx_http_fastcgi_mux_stream_t *st, u_char *pos,
+    size_t len)
+{
+    u_char                      *p;
+    size_t                       n;
+    ngx_http_fastcgi_mux_buf_t  *b;
+
+    if (st->reset || st->in_closed) {
+        return NGX_OK;
+    }
+
+    while (len) {
+        b = st->last_in;
+
+        if (b == NULL || b->last == b->end) {
+
+            /* a new buffer, see ngx_http_fastcgi_mux_reserve() */
+
+            p = ngx_http_fastcgi_mux_reserve(st->hc, &st->in, &st->last_in, 1);
+            if (p == NULL) {
+                return NGX_ERROR;
+            }
+
+            b = st->last_in;
+            b->last = p;
+        }
+
+        n = ngx_min(len, (size_t) (b->end - b->last));
+
+        b->last = ngx_cpymem(b->last, pos, n);
+
+        pos += n;
+        len -= n;
+        st->in_size += n;
+    }
+
+    if (st->in_size > NGX_HTTP_FASTCGI_MUX_INPUT_LIMIT) {
+        st->hc->input_blocked = 1;
+    }
+
+    ngx_http_fastcgi_mux_wake(&st->read);
+
+    return NGX_OK;
+}
+
+
+static ngx_http_fastcgi_mux_stream_t *
+ngx_http_fastcgi_mux_find(ngx_http_fastcgi_mux_conn_t *hc, ngx_uint_t id)
+{
+    void  *st;
+
+    if (id == 0 || id > hc->nslots) {
+        return NULL;
+    }
+
+    st = hc->requests[id];
+
+    if (st == &ngx_http_fastcgi_mux_draining) {
+        return NULL;
+    }
+
+    return st;
+}
+
+
+static ssize_t
+ngx_http_fastcgi_mux_recv(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    size_t                          n, total;
+    ngx_event_t                    *rev;
+    ngx_http_fastcgi_mux_buf_t     *b;
+    ngx_http_fastcgi_mux_conn_t    *hc;
+    ngx_http_fastcgi_mux_stream_t  *st;
+
+    st = (ngx_http_fastcgi_mux_stream_t *) c;
+    hc = st->hc;
+    rev = c->read;
+
+    total = 0;
+
+    while (st->in && size) {
+        b = st->in;
+
+        n = ngx_min((size_t) (b->last - b->pos), size);
+
+        buf = ngx_cpymem(buf, b->pos, n);
+
+        b->pos += n;
+        size -= n;
+        total += n;
+
+        if (b->pos == b->last) {
+            st->in = b->next;
+
+            if (st->in == NULL) {
+                st->last_in = NULL;
+            }
+
+            ngx_http_fastcgi_mux_free_buf(hc, b);
+        }
+    }
+
+    if (total) {
+        st->in_size -= total;
+
+        if (hc && hc->input_blocked
+            && st->in_size <= NGX_HTTP_FASTCGI_MUX_INPUT_LIMIT / 2)
+        {
+            ngx_http_fastcgi_mux_unblock_input(hc);
+        }
+
+        rev->ready = (st->in || st->in_closed || st->reset);
+
+        return total;
+    }
+
+    if (st->reset || (hc == NULL && !st->in_closed)) {
+        rev->ready = 0;
+        rev->error = 1;
+        return NGX_ERROR;
+    }
+
+    if (st->in_closed) {
+        rev->ready = 0;
+        rev->eof = 1;
+        return 0;
+    }
+
+    rev->ready = 0;
+
+    return NGX_AGAIN;
+}
+
+
+static ssize_t
+ngx_http_fastcgi_mux_recv_chain(ngx_connection_t *c, ngx_chain_t *cl,
+    off_t limit)
+{
+    size_t      size;
+    ssize_t     n, total;
+    ngx_buf_t  *b;
+
+    total = 0;
+
+    for ( /* void */ ; cl; cl = cl->next) {
+        b = cl->buf;
+
+        size = b->end - b->last;
+
+        if (limit && (off_t) (total + size) > limit) {
+            size = limit - total;
+        }
+
+        /* like readv(), the buffers are filled but not advanced */
+
+        n = ngx_http_fastcgi_mux_recv(c, b->last, size);
+
+        if (n == NGX_AGAIN || n == NGX_ERROR || n == 0) {
+            return total ? total : n;
+        }
+
+        total += n;
+
+        if ((size_t) n < size || (limit && total >= limit)) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+
+static ngx_chain_t *
+ngx_http_fastcgi_mux_send_chain(ngx_connection_t *c, ngx_chain_t *in,
+    off_t limit)
+{
+    ngx_int_t                       rc;
+    ngx_buf_t                      *b;
+    ngx_http_fastcgi_mux_conn_t    *hc;
+    ngx_http_fastcgi_mux_stream_t  *st;
+
+    st = (ngx_http_fastcgi_mux_stream_t *) c;
+    hc = st->hc;
+
+    if (hc == NULL || st->reset) {
+        c->write->error = 1;
+        return NGX_CHAIN_ERROR;
+    }
+
+    if (!hc->connected) {
+        st->blocked = 1;
+        c->write->ready = 0;
+        return in;
+    }
+
+    for ( /* void */ ; in; in = in->next) {
+        b = in->buf;
+
+        if (ngx_buf_special(b)) {
+            continue;
+        }
+
+        rc = ngx_http_fastcgi_mux_output(st, b);
+
+        if (rc == NGX_ERROR) {
+            c->write->error = 1;
+            return NGX_CHAIN_ERROR;
+        }
+
+        if (rc == NGX_AGAIN) {
+            break;
+        }
+    }
+
+    ngx_http_fastcgi_mux_post(hc);
+
+    if (in) {
+        st->blocked = 1;
+        c->write->ready = 0;
+    }
+
+    return in;
+}
+
+
+static ngx_int_t
+ngx_http_fastcgi_mux_output(ngx_http_fastcgi_mux_stream_t *st, ngx_buf_t *b)
+{
+    u_char                       *p;
+    size_t                        n;
+    ngx_http_fastcgi_header_t    *h;
+    ngx_http_fastcgi_mux_conn_t  *hc;
+
+    hc = st->hc;
+
+    for ( ;; ) {
+
+        if (ngx_buf_size(b) == 0) {
+            return NGX_OK;
+        }
+
+        if (st->out_closed) {
+
+            /* the rest of the request body is not needed */
+
+            b->pos = b->last;
+            b->file_pos = b->file_last;
+
+            return NGX_OK;
+        }
+
+        if (hc->owner && hc->owner != st) {
+            return NGX_AGAIN;
+        }
+
+        if (st->out_rest == 0) {
+
+            /* records are only started while the output is short */
+
+            if (st->out_header_len == 0
+                && hc->out_size >= NGX_HTTP_FASTCGI_MUX_OUTPUT_LIMIT)
+            {
+                return NGX_AGAIN;
+            }
+
+            n = ngx_min((size_t) ngx_buf_size(b),
+                        sizeof(ngx_http_fastcgi_header_t)
+                        - st->out_header_len);
+
+            if (ngx_http_fastcgi_mux_copy(st, b, st->out_header
+                                                 + st->out_header_len, n)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            st->out_header_len += n;
+
+            if (st->out_header_len < sizeof(ngx_http_fastcgi_header_t)) {
+                continue;
+            }
+
+            st->out_header_len = 0;
+
+            h = (ngx_http_fastcgi_header_t *) st->out_header;
+
+            h->request_id_hi = (u_char) (st->id >> 8);
+            h->request_id_lo = (u_char) st->id;
+
+            p = ngx_http_fastcgi_mux_reserve(hc, &hc->out, &hc->last_out,
+                                             sizeof(ngx_http_fastcgi_header_t));
+            if (p == NULL) {
+                return NGX_ERROR;
+            }
+
+            ngx_memcpy(p, st->out_header, sizeof(ngx_http_fastcgi_header_t));
+            hc->out_size += sizeof(ngx_http_fastcgi_header_t);
+
+            st->out_rest = ((h->content_length_hi << 8) | h->content_length_lo)
+                           + h->padding_length;
+
+            if (st->out_rest) {
+                hc->owner = st;
+            }
+
+            continue;
+        }
+
+        n = ngx_min((off_t) st->out_rest, ngx_buf_size(b));
+        n = ngx_min(n, NGX_HTTP_FASTCGI_MUX_BUFFER_SIZE);
+
+        p = ngx_http_fastcgi_mux_reserve(hc, &hc->out, &hc->last_out, n);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        hc->out_size += n;
+
+        if (ngx_http_fastcgi_mux_copy(st, b, p, n) != NGX_OK) {
+
+            /* the record is reserved already */
+
+            ngx_http_fastcgi_mux_close(hc);
+            return NGX_ERROR;
+        }
+
+        st->out_rest -= n;
+
+        if (st->out_rest == 0) {
+            hc->owner = NULL;
+            ngx_http_fastcgi_mux_wake_blocked(hc);
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_http_fastcgi_mux_copy(ngx_http_fastcgi_mux_stream_t *st, ngx_buf_t *b,
+    u_char *p, size_t size)
+{
+    ssize_t  n;
+
+    if (ngx_buf_in_memory(b)) {
+        ngx_memcpy(p, b->pos, size);
+        b->pos += size;
+
+        if (b->in_file) {
+            b->file_pos += size;
+        }
+
+        return NGX_OK;
+    }
+
+    n = ngx_read_file(b->file, p, size, b->file_pos);
+
+    if (n != (ssize_t) size) {
+        if (n != NGX_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, st->c.log, 0,
+                          ngx_read_file_n " read only %z of %uz from \"%s\"",
+                          n, size, b->file->name.data);
+        }
+
+        return NGX_ERROR;
+    }
+
+    b->file_pos += size;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_fastcgi_mux_close_stream(ngx_http_fastcgi_mux_stream_t *st)
+{
+    u_char                       *p;
+    ngx_connection_t             *c;
+    ngx_http_fastcgi_mux_buf_t   *b;
+    ngx_http_fastcgi_mux_conn_t  *hc;
+    ngx_http_fastcgi_header_t    *h;
+
+    c = &st->c;
+    hc = st->hc;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "fastcgi mux close request %p id:%ui", st, st->id);
+
+    if (st->read.timer_set) {
+        ngx_del_timer(&st->read, NGX_FUNC_LINE);
+    }
+
+    if (st->write.timer_set) {
+        ngx_del_timer(&st->write, NGX_FUNC_LINE);
+    }
+
+    if (st->read.posted) {
+        ngx_delete_posted_event(&st->read);
+    }
+
+    if (st->write.posted) {
+        ngx_delete_posted_event(&st->write);
+    }
+
+    while (st->in) {
+        b = st->in;
+        st->in = b->next;
+        ngx_http_fastcgi_mux_free_buf(hc, b);
+    }
+
+    if (c->pool) {
+        ngx_destroy_pool(c->pool);
+    }
+
+    if (hc == NULL) {
+        ngx_free(st);
+        return;
+    }
+
+    if (hc->owner == st && ngx_http_fastcgi_mux_finish_record(st) != NGX_OK) {
+        ngx_http_fastcgi_mux_close(hc);
+        ngx_free(st);
+        return;
+    }
+
+    if (st->id) {
+
+        /* the id is not reused until the application ends the request */
+
+        hc->requests[st->id] = &ngx_http_fastcgi_mux_draining;
+
+        p = ngx_http_fastcgi_mux_reserve(hc, &hc->out, &hc->last_out,
+                                         sizeof(ngx_http_fastcgi_header_t));
+        if (p) {
+            h = (ngx_http_fastcgi_header_t *) p;
+
+            h->version = 1;
+            h->type = NGX_HTTP_FASTCGI_ABORT_REQUEST;
+            h->request_id_hi = (u_char) (st->id >> 8);
+            h->request_id_lo = (u_char) st->id;
+            h->content_length_hi = 0;
+            h->content_length_lo = 0;
+            h->padding_length = 0;
+            h->reserved = 0;
+
+            hc->out_size += sizeof(ngx_http_fastcgi_header_t);
+        }
+    }
+
+    ngx_queue_remove(&st->queue);
+    hc->nstreams--;
+
+    if (hc->input_blocked) {
+        ngx_http_fastcgi_mux_unblock_input(hc);
+    }
+
+    ngx_http_fastcgi_mux_wake_blocked(hc);
+    ngx_http_fastcgi_mux_post(hc);
+
+    if (hc->nstreams == 0) {
+        ngx_http_fastcgi_mux_idle(hc);
+    }
+
+    ngx_free(st);
+}
+
+
+/* pads the record the request has started, the connection is released */
+
+static ngx_int_t
+ngx_http_fastcgi_mux_finish_record(ngx_http_fastcgi_mux_stream_t *st)
+{
+    u_char                       *p;
+    ngx_http_fastcgi_mux_conn_t  *hc;
+
+    hc = st->hc;
+
+    p = ngx_http_fastcgi_mux_reserve(hc, &hc->out, &hc->last_out,
+                                     st->out_rest);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(p, st->out_rest);
+
+    hc->out_size += st->out_rest;
+    st->out_rest = 0;
+
+    hc->owner = NULL;
+
+    ngx_http_fastcgi_mux_wake_blocked(hc);
+    ngx_http_fastcgi_mux_post(hc);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_fastcgi_mux_unblock_input(ngx_http_fastcgi_mux_conn_t *hc)
+{
+    ngx_queue_t                    *q;
+    ngx_http_fastcgi_mux_stream_t  *st;
+
+    for (q = ngx_queue_head(&hc->streams);
+         q != ngx_queue_sentinel(&hc->streams);
+         q = ngx_queue_next(q))
+    {
+        st = ngx_queue_data(q, ngx_http_fastcgi_mux_stream_t, queue);
+
+        if (st->in_size > NGX_HTTP_FASTCGI_MUX_INPUT_LIMIT / 2) {
+            return;
+        }
+    }
+
+    hc->input_blocked = 0;
+
+    ngx_http_fastcgi_mux_wake(hc->connection->read);
+}
+
+
+static void
+ngx_http_fastcgi_mux_wake(ngx_event_t *ev)
+{
+    ev->ready = 1;
+
+    if (ev->handler && !ev->posted) {
+        ngx_post_event(ev, &ngx_posted_events);
+    }
+}
+
+
+static void
+ngx_http_fastcgi_mux_wake_blocked(ngx_http_fastcgi_mux_conn_t *hc)
+{
+    ngx_queue_t                    *q;
+    ngx_http_fastcgi_mux_stream_t  *st;
+
+    for (q = ngx_queue_head(&hc->streams);
+         q != ngx_queue_sentinel(&hc->streams);
+         q = ngx_queue_next(q))
+    {
+        st = ngx_queue_data(q, ngx_http_fastcgi_mux_stream_t, queue);
+
+        if (st->blocked) {
+            st->blocked = 0;
+            ngx_http_fastcgi_mux_wake(&st->write);
+        }
+    }
+}
+
+
+/* appends size bytes to a list of buffers, the bytes are never split */
+
+static u_char *
+ngx_http_fastcgi_mux_reserve(ngx_http_fastcgi_mux_conn_t *hc,
+    ngx_http_fastcgi_mux_buf_t **first, ngx_http_fastcgi_mux_buf_t **last,
+    size_t size)
+{
+    u_char                      *p;
+    ngx_http_fastcgi_mux_buf_t  *b;
+
+    b = *last;
+
+    if (b == NULL || (size_t) (b->end - b->last) < size) {
+
+        if (size <= NGX_HTTP_FASTCGI_MUX_BUFFER_SIZE && hc->free) {
+            b = hc->free;
+            hc->free = b->next;
+            hc->nfree--;
+
+        } else {
+            b = ngx_alloc(sizeof(ngx_http_fastcgi_mux_buf_t)
+                          + ngx_max(size, NGX_HTTP_FASTCGI_MUX_BUFFER_SIZE),
+                          hc->connection->log);
+            if (b == NULL) {
+                return NULL;
+            }
+
+            b->end = ngx_http_fastcgi_mux_buf_start(b)
+                     + ngx_max(size, NGX_HTTP_FASTCGI_MUX_BUFFER_SIZE);
+        }
+
+        b->pos = ngx_http_fastcgi_mux_buf_start(b);
+        b->last = b->pos;
+        b->next = NULL;
+
+        if (*last) {
+            (*last)->next = b;
+
+        } else {
+            *first = b;
+        }
+
+        *last = b;
+    }
+
+    p = b->last;
+    b->last += size;
+
+    return p;
+}
+
+
+static void
+ngx_http_fastcgi_mux_free_buf(ngx_http_fastcgi_mux_conn_t *hc,
+    ngx_http_fastcgi_mux_buf_t *b)
+{
+    if (hc == NULL
+        || hc->nfree >= NGX_HTTP_FASTCGI_MUX_FREE_BUFS
+        || b->end - ngx_http_fastcgi_mux_buf_start(b)
+           != NGX_HTTP_FASTCGI_MUX_BUFFER_SIZE)
+    {
+        ngx_free(b);
+        return;
+    }
+
+    b->next = hc->free;
+    hc->free = b;
+    hc->nfree++;
+}
+
+
+static ngx_int_t
+ngx_http_fastcgi_add_variables(ngx_conf_t *cf)
+{
+   ngx_http_variable_t  *var, *v;
+
+    for (v = ngx_http_fastcgi_vars; v->name.len; v++) {
+        var = ngx_http_add_variable(cf, &v->name, v->flags);
+        if (var == NULL) {
+            return NGX_ERROR;
+        }
+
+        var->get_handler = v->get_handler;
+        var->data = v->data;
+    }
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_fastcgi_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_fastcgi_main_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_fastcgi_main_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+#if (NGX_HTTP_CACHE)
+    if (ngx_array_init(&conf->caches, cf->pool, 4,
+                       sizeof(ngx_http_file_cache_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+#endif
+
+    return conf;
+}
+
+
+static void *
+ngx_http_fastcgi_create_loc_conf(ngx_conf_t *cf)
+{
+    ngx_http_fastcgi_loc_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_fastcgi_loc_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->upstream.bufs.num = 0;
+     *     conf->upstream.ignore_headers = 0;
+     *     conf->upstream.next_upstream = 0;
+     *     conf->upstream.cache_zone = NULL;
+     *     conf->upstream.cache_use_stale = 0;
+     *     conf->upstream.cache_methods = 0;
+     *     conf->upstream.temp_path = NULL;
+     *     conf->upstream.hide_headers_hash = { NULL, 0 };
+     *     conf->upstream.uri = { 0, NULL };
+     *     conf->upstream.location = NULL;
+     *     conf->upstream.store_lengths = NULL;
+     *     conf->upstream.store_values = NULL;
+     *
+     *     conf->index.len = { 0, NULL };
+     */
+
+    conf->upstream.store = NGX_CONF_UNSET;
+    conf->upstream.store_access = NGX_CONF_UNSET_UINT;
+    conf->upstream.next_upstream_tries = NGX_CONF_UNSET_UINT;
+    conf->upstream.buffering = NGX_CONF_UNSET;
+    conf->upstream.request_buffering = NGX_CONF_UNSET;
+    conf->upstream.ignore_client_abort = NGX_CONF_UNSET;
+    conf->upstream.force_ranges = NGX_CONF_UNSET;
+
+    conf->upstream.local = NGX_CONF_UNSET_PTR;
+
+    conf->upstream.connect_timeout = NGX_CONF_UNSET_MSEC;
+    conf->upstream.send_timeout = NGX_CONF_UNSET_MSEC;
+    conf->upstream.read_timeout = NGX_CONF_UNSET_MSEC;
+    conf->upstream.next_upstream_timeout = NGX_CONF_UNSET_MSEC;
+
+    conf->upstream.send_lowat = NGX_CONF_UNSET_SIZE;
+    conf->upstream.buffer_size = NGX_CONF_UNSET_SIZE;
+    conf->upstream.limit_rate = NGX_CONF_UNSET_SIZE;
+
+    conf->upstream.busy_buffers_size_conf = NGX_CONF_UNSET_SIZE;
+    conf->upstream.max_temp_file_size_conf = NGX_CONF_UNSET_SIZE;
+    conf->upstream.temp_file_write_size_conf = NGX_CONF_UNSET_SIZE;
+
+    conf->upstream.pass_request_headers = NGX_CONF_UNSET;
+    conf->upstream.pass_request_body = NGX_CONF_UNSET;
+
+#if (NGX_HTTP_CACHE)
+    conf->upstream.cache = NGX_CONF_UNSET;
+    conf->upstream.cache_min_uses = NGX_CONF_UNSET_UINT;
+    conf->upstream.cache_bypass = NGX_CONF_UNSET_PTR;
+    conf->upstream.no_cache = NGX_CONF_UNSET_PTR;
+    conf->upstream.cache_valid = NGX_CONF_UNSET_PTR;
+    conf->upstream.cache_lock = NGX_CONF_UNSET;
+    conf->upstream.cache_lock_timeout = NGX_CONF_UNSET_MSEC;
+    conf->upstream.cache_lock_age = NGX_CONF_UNSET_MSEC;
+    conf->upstream.cache_revalidate = NGX_CONF_UNSET;
+    conf->upstream.cache_background_update = NGX_CONF_UNSET;
+#endif
+
+    conf->upstream.hide_headers = NGX_CONF_UNSET_PTR;
+    conf->upstream.pass_headers = NGX_CONF_UNSET_PTR;
+
+    conf->upstream.intercept_errors = NGX_CONF_UNSET;
+
+    /* "fastcgi_cyclic_temp_file" is disabled */
+    conf->upstream.cyclic_temp_file = 0;
+
+    conf->upstream.change_buffering = 1;
+
+    conf->catch_stderr = NGX_CONF_UNSET_PTR;
+
+    conf->keep_conn = NGX_CONF_UNSET;
+    conf->multiplex = NGX_CONF_UNSET;
+    conf->multiplex_requests = NGX_CONF_UNSET_UINT;
+
+    ngx_str_set(&conf->upstream.module, "fastcgi");
+
+    return conf;
+}
+
+
+static char *
+ngx_http_fastcgi_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_fastcgi_loc_conf_t *prev = parent;
+    ngx_http_fastcgi_loc_conf_t *conf = child;
+
+    size_t                        size;
+    ngx_int_t                     rc;
+    ngx_hash_init_t               hash;
+    ngx_http_core_loc_conf_t     *clcf;
+
+#if (NGX_HTTP_CACHE)
+
+    if (conf->upstream.store > 0) {
+        conf->upstream.cache = 0;
+    }
+
+    if (conf->upstream.cache > 0) {
+        conf->upstream.store = 0;
+    }
+
+#endif
+
+    if (conf->upstream.store == NGX_CONF_UNSET) {
+        ngx_conf_merge_value(conf->upstream.store,
+                              prev->upstream.store, 0);
+
+        conf->upstream.store_lengths = prev->upstream.store_lengths;
+        conf->upstream.store_values = prev->upstream.store_values;
+    }
+
+    ngx_conf_merge_uint_value(conf->upstream.store_access,
+                              prev->upstream.store_access, 0600);
+
+    ngx_conf_merge_uint_value(conf->upstream.next_upstream_tries,
+                              prev->upstream.next_upstream_tries, 0);
+
+    ngx_conf_merge_value(conf->upstream.buffering,
+                              prev->upstream.buffering, 1);
+
+    ngx_conf_merge_value(conf->upstream.request_buffering,
+                              prev->upstream.request_buffering, 1);
+
+    ngx_conf_merge_value(conf->upstream.ignore_client_abort,
+                              prev->upstream.ignore_client_abort, 0);
+
+    ngx_conf_merge_value(conf->upstream.force_ranges,
+                              prev->upstream.force_ranges, 0);
+
+    ngx_conf_merge_ptr_value(conf->upstream.local,
+                              prev->upstream.local, NULL);
+
+    ngx_conf_merge_msec_value(conf->upstream.connect_timeout,
+                              prev->upstream.connect_timeout, 60000);
+
+    ngx_conf_merge_msec_value(conf->upstream.send_timeout,
+                              prev->upstream.send_timeout, 60000);
+
+    ngx_conf_merge_msec_value(conf->upstream.read_timeout,
+                              prev->upstream.read_timeout, 60000);
+
+    ngx_conf_merge_msec_value(conf->upstream.next_upstream_timeout,
+                              prev->upstream.next_upstream_timeout, 0);
+
+    ngx_conf_merge_size_value(conf->upstream.send_lowat,
+                              prev->upstream.send_lowat, 0);
+                              
+    ngx_conf_merge_size_value(conf->upstream.buffer_size,
+                              prev->upstream.buffer_size,
+                              (size_t) ngx_pagesize);
+
+    ngx_conf_merge_size_value(conf->upstream.limit_rate,
+                              prev->upstream.limit_rate, 0);
+
+
+    ngx_conf_merge_bufs_value(conf->upstream.bufs, prev->upstream.bufs,
+                              8, ngx_pagesize);
 
     if (conf->upstream.bufs.num < 2) {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
@@ -3622,6 +5252,9 @@ ngx_http_fastcgi_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_value(conf->upstream.cache_revalidate,
                               prev->upstream.cache_revalidate, 0);
 
+    ngx_conf_merge_value(conf->upstream.cache_background_update,
+                              prev->upstream.cache_background_update, 0);
+
 #endif
 
     ngx_conf_merge_value(conf->upstream.pass_request_headers,
@@ -3636,6 +5269,16 @@ ngx_http_fastcgi_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_value(conf->keep_conn, prev->keep_conn, 0);
 
+    ngx_conf_merge_value(conf->multiplex, prev->multiplex, 0);
+    ngx_conf_merge_uint_value(conf->multiplex_requests,
+                              prev->multiplex_requests, 16);
+
+    /* requests end with FCGI_END_REQUEST on a shared connection */
+
+    if (conf->multiplex) {
+        conf->keep_conn = 1;
+    }
+
 
     ngx_conf_merge_str_value(conf->index, prev->index, "");
 
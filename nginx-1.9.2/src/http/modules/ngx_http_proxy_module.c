@@ -276,6 +276,9 @@ static ngx_conf_bitmask_t  ngx_http_proxy_ssl_protocols[] = {
 static ngx_conf_enum_t  ngx_http_proxy_http_version[] = {
     { ngx_string("1.0"), NGX_HTTP_VERSION_10 },
     { ngx_string("1.1"), NGX_HTTP_VERSION_11 },
+#if (NGX_HTTP_V2)
+    { ngx_string("2"), NGX_HTTP_VERSION_20 },
+#endif
     { ngx_null_string, 0 }
 };
 
@@ -1078,6 +1081,13 @@ more request may be passed to the proxied server.
       offsetof(ngx_http_proxy_loc_conf_t, upstream.cache_revalidate),
       NULL },
 
+    { ngx_string("proxy_cache_background_update"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_proxy_loc_conf_t, upstream.cache_background_update),
+      NULL },
+
 #endif
 
     /*
@@ -1545,6 +1555,13 @@ static ngx_int_t ngx_http_proxy_handler(ngx_http_request_t *r)
     //调用process_header对于FCGI，当然是调用对应的读取FCGI格式的函数了，对于代理模块，只要处理HTTP格式即可
     u->abort_request = ngx_http_proxy_abort_request;
     u->finalize_request = ngx_http_proxy_finalize_request;
+
+#if (NGX_HTTP_V2)
+    if (plcf->upstream.http2) {
+        u->init_peer = ngx_http_v2_upstream_init_peer;
+    }
+#endif
+
     r->state = 0;
 
     if (plcf->redirects) {
@@ -2046,7 +2063,9 @@ ngx_http_proxy_create_request(ngx_http_request_t *r) //ngx_http_upstream_init_re
 
     u->uri.len = b->last - u->uri.data;
 
-    if (plcf->http_version == NGX_HTTP_VERSION_11) {
+    /* HTTP/2 streams are created from an HTTP/1.1 request */
+
+    if (plcf->http_version != NGX_HTTP_VERSION_10) {
         b->last = ngx_cpymem(b->last, ngx_http_proxy_version_11,
                              sizeof(ngx_http_proxy_version_11) - 1);
 
@@ -2452,6 +2471,13 @@ ngx_http_proxy_process_status_line(ngx_http_request_t *r)
     u->headers_in.status_n = ctx->status.code;
 
     len = ctx->status.end - ctx->status.start;
+
+    /* HTTP/2 has no reason phrase, the standard one is used then */
+
+    if (u->conf->http2 && len == 3) {
+        len = 0;
+    }
+
     u->headers_in.status_line.len = len;
 
     u->headers_in.status_line.data = ngx_pnalloc(r->pool, len);
@@ -3615,6 +3641,7 @@ ngx_http_proxy_create_loc_conf(ngx_conf_t *cf)
     conf->upstream.cache_lock_timeout = NGX_CONF_UNSET_MSEC;
     conf->upstream.cache_lock_age = NGX_CONF_UNSET_MSEC;
     conf->upstream.cache_revalidate = NGX_CONF_UNSET;
+    conf->upstream.cache_background_update = NGX_CONF_UNSET;
 #endif
 
     conf->upstream.hide_headers = NGX_CONF_UNSET_PTR;
@@ -3914,6 +3941,9 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_value(conf->upstream.cache_revalidate,
                               prev->upstream.cache_revalidate, 0);
 
+    ngx_conf_merge_value(conf->upstream.cache_background_update,
+                              prev->upstream.cache_background_update, 0);
+
 #endif
 
     ngx_conf_merge_str_value(conf->method, prev->method, "");
@@ -4030,6 +4060,8 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_uint_value(conf->http_version, prev->http_version,
                               NGX_HTTP_VERSION_10);
 
+    conf->upstream.http2 = (conf->http_version == NGX_HTTP_VERSION_20);
+
     ngx_conf_merge_uint_value(conf->headers_hash_max_size,
                               prev->headers_hash_max_size, 512);
 
@@ -20,6 +20,7 @@ typedef struct {
     ngx_ssl_t                       ssl;
 
     ngx_flag_t                      prefer_server_ciphers;
+    ngx_flag_t                      ktls;
 
     ngx_uint_t                      protocols;
 
@@ -28,6 +29,10 @@ typedef struct {
 
     size_t                          buffer_size;
 
+    ngx_flag_t                      dyn_rec;
+    size_t                          dyn_rec_threshold;
+    ngx_msec_t                      dyn_rec_timeout;
+
     ssize_t                         builtin_session_cache;
 
     time_t                          session_timeout;
@@ -54,6 +59,10 @@ typedef struct {
     ngx_str_t                       stapling_file;
     ngx_str_t                       stapling_responder;
 
+#if (NGX_THREADS)
+    ngx_thread_pool_t              *thread_pool;
+#endif
+
     u_char                         *file;
     ngx_uint_t                      line;
 } ngx_http_ssl_srv_conf_t;
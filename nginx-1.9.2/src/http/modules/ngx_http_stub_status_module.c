@@ -9,11 +9,39 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#if (NGX_THREADS)
+#include <ngx_thread_pool.h>
+#endif
+
+
+#define NGX_HTTP_STUB_STATUS_LOOPS                                            \
+    "worker loop 64 128 256 512 1024 2048 4096 8192 16384 32768 65536 "       \
+    "131072 262144 524288 1048576 inf\n"
+
+
+/* the optional sections printed after the standard lines */
+#define NGX_HTTP_STUB_STATUS_WORKERS       0x0001
+#define NGX_HTTP_STUB_STATUS_THREAD_POOLS  0x0002
+#define NGX_HTTP_STUB_STATUS_SSL_SESSIONS  0x0004
+
+#define NGX_HTTP_STUB_STATUS_THREADS                                          \
+    "thread pool waiting max_waiting posted completed overflows "             \
+    "latency max_latency\n"
+
+#define NGX_HTTP_STUB_STATUS_SSL                                              \
+    "ssl session cache shard hits misses evictions\n"
+
+
+typedef struct {
+    ngx_uint_t                 sections;
+} ngx_http_stub_status_loc_conf_t;
+
 
 static ngx_int_t ngx_http_stub_status_handler(ngx_http_request_t *r);
 static ngx_int_t ngx_http_stub_status_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_stub_status_add_variables(ngx_conf_t *cf);
+static void *ngx_http_stub_status_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_set_stub_status(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 
@@ -21,9 +49,9 @@ static char *ngx_http_set_stub_status(ngx_conf_t *cf, ngx_command_t *cmd,
 static ngx_command_t  ngx_http_status_commands[] = {
 
     { ngx_string("stub_status"),
-      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE1,
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_ANY,
       ngx_http_set_stub_status,
-      0,
+      NGX_HTTP_LOC_CONF_OFFSET,
       0,
       NULL },
 
@@ -41,7 +69,7 @@ static ngx_http_module_t  ngx_http_stub_status_module_ctx = {
     NULL,                                  /* create server configuration */
     NULL,                                  /* merge server configuration */
 
-    NULL,                                  /* create location configuration */
+    ngx_http_stub_status_create_loc_conf,  /* create location configuration */
     NULL                                   /* merge location configuration */
 };
 
@@ -87,11 +115,26 @@ static ngx_http_variable_t  ngx_http_stub_status_vars[] = {
 static ngx_int_t
 ngx_http_stub_status_handler(ngx_http_request_t *r)
 {
-    size_t             size;
-    ngx_int_t          rc;
-    ngx_buf_t         *b;
-    ngx_chain_t        out;
-    ngx_atomic_int_t   ap, hn, ac, rq, rd, wr, wa;
+    size_t              size;
+    ngx_int_t           rc;
+    ngx_buf_t          *b;
+    ngx_uint_t          i, j, n;
+    ngx_chain_t         out;
+    ngx_atomic_int_t    ap, hn, ac, rq, rd, wr, wa;
+    ngx_core_conf_t    *ccf;
+    ngx_stat_loop_t    *sl;
+    ngx_stat_accept_t  *st;
+#if (NGX_THREADS)
+    ngx_str_t                tpn;
+    ngx_thread_pool_stat_t   tps;
+#endif
+#if (NGX_SSL)
+    ngx_list_part_t               *part;
+    ngx_shm_zone_t                *shm_zone;
+    ngx_ssl_session_cache_stat_t   scs;
+#endif
+
+    ngx_http_stub_status_loc_conf_t  *slcf;
 
     if (r->method != NGX_HTTP_GET && r->method != NGX_HTTP_HEAD) {
         return NGX_HTTP_NOT_ALLOWED;
@@ -122,6 +165,86 @@ ngx_http_stub_status_handler(ngx_http_request_t *r)
            + 6 + 3 * NGX_ATOMIC_T_LEN
            + sizeof("Reading:  Writing:  Waiting:  \n") + 3 * NGX_ATOMIC_T_LEN;
 
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_stub_status_module);
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(ngx_cycle->conf_ctx,
+                                           ngx_core_module);
+
+    if (slcf->sections & NGX_HTTP_STUB_STATUS_WORKERS) {
+        n = ngx_min((ngx_uint_t) ccf->worker_processes, ngx_stat_accepts_n);
+
+    } else {
+        n = 0;
+    }
+
+    if (n) {
+        size += sizeof("worker wakeups accepts batch local\n") - 1
+                + n * (7 + NGX_INT_T_LEN + 4 * NGX_ATOMIC_T_LEN);
+    }
+
+    if (n && (ngx_event_flags & NGX_USE_BATCH_EVENT)) {
+        size += sizeof(NGX_HTTP_STUB_STATUS_LOOPS) - 1
+                + n * (3 + NGX_INT_T_LEN
+                       + NGX_STAT_LOOP_BUCKETS * (1 + NGX_ATOMIC_T_LEN));
+    }
+
+#if (NGX_THREADS)
+
+    /* the counters are kept by each worker, these are of the current one */
+
+    if (slcf->sections & NGX_HTTP_STUB_STATUS_THREAD_POOLS) {
+        size += sizeof(NGX_HTTP_STUB_STATUS_THREADS) - 1;
+
+        for (i = 0;
+             ngx_thread_pool_get_stat((ngx_cycle_t *) ngx_cycle, i, &tpn, &tps)
+             == NGX_OK;
+             i++)
+        {
+            size += 10 + tpn.len + 7 * NGX_ATOMIC_T_LEN;
+        }
+    }
+
+#endif
+
+#if (NGX_SSL)
+
+    if (slcf->sections & NGX_HTTP_STUB_STATUS_SSL_SESSIONS) {
+        size += sizeof(NGX_HTTP_STUB_STATUS_SSL) - 1;
+
+        part = (ngx_list_part_t *) &ngx_cycle->shared_memory.part;
+        shm_zone = part->elts;
+
+        for (i = 0; /* void */ ; i++) {
+
+            if (i >= part->nelts) {
+                if (part->next == NULL) {
+                    break;
+                }
+
+                part = part->next;
+                shm_zone = part->elts;
+                i = 0;
+            }
+
+            if (shm_zone[i].init != ngx_ssl_session_cache_init
+                || shm_zone[i].data == NULL)
+            {
+                continue;
+            }
+
+            for (j = 0;
+                 ngx_ssl_session_cache_get_stat(&shm_zone[i], j, &scs)
+                 == NGX_OK;
+                 j++)
+            {
+                size += 7 + shm_zone[i].shm.name.len + NGX_INT_T_LEN
+                        + 3 * NGX_ATOMIC_T_LEN;
+            }
+        }
+    }
+
+#endif
+
     b = ngx_create_temp_buf(r->pool, size);
     if (b == NULL) {
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
@@ -148,6 +271,102 @@ ngx_http_stub_status_handler(ngx_http_request_t *r)
     b->last = ngx_sprintf(b->last, "Reading: %uA Writing: %uA Waiting: %uA \n",
                           rd, wr, wa);
 
+    if (n) {
+        b->last = ngx_cpymem(b->last, "worker wakeups accepts batch local\n",
+                             sizeof("worker wakeups accepts batch local\n")
+                             - 1);
+    }
+
+    for (i = 0; i < n; i++) {
+        st = &ngx_stat_accepts[i];
+
+        b->last = ngx_sprintf(b->last, " %ui %uA %uA %uA %uA \n",
+                              i, st->wakeups, st->accepted, st->batch,
+                              st->local);
+    }
+
+    if (n && (ngx_event_flags & NGX_USE_BATCH_EVENT)) {
+        b->last = ngx_cpymem(b->last, NGX_HTTP_STUB_STATUS_LOOPS,
+                             sizeof(NGX_HTTP_STUB_STATUS_LOOPS) - 1);
+
+        for (i = 0; i < n; i++) {
+            sl = &ngx_stat_loops[i];
+
+            b->last = ngx_sprintf(b->last, " %ui", i);
+
+            for (j = 0; j < NGX_STAT_LOOP_BUCKETS; j++) {
+                b->last = ngx_sprintf(b->last, " %uA", sl->time[j]);
+            }
+
+            *b->last++ = ' ';
+            *b->last++ = LF;
+        }
+    }
+
+#if (NGX_THREADS)
+
+    if (slcf->sections & NGX_HTTP_STUB_STATUS_THREAD_POOLS) {
+        b->last = ngx_cpymem(b->last, NGX_HTTP_STUB_STATUS_THREADS,
+                             sizeof(NGX_HTTP_STUB_STATUS_THREADS) - 1);
+
+        for (i = 0;
+             ngx_thread_pool_get_stat((ngx_cycle_t *) ngx_cycle, i, &tpn, &tps)
+             == NGX_OK;
+             i++)
+        {
+            b->last = ngx_sprintf(b->last,
+                                  " %V %uA %uA %uA %uA %uA %uA %uA \n",
+                                  &tpn, tps.waiting, tps.max_waiting,
+                                  tps.posted, tps.completed, tps.overflows,
+                                  tps.latency, tps.max_latency);
+        }
+    }
+
+#endif
+
+#if (NGX_SSL)
+
+    /* the session caches are shared, the counters are of all workers */
+
+    if (slcf->sections & NGX_HTTP_STUB_STATUS_SSL_SESSIONS) {
+        b->last = ngx_cpymem(b->last, NGX_HTTP_STUB_STATUS_SSL,
+                             sizeof(NGX_HTTP_STUB_STATUS_SSL) - 1);
+
+        part = (ngx_list_part_t *) &ngx_cycle->shared_memory.part;
+        shm_zone = part->elts;
+
+        for (i = 0; /* void */ ; i++) {
+
+            if (i >= part->nelts) {
+                if (part->next == NULL) {
+                    break;
+                }
+
+                part = part->next;
+                shm_zone = part->elts;
+                i = 0;
+            }
+
+            if (shm_zone[i].init != ngx_ssl_session_cache_init
+                || shm_zone[i].data == NULL)
+            {
+                continue;
+            }
+
+            for (j = 0;
+                 ngx_ssl_session_cache_get_stat(&shm_zone[i], j, &scs)
+                 == NGX_OK;
+                 j++)
+            {
+                b->last = ngx_sprintf(b->last, " %V %ui %uA %uA %uA \n",
+                                      &shm_zone[i].shm.name, j, scs.hits,
+                                      scs.misses, scs.evictions);
+            }
+        }
+    }
+
+#endif
+
     r->headers_out.status = NGX_HTTP_OK;
     r->headers_out.content_length_n = b->last - b->pos;
 
@@ -228,11 +447,69 @@ ngx_http_stub_status_add_variables(ngx_conf_t *cf)
 }
 
 
+static void *
+ngx_http_stub_status_create_loc_conf(ngx_conf_t *cf)
+{
+    ngx_http_stub_status_loc_conf_t  *slcf;
+
+    slcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_stub_status_loc_conf_t));
+    if (slcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     slcf->sections = 0;
+     */
+
+    return slcf;
+}
+
+
 static char *
 ngx_http_set_stub_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
+    ngx_http_stub_status_loc_conf_t *slcf = conf;
+
+    ngx_str_t                 *value;
+    ngx_uint_t                 i;
     ngx_http_core_loc_conf_t  *clcf;
 
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strcmp(value[i].data, "workers") == 0) {
+            slcf->sections |= NGX_HTTP_STUB_STATUS_WORKERS;
+            continue;
+        }
+
+#if (NGX_THREADS)
+        if (ngx_strcmp(value[i].data, "thread_pools") == 0) {
+            slcf->sections |= NGX_HTTP_STUB_STATUS_THREAD_POOLS;
+            continue;
+        }
+#endif
+
+#if (NGX_SSL)
+        if (ngx_strcmp(value[i].data, "ssl_session_cache") == 0) {
+            slcf->sections |= NGX_HTTP_STUB_STATUS_SSL_SESSIONS;
+            continue;
+        }
+#endif
+
+        /* "stub_status on" of the old versions */
+
+        if (ngx_strcmp(value[i].data, "on") == 0 && cf->args->nelts == 2) {
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
     clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
     clcf->handler = ngx_http_stub_status_handler;
 
@@ -10,9 +10,50 @@
 #include <ngx_http.h>
 
 
+#define NGX_HTTP_SUB_NONE  (-1)
+
+
 typedef struct {
     ngx_str_t                  match;
     ngx_http_complex_value_t   value;
+} ngx_http_sub_match_t;
+
+
+typedef struct {
+    ngx_uint_t                 depth;
+    ngx_uint_t                 fail;
+
+    /* the longest pattern ending in this state, or NGX_HTTP_SUB_NONE */
+    ngx_int_t                  match;
+} ngx_http_sub_node_t;
+
+
+/*
+ * Aho-Corasick automaton of all sub_filter strings of a location,
+ * converted to a DFA: the next state is a single table lookup per byte
+ * regardless of the number of strings.  Bytes are mapped to classes
+ * first, so the table only has a column per distinct (case-insensitive)
+ * byte of the strings plus one for all other bytes.
+ */
+
+typedef struct {
+    u_char                     classes[256];
+    ngx_uint_t                 nclasses;
+
+    ngx_uint_t                 nnodes;
+    ngx_http_sub_node_t       *nodes;
+    uint32_t                  *next;
+
+    /* the final state of every pattern */
+    ngx_uint_t                *finals;
+
+    size_t                     max_len;
+} ngx_http_sub_tables_t;
+
+
+typedef struct {
+    ngx_array_t               *matches;
+    ngx_http_sub_tables_t     *tables;
 
     ngx_hash_t                 types;
 
@@ -23,15 +64,8 @@ typedef struct {
 } ngx_http_sub_loc_conf_t;
 
 
-typedef enum {
-    sub_start_state = 0,
-    sub_match_state,
-} ngx_http_sub_state_e;
-
-
 typedef struct {
-    ngx_str_t                  match;
-    ngx_str_t                  saved;
+    /* bytes of a possible match that came in previous buffers */
     ngx_str_t                  looked;
 
     ngx_uint_t                 once;   /* unsigned  once:1 */
@@ -40,7 +74,6 @@ typedef struct {
 
     u_char                    *pos;
     u_char                    *copy_start;
-    u_char                    *copy_end;
 
     ngx_chain_t               *in;
     ngx_chain_t               *out;
@@ -48,19 +81,28 @@ typedef struct {
     ngx_chain_t               *busy;
     ngx_chain_t               *free;
 
-    ngx_str_t                  sub;
+    ngx_str_t                 *sub;
+
+    /* sub_filter_once: the strings already replaced */
+    u_char                    *matched;
+    ngx_uint_t                 nmatched;
 
     ngx_uint_t                 state;
+    ngx_int_t                  index;
 } ngx_http_sub_ctx_t;
 
 
 static ngx_int_t ngx_http_sub_output(ngx_http_request_t *r,
     ngx_http_sub_ctx_t *ctx);
 static ngx_int_t ngx_http_sub_parse(ngx_http_request_t *r,
-    ngx_http_sub_ctx_t *ctx);
+    ngx_http_sub_ctx_t *ctx, ngx_http_sub_tables_t *tables);
+static ngx_int_t ngx_http_sub_flush(ngx_http_request_t *r,
+    ngx_http_sub_ctx_t *ctx, size_t keep, ngx_buf_t **last);
 
 static char * ngx_http_sub_filter(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static ngx_http_sub_tables_t *ngx_http_sub_init_tables(ngx_conf_t *cf,
+    ngx_array_t *matches);
 static void *ngx_http_sub_create_conf(ngx_conf_t *cf);
 static char *ngx_http_sub_merge_conf(ngx_conf_t *cf,
     void *parent, void *child);
@@ -144,7 +186,7 @@ ngx_http_sub_header_filter(ngx_http_request_t *r)
 
     slcf = ngx_http_get_module_loc_conf(r, ngx_http_sub_filter_module);
 
-    if (slcf->match.len == 0
+    if (slcf->matches == NULL
         || r->headers_out.content_length_n == 0
         || ngx_http_test_content_type(r, &slcf->types) == NULL)
     {
@@ -156,19 +198,26 @@ ngx_http_sub_header_filter(ngx_http_request_t *r)
         return NGX_ERROR;
     }
 
-    ctx->saved.data = ngx_pnalloc(r->pool, slcf->match.len);
-    if (ctx->saved.data == NULL) {
+    ctx->looked.data = ngx_pnalloc(r->pool, slcf->tables->max_len);
+    if (ctx->looked.data == NULL) {
         return NGX_ERROR;
     }
 
-    ctx->looked.data = ngx_pnalloc(r->pool, slcf->match.len);
-    if (ctx->looked.data == NULL) {
+    ctx->sub = ngx_pcalloc(r->pool,
+                           slcf->matches->nelts * sizeof(ngx_str_t));
+    if (ctx->sub == NULL) {
         return NGX_ERROR;
     }
 
+    if (slcf->once) {
+        ctx->matched = ngx_pcalloc(r->pool, slcf->matches->nelts);
+        if (ctx->matched == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
     ngx_http_set_ctx(r, ctx, ngx_http_sub_filter_module);
 
-    ctx->match = slcf->match;
     ctx->last_out = &ctx->out;
 
     r->filter_need_in_memory = 1;
@@ -192,10 +241,12 @@ ngx_http_sub_header_filter(ngx_http_request_t *r)
 static ngx_int_t
 ngx_http_sub_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
 {
+    size_t                     keep, len;
     ngx_int_t                  rc;
     ngx_buf_t                 *b;
     ngx_chain_t               *cl;
     ngx_http_sub_ctx_t        *ctx;
+    ngx_http_sub_match_t      *match;
     ngx_http_sub_loc_conf_t   *slcf;
 
     ctx = ngx_http_get_module_ctx(r, ngx_http_sub_filter_module);
@@ -234,112 +285,48 @@ ngx_http_sub_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http sub filter \"%V\"", &r->uri);
 
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_sub_filter_module);
+    match = slcf->matches->elts;
+
     while (ctx->in || ctx->buf) {
 
         if (ctx->buf == NULL) {
             ctx->buf = ctx->in->buf;
             ctx->in = ctx->in->next;
             ctx->pos = ctx->buf->pos;
-        }
-
-        if (ctx->state == sub_start_state) {
             ctx->copy_start = ctx->pos;
-            ctx->copy_end = ctx->pos;
         }
 
         b = NULL;
 
         while (ctx->pos < ctx->buf->last) {
 
-            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                           "saved: \"%V\" state: %d", &ctx->saved, ctx->state);
+            rc = ngx_http_sub_parse(r, ctx, slcf->tables);
 
-            rc = ngx_http_sub_parse(r, ctx);
+            ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "parse: %i, looked: \"%V\" state: %ui",
+                           rc, &ctx->looked, ctx->state);
 
-            ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                           "parse: %d, looked: \"%V\" %p-%p",
-                           rc, &ctx->looked, ctx->copy_start, ctx->copy_end);
-
-            if (rc == NGX_ERROR) {
-                return rc;
-            }
-
-            if (ctx->saved.len) {
-
-                ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                               "saved: \"%V\"", &ctx->saved);
-
-                cl = ngx_chain_get_free_buf(r->pool, &ctx->free);
-                if (cl == NULL) {
-                    return NGX_ERROR;
-                }
-
-                b = cl->buf;
-
-                ngx_memzero(b, sizeof(ngx_buf_t));
-
-                b->pos = ngx_pnalloc(r->pool, ctx->saved.len);
-                if (b->pos == NULL) {
-                    return NGX_ERROR;
-                }
-
-                ngx_memcpy(b->pos, ctx->saved.data, ctx->saved.len);
-                b->last = b->pos + ctx->saved.len;
-                b->memory = 1;
-
-                *ctx->last_out = cl;
-                ctx->last_out = &cl->next;
-
-                ctx->saved.len = 0;
+            if (rc == NGX_AGAIN) {
+                break;
             }
 
-            if (ctx->copy_start != ctx->copy_end) {
-
-                cl = ngx_chain_get_free_buf(r->pool, &ctx->free);
-                if (cl == NULL) {
-                    return NGX_ERROR;
-                }
-
-                b = cl->buf;
-
-                ngx_memcpy(b, ctx->buf, sizeof(ngx_buf_t));
-
-                b->pos = ctx->copy_start;
-                b->last = ctx->copy_end;
-                b->shadow = NULL;
-                b->last_buf = 0;
-                b->last_in_chain = 0;
-                b->recycled = 0;
-
-                if (b->in_file) {
-                    b->file_last = b->file_pos + (b->last - ctx->buf->pos);
-                    b->file_pos += b->pos - ctx->buf->pos;
-                }
-
-                *ctx->last_out = cl;
-                ctx->last_out = &cl->next;
-            }
+            /* rc == NGX_OK */
 
-            if (ctx->state == sub_start_state) {
-                ctx->copy_start = ctx->pos;
-                ctx->copy_end = ctx->pos;
+            len = match[ctx->index].match.len;
 
-            } else {
-                ctx->copy_start = NULL;
-                ctx->copy_end = NULL;
-            }
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http sub filter matched \"%V\"",
+                           &match[ctx->index].match);
 
-            if (ctx->looked.len > (size_t) (ctx->pos - ctx->buf->pos)) {
-                ctx->saved.len = ctx->looked.len - (ctx->pos - ctx->buf->pos);
-                ngx_memcpy(ctx->saved.data, ctx->looked.data, ctx->saved.len);
-            }
+            /* output everything before the match and drop the match */
 
-            if (rc == NGX_AGAIN) {
-                continue;
+            if (ngx_http_sub_flush(r, ctx, len, &b) != NGX_OK) {
+                return NGX_ERROR;
             }
 
-
-            /* rc == NGX_OK */
+            ctx->looked.len = 0;
+            ctx->copy_start = ctx->pos;
 
             cl = ngx_chain_get_free_buf(r->pool, &ctx->free);
             if (cl == NULL) {
@@ -350,21 +337,21 @@ ngx_http_sub_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
 
             ngx_memzero(b, sizeof(ngx_buf_t));
 
-            slcf = ngx_http_get_module_loc_conf(r, ngx_http_sub_filter_module);
-
-            if (ctx->sub.data == NULL) {
+            if (ctx->sub[ctx->index].data == NULL) {
 
-                if (ngx_http_complex_value(r, &slcf->value, &ctx->sub)
+                if (ngx_http_complex_value(r, &match[ctx->index].value,
+                                           &ctx->sub[ctx->index])
                     != NGX_OK)
                 {
                     return NGX_ERROR;
                 }
             }
 
-            if (ctx->sub.len) {
+            if (ctx->sub[ctx->index].len) {
                 b->memory = 1;
-                b->pos = ctx->sub.data;
-                b->last = ctx->sub.data + ctx->sub.len;
+                b->pos = ctx->sub[ctx->index].data;
+                b->last = ctx->sub[ctx->index].data
+                          + ctx->sub[ctx->index].len;
 
             } else {
                 b->sync = 1;
@@ -373,31 +360,35 @@ ngx_http_sub_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
             *ctx->last_out = cl;
             ctx->last_out = &cl->next;
 
-            ctx->once = slcf->once;
+            if (ctx->matched) {
+                ctx->matched[ctx->index] = 1;
 
-            continue;
+                if (++ctx->nmatched == slcf->matches->nelts) {
+                    ctx->once = 1;
+                }
+            }
         }
 
-        if (ctx->looked.len
-            && (ctx->buf->last_buf || ctx->buf->last_in_chain))
-        {
-            cl = ngx_chain_get_free_buf(r->pool, &ctx->free);
-            if (cl == NULL) {
-                return NGX_ERROR;
-            }
+        if (ctx->buf->last_buf || ctx->buf->last_in_chain) {
+            ctx->state = 0;
+            keep = 0;
 
-            b = cl->buf;
+        } else {
+            keep = slcf->tables->nodes[ctx->state].depth;
+        }
 
-            ngx_memzero(b, sizeof(ngx_buf_t));
+        if (ngx_http_sub_flush(r, ctx, keep, &b) != NGX_OK) {
+            return NGX_ERROR;
+        }
 
-            b->pos = ctx->looked.data;
-            b->last = b->pos + ctx->looked.len;
-            b->memory = 1;
+        /* the rest of the buffer may be the start of a match */
 
-            *ctx->last_out = cl;
-            ctx->last_out = &cl->next;
+        len = ctx->buf->last - ctx->copy_start;
 
-            ctx->looked.len = 0;
+        if (len) {
+            ngx_memcpy(ctx->looked.data + ctx->looked.len, ctx->copy_start,
+                       len);
+            ctx->looked.len += len;
         }
 
         if (ctx->buf->last_buf || ctx->buf->flush || ctx->buf->sync
@@ -428,9 +419,6 @@ ngx_http_sub_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
         }
 
         ctx->buf = NULL;
-
-        ctx->saved.len = ctx->looked.len;
-        ngx_memcpy(ctx->saved.data, ctx->looked.data, ctx->looked.len);
     }
 
     if (ctx->out == NULL && ctx->busy == NULL) {
@@ -441,6 +429,103 @@ ngx_http_sub_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
 }
 
 
+/*
+ * output the bytes passed by the parser except the last "keep" ones:
+ * first those saved from previous buffers, then those of ctx->buf
+ */
+
+static ngx_int_t
+ngx_http_sub_flush(ngx_http_request_t *r, ngx_http_sub_ctx_t *ctx,
+    size_t keep, ngx_buf_t **last)
+{
+    size_t        n, len;
+    u_char       *end;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    n = ctx->pos - ctx->buf->pos;
+
+    if (keep > n) {
+        len = ctx->looked.len - (keep - n);
+
+    } else {
+        len = ctx->looked.len;
+    }
+
+    if (len) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "saved: %uz", len);
+
+        cl = ngx_chain_get_free_buf(r->pool, &ctx->free);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        b = cl->buf;
+
+        ngx_memzero(b, sizeof(ngx_buf_t));
+
+        b->pos = ngx_pnalloc(r->pool, len);
+        if (b->pos == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(b->pos, ctx->looked.data, len);
+        b->last = b->pos + len;
+        b->memory = 1;
+
+        *ctx->last_out = cl;
+        ctx->last_out = &cl->next;
+
+        *last = b;
+
+        ctx->looked.len -= len;
+        ngx_memmove(ctx->looked.data, ctx->looked.data + len,
+                    ctx->looked.len);
+    }
+
+    if (keep > n) {
+        return NGX_OK;
+    }
+
+    end = ctx->pos - keep;
+
+    if (end == ctx->copy_start) {
+        return NGX_OK;
+    }
+
+    cl = ngx_chain_get_free_buf(r->pool, &ctx->free);
+    if (cl == NULL) {
+        return NGX_ERROR;
+    }
+
+    b = cl->buf;
+
+    ngx_memcpy(b, ctx->buf, sizeof(ngx_buf_t));
+
+    b->pos = ctx->copy_start;
+    b->last = end;
+    b->shadow = NULL;
+    b->last_buf = 0;
+    b->last_in_chain = 0;
+    b->recycled = 0;
+
+    if (b->in_file) {
+        b->file_last = b->file_pos + (b->last - ctx->buf->pos);
+        b->file_pos += b->pos - ctx->buf->pos;
+    }
+
+    *ctx->last_out = cl;
+    ctx->last_out = &cl->next;
+
+    *last = b;
+
+    ctx->copy_start = end;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_sub_output(ngx_http_request_t *r, ngx_http_sub_ctx_t *ctx)
 {
@@ -510,18 +595,27 @@ ngx_http_sub_output(ngx_http_request_t *r, ngx_http_sub_ctx_t *ctx)
 }
 
 
+/*
+ * runs the automaton from ctx->pos; returns NGX_OK with ctx->pos set
+ * after the match and ctx->index set to the string matched, or NGX_AGAIN
+ * when the buffer is exhausted.  Of the strings ending at the same byte
+ * the longest one wins, and the automaton restarts after a match, so
+ * matches never overlap.
+ */
+
 static ngx_int_t
-ngx_http_sub_parse(ngx_http_request_t *r, ngx_http_sub_ctx_t *ctx)
+ngx_http_sub_parse(ngx_http_request_t *r, ngx_http_sub_ctx_t *ctx,
+    ngx_http_sub_tables_t *tables)
 {
-    u_char                *p, *last, *copy_end, ch, match;
-    size_t                 looked, i;
-    ngx_http_sub_state_e   state;
+    u_char               *p, *last, *classes;
+    uint32_t             *next;
+    ngx_int_t             index;
+    ngx_uint_t            state, nclasses;
+    ngx_http_sub_node_t  *nodes;
 
     if (ctx->once) {
-        ctx->copy_start = ctx->pos;
-        ctx->copy_end = ctx->buf->last;
         ctx->pos = ctx->buf->last;
-        ctx->looked.len = 0;
+        ctx->state = 0;
 
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "once");
 
@@ -529,174 +623,239 @@ ngx_http_sub_parse(ngx_http_request_t *r, ngx_http_sub_ctx_t *ctx)
     }
 
     state = ctx->state;
-    looked = ctx->looked.len;
     last = ctx->buf->last;
-    copy_end = ctx->copy_end;
+
+    classes = tables->classes;
+    nclasses = tables->nclasses;
+    next = tables->next;
+    nodes = tables->nodes;
 
     for (p = ctx->pos; p < last; p++) {
 
-        ch = *p;
-        ch = ngx_tolower(ch);
+        /* the tight loop */
 
-        if (state == sub_start_state) {
+        state = next[state * nclasses + classes[*p]];
+        index = nodes[state].match;
 
-            /* the tight loop */
+        if (index == NGX_HTTP_SUB_NONE) {
+            continue;
+        }
 
-            match = ctx->match.data[0];
+        if (ctx->matched) {
 
-            for ( ;; ) {
-                if (ch == match) {
+            /* skip the strings already replaced, trying shorter ones */
 
-                    if (ctx->match.len == 1) {
-                        ctx->pos = p + 1;
-                        ctx->copy_end = p;
+            while (index != NGX_HTTP_SUB_NONE && ctx->matched[index]) {
+                index = nodes[nodes[tables->finals[index]].fail].match;
+            }
 
-                        return NGX_OK;
-                    }
+            if (index == NGX_HTTP_SUB_NONE) {
+                continue;
+            }
+        }
 
-                    copy_end = p;
-                    ctx->looked.data[0] = *p;
-                    looked = 1;
-                    state = sub_match_state;
+        ctx->pos = p + 1;
+        ctx->state = 0;
+        ctx->index = index;
 
-                    goto match_started;
-                }
+        return NGX_OK;
+    }
 
-                if (++p == last) {
-                    break;
-                }
+    ctx->pos = p;
+    ctx->state = state;
 
-                ch = *p;
-                ch = ngx_tolower(ch);
-            }
+    return NGX_AGAIN;
+}
 
-            ctx->state = state;
-            ctx->pos = p;
-            ctx->looked.len = looked;
-            ctx->copy_end = p;
 
-            if (ctx->copy_start == NULL) {
-                ctx->copy_start = ctx->buf->pos;
-            }
+static char *
+ngx_http_sub_filter(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_sub_loc_conf_t *slcf = conf;
+
+    ngx_str_t                         *value;
+    ngx_uint_t                         i;
+    ngx_http_sub_match_t              *match;
+    ngx_http_compile_complex_value_t   ccv;
 
-            return NGX_AGAIN;
+    value = cf->args->elts;
 
-        match_started:
+    if (value[1].len == 0) {
+        return "has empty search string";
+    }
 
-            continue;
+    ngx_strlow(value[1].data, value[1].data, value[1].len);
+
+    if (slcf->matches == NULL) {
+        slcf->matches = ngx_array_create(cf->pool, 4,
+                                         sizeof(ngx_http_sub_match_t));
+        if (slcf->matches == NULL) {
+            return NGX_CONF_ERROR;
         }
+    }
 
-        /* state == sub_match_state */
+    match = slcf->matches->elts;
 
-        if (ch == ctx->match.data[looked]) {
-            ctx->looked.data[looked] = *p;
-            looked++;
+    for (i = 0; i < slcf->matches->nelts; i++) {
+        if (match[i].match.len == value[1].len
+            && ngx_strncmp(match[i].match.data, value[1].data, value[1].len)
+               == 0)
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "duplicate search string \"%V\"", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+    }
 
-            if (looked == ctx->match.len) {
+    match = ngx_array_push(slcf->matches);
+    if (match == NULL) {
+        return NGX_CONF_ERROR;
+    }
 
-                ctx->state = sub_start_state;
-                ctx->pos = p + 1;
-                ctx->looked.len = 0;
-                ctx->saved.len = 0;
-                ctx->copy_end = copy_end;
+    match->match = value[1];
 
-                if (ctx->copy_start == NULL && copy_end) {
-                    ctx->copy_start = ctx->buf->pos;
-                }
+    ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
 
-                return NGX_OK;
-            }
+    ccv.cf = cf;
+    ccv.value = &value[2];
+    ccv.complex_value = &match->value;
 
-        } else {
-            /*
-             * check if there is another partial match in previously
-             * matched substring to catch cases like "aab" in "aaab"
-             */
-
-            ctx->looked.data[looked] = *p;
-            looked++;
-
-            for (i = 1; i < looked; i++) {
-                if (ngx_strncasecmp(ctx->looked.data + i,
-                                    ctx->match.data, looked - i)
-                    == 0)
-                {
-                    break;
-                }
-            }
+    if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
 
-            if (i < looked) {
-                if (ctx->saved.len > i) {
-                    ctx->saved.len = i;
-                }
+    return NGX_CONF_OK;
+}
 
-                if ((size_t) (p + 1 - ctx->buf->pos) >= looked - i) {
-                    copy_end = p + 1 - (looked - i);
-                }
 
-                ngx_memmove(ctx->looked.data, ctx->looked.data + i, looked - i);
-                looked = looked - i;
+static ngx_http_sub_tables_t *
+ngx_http_sub_init_tables(ngx_conf_t *cf, ngx_array_t *matches)
+{
+    u_char                 c;
+    size_t                 total;
+    uint32_t              *next, *row;
+    ngx_uint_t             i, j, k, state, nclasses, head, tail, *queue;
+    ngx_http_sub_node_t   *nodes;
+    ngx_http_sub_match_t  *match;
+    ngx_http_sub_tables_t *tables;
+
+    tables = ngx_pcalloc(cf->pool, sizeof(ngx_http_sub_tables_t));
+    if (tables == NULL) {
+        return NULL;
+    }
 
-            } else {
-                copy_end = p;
-                looked = 0;
-                state = sub_start_state;
-            }
+    match = matches->elts;
+
+    /* class 0 is for the bytes which do not occur in any string */
 
-            if (ctx->saved.len) {
-                p++;
-                goto out;
+    nclasses = 1;
+    total = 1;
+
+    for (i = 0; i < matches->nelts; i++) {
+
+        for (j = 0; j < match[i].match.len; j++) {
+            c = match[i].match.data[j];
+
+            if (tables->classes[c] == 0) {
+                tables->classes[c] = (u_char) nclasses;
+                tables->classes[ngx_toupper(c)] = (u_char) nclasses;
+                nclasses++;
             }
         }
-    }
 
-    ctx->saved.len = 0;
+        total += match[i].match.len;
 
-out:
+        if (match[i].match.len > tables->max_len) {
+            tables->max_len = match[i].match.len;
+        }
+    }
 
-    ctx->state = state;
-    ctx->pos = p;
-    ctx->looked.len = looked;
+    nodes = ngx_pcalloc(cf->pool, total * sizeof(ngx_http_sub_node_t));
+    next = ngx_pcalloc(cf->pool, total * nclasses * sizeof(uint32_t));
+    tables->finals = ngx_palloc(cf->pool, matches->nelts * sizeof(ngx_uint_t));
+    queue = ngx_palloc(cf->temp_pool, total * sizeof(ngx_uint_t));
 
-    ctx->copy_end = (state == sub_start_state) ? p : copy_end;
+    if (nodes == NULL || next == NULL || tables->finals == NULL
+        || queue == NULL)
+    {
+        return NULL;
+    }
 
-    if (ctx->copy_start == NULL && ctx->copy_end) {
-        ctx->copy_start = ctx->buf->pos;
+    for (i = 0; i < total; i++) {
+        nodes[i].match = NGX_HTTP_SUB_NONE;
     }
 
-    return NGX_AGAIN;
-}
+    /* the trie; no edge leads to the root, so 0 means "no edge" here */
 
+    tables->nnodes = 1;
 
-static char *
-ngx_http_sub_filter(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
-{
-    ngx_http_sub_loc_conf_t *slcf = conf;
+    for (i = 0; i < matches->nelts; i++) {
+        state = 0;
 
-    ngx_str_t                         *value;
-    ngx_http_compile_complex_value_t   ccv;
+        for (j = 0; j < match[i].match.len; j++) {
+            row = &next[state * nclasses
+                        + tables->classes[match[i].match.data[j]]];
 
-    if (slcf->match.data) {
-        return "is duplicate";
+            if (*row == 0) {
+                *row = (uint32_t) tables->nnodes;
+                nodes[tables->nnodes].depth = j + 1;
+                tables->nnodes++;
+            }
+
+            state = *row;
+        }
+
+        nodes[state].match = i;
+        tables->finals[i] = state;
     }
 
-    value = cf->args->elts;
+    /*
+     * breadth-first: the failure state of a node is found through the
+     * already complete transitions of its parent's failure state, and
+     * the missing edges are replaced by those of the failure state
+     */
 
-    ngx_strlow(value[1].data, value[1].data, value[1].len);
+    head = 0;
+    tail = 0;
 
-    slcf->match = value[1];
+    for (k = 0; k < nclasses; k++) {
+        state = next[k];
 
-    ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+        if (state) {
+            nodes[state].fail = 0;
+            queue[tail++] = state;
+        }
+    }
 
-    ccv.cf = cf;
-    ccv.value = &value[2];
-    ccv.complex_value = &slcf->value;
+    while (head < tail) {
+        i = queue[head++];
 
-    if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
-        return NGX_CONF_ERROR;
+        if (nodes[i].match == NGX_HTTP_SUB_NONE) {
+            nodes[i].match = nodes[nodes[i].fail].match;
+        }
+
+        for (k = 0; k < nclasses; k++) {
+            state = next[i * nclasses + k];
+
+            if (state) {
+                nodes[state].fail = next[nodes[i].fail * nclasses + k];
+                queue[tail++] = state;
+
+            } else {
+                next[i * nclasses + k] = next[nodes[i].fail * nclasses + k];
+            }
+        }
     }
 
-    return NGX_CONF_OK;
+    tables->nclasses = nclasses;
+    tables->nodes = nodes;
+    tables->next = next;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "sub filter: %ui strings, %ui states, %ui classes",
+                   matches->nelts, tables->nnodes, nclasses);
+
+    return tables;
 }
 
 
@@ -713,7 +872,8 @@ ngx_http_sub_create_conf(ngx_conf_t *cf)
     /*
      * set by ngx_pcalloc():
      *
-     *     conf->match = { 0, NULL };
+     *     conf->matches = NULL;
+     *     conf->tables = NULL;
      *     conf->types = { NULL };
      *     conf->types_keys = NULL;
      */
@@ -732,11 +892,27 @@ ngx_http_sub_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_http_sub_loc_conf_t *conf = child;
 
     ngx_conf_merge_value(conf->once, prev->once, 1);
-    ngx_conf_merge_str_value(conf->match, prev->match, "");
     ngx_conf_merge_value(conf->last_modified, prev->last_modified, 0);
 
-    if (conf->value.value.data == NULL) {
-        conf->value = prev->value;
+    /* the automaton is built once and shared with the inheriting levels */
+
+    if (conf->matches == NULL) {
+
+        if (prev->matches && prev->tables == NULL) {
+            prev->tables = ngx_http_sub_init_tables(cf, prev->matches);
+            if (prev->tables == NULL) {
+                return NGX_CONF_ERROR;
+            }
+        }
+
+        conf->matches = prev->matches;
+        conf->tables = prev->tables;
+
+    } else {
+        conf->tables = ngx_http_sub_init_tables(cf, conf->matches);
+        if (conf->tables == NULL) {
+            return NGX_CONF_ERROR;
+        }
     }
 
     if (ngx_http_merge_types(cf, &conf->types_keys, &conf->types,
@@ -0,0 +1,655 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * Peak EWMA balancing: every peer keeps an exponentially weighted moving
+ * average of its response header time which jumps up to any slower
+ * sample at once and decays back with the "decay" time constant.  Each
+ * request compares two randomly chosen peers and takes the one with
+ * the lower (latency * (active connections + 1) / weight) cost.
+ *
+ * The average is stored in the round robin peer, so with the "zone"
+ * directive it is shared by all worker processes.
+ */
+
+
+typedef struct {
+    ngx_msec_t                          decay;
+} ngx_http_upstream_ewma_srv_conf_t;
+
+
+typedef struct {
+    /* the round robin data must be first */
+    ngx_http_upstream_rr_peer_data_t    rrp;
+    ngx_http_request_t                 *request;
+    ngx_http_upstream_ewma_srv_conf_t  *conf;
+    ngx_msec_t                          start;
+} ngx_http_upstream_ewma_peer_data_t;
+
+
+typedef struct {
+    ngx_str_t                           choice;
+    ngx_uint_t                          ewma_usec;
+    ngx_uint_t                          chosen;    /* unsigned  chosen:1; */
+} ngx_http_upstream_ewma_ctx_t;
+
+
+typedef struct {
+    ngx_http_upstream_rr_peer_t        *peer;
+    ngx_uint_t                          index;
+    ngx_uint_t                          conns;
+    ngx_uint_t                          ewma_usec;
+    uint64_t                            cost;
+} ngx_http_upstream_ewma_candidate_t;
+
+
+static ngx_int_t ngx_http_upstream_init_ewma(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_init_ewma_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_get_ewma_peer(ngx_peer_connection_t *pc,
+    void *data);
+static void ngx_http_upstream_free_ewma_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+static ngx_uint_t ngx_http_upstream_ewma_current(
+    ngx_http_upstream_rr_peer_t *peer, ngx_msec_t decay, ngx_msec_t now);
+static void ngx_http_upstream_ewma_choice(ngx_http_request_t *r,
+    ngx_http_upstream_ewma_candidate_t *cand, ngx_uint_t n);
+
+static ngx_int_t ngx_http_upstream_ewma_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_upstream_ewma_choice_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+
+static ngx_int_t ngx_http_upstream_ewma_add_variables(ngx_conf_t *cf);
+static void *ngx_http_upstream_ewma_create_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_ewma(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_upstream_ewma_commands[] = {
+
+    { ngx_string("ewma"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE1,
+      ngx_http_upstream_ewma,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_ewma_module_ctx = {
+    ngx_http_upstream_ewma_add_variables,  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_upstream_ewma_create_conf,    /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_ewma_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_ewma_module_ctx,    /* module context */
+    ngx_http_upstream_ewma_commands,       /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_http_variable_t  ngx_http_upstream_ewma_vars[] = {
+
+    { ngx_string("upstream_ewma"), NULL,
+      ngx_http_upstream_ewma_variable, 0,
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("upstream_ewma_choice"), NULL,
+      ngx_http_upstream_ewma_choice_variable, 0,
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_null_string, NULL, NULL, 0, 0, 0 }
+};
+
+
+static ngx_int_t
+ngx_http_upstream_init_ewma(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "init ewma");
+
+    if (ngx_http_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    us->peer.init = ngx_http_upstream_init_ewma_peer;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_ewma_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_upstream_ewma_ctx_t        *ctx;
+    ngx_http_upstream_ewma_peer_data_t  *ep;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "init ewma peer");
+
+    ep = ngx_palloc(r->pool, sizeof(ngx_http_upstream_ewma_peer_data_t));
+    if (ep == NULL) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.data = &ep->rrp;
+
+    if (ngx_http_upstream_init_round_robin_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_upstream_ewma_module);
+
+    if (ctx == NULL) {
+        ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_upstream_ewma_ctx_t));
+        if (ctx == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_http_set_ctx(r, ctx, ngx_http_upstream_ewma_module);
+    }
+
+    r->upstream->peer.get = ngx_http_upstream_get_ewma_peer;
+    r->upstream->peer.free = ngx_http_upstream_free_ewma_peer;
+
+    ep->request = r;
+    ep->conf = ngx_http_conf_upstream_srv_conf(us,
+                                               ngx_http_upstream_ewma_module);
+    ep->start = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_get_ewma_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_upstream_ewma_peer_data_t  *ep = data;
+
+    time_t                               now;
+    uintptr_t                            m;
+    ngx_int_t                            rc;
+    ngx_msec_t                           decay;
+    ngx_uint_t                           i, n, k, j;
+    ngx_http_upstream_rr_peer_t         *peer, *best;
+    ngx_http_upstream_rr_peers_t        *peers;
+    ngx_http_upstream_rr_peer_data_t    *rrp;
+    ngx_http_upstream_ewma_candidate_t   cand[2], tmp;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get ewma peer, try: %ui", pc->tries);
+
+    rrp = &ep->rrp;
+
+    ep->start = ngx_current_msec;
+
+    if (rrp->peers->single) {
+        return ngx_http_upstream_get_round_robin_peer(pc, rrp);
+    }
+
+    pc->cached = 0;
+    pc->connection = NULL;
+
+    now = ngx_time();
+    decay = ep->conf->decay;
+
+    peers = rrp->peers;
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+    /* pick two random usable peers in a single pass (reservoir sampling) */
+
+    k = 0;
+
+    for (peer = peers->peer, i = 0;
+         peer;
+         peer = peer->next, i++)
+    {
+        n = i / (8 * sizeof(uintptr_t));
+        m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+        if (rrp->tried[n] & m) {
+            continue;
+        }
+
+        if (peer->down) {
+            continue;
+        }
+
+        if (peer->max_fails
+            && peer->fails >= peer->max_fails
+            && now - peer->checked <= peer->fail_timeout)
+        {
+            continue;
+        }
+
+        if (k < 2) {
+            j = k;
+
+        } else {
+            j = (ngx_uint_t) ngx_random() % (k + 1);
+
+            if (j >= 2) {
+                k++;
+                continue;
+            }
+        }
+
+        cand[j].peer = peer;
+        cand[j].index = i;
+
+        k++;
+    }
+
+    if (k == 0) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get ewma peer, no peer found");
+        goto failed;
+    }
+
+    if (k > 2) {
+        k = 2;
+    }
+
+    for (j = 0; j < k; j++) {
+        peer = cand[j].peer;
+
+        cand[j].conns = peer->conns;
+        cand[j].ewma_usec = ngx_http_upstream_ewma_current(peer, decay,
+                                                           ngx_current_msec);
+
+        /* the cost is scaled by 1000 to keep precision for small weights */
+
+        cand[j].cost = (uint64_t) (cand[j].ewma_usec + 1) * (peer->conns + 1)
+                       * 1000 / peer->weight;
+    }
+
+    if (k == 2 && cand[1].cost < cand[0].cost) {
+        tmp = cand[0];
+        cand[0] = cand[1];
+        cand[1] = tmp;
+    }
+
+    best = cand[0].peer;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get ewma peer, peer:%ui, ewma:%uius, conns:%ui",
+                   cand[0].index, cand[0].ewma_usec, best->conns);
+
+    if (now - best->checked > best->fail_timeout) {
+        best->checked = now;
+    }
+
+    pc->sockaddr = best->sockaddr;
+    pc->socklen = best->socklen;
+    pc->name = &best->name;
+
+    best->conns++;
+
+    rrp->current = best;
+
+    n = cand[0].index / (8 * sizeof(uintptr_t));
+    m = (uintptr_t) 1 << cand[0].index % (8 * sizeof(uintptr_t));
+
+    rrp->tried[n] |= m;
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    ngx_http_upstream_ewma_choice(ep->request, cand, k);
+
+    return NGX_OK;
+
+failed:
+
+    if (peers->next) {
+
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get ewma peer, backup servers");
+
+        rrp->peers = peers->next;
+
+        n = (rrp->peers->number + (8 * sizeof(uintptr_t) - 1))
+                / (8 * sizeof(uintptr_t));
+
+        for (i = 0; i < n; i++) {
+             rrp->tried[i] = 0;
+        }
+
+        ngx_http_upstream_rr_peers_unlock(peers);
+
+        rc = ngx_http_upstream_get_ewma_peer(pc, ep);
+
+        if (rc != NGX_BUSY) {
+            return rc;
+        }
+
+        ngx_http_upstream_rr_peers_wlock(peers);
+    }
+
+    /* all peers failed, mark them as live for quick recovery */
+
+    for (peer = peers->peer; peer; peer = peer->next) {
+        peer->fails = 0;
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    pc->name = peers->name;
+
+    return NGX_BUSY;
+}
+
+
+static void
+ngx_http_upstream_free_ewma_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t state)
+{
+    ngx_http_upstream_ewma_peer_data_t  *ep = data;
+
+    uint64_t                      cost;
+    ngx_uint_t                    sample;
+    ngx_msec_t                    elapsed, decay, now;
+    ngx_http_upstream_t          *u;
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    peer = ep->rrp.current;
+    u = ep->request->upstream;
+
+    if (peer == NULL || ep->start == 0) {
+        goto done;
+    }
+
+    now = ngx_current_msec;
+
+    /* the average is kept in microseconds */
+
+    if (u->state && u->state->header_time != (ngx_msec_t) -1) {
+        sample = (ngx_uint_t) u->state->header_time * 1000;
+
+    } else if (state & NGX_PEER_FAILED) {
+        sample = (ngx_uint_t) (now - ep->start) * 1000;
+
+    } else {
+        goto done;
+    }
+
+    decay = ep->conf->decay;
+
+    ngx_http_upstream_rr_peers_wlock(ep->rrp.peers);
+
+    if (state & NGX_PEER_FAILED) {
+        sample = ngx_max(sample, 2 * peer->ewma_usec);
+    }
+
+    if (sample > peer->ewma_usec || peer->ewma_stamp == 0) {
+
+        /* peak: slow responses are taken into account at once */
+
+        peer->ewma_usec = sample;
+
+    } else {
+        elapsed = now - peer->ewma_stamp;
+
+        cost = ((uint64_t) peer->ewma_usec * decay
+                + (uint64_t) sample * elapsed)
+               / (decay + elapsed);
+
+        peer->ewma_usec = (ngx_uint_t) cost;
+    }
+
+    peer->ewma_stamp = now;
+
+    ngx_http_upstream_rr_peers_unlock(ep->rrp.peers);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "free ewma peer \"%V\", sample:%uius, ewma:%uius",
+                   &peer->name, sample, peer->ewma_usec);
+
+done:
+
+    ep->start = 0;
+
+    ngx_http_upstream_free_round_robin_peer(pc, &ep->rrp, state);
+}
+
+
+static ngx_uint_t
+ngx_http_upstream_ewma_current(ngx_http_upstream_rr_peer_t *peer,
+    ngx_msec_t decay, ngx_msec_t now)
+{
+    ngx_msec_t  elapsed;
+
+    /*
+     * an idle peer decays towards zero, e^(-t/decay) is approximated
+     * with decay / (decay + t) to stay in integer arithmetic
+     */
+
+    elapsed = now - peer->ewma_stamp;
+
+    if (peer->ewma_usec == 0 || elapsed == 0) {
+        return peer->ewma_usec;
+    }
+
+    return (ngx_uint_t) ((uint64_t) peer->ewma_usec * decay
+                         / (decay + elapsed));
+}
+
+
+static void
+ngx_http_upstream_ewma_choice(ngx_http_request_t *r,
+    ngx_http_upstream_ewma_candidate_t *cand, ngx_uint_t n)
+{
+    u_char                        *p;
+    size_t                         len;
+    ngx_uint_t                     i;
+    ngx_http_upstream_ewma_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_upstream_ewma_module);
+
+    if (ctx == NULL) {
+        return;
+    }
+
+    /* "name:ewma:conns" of the candidates, the chosen peer first */
+
+    len = 0;
+
+    for (i = 0; i < n; i++) {
+        len += cand[i].peer->name.len + 2 * (NGX_INT_T_LEN + 1) + 4 + 1;
+    }
+
+    p = ngx_pnalloc(r->pool, len);
+    if (p == NULL) {
+        return;
+    }
+
+    ctx->choice.data = p;
+
+    for (i = 0; i < n; i++) {
+        if (i) {
+            *p++ = ' ';
+        }
+
+        p = ngx_sprintf(p, "%V:%ui.%03ui:%ui", &cand[i].peer->name,
+                        cand[i].ewma_usec / 1000, cand[i].ewma_usec % 1000,
+                        cand[i].conns);
+    }
+
+    ctx->choice.len = p - ctx->choice.data;
+    ctx->ewma_usec = cand[0].ewma_usec;
+    ctx->chosen = 1;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_ewma_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char                        *p;
+    ngx_http_upstream_ewma_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_upstream_ewma_module);
+
+    if (ctx == NULL || !ctx->chosen) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    p = ngx_pnalloc(r->pool, NGX_INT_T_LEN + 4);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_sprintf(p, "%ui.%03ui",
+                         ctx->ewma_usec / 1000, ctx->ewma_usec % 1000)
+             - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_ewma_choice_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_http_upstream_ewma_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_upstream_ewma_module);
+
+    if (ctx == NULL || !ctx->chosen) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->len = ctx->choice.len;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = ctx->choice.data;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_ewma_add_variables(ngx_conf_t *cf)
+{
+    ngx_http_variable_t  *var, *v;
+
+    for (v = ngx_http_upstream_ewma_vars; v->name.len; v++) {
+        var = ngx_http_add_variable(cf, &v->name, v->flags);
+        if (var == NULL) {
+            return NGX_ERROR;
+        }
+
+        var->get_handler = v->get_handler;
+        var->data = v->data;
+    }
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_upstream_ewma_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_ewma_srv_conf_t  *conf;
+
+    conf = ngx_palloc(cf->pool, sizeof(ngx_http_upstream_ewma_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    conf->decay = 10000;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_ewma(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_ewma_srv_conf_t  *ecf = conf;
+
+    ngx_str_t                     *value, s;
+    ngx_msec_t                     decay;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    if (uscf->peer.init_upstream) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "load balancing method redefined");
+    }
+
+    if (cf->args->nelts == 2) {
+        value = cf->args->elts;
+
+        if (ngx_strncmp(value[1].data, "decay=", 6) != 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+
+        s.len = value[1].len - 6;
+        s.data = value[1].data + 6;
+
+        decay = ngx_parse_time(&s, 0);
+
+        if (decay == (ngx_msec_t) NGX_ERROR || decay == 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid decay \"%V\"", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+
+        ecf->decay = decay;
+    }
+
+    uscf->peer.init_upstream = ngx_http_upstream_init_ewma;
+
+    uscf->flags = NGX_HTTP_UPSTREAM_CREATE
+                  |NGX_HTTP_UPSTREAM_WEIGHT
+                  |NGX_HTTP_UPSTREAM_MAX_FAILS
+                  |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
+                  |NGX_HTTP_UPSTREAM_DOWN
+                  |NGX_HTTP_UPSTREAM_BACKUP;
+
+    return NGX_CONF_OK;
+}
@@ -22,9 +22,28 @@ typedef struct {
 } ngx_http_upstream_chash_points_t;
 
 
+typedef struct {
+    ngx_uint_t                          size;
+    uint32_t                           *lookup;
+
+    /* peers the index below was built for, per worker process */
+    ngx_http_upstream_rr_peers_t       *peers;
+    ngx_http_upstream_rr_peer_t       **peer;
+} ngx_http_upstream_maglev_t;
+
+
+typedef struct {
+    ngx_uint_t                          pos;
+    ngx_uint_t                          skip;
+    ngx_uint_t                          weight;
+} ngx_http_upstream_maglev_perm_t;
+
+
 typedef struct {
     ngx_http_complex_value_t            key;
     ngx_http_upstream_chash_points_t   *points;
+    ngx_http_upstream_maglev_t         *maglev;
+    ngx_uint_t                          bound;    /* percents */
 } ngx_http_upstream_hash_srv_conf_t;
 
 
@@ -37,6 +56,7 @@ typedef struct {
     ngx_uint_t                          rehash;
     uint32_t                            hash;
     ngx_event_get_peer_pt               get_rr_peer;
+    unsigned                            counted:1;
 } ngx_http_upstream_hash_peer_data_t;
 
 
@@ -58,6 +78,15 @@ static ngx_int_t ngx_http_upstream_init_chash_peer(ngx_http_request_t *r,
 static ngx_int_t ngx_http_upstream_get_chash_peer(ngx_peer_connection_t *pc,
     void *data);
 
+static ngx_int_t ngx_http_upstream_init_maglev(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_init_maglev_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_get_maglev_peer(ngx_peer_connection_t *pc,
+    void *data);
+static void ngx_http_upstream_free_maglev_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+
 static void *ngx_http_upstream_hash_create_conf(ngx_conf_t *cf);
 static char *ngx_http_upstream_hash(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -66,7 +95,7 @@ static char *ngx_http_upstream_hash(ngx_conf_t *cf, ngx_command_t *cmd,
 static ngx_command_t  ngx_http_upstream_hash_commands[] = {
 
     { ngx_string("hash"),
-      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE123,
       ngx_http_upstream_hash,
       NGX_HTTP_SRV_CONF_OFFSET,
       0,
@@ -76,6 +105,13 @@ static ngx_command_t  ngx_http_upstream_hash_commands[] = {
 };
 
 
+/* maglev lookup table sizes, at least 100 entries per peer are preferred */
+
+static ngx_uint_t  ngx_http_upstream_maglev_sizes[] = {
+    65537, 131071, 262139, 524287, 1048573, 2097143, 4194301
+};
+
+
 static ngx_http_module_t  ngx_http_upstream_hash_module_ctx = {
     NULL,                                  /* preconfiguration */
     NULL,                                  /* postconfiguration */
@@ -614,6 +650,302 @@ found:
 }
 
 
+/*
+ * Maglev hashing: every peer walks its own permutation of the lookup
+ * table (offset and skip derived from the peer address) and the peers
+ * take turns claiming the next free entry, "weight" entries per round.
+ * A key is mapped with a single table lookup, and adding or removing
+ * a peer only moves the entries that peer claims or releases.
+ */
+
+static ngx_int_t
+ngx_http_upstream_init_maglev(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
+{
+    uint32_t                           *lookup;
+    ngx_uint_t                          size, filled, i, j, n, pos;
+    ngx_http_upstream_rr_peer_t        *peer;
+    ngx_http_upstream_rr_peers_t       *peers;
+    ngx_http_upstream_maglev_t         *maglev;
+    ngx_http_upstream_maglev_perm_t    *perm;
+    ngx_http_upstream_hash_srv_conf_t  *hcf;
+
+    if (ngx_http_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    us->peer.init = ngx_http_upstream_init_maglev_peer;
+
+    peers = us->peer.data;
+
+    n = sizeof(ngx_http_upstream_maglev_sizes) / sizeof(ngx_uint_t);
+
+    for (i = 0; i < n - 1; i++) {
+        if (ngx_http_upstream_maglev_sizes[i] >= 100 * peers->number) {
+            break;
+        }
+    }
+
+    size = ngx_http_upstream_maglev_sizes[i];
+
+    maglev = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_maglev_t));
+    if (maglev == NULL) {
+        return NGX_ERROR;
+    }
+
+    lookup = ngx_palloc(cf->pool, size * sizeof(uint32_t));
+    if (lookup == NULL) {
+        return NGX_ERROR;
+    }
+
+    perm = ngx_palloc(cf->temp_pool,
+                      peers->number * sizeof(ngx_http_upstream_maglev_perm_t));
+    if (perm == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (peer = peers->peer, i = 0; peer; peer = peer->next, i++) {
+        perm[i].pos = ngx_crc32_long(peer->name.data, peer->name.len) % size;
+        perm[i].skip = ngx_murmur_hash2(peer->name.data, peer->name.len)
+                       % (size - 1) + 1;
+        perm[i].weight = peer->weight;
+    }
+
+    ngx_memset(lookup, 0xff, size * sizeof(uint32_t));
+
+    filled = 0;
+
+    for ( ;; ) {
+        for (i = 0; i < peers->number; i++) {
+            for (j = 0; j < perm[i].weight; j++) {
+
+                pos = perm[i].pos;
+
+                while (lookup[pos] != (uint32_t) -1) {
+                    pos += perm[i].skip;
+
+                    if (pos >= size) {
+                        pos -= size;
+                    }
+                }
+
+                lookup[pos] = (uint32_t) i;
+
+                pos += perm[i].skip;
+                perm[i].pos = (pos >= size) ? pos - size : pos;
+
+                if (++filled == size) {
+                    goto done;
+                }
+            }
+        }
+    }
+
+done:
+
+    maglev->size = size;
+    maglev->lookup = lookup;
+
+    hcf = ngx_http_conf_upstream_srv_conf(us, ngx_http_upstream_hash_module);
+    hcf->maglev = maglev;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_maglev_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_uint_t                           i;
+    ngx_http_upstream_rr_peer_t         *peer, **index;
+    ngx_http_upstream_maglev_t          *maglev;
+    ngx_http_upstream_hash_srv_conf_t   *hcf;
+    ngx_http_upstream_hash_peer_data_t  *hp;
+
+    if (ngx_http_upstream_init_hash_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.get = ngx_http_upstream_get_maglev_peer;
+
+    hp = r->upstream->peer.data;
+    hcf = ngx_http_conf_upstream_srv_conf(us, ngx_http_upstream_hash_module);
+    maglev = hcf->maglev;
+
+    if (maglev->peers != hp->rrp.peers) {
+
+        /*
+         * the table stores peer numbers; the pointers are resolved
+         * once per process as the peers may have been moved to
+         * a shared memory zone after the table was built
+         */
+
+        index = ngx_palloc(ngx_cycle->pool,
+                           hp->rrp.peers->number
+                           * sizeof(ngx_http_upstream_rr_peer_t *));
+        if (index == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_http_upstream_rr_peers_rlock(hp->rrp.peers);
+
+        for (peer = hp->rrp.peers->peer, i = 0; peer; peer = peer->next, i++) {
+            index[i] = peer;
+        }
+
+        ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+
+        maglev->peer = index;
+        maglev->peers = hp->rrp.peers;
+    }
+
+    hp->hash = ngx_crc32_long(hp->key.data, hp->key.len) % maglev->size;
+    hp->counted = 0;
+
+    if (hcf->bound) {
+        r->upstream->peer.free = ngx_http_upstream_free_maglev_peer;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_get_maglev_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_upstream_hash_peer_data_t  *hp = data;
+
+    time_t                              now;
+    uintptr_t                           m;
+    ngx_uint_t                          n, p, limit;
+    ngx_http_upstream_rr_peer_t        *peer;
+    ngx_http_upstream_rr_peers_t       *peers;
+    ngx_http_upstream_maglev_t         *maglev;
+    ngx_http_upstream_hash_srv_conf_t  *hcf;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get maglev peer, try: %ui", pc->tries);
+
+    peers = hp->rrp.peers;
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+    if (hp->tries > 20 || peers->single) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        return hp->get_rr_peer(pc, &hp->rrp);
+    }
+
+    now = ngx_time();
+
+    pc->cached = 0;
+    pc->connection = NULL;
+
+    hcf = hp->conf;
+    maglev = hcf->maglev;
+
+    for ( ;; ) {
+        p = maglev->lookup[hp->hash];
+        peer = maglev->peer[p];
+
+        n = p / (8 * sizeof(uintptr_t));
+        m = (uintptr_t) 1 << p % (8 * sizeof(uintptr_t));
+
+        if (hp->rrp.tried[n] & m) {
+            goto next;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get maglev peer, entry:%uD, peer:%ui", hp->hash, p);
+
+        if (peer->down) {
+            goto next;
+        }
+
+        if (peer->max_fails
+            && peer->fails >= peer->max_fails
+            && now - peer->checked <= peer->fail_timeout)
+        {
+            goto next;
+        }
+
+        if (hcf->bound) {
+
+            /*
+             * bounded load: a peer may not take more than "bound" times
+             * its weighted share of the connections, including this one
+             */
+
+            limit = (hcf->bound * (peers->conns + 1) * peer->weight
+                     + 100 * peers->total_weight - 1)
+                    / (100 * peers->total_weight);
+
+            if (peer->conns >= limit) {
+                ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                               "get maglev peer, overloaded:%ui, limit:%ui",
+                               peer->conns, limit);
+                goto next;
+            }
+        }
+
+        break;
+
+    next:
+
+        /* spill over to the next entry of the table */
+
+        if (++hp->hash == maglev->size) {
+            hp->hash = 0;
+        }
+
+        if (++hp->tries > 20) {
+            ngx_http_upstream_rr_peers_unlock(peers);
+            return hp->get_rr_peer(pc, &hp->rrp);
+        }
+    }
+
+    hp->rrp.current = peer;
+
+    pc->sockaddr = peer->sockaddr;
+    pc->socklen = peer->socklen;
+    pc->name = &peer->name;
+
+    peer->conns++;
+
+    if (hcf->bound) {
+        peers->conns++;
+        hp->counted = 1;
+    }
+
+    if (now - peer->checked > peer->fail_timeout) {
+        peer->checked = now;
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    hp->rrp.tried[n] |= m;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_free_maglev_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t state)
+{
+    ngx_http_upstream_hash_peer_data_t  *hp = data;
+
+    if (hp->counted) {
+        ngx_http_upstream_rr_peers_wlock(hp->rrp.peers);
+        hp->rrp.peers->conns--;
+        ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+
+        hp->counted = 0;
+    }
+
+    ngx_http_upstream_free_round_robin_peer(pc, &hp->rrp, state);
+}
+
+
 static void *
 ngx_http_upstream_hash_create_conf(ngx_conf_t *cf)
 {
@@ -625,6 +957,8 @@ ngx_http_upstream_hash_create_conf(ngx_conf_t *cf)
     }
 
     conf->points = NULL;
+    conf->maglev = NULL;
+    conf->bound = 0;
 
     return conf;
 }
@@ -635,6 +969,7 @@ ngx_http_upstream_hash(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_http_upstream_hash_srv_conf_t  *hcf = conf;
 
+    ngx_int_t                          bound;
     ngx_str_t                         *value;
     ngx_http_upstream_srv_conf_t      *uscf;
     ngx_http_compile_complex_value_t   ccv;
@@ -667,9 +1002,32 @@ ngx_http_upstream_hash(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     if (cf->args->nelts == 2) {
         uscf->peer.init_upstream = ngx_http_upstream_init_hash;
 
-    } else if (ngx_strcmp(value[2].data, "consistent") == 0) {
+    } else if (cf->args->nelts == 3
+               && ngx_strcmp(value[2].data, "consistent") == 0)
+    {
         uscf->peer.init_upstream = ngx_http_upstream_init_chash;
 
+    } else if (ngx_strcmp(value[2].data, "maglev") == 0) {
+        uscf->peer.init_upstream = ngx_http_upstream_init_maglev;
+
+        if (cf->args->nelts == 4) {
+            if (ngx_strncmp(value[3].data, "bound=", 6) != 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid parameter \"%V\"", &value[3]);
+                return NGX_CONF_ERROR;
+            }
+
+            bound = ngx_atofp(value[3].data + 6, value[3].len - 6, 2);
+
+            if (bound == NGX_ERROR || bound < 100) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid bound \"%V\"", &value[3]);
+                return NGX_CONF_ERROR;
+            }
+
+            hcf->bound = bound;
+        }
+
     } else {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[2]);
@@ -0,0 +1,800 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * Active health checks.  Every worker process runs a timer per upstream,
+ * and a probe of a peer is started by whichever worker first moves the
+ * peer's "hc_checked" stamp forward; with the "zone" directive the peers
+ * live in shared memory, so each peer is probed once per interval no
+ * matter how many workers there are, and a peer marked down by a probe
+ * is skipped by all workers at once.
+ */
+
+
+#define NGX_HTTP_UPSTREAM_HC_HTTP       0
+#define NGX_HTTP_UPSTREAM_HC_TCP        1
+
+#define NGX_HTTP_UPSTREAM_HC_BUFFER     4096
+
+
+typedef struct {
+    ngx_msec_t                          interval;
+    ngx_msec_t                          timeout;
+    ngx_uint_t                          fails;
+    ngx_uint_t                          passes;
+    ngx_uint_t                          type;
+    ngx_uint_t                          status_min;
+    ngx_uint_t                          status_max;
+    ngx_str_t                           match;
+    ngx_str_t                           request;
+} ngx_http_upstream_hc_srv_conf_t;
+
+
+typedef struct ngx_http_upstream_hc_s  ngx_http_upstream_hc_t;
+
+typedef struct {
+    ngx_http_upstream_hc_t             *hc;
+    ngx_http_upstream_rr_peers_t       *peers;
+    ngx_http_upstream_rr_peer_t        *peer;
+    ngx_peer_connection_t               pc;
+    ngx_buf_t                          *buffer;
+    size_t                              sent;
+    ngx_uint_t                          busy;   /* unsigned  busy:1; */
+} ngx_http_upstream_hc_peer_t;
+
+
+struct ngx_http_upstream_hc_s {
+    ngx_http_upstream_hc_srv_conf_t    *conf;
+    ngx_event_t                         event;
+    ngx_uint_t                          npeers;
+    ngx_http_upstream_hc_peer_t        *peer;
+};
+
+
+static ngx_int_t ngx_http_upstream_hc_init_process(ngx_cycle_t *cycle);
+static ngx_int_t ngx_http_upstream_hc_init_upstream(ngx_cycle_t *cycle,
+    ngx_http_upstream_srv_conf_t *uscf);
+static void ngx_http_upstream_hc_timer_handler(ngx_event_t *ev);
+static void ngx_http_upstream_hc_probe(ngx_http_upstream_hc_peer_t *hp);
+static void ngx_http_upstream_hc_write_handler(ngx_event_t *wev);
+static void ngx_http_upstream_hc_read_handler(ngx_event_t *rev);
+static ngx_int_t ngx_http_upstream_hc_test_connect(ngx_connection_t *c);
+static ngx_int_t ngx_http_upstream_hc_check_response(
+    ngx_http_upstream_hc_peer_t *hp);
+static void ngx_http_upstream_hc_done(ngx_http_upstream_hc_peer_t *hp,
+    ngx_uint_t ok);
+
+static void *ngx_http_upstream_hc_create_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_health_check(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+
+
+static ngx_command_t  ngx_http_upstream_hc_commands[] = {
+
+    { ngx_string("health_check"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_ANY,
+      ngx_http_upstream_health_check,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_hc_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_upstream_hc_create_conf,      /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_hc_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_hc_module_ctx,      /* module context */
+    ngx_http_upstream_hc_commands,         /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    ngx_http_upstream_hc_init_process,     /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_upstream_hc_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                         i;
+    ngx_http_upstream_srv_conf_t     **uscfp;
+    ngx_http_upstream_main_conf_t     *umcf;
+    ngx_http_upstream_hc_srv_conf_t   *hcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_upstream_module);
+
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL || uscfp[i]->peer.data == NULL) {
+            continue;
+        }
+
+        hcf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                              ngx_http_upstream_hc_module);
+
+        if (hcf->interval == NGX_CONF_UNSET_MSEC) {
+            continue;
+        }
+
+        if (ngx_http_upstream_hc_init_upstream(cycle, uscfp[i]) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_hc_init_upstream(ngx_cycle_t *cycle,
+    ngx_http_upstream_srv_conf_t *uscf)
+{
+    ngx_uint_t                        n;
+    ngx_http_upstream_hc_t           *hc;
+    ngx_http_upstream_rr_peer_t      *peer;
+    ngx_http_upstream_rr_peers_t     *peers;
+    ngx_http_upstream_hc_peer_t      *hp;
+    ngx_http_upstream_hc_srv_conf_t  *hcf;
+
+    hcf = ngx_http_conf_upstream_srv_conf(uscf, ngx_http_upstream_hc_module);
+
+    n = 0;
+
+    for (peers = uscf->peer.data; peers; peers = peers->next) {
+        n += peers->number;
+    }
+
+    hc = ngx_pcalloc(cycle->pool, sizeof(ngx_http_upstream_hc_t));
+    if (hc == NULL) {
+        return NGX_ERROR;
+    }
+
+    hc->peer = ngx_pcalloc(cycle->pool,
+                           n * sizeof(ngx_http_upstream_hc_peer_t));
+    if (hc->peer == NULL) {
+        return NGX_ERROR;
+    }
+
+    hc->conf = hcf;
+
+    for (peers = uscf->peer.data; peers; peers = peers->next) {
+        for (peer = peers->peer; peer; peer = peer->next) {
+            hp = &hc->peer[hc->npeers++];
+
+            hp->hc = hc;
+            hp->peers = peers;
+            hp->peer = peer;
+
+            if (hcf->type == NGX_HTTP_UPSTREAM_HC_TCP) {
+                continue;
+            }
+
+            hp->buffer = ngx_create_temp_buf(cycle->pool,
+                                             NGX_HTTP_UPSTREAM_HC_BUFFER);
+            if (hp->buffer == NULL) {
+                return NGX_ERROR;
+            }
+        }
+    }
+
+    hc->event.handler = ngx_http_upstream_hc_timer_handler;
+    hc->event.data = hc;
+    hc->event.log = cycle->log;
+    hc->event.cancelable = 1;
+
+    /* spread the first checks of the workers over the interval */
+
+    ngx_add_timer(&hc->event, (ngx_msec_t) ngx_random() % hcf->interval + 1,
+                  NGX_FUNC_LINE);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_hc_timer_handler(ngx_event_t *ev)
+{
+    ngx_http_upstream_hc_t *hc = ev->data;
+
+    ngx_uint_t                        i;
+    ngx_msec_t                        now, checked, min;
+    ngx_http_upstream_rr_peer_t      *peer;
+    ngx_http_upstream_hc_peer_t      *hp;
+    ngx_http_upstream_hc_srv_conf_t  *hcf;
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    hcf = hc->conf;
+    now = ngx_current_msec;
+
+    /*
+     * timers of different workers are not in step; a small slack keeps
+     * a probe from being skipped by the worker that made the previous one
+     */
+
+    min = hcf->interval - hcf->interval / 8;
+
+    for (i = 0; i < hc->npeers; i++) {
+        hp = &hc->peer[i];
+        peer = hp->peer;
+
+        if (hp->busy) {
+            continue;
+        }
+
+        if (peer->down & ~NGX_HTTP_UPSTREAM_RR_HC_DOWN) {
+            continue;
+        }
+
+        checked = peer->hc_checked;
+
+        if (now - checked < min) {
+            continue;
+        }
+
+        if (!ngx_atomic_cmp_set(&peer->hc_checked, checked, now)) {
+            continue;
+        }
+
+        ngx_http_upstream_hc_probe(hp);
+    }
+
+    ngx_add_timer(ev, hcf->interval, NGX_FUNC_LINE);
+}
+
+
+static void
+ngx_http_upstream_hc_probe(ngx_http_upstream_hc_peer_t *hp)
+{
+    ngx_int_t                         rc;
+    ngx_connection_t                 *c;
+    ngx_http_upstream_hc_srv_conf_t  *hcf;
+
+    hcf = hp->hc->conf;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "health check \"%V\"", &hp->peer->name);
+
+    ngx_memzero(&hp->pc, sizeof(ngx_peer_connection_t));
+
+    hp->pc.sockaddr = hp->peer->sockaddr;
+    hp->pc.socklen = hp->peer->socklen;
+    hp->pc.name = &hp->peer->name;
+    hp->pc.get = ngx_event_get_peer;
+    hp->pc.log = ngx_cycle->log;
+    hp->pc.log_error = NGX_ERROR_INFO;
+
+    rc = ngx_event_connect_peer(&hp->pc);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        ngx_http_upstream_hc_done(hp, 0);
+        return;
+    }
+
+    hp->busy = 1;
+    hp->sent = 0;
+
+    if (hp->buffer) {
+        hp->buffer->pos = hp->buffer->start;
+        hp->buffer->last = hp->buffer->start;
+    }
+
+    c = hp->pc.connection;
+
+    c->data = hp;
+    c->log_error = NGX_ERROR_INFO;
+
+    c->write->handler = ngx_http_upstream_hc_write_handler;
+    c->read->handler = ngx_http_upstream_hc_read_handler;
+
+    /* the read timer limits the whole probe, connect included */
+
+    ngx_add_timer(c->read, hcf->timeout, NGX_FUNC_LINE);
+
+    if (rc == NGX_OK) {
+        ngx_http_upstream_hc_write_handler(c->write);
+    }
+}
+
+
+static void
+ngx_http_upstream_hc_write_handler(ngx_event_t *wev)
+{
+    ssize_t                           n;
+    ngx_connection_t                 *c;
+    ngx_http_upstream_hc_peer_t      *hp;
+    ngx_http_upstream_hc_srv_conf_t  *hcf;
+
+    c = wev->data;
+    hp = c->data;
+    hcf = hp->hc->conf;
+
+    if (hp->sent == 0 && ngx_http_upstream_hc_test_connect(c) != NGX_OK) {
+        ngx_http_upstream_hc_done(hp, 0);
+        return;
+    }
+
+    if (hcf->type == NGX_HTTP_UPSTREAM_HC_TCP) {
+        ngx_http_upstream_hc_done(hp, 1);
+        return;
+    }
+
+    while (hp->sent < hcf->request.len) {
+        n = c->send(c, hcf->request.data + hp->sent,
+                    hcf->request.len - hp->sent);
+
+        if (n == NGX_ERROR) {
+            ngx_http_upstream_hc_done(hp, 0);
+            return;
+        }
+
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_write_event(wev, 0, NGX_FUNC_LINE) != NGX_OK) {
+                ngx_http_upstream_hc_done(hp, 0);
+            }
+
+            return;
+        }
+
+        hp->sent += n;
+    }
+
+    if (c->read->ready) {
+        ngx_http_upstream_hc_read_handler(c->read);
+    }
+}
+
+
+static void
+ngx_http_upstream_hc_read_handler(ngx_event_t *rev)
+{
+    ssize_t                       n;
+    ngx_buf_t                    *b;
+    ngx_connection_t             *c;
+    ngx_http_upstream_hc_peer_t  *hp;
+
+    c = rev->data;
+    hp = c->data;
+
+    if (rev->timedout) {
+        ngx_log_error(NGX_LOG_INFO, c->log, NGX_ETIMEDOUT,
+                      "health check of \"%V\" timed out", &hp->peer->name);
+        ngx_http_upstream_hc_done(hp, 0);
+        return;
+    }
+
+    if (hp->buffer == NULL || hp->sent < hp->hc->conf->request.len) {
+
+        /* nothing is expected before the request is sent */
+
+        if (ngx_handle_read_event(rev, 0, NGX_FUNC_LINE) != NGX_OK) {
+            ngx_http_upstream_hc_done(hp, 0);
+        }
+
+        return;
+    }
+
+    b = hp->buffer;
+
+    while (b->last < b->end) {
+        n = c->recv(c, b->last, b->end - b->last);
+
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_read_event(rev, 0, NGX_FUNC_LINE) != NGX_OK) {
+                ngx_http_upstream_hc_done(hp, 0);
+            }
+
+            return;
+        }
+
+        if (n == NGX_ERROR) {
+            ngx_http_upstream_hc_done(hp, 0);
+            return;
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        b->last += n;
+    }
+
+    /* the response is complete or the buffer is full */
+
+    ngx_http_upstream_hc_done(hp,
+                       ngx_http_upstream_hc_check_response(hp) == NGX_OK);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_hc_test_connect(ngx_connection_t *c)
+{
+    int        err;
+    socklen_t  len;
+
+#if (NGX_HAVE_KQUEUE)
+
+    if (ngx_event_flags & NGX_USE_KQUEUE_EVENT)  {
+        if (c->write->pending_eof || c->read->pending_eof) {
+            if (c->write->pending_eof) {
+                err = c->write->kq_errno;
+
+            } else {
+                err = c->read->kq_errno;
+            }
+
+            c->log->action = "health check connecting to upstream";
+            (void) ngx_connection_error(c, err,
+                                    "kevent() reported that connect() failed");
+            return NGX_ERROR;
+        }
+
+    } else
+#endif
+    {
+        err = 0;
+        len = sizeof(int);
+
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len)
+            == -1)
+        {
+            err = ngx_socket_errno;
+        }
+
+        if (err) {
+            c->log->action = "health check connecting to upstream";
+            (void) ngx_connection_error(c, err, "connect() failed");
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_hc_check_response(ngx_http_upstream_hc_peer_t *hp)
+{
+    u_char                           *p, *last, *body;
+    ngx_uint_t                        status;
+    ngx_http_upstream_hc_srv_conf_t  *hcf;
+
+    hcf = hp->hc->conf;
+
+    p = hp->buffer->pos;
+    last = hp->buffer->last;
+
+    /* "HTTP/1.x NNN" */
+
+    if (last - p < 12 || ngx_strncmp(p, "HTTP/1.", 7) != 0 || p[8] != ' ') {
+        ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                      "health check of \"%V\": invalid response",
+                      &hp->peer->name);
+        return NGX_ERROR;
+    }
+
+    status = ngx_atoi(p + 9, 3);
+
+    if (status == (ngx_uint_t) NGX_ERROR
+        || status < hcf->status_min || status > hcf->status_max)
+    {
+        ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                      "health check of \"%V\": unexpected status",
+                      &hp->peer->name);
+        return NGX_ERROR;
+    }
+
+    if (hcf->match.len == 0) {
+        return NGX_OK;
+    }
+
+    for (body = p; body + 4 <= last; body++) {
+        if (ngx_strncmp(body, "\r\n\r\n", 4) == 0) {
+            break;
+        }
+    }
+
+    for (p = body + 4; p + hcf->match.len <= last; p++) {
+        if (ngx_memcmp(p, hcf->match.data, hcf->match.len) == 0) {
+            return NGX_OK;
+        }
+    }
+
+    ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                  "health check of \"%V\": body does not match",
+                  &hp->peer->name);
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_http_upstream_hc_done(ngx_http_upstream_hc_peer_t *hp, ngx_uint_t ok)
+{
+    ngx_http_upstream_rr_peer_t      *peer;
+    ngx_http_upstream_hc_srv_conf_t  *hcf;
+
+    if (hp->pc.connection) {
+        ngx_close_connection(hp->pc.connection);
+        hp->pc.connection = NULL;
+    }
+
+    hp->busy = 0;
+
+    hcf = hp->hc->conf;
+    peer = hp->peer;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "health check \"%V\" done: %ui", &peer->name, ok);
+
+    ngx_http_upstream_rr_peers_wlock(hp->peers);
+
+    if (ok) {
+        peer->hc_fails = 0;
+
+        if ((peer->down & NGX_HTTP_UPSTREAM_RR_HC_DOWN)
+            && ++peer->hc_passes >= hcf->passes)
+        {
+            peer->down &= ~NGX_HTTP_UPSTREAM_RR_HC_DOWN;
+            peer->hc_passes = 0;
+            peer->fails = 0;
+
+            ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                          "upstream server \"%V\" passed health check",
+                          &peer->name);
+        }
+
+    } else {
+        peer->hc_passes = 0;
+
+        if (!(peer->down & NGX_HTTP_UPSTREAM_RR_HC_DOWN)
+            && ++peer->hc_fails >= hcf->fails)
+        {
+            peer->down |= NGX_HTTP_UPSTREAM_RR_HC_DOWN;
+            peer->hc_fails = 0;
+
+            ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                          "upstream server \"%V\" failed health check",
+                          &peer->name);
+        }
+    }
+
+    ngx_http_upstream_rr_peers_unlock(hp->peers);
+}
+
+
+static void *
+ngx_http_upstream_hc_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_hc_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_hc_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->type = NGX_HTTP_UPSTREAM_HC_HTTP;
+     *     conf->match = { 0, NULL };
+     *     conf->request = { 0, NULL };
+     */
+
+    conf->interval = NGX_CONF_UNSET_MSEC;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_health_check(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_upstream_hc_srv_conf_t  *hcf = conf;
+
+    u_char                        *p, *dash;
+    ngx_str_t                     *value, s, uri;
+    ngx_int_t                      n, min;
+    ngx_uint_t                     i;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    if (hcf->interval != NGX_CONF_UNSET_MSEC) {
+        return "is duplicate";
+    }
+
+    hcf->interval = 5000;
+    hcf->timeout = 1000;
+    hcf->fails = 1;
+    hcf->passes = 1;
+    hcf->status_min = 200;
+    hcf->status_max = 399;
+
+    ngx_str_set(&uri, "/");
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "interval=", 9) == 0) {
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            hcf->interval = ngx_parse_time(&s, 0);
+            if (hcf->interval == (ngx_msec_t) NGX_ERROR
+                || hcf->interval == 0)
+            {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "timeout=", 8) == 0) {
+            s.len = value[i].len - 8;
+            s.data = value[i].data + 8;
+
+            hcf->timeout = ngx_parse_time(&s, 0);
+            if (hcf->timeout == (ngx_msec_t) NGX_ERROR || hcf->timeout == 0) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "fails=", 6) == 0) {
+            n = ngx_atoi(&value[i].data[6], value[i].len - 6);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            hcf->fails = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "passes=", 7) == 0) {
+            n = ngx_atoi(&value[i].data[7], value[i].len - 7);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            hcf->passes = n;
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "type=http") == 0) {
+            hcf->type = NGX_HTTP_UPSTREAM_HC_HTTP;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "type=tcp") == 0) {
+            hcf->type = NGX_HTTP_UPSTREAM_HC_TCP;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "uri=", 4) == 0) {
+            uri.len = value[i].len - 4;
+            uri.data = value[i].data + 4;
+
+            if (uri.len == 0 || uri.data[0] != '/') {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "status=", 7) == 0) {
+            p = value[i].data + 7;
+            dash = ngx_strlchr(p, value[i].data + value[i].len, '-');
+
+            if (dash) {
+                min = ngx_atoi(p, dash - p);
+                n = ngx_atoi(dash + 1, value[i].data + value[i].len - dash - 1);
+
+            } else {
+                min = ngx_atoi(p, value[i].len - 7);
+                n = min;
+            }
+
+            if (min == NGX_ERROR || n == NGX_ERROR
+                || min < 100 || n > 599 || min > n)
+            {
+                goto invalid;
+            }
+
+            hcf->status_min = min;
+            hcf->status_max = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "match=", 6) == 0) {
+            hcf->match.len = value[i].len - 6;
+            hcf->match.data = value[i].data + 6;
+
+            if (hcf->match.len == 0) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    if (hcf->type == NGX_HTTP_UPSTREAM_HC_TCP) {
+        return NGX_CONF_OK;
+    }
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    hcf->request.len = sizeof("GET  HTTP/1.0" CRLF "Host: " CRLF
+                              "User-Agent: nginx health check" CRLF
+                              "Connection: close" CRLF CRLF) - 1
+                       + uri.len + uscf->host.len;
+
+    hcf->request.data = ngx_pnalloc(cf->pool, hcf->request.len);
+    if (hcf->request.data == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_sprintf(hcf->request.data,
+                "GET %V HTTP/1.0" CRLF "Host: %V" CRLF
+                "User-Agent: nginx health check" CRLF
+                "Connection: close" CRLF CRLF,
+                &uri, &uscf->host);
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
@@ -44,7 +44,7 @@ case NGX_HTTP_CACHE_SCARCE: (
 #define NGX_HTTP_CACHE_ETAG_LEN      42
 #define NGX_HTTP_CACHE_VARY_LEN      42
 
-#define NGX_HTTP_CACHE_VERSION       3
+#define NGX_HTTP_CACHE_VERSION       4
 
 
 typedef struct { //ռ͸ֵngx_http_file_cache_valid_set_slot
@@ -52,6 +52,11 @@ typedef struct { //
     time_t                           valid; //proxy_cache_valid xxx 4m;е4m
 } ngx_http_cache_valid_t;
 
+
+typedef struct ngx_http_file_cache_ram_s  ngx_http_file_cache_ram_t;
+typedef struct ngx_http_file_cache_delete_s  ngx_http_file_cache_delete_t;
+typedef struct ngx_http_file_cache_loader_s  ngx_http_file_cache_loader_t;
+
 //ṹ ngx_http_file_cache_node_t ̻ļڴеϢ 
 //һcacheļӦһnodenodeҪcache keyuniq uniqҪǹļkeyں
 
@@ -118,8 +123,28 @@ error_page 
     size_t                           body_start; //ʵӦbodyС  ֵngx_http_file_cache_update
     off_t                            fs_size; //ļС   ֵngx_http_file_cache_update
     ngx_msec_t                       lock_time;
+
+    /* the in-memory copy of the cache file, see "ram_size" */
+    ngx_http_file_cache_ram_t       *ram;
 } ngx_http_file_cache_node_t;
 
+
+/*
+ * a copy of a small cache file kept in the keys zone, the object is
+ * immutable once linked to a node and is freed when it is unlinked and
+ * no request is sending it
+ */
+
+struct ngx_http_file_cache_ram_s {
+    ngx_queue_t                      queue;
+    ngx_http_file_cache_node_t      *node;
+    ngx_file_uniq_t                  uniq;
+    size_t                           len;
+    size_t                           size;
+    ngx_uint_t                       count;
+    u_char                           data[1];
+};
+
 //ο: nginx proxy cache  http://blog.csdn.net/xiaolang85/article/details/38260041
 //ο:nginx proxy cacheʵԭ http://blog.itpub.net/15480802/viewspace-1421409/
 /*
@@ -157,6 +182,9 @@ struct ngx_http_cache_s {//
     //ûЯͷЯʱ䣬ͨngx_http_file_cache_valid(fastcgi_cache_valid proxy_cache_valid xxx 4m;)ȡʱ
     //ngx_http_file_cache_readжȡʱ򣬻ͨif (c->valid_sec < now) { }жϻǷڣ
     time_t                           valid_sec; //ֵngx_http_upstream_send_response(Ҳfastcgi_cache_validõЧʱ)  //ÿnginx˳ʱkill nginxֻļڣɾ
+    /* stale-while-revalidate and stale-if-error */
+    time_t                           updating_sec;
+    time_t                           error_sec;
     //Яͷ"Last-Modified:XXX"ֵngx_http_upstream_process_last_modified
     time_t                           last_modified;
     
@@ -265,6 +293,7 @@ body_start: [ngx_http_file_cache_header_t]["\nKEY: "][fastcgi_cache_key
     //ngx_http_file_cache_node_t  ȡ(´߱ѯõ)ngx_http_file_cache_node_tngx_http_file_cache_exists
     //ڻȡǰȻһǷлݣûУngx_http_file_cache_openдnode,Ȼȥ˻ȡ
     ngx_http_file_cache_node_t      *node; //ngx_http_file_cache_existsдռ͸ֵ
+    ngx_http_file_cache_ram_t       *ram;
 
 #if (NGX_THREADS)
 //ngx_http_file_cache_aio_read->ngx_thread_readдռ͸ֵ
@@ -313,6 +342,11 @@ body_start: [ngx_http_file_cache_header_t]["\nKEY: "][fastcgi_cache_key
     // עͬһͻrͬһͻڻȡݵĹ(ݻû)ַһgetעֻaioи
     unsigned                         reading:1; 
     unsigned                         secondary:1;
+
+    unsigned                         stale_updating:1;
+    unsigned                         stale_error:1;
+    /* the entry is updated by a background subrequest */
+    unsigned                         background:1;
 };
 
 /*
@@ -344,6 +378,8 @@ Content-type: text/html
 typedef struct { //дļǰֵȼngx_http_file_cache_set_headerȡļеĸͷṹngx_http_file_cache_read
     ngx_uint_t                       version;
     time_t                           valid_sec;
+    time_t                           updating_sec;
+    time_t                           error_sec;
     time_t                           last_modified;
     time_t                           date;
     uint32_t                         crc32;
@@ -413,6 +449,18 @@ typedef struct { //
     ngx_atomic_t                     loading;  /* Ƿڱ loader ̼ */ //loadcache  loaderpidngx_http_file_cache_loader
     //ļܴСļϻɾsizeȥɾⲿִСngx_http_file_cache_delete
     off_t                            size;    /* ʼΪ 0 */ //ռ˻ռܴСֵngx_http_file_cache_update  
+
+    /* the in-memory tier, LRU */
+    ngx_queue_t                      ram_queue;
+    size_t                           ram_size;
+
+    /* TinyLFU frequency sketch: 4 rows of 4-bit counters */
+    u_char                          *ram_sketch;
+    ngx_uint_t                       ram_width;
+    ngx_uint_t                       ram_additions;
+
+    /* the time of the loaded index snapshot until it is reconciled */
+    time_t                           index_time;
 } ngx_http_file_cache_sh_t; //עngx_http_file_cache_sh_tngx_open_file_cache_t
 //²ο:漰ʵ(һ    ) http://blog.csdn.net/brainkick/article/details/8535242
 
@@ -470,6 +518,24 @@ proxy_cache_path(fastcgi_cache_path) /a/b
 
     //fastcgi_cache_path keys_zone=fcgi:10m;еkeys_zone=fcgi:10mָڴѾڴռС
     ngx_shm_zone_t                  *shm_zone;
+
+    size_t                           ram_size;
+    size_t                           ram_max_object;
+    ngx_uint_t                       ram_width;
+
+    /* the index snapshot, see "index_checkpoint" */
+    ngx_str_t                        index;
+    ngx_str_t                        index_temp;
+    time_t                           index_checkpoint;
+    time_t                           index_next;
+
+#if (NGX_THREADS)
+    /* the pool for directory scanning and unlink(), see "thread_pool" */
+    ngx_thread_pool_t               *thread_pool;
+    ngx_http_file_cache_delete_t    *free_deletes;
+    ngx_uint_t                       deletes;
+    ngx_http_file_cache_loader_t    *loader;
+#endif
 };
 
 
@@ -2751,6 +2751,13 @@ ngx_http_update_location_config(ngx_http_request_t *r)
 
     } else {
         r->connection->sendfile = 0;
+
+#if (NGX_HTTP_SSL)
+        if (r->connection->ssl) {
+            /* kernel TLS sends file buffers as is only with sendfile */
+            r->main_filter_need_in_memory = 1;
+        }
+#endif
     }
 
     if (clcf->client_body_in_file_only) { //配置client_body_in_file_only on | clean
@@ -4000,6 +4007,7 @@ ngx_http_subrequest(ngx_http_request_t *r,
        发送body给downsstream时用到 */  
     sr->subrequest_in_memory = (flags & NGX_HTTP_SUBREQUEST_IN_MEMORY) != 0;
     sr->waited = (flags & NGX_HTTP_SUBREQUEST_WAITED) != 0;
+    sr->background = (flags & NGX_HTTP_SUBREQUEST_BACKGROUND) != 0;
 
     sr->unparsed_uri = r->unparsed_uri;
     sr->method_name = ngx_http_core_get_method;
@@ -4036,7 +4044,7 @@ ngx_http_subrequest(ngx_http_request_t *r,
           下面的这个if中最终c->data指向的是sub11_r，也就是最左下层的r
      */
     //注意:在创建子请求的过程中并没有创建新的ngx_connection_t，也就是始终用的root请求的ngx_connection_t
-    if (c->data == r && r->postponed == NULL) { //说明是r还没有子请求，在创建r的第一个子请求，例如第二层r的第一个子请求就是第三层r
+    if (c->data == r && r->postponed == NULL && !sr->background) { //说明是r还没有子请求，在创建r的第一个子请求，例如第二层r的第一个子请求就是第三层r
         c->data = sr;  /* 最终客户端请求r->connection->data指向最下层左边的子请求 */
     } 
 
@@ -4055,23 +4063,27 @@ ngx_http_subrequest(ngx_http_request_t *r,
 
     sr->log_handler = r->log_handler;
 
-    pr = ngx_palloc(r->pool, sizeof(ngx_http_postponed_request_t));
-    if (pr == NULL) {
-        return NGX_ERROR;
-    }
+    /* a background subrequest does not take part in the output */
 
-    pr->request = sr;
-    pr->out = NULL;
-    pr->next = NULL;
+    if (!sr->background) {
+        pr = ngx_palloc(r->pool, sizeof(ngx_http_postponed_request_t));
+        if (pr == NULL) {
+            return NGX_ERROR;
+        }
 
-    //连接图形化可以参考http://blog.csdn.net/fengmo_q/article/details/6685840
-    if (r->postponed) {/* 把该子请求挂载在其父请求的postponed链表的队尾 */  
-        //同一个r中创建的子请求通过r->postponed->next连接在一起，这些子请求中分别在创建子请求则通过postponed指向各自的子请求
-        for (p = r->postponed; p->next; p = p->next) { /* void */ }
-        p->next = pr;
+        pr->request = sr;
+        pr->out = NULL;
+        pr->next = NULL;
 
-    } else {
-        r->postponed = pr;
+        //连接图形化可以参考http://blog.csdn.net/fengmo_q/article/details/6685840
+        if (r->postponed) {/* 把该子请求挂载在其父请求的postponed链表的队尾 */  
+            //同一个r中创建的子请求通过r->postponed->next连接在一起，这些子请求中分别在创建子请求则通过postponed指向各自的子请求
+            for (p = r->postponed; p->next; p = p->next) { /* void */ }
+            p->next = pr;
+
+        } else {
+            r->postponed = pr;
+        }
     }
 
     /* 这里赋值为1，需要做从定向 */
@@ -11,6 +11,69 @@
 #include <ngx_md5.h>
 
 
+#define NGX_HTTP_FILE_CACHE_INDEX_MAGIC    0x78646e69  /* "indx" */
+#define NGX_HTTP_FILE_CACHE_INDEX_VERSION  1
+
+/* the number of entries copied under the lock or read at once */
+#define NGX_HTTP_FILE_CACHE_INDEX_BATCH    1024
+
+
+typedef struct {
+    uint32_t                         magic;
+    uint32_t                         version;
+    uint32_t                         entry_size;
+    uint32_t                         bsize;
+    size_t                           level[3];
+    time_t                           time;
+    uint64_t                         entries;
+} ngx_http_file_cache_index_header_t;
+
+
+typedef struct {
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN];
+    ngx_file_uniq_t                  uniq;
+    off_t                            fs_size;
+    u_short                          body_start;
+} ngx_http_file_cache_index_entry_t;
+
+
+#if (NGX_THREADS)
+
+/* the number of files unlinked by a task and of the tasks in flight */
+#define NGX_HTTP_FILE_CACHE_DELETE_BATCH   64
+#define NGX_HTTP_FILE_CACHE_DELETE_TASKS   8
+
+
+struct ngx_http_file_cache_delete_s {
+    ngx_http_file_cache_t           *cache;
+    ngx_http_file_cache_delete_t    *next;
+    ngx_thread_task_t               *task;
+
+    ngx_uint_t                       nfiles;
+    u_char                          *names;
+    u_char                          *name[NGX_HTTP_FILE_CACHE_DELETE_BATCH];
+    ngx_http_file_cache_node_t      *node[NGX_HTTP_FILE_CACHE_DELETE_BATCH];
+};
+
+
+struct ngx_http_file_cache_loader_s {
+    ngx_thread_mutex_t               mutex;
+    ngx_thread_cond_t                cond;
+    ngx_uint_t                       pending;
+    ngx_uint_t                       aborted;
+};
+
+
+typedef struct {
+    /* a copy of the cache with its own loader counters */
+    ngx_http_file_cache_t            cache;
+    ngx_http_file_cache_loader_t    *loader;
+    ngx_str_t                        path;
+} ngx_http_file_cache_walk_t;
+
+#endif
+
+
 static ngx_int_t ngx_http_file_cache_lock(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static void ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev);
@@ -63,6 +126,57 @@ static ngx_int_t ngx_http_file_cache_add(ngx_http_file_cache_t *cache,
 static ngx_int_t ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
 
+static ngx_int_t ngx_http_file_cache_ram_open(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static ssize_t ngx_http_file_cache_ram_read(ngx_http_cache_t *c);
+static void ngx_http_file_cache_ram_add(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static ngx_int_t ngx_http_file_cache_ram_admit(ngx_http_file_cache_t *cache,
+    u_char *key, size_t size);
+static void ngx_http_file_cache_ram_detach(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn);
+static void ngx_http_file_cache_ram_free(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_ram_t *ram);
+static void ngx_http_file_cache_ram_release(ngx_http_cache_t *c);
+static void ngx_http_file_cache_ram_cleanup(void *data);
+static size_t ngx_http_file_cache_ram_size(size_t len);
+static void ngx_http_file_cache_ram_touch(ngx_http_file_cache_t *cache,
+    u_char *key);
+static ngx_uint_t ngx_http_file_cache_ram_frequency(
+    ngx_http_file_cache_t *cache, u_char *key);
+static void ngx_http_file_cache_ram_node_key(ngx_http_file_cache_node_t *fcn,
+    u_char *key);
+static void ngx_http_file_cache_index_save(ngx_http_file_cache_t *cache);
+static ngx_int_t ngx_http_file_cache_index_copy(ngx_http_file_cache_t *cache,
+    u_char *key, ngx_uint_t first, ngx_http_file_cache_index_entry_t *entries,
+    ngx_uint_t *n);
+static ngx_int_t ngx_http_file_cache_index_cmp(ngx_http_file_cache_node_t *fcn,
+    u_char *key);
+static ngx_rbtree_node_t *ngx_http_file_cache_index_next(ngx_rbtree_t *tree,
+    ngx_rbtree_node_t *node);
+static ngx_int_t ngx_http_file_cache_index_load(ngx_http_file_cache_t *cache,
+    ngx_log_t *log);
+static ngx_int_t ngx_http_file_cache_index_add(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_index_entry_t *entry);
+static time_t ngx_http_file_cache_index_checkpoint(ngx_http_file_cache_t *cache,
+    time_t next);
+#if (NGX_THREADS)
+static time_t ngx_http_file_cache_delete_start(ngx_http_file_cache_t *cache);
+static ngx_http_file_cache_delete_t *ngx_http_file_cache_delete_alloc(
+    ngx_http_file_cache_t *cache);
+static time_t ngx_http_file_cache_delete_collect(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_delete_t *d);
+static void ngx_http_file_cache_delete_thread(void *data, ngx_log_t *log);
+static void ngx_http_file_cache_delete_done(ngx_http_file_cache_delete_t *d);
+static void ngx_http_file_cache_delete_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_file_cache_walk_post(ngx_http_file_cache_t *cache,
+    ngx_str_t *path);
+static void ngx_http_file_cache_walk_thread(void *data, ngx_log_t *log);
+static void ngx_http_file_cache_walk_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_file_cache_walk_wait(
+    ngx_http_file_cache_loader_t *loader);
+#endif
+
 
 ngx_str_t  ngx_http_cache_status[] = {
     ngx_string("MISS"),
@@ -78,6 +192,13 @@ ngx_str_t  ngx_http_cache_status[] = {
 static u_char  ngx_http_file_cache_key[] = { LF, 'K', 'E', 'Y', ':', ' ' };
 
 
+/* an object is admitted to the ram tier after it was used at least twice */
+#define NGX_HTTP_FILE_CACHE_RAM_MIN_USES  2
+
+/* the number of the least recently used objects examined on admission */
+#define NGX_HTTP_FILE_CACHE_RAM_TRIES     32
+
+
 static ngx_int_t
 ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data) //ngx_init_cycleִ
 {
@@ -117,10 +238,22 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data) //ngx_init_cycle
 
         cache->max_size /= cache->bsize;
 
-        if (!cache->sh->cold || cache->sh->loading) {
+        if ((!cache->sh->cold && !cache->sh->index_time)
+            || cache->sh->loading)
+        {
             cache->path->loader = NULL;
         }
 
+        if (cache->ram_size && cache->sh->ram_sketch == NULL) {
+            cache->sh->ram_sketch = ngx_slab_calloc(cache->shpool,
+                                                    cache->ram_width * 2);
+            if (cache->sh->ram_sketch == NULL) {
+                return NGX_ERROR;
+            }
+
+            cache->sh->ram_width = cache->ram_width;
+        }
+
         return NGX_OK;
     }
 
@@ -149,6 +282,19 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data) //ngx_init_cycle
     cache->sh->loading = 0;
     cache->sh->size = 0;
 
+    ngx_queue_init(&cache->sh->ram_queue);
+    cache->sh->ram_size = 0;
+
+    if (cache->ram_size) {
+        cache->sh->ram_sketch = ngx_slab_calloc(cache->shpool,
+                                                cache->ram_width * 2);
+        if (cache->sh->ram_sketch == NULL) {
+            return NGX_ERROR;
+        }
+
+        cache->sh->ram_width = cache->ram_width;
+    }
+
     cache->bsize = ngx_fs_bsize(cache->path->name.data);
 
     cache->max_size /= cache->bsize;
@@ -165,6 +311,10 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data) //ngx_init_cycle
 
     cache->shpool->log_nomem = 0;
 
+    if (cache->index.len && !ngx_test_config) {
+        (void) ngx_http_file_cache_index_load(cache, shm_zone->shm.log);
+    }
+
     return NGX_OK;
 }
 
@@ -371,6 +521,18 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
         goto done;
     }
 
+    if (cache->ram_size && c->exists && c->node->ram) {
+        rc = ngx_http_file_cache_ram_open(r, c);
+
+        if (rc == NGX_OK) {
+            return ngx_http_file_cache_read(r, c);
+        }
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+    }
+
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
     ngx_memzero(&of, sizeof(ngx_open_file_info_t));
@@ -623,7 +785,12 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
      ͷngx_http_cache_send->ngx_http_send_headerͣ
      ļİ岿ngx_http_cache_send벿дfilterģз
      */
-    n = ngx_http_file_cache_aio_read(r, c);//ȡļеǰͷϢ
+    if (c->ram) {
+        n = ngx_http_file_cache_ram_read(c);
+
+    } else {
+        n = ngx_http_file_cache_aio_read(r, c);//ȡļеǰͷϢ
+    }
 
     if (n < 0) {
         return n;
@@ -681,6 +848,8 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
     c->buf->last += n; //ƶlastָ
 
     c->valid_sec = h->valid_sec;
+    c->updating_sec = h->updating_sec;
+    c->error_sec = h->error_sec;
     c->last_modified = h->last_modified;
     c->date = h->date;
     c->valid_msec = h->valid_msec;
@@ -713,6 +882,8 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
     now = ngx_time();
 
     if (c->valid_sec < now) { //жϸûǷ
+        c->stale_updating = c->valid_sec + c->updating_sec >= now;
+        c->stale_error = c->valid_sec + c->error_sec >= now;
 
         ngx_shmtx_lock(&cache->shpool->mutex);
 
@@ -735,6 +906,13 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
         return rc;
     }
 
+    if (cache->ram_size
+        && c->ram == NULL
+        && c->length <= (off_t) cache->ram_max_object)
+    {
+        ngx_http_file_cache_ram_add(r, c);
+    }
+
     return NGX_OK;
 }
 
@@ -1051,8 +1229,14 @@ renew:
     fcn->body_start = 0;
     fcn->fs_size = 0;
 
+    ngx_http_file_cache_ram_detach(cache, fcn);
+
 done:
 
+    if (c->node == NULL && cache->ram_size && cache->sh->ram_sketch) {
+        ngx_http_file_cache_ram_touch(cache, c->key);
+    }
+
     fcn->expire = ngx_time() + cache->inactive;
 
     ngx_queue_insert_head(&cache->sh->queue, &fcn->queue); //´nodeڵӵcache->sh->queueͷ
@@ -1373,6 +1557,8 @@ ngx_http_file_cache_reopen(ngx_http_request_t *r, ngx_http_cache_t *c)
         return NGX_DECLINED;
     }
 
+    ngx_http_file_cache_ram_release(c);
+
     cache = c->file_cache;
 
     ngx_shmtx_lock(&cache->shpool->mutex);
@@ -1435,6 +1621,8 @@ ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf)
 
     h->version = NGX_HTTP_CACHE_VERSION;
     h->valid_sec = c->valid_sec;
+    h->updating_sec = c->updating_sec;
+    h->error_sec = c->error_sec;
     h->last_modified = c->last_modified;
     h->date = c->date;
     h->crc32 = c->crc32;
@@ -1597,6 +1785,7 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
 
     //ڻȡǰȻһǷлݣûУngx_http_file_cache_openдnode
     c->node->count--;
+    ngx_http_file_cache_ram_detach(cache, c->node);
     c->node->uniq = uniq;
     c->node->body_start = c->body_start;
 
@@ -1706,6 +1895,8 @@ ngx_http_file_cache_update_header(ngx_http_request_t *r)
 
     h.version = NGX_HTTP_CACHE_VERSION;
     h.valid_sec = c->valid_sec;
+    h.updating_sec = c->updating_sec;
+    h.error_sec = c->error_sec;
     h.last_modified = c->last_modified;
     h.date = c->date;
     h.crc32 = c->crc32;
@@ -1734,6 +1925,14 @@ ngx_http_file_cache_update_header(ngx_http_request_t *r)
     (void) ngx_write_file(&file, (u_char *) &h,
                           sizeof(ngx_http_file_cache_header_t), 0);
 
+    /* the copy in memory has the old header */
+
+    if (c->node) {
+        ngx_shmtx_lock(&c->file_cache->shpool->mutex);
+        ngx_http_file_cache_ram_detach(c->file_cache, c->node);
+        ngx_shmtx_unlock(&c->file_cache->shpool->mutex);
+    }
+
 done:
 
     if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
@@ -1800,6 +1999,19 @@ ngx_http_cache_send(ngx_http_request_t *r)
 
     //һ´巢
 
+    if (c->ram) {
+        b->pos = c->ram->data + c->body_start;
+        b->last = c->ram->data + c->length;
+        b->memory = (c->length - c->body_start) ? 1: 0;
+        b->last_buf = (r == r->main) ? 1: 0;
+        b->last_in_chain = 1;
+
+        out.buf = b;
+        out.next = NULL;
+
+        return ngx_http_output_filter(r, &out);
+    }
+
     b->file_pos = c->body_start; //ָҳ岿
     b->file_last = c->length; //ĩβҲļβ   
 
@@ -1851,6 +2063,7 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
         }
 
     } else if (!fcn->exists && fcn->count == 0 && c->min_uses == 1) {
+        ngx_http_file_cache_ram_detach(cache, fcn);
         ngx_queue_remove(&fcn->queue);
         ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
         ngx_slab_free_locked(cache->shpool, fcn);
@@ -1894,7 +2107,9 @@ ngx_http_file_cache_cleanup(void *data)
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
                    "http file cache cleanup");
 
-    if (c->updating) {
+    /* the background subrequest completes before the request is freed */
+
+    if (c->updating && !c->background) {
         ngx_log_error(NGX_LOG_ALERT, c->file.log, 0,
                       "stalled cache updating, error:%ui", c->error);
     }
@@ -1902,581 +2117,1963 @@ ngx_http_file_cache_cleanup(void *data)
     ngx_http_file_cache_free(c, NULL);
 }
 
-/*
-ngx_http_file_cache_expireһngx_http_file_cache_forced_expireʲôأҪӣǰһֻйڵcache
-Żȥɾ(üΪ0)һûйڣֻҪüΪ0ͻȥϸʵ֡
-*/
-/*
-Ȼngx_http_file_cache_forced_expire˼壬ǿɾcache ڵ㣬ķֵҲwait timeıҲǴӺǰġ
-*/
 
-/*
-ngx_http_file_cache_forced_expire  inactive queue βʼɨ裬ֱҵ 
-Աĵǰδʹýڵ ( fcn->count == 0 ҲǷ) ߲20 ڵδҵĽڵ㡣 
-*/
-//ɾڵĻ
-static time_t //һлļС( xxx_cache_path  path max_size=sizeеsize),øú
-ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
+static ngx_int_t
+ngx_http_file_cache_ram_open(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-    u_char                      *name;
-    size_t                       len;
-    time_t                       wait;
-    ngx_uint_t                   tries;
-    ngx_path_t                  *path;
-    ngx_queue_t                 *q;
-    ngx_http_file_cache_node_t  *fcn;
+    off_t                       fs_size;
+    ngx_pool_cleanup_t         *cln;
+    ngx_http_file_cache_t      *cache;
+    ngx_http_file_cache_ram_t  *ram;
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache forced expire");
+    cache = c->file_cache;
 
-    path = cache->path;
-    
-    //lenʾļӦȫ·Ƶĳ
-     /* 
-     ȫ·ʽΪ:proxy_cache_path+'/'+levelɵ·+16ƱʾMD5룬path->name.len + 1 ʾproxy_cache_path+'/'
-     ȣpath->len ʾ levelɵ·ĳȣ2 * NGX_HTTP_CACHE_KEY_LEN ʾ16ƱʾMD5ĳȣ֮
-     2 * NGX_HTTP_CACHE_KEY_LEN MD516ֽڣһֽ8λһ16ֻҪ4λʾMD5ռλΪ     
-     16*8,ת16ƵʽʾֽڵĸΪ16*8/2=16*2 = NGX_HTTP_CACHE_KEY_LEN * 2
-     */
-    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
 
-    name = ngx_alloc(len + 1, ngx_cycle->log);
-    if (name == NULL) {
-        return 10;
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    ram = c->node->ram;
+
+    if (ram == NULL || !c->node->exists || ram->uniq != c->node->uniq) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_DECLINED;
     }
 
-    ngx_memcpy(name, path->name.data, path->name.len);
+    ram->count++;
 
-    wait = 10;
-    tries = 20; //ɾڵ㳢Դ
+    ngx_queue_remove(&ram->queue);
+    ngx_queue_insert_head(&cache->sh->ram_queue, &ram->queue);
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    fs_size = c->node->fs_size;
 
-    for (q = ngx_queue_last(&cache->sh->queue);
-         q != ngx_queue_sentinel(&cache->sh->queue);
-         q = ngx_queue_prev(q))
-    {
-        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+    ngx_shmtx_unlock(&cache->shpool->mutex);
 
-        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                  "http file cache forced expire: #%d %d %02xd%02xd%02xd%02xd",
-                  fcn->count, fcn->exists,
-                  fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache ram: \"%s\" %uz",
+                   c->file.name.data, ram->len);
 
-        if (fcn->count == 0) {
-            //üΪ0ɾcache
-            ngx_http_file_cache_delete(cache, q, name);
-            wait = 0;
+    c->ram = ram;
 
-        } else {
-            //20
-            if (--tries) {
-                continue;
-            }
+    cln->handler = ngx_http_file_cache_ram_cleanup;
+    cln->data = c;
 
-            wait = 1;
-        }
+    c->uniq = ram->uniq;
+    c->length = ram->len;
+    c->fs_size = fs_size;
 
-        break;
+    c->buf = ngx_create_temp_buf(r->pool, c->body_start);
+    if (c->buf == NULL) {
+        return NGX_ERROR;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    return NGX_OK;
+}
 
-    ngx_free(name);
 
-    return wait;
+static ssize_t
+ngx_http_file_cache_ram_read(ngx_http_cache_t *c)
+{
+    size_t  n;
+
+    /*
+     * the header is copied as upstream modules modify it while parsing,
+     * the body is sent directly from the shared memory
+     */
+
+    n = ngx_min(c->ram->len, (size_t) (c->buf->end - c->buf->pos));
+
+    ngx_memcpy(c->buf->pos, c->ram->data, n);
+
+    return n;
 }
 
-//οnginx proxy cache http://blog.csdn.net/xiaolang85/article/details/38260041 ͼ
-/*
-ngx_http_file_cache_expireһngx_http_file_cache_forced_expireʲôأҪӣǰһֻйڵcache
-Żȥɾ(üΪ0)һûйڣֻҪüΪ0ͻȥϸʵ֡
-*/
 
-/*
-ngx_http_file_cache_expireעnginxʹLRUҲǶβ˱ʱûбʹõģصľ
-һwaitֵֵļ㲻֪ΪʲônginxΪ10msҾֵΪɵá
-*/
+static void
+ngx_http_file_cache_ram_add(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+    size_t                      size;
+    ssize_t                     n;
+    ngx_http_file_cache_t      *cache;
+    ngx_http_file_cache_ram_t  *ram;
 
-/*
-ļstat״̬Ϣngx_cached_open_file_s(ngx_open_file_cache_t->rbtree(expire_queue)ĳԱ   )ngx_expire_old_cached_filesʧЧж, 
-ļϢ(ʵʵڵļϢ)ngx_http_file_cache_node_t(ngx_http_file_cache_s->shеĳԱ)ngx_http_file_cache_expireʧЧжϡ
-*/
+    cache = c->file_cache;
 
-//ɾڻ ngx_http_file_cache_expire ڻĿ (ɾռõĹڴ ͶӦĴļ) 
-static time_t //ngx_http_file_cache_expirengx_http_file_cache_addӦ
-ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
-{ //ٷֵ10Ҳ̳ʱϻʱ10s,ʹƻнڵ㻹5s͹ˣǻ10sʱ
-//ȻĩβĻļڱɾ򷵻1
-    u_char                      *name, *p;
-    size_t                       len;
-    time_t                       now, wait;
-    ngx_path_t                  *path;
-    ngx_queue_t                 *q;
-    ngx_http_file_cache_node_t  *fcn;
-    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
+    size = ngx_http_file_cache_ram_size((size_t) c->length);
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache expire");
+    ngx_shmtx_lock(&cache->shpool->mutex);
 
-    path = cache->path;
-    
-    //lenʾļӦȫ·Ƶĳ
-    
-    /* 
-        ȫ·ʽΪ:proxy_cache_path+'/'+levelɵ·+16ƱʾMD5룬path->name.len + 1 ʾ
-        proxy_cache_path+'/'ĳȣpath->len ʾ levelɵ·ĳȣ2 * NGX_HTTP_CACHE_KEY_LEN ʾ16Ʊʾ
-        MD5ĳȣ֮2 * NGX_HTTP_CACHE_KEY_LEN MD516ֽڣһֽ8λһ16ֻҪ4λʾ
-        MD5ռλΪ16*8,ת16ƵʽʾֽڵĸΪ16*8/2=16*2 = NGX_HTTP_CACHE_KEY_LEN * 2
-    */
-    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+    if (c->node->ram
+        || !c->node->exists
+        || c->node->uniq != c->uniq
+        || ngx_http_file_cache_ram_admit(cache, c->key, size) != NGX_OK)
+    {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return;
+    }
 
-    name = ngx_alloc(len + 1, ngx_cycle->log);
-    if (name == NULL) {
-        return 10;
+    ram = ngx_slab_alloc_locked(cache->shpool,
+                                offsetof(ngx_http_file_cache_ram_t, data)
+                                + (size_t) c->length);
+    if (ram == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return;
     }
 
-    ngx_memcpy(name, path->name.data, path->name.len);
+    ram->node = NULL;
+    ram->uniq = c->uniq;
+    ram->len = (size_t) c->length;
+    ram->size = size;
+    ram->count = 0;
 
-    now = ngx_time();
+    cache->sh->ram_size += size;
 
-    ngx_shmtx_lock(&cache->shpool->mutex); //̻ͬʱԹڴ
+    ngx_shmtx_unlock(&cache->shpool->mutex);
 
-    for ( ;; ) {
+    /* the object is small and usually in the page cache */
 
-        if (ngx_quit || ngx_terminate) {
-            wait = 1;
-            break;
-        }
+    n = ngx_read_file(&c->file, ram->data, ram->len, 0);
 
-        if (ngx_queue_empty(&cache->sh->queue)) {
-            //cacheΪգֱ˳
-            wait = 10;//ٷֵ10Ҳ̳ʱϻʱ10s,ʹƻнڵ㻹5s͹ˣǻ10sʱ
-            break;
-        }
-        
-        //ȡùڶеһڵ
-        q = ngx_queue_last(&cache->sh->queue);
-        
-        //ùڶнڵӦngx_http_file_cache_node_tڵĵַ
-        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+    ngx_shmtx_lock(&cache->shpool->mutex);
 
-        wait = fcn->expire - now;
-        
-        //ʾǰcacheļûйڣֱѭΪڶԽµľԽǰţµĻڶͷ
-        if (wait > 0) {
-            //ûгʱ˳ѭ
-            wait = wait > 10 ? 10 : wait;//ٷֵ10Ҳ̳ʱϻʱ10s,ʹƻнڵ㻹5s͹ˣǻ10sʱ
-            break;
-        }
+    if (n == (ssize_t) ram->len
+        && c->node->ram == NULL
+        && c->node->exists
+        && c->node->uniq == ram->uniq)
+    {
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache ram add: \"%s\" %uz",
+                       c->file.name.data, ram->len);
 
-        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache expire: #%d %d %02xd%02xd%02xd%02xd",
-                       fcn->count, fcn->exists,
-                       fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
+        ram->node = c->node;
+        c->node->ram = ram;
 
-        if (fcn->count == 0) { 
-            //üΪ0ɾcacheڵ
-            //ɾлļ
-            ngx_http_file_cache_delete(cache, q, name);
-            continue;
-        }
+        ngx_queue_insert_head(&cache->sh->ram_queue, &ram->queue);
 
-        if (fcn->deleting) { //ngx_http_file_cache_deleteĶ
-            //ǰڵɾ˳ѭ
-            wait = 1; //ĩβڵڱɾ򷵻1,1sִиú
+    } else {
+        ngx_http_file_cache_ram_free(cache, ram);
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_ram_admit(ngx_http_file_cache_t *cache, u_char *key,
+    size_t size)
+{
+    ssize_t                     need;
+    ngx_uint_t                  freq, tries;
+    ngx_queue_t                *q, *prev;
+    ngx_http_file_cache_ram_t  *ram;
+    u_char                      victim[NGX_HTTP_CACHE_KEY_LEN];
+
+    freq = ngx_http_file_cache_ram_frequency(cache, key);
+
+    if (freq < NGX_HTTP_FILE_CACHE_RAM_MIN_USES) {
+        return NGX_DECLINED;
+    }
+
+    need = (ssize_t) (cache->sh->ram_size + size - cache->ram_size);
+
+    if (need <= 0) {
+        return NGX_OK;
+    }
+
+    /*
+     * TinyLFU admission: the candidate replaces the least recently used
+     * objects only if it is used more frequently than each of them
+     */
+
+    tries = NGX_HTTP_FILE_CACHE_RAM_TRIES;
+
+    for (q = ngx_queue_last(&cache->sh->ram_queue);
+         q != ngx_queue_sentinel(&cache->sh->ram_queue) && need > 0;
+         q = ngx_queue_prev(q))
+    {
+        if (tries-- == 0) {
+            return NGX_DECLINED;
+        }
+
+        ram = ngx_queue_data(q, ngx_http_file_cache_ram_t, queue);
+
+        if (ram->count) {
+            continue;
+        }
+
+        ngx_http_file_cache_ram_node_key(ram->node, victim);
+
+        if (ngx_http_file_cache_ram_frequency(cache, victim) >= freq) {
+            return NGX_DECLINED;
+        }
+
+        need -= ram->size;
+    }
+
+    if (need > 0) {
+        return NGX_DECLINED;
+    }
+
+    q = ngx_queue_last(&cache->sh->ram_queue);
+
+    while (cache->sh->ram_size + size > cache->ram_size) {
+        prev = ngx_queue_prev(q);
+
+        ram = ngx_queue_data(q, ngx_http_file_cache_ram_t, queue);
+
+        if (ram->count == 0) {
+            ngx_http_file_cache_ram_detach(cache, ram->node);
+        }
+
+        q = prev;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_ram_detach(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn)
+{
+    ngx_http_file_cache_ram_t  *ram;
+
+    ram = fcn->ram;
+
+    if (ram == NULL) {
+        return;
+    }
+
+    fcn->ram = NULL;
+    ram->node = NULL;
+
+    ngx_queue_remove(&ram->queue);
+
+    if (ram->count == 0) {
+        ngx_http_file_cache_ram_free(cache, ram);
+    }
+}
+
+
+static void
+ngx_http_file_cache_ram_free(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_ram_t *ram)
+{
+    cache->sh->ram_size -= ram->size;
+
+    ngx_slab_free_locked(cache->shpool, ram);
+}
+
+
+static void
+ngx_http_file_cache_ram_release(ngx_http_cache_t *c)
+{
+    ngx_http_file_cache_t      *cache;
+    ngx_http_file_cache_ram_t  *ram;
+
+    ram = c->ram;
+
+    if (ram == NULL) {
+        return;
+    }
+
+    c->ram = NULL;
+
+    cache = c->file_cache;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    if (--ram->count == 0 && ram->node == NULL) {
+        ngx_http_file_cache_ram_free(cache, ram);
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+}
+
+
+static void
+ngx_http_file_cache_ram_cleanup(void *data)
+{
+    ngx_http_cache_t  *c = data;
+
+    ngx_http_file_cache_ram_release(c);
+}
+
+
+static size_t
+ngx_http_file_cache_ram_size(size_t len)
+{
+    size_t  size, n;
+
+    /* the size of the slab allocation */
+
+    size = offsetof(ngx_http_file_cache_ram_t, data) + len;
+
+    if (size > ngx_pagesize / 2) {
+        return ngx_align(size, ngx_pagesize);
+    }
+
+    for (n = 8; n < size; n <<= 1) { /* void */ }
+
+    return n;
+}
+
+
+/*
+ * the frequency sketch is a count-min sketch of 4-bit counters,
+ * the rows are indexed by the 32-bit words of the md5 key;
+ * all counters are halved after 10 * width additions
+ */
+
+static void
+ngx_http_file_cache_ram_touch(ngx_http_file_cache_t *cache, u_char *key)
+{
+    u_char                    *p;
+    uint32_t                   hash[4];
+    ngx_uint_t                 i, n;
+    ngx_http_file_cache_sh_t  *sh;
+
+    sh = cache->sh;
+
+    ngx_memcpy(hash, key, sizeof(hash));
+
+    for (i = 0; i < 4; i++) {
+        n = i * sh->ram_width + (hash[i] & (sh->ram_width - 1));
+        p = &sh->ram_sketch[n / 2];
+
+        if (n & 1) {
+            if (*p < 0xf0) {
+                *p += 0x10;
+            }
+
+        } else {
+            if ((*p & 0x0f) != 0x0f) {
+                *p += 0x01;
+            }
+        }
+    }
+
+    if (++sh->ram_additions < sh->ram_width * 10) {
+        return;
+    }
+
+    for (i = 0; i < sh->ram_width * 2; i++) {
+        sh->ram_sketch[i] = (sh->ram_sketch[i] >> 1) & 0x77;
+    }
+
+    sh->ram_additions /= 2;
+}
+
+
+static ngx_uint_t
+ngx_http_file_cache_ram_frequency(ngx_http_file_cache_t *cache, u_char *key)
+{
+    uint32_t                   hash[4];
+    ngx_uint_t                 i, n, v, freq;
+    ngx_http_file_cache_sh_t  *sh;
+
+    sh = cache->sh;
+
+    ngx_memcpy(hash, key, sizeof(hash));
+
+    freq = 0x0f;
+
+    for (i = 0; i < 4; i++) {
+        n = i * sh->ram_width + (hash[i] & (sh->ram_width - 1));
+        v = (sh->ram_sketch[n / 2] >> ((n & 1) * 4)) & 0x0f;
+
+        if (v < freq) {
+            freq = v;
+        }
+    }
+
+    return freq;
+}
+
+
+static void
+ngx_http_file_cache_ram_node_key(ngx_http_file_cache_node_t *fcn,
+    u_char *key)
+{
+    ngx_memcpy(key, &fcn->node.key, sizeof(ngx_rbtree_key_t));
+    ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+}
+
+/*
+ngx_http_file_cache_expireһngx_http_file_cache_forced_expireʲôأҪӣǰһֻйڵcache
+Żȥɾ(üΪ0)һûйڣֻҪüΪ0ͻȥϸʵ֡
+*/
+/*
+Ȼngx_http_file_cache_forced_expire˼壬ǿɾcache ڵ㣬ķֵҲwait timeıҲǴӺǰġ
+*/
+
+/*
+ngx_http_file_cache_forced_expire  inactive queue βʼɨ裬ֱҵ 
+Աĵǰδʹýڵ ( fcn->count == 0 ҲǷ) ߲20 ڵδҵĽڵ㡣 
+*/
+//ɾڵĻ
+static time_t //һлļС( xxx_cache_path  path max_size=sizeеsize),øú
+ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
+{
+    u_char                      *name;
+    size_t                       len;
+    time_t                       wait;
+    ngx_uint_t                   tries;
+    ngx_path_t                  *path;
+    ngx_queue_t                 *q;
+    ngx_http_file_cache_node_t  *fcn;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache forced expire");
+
+    path = cache->path;
+    
+    //lenʾļӦȫ·Ƶĳ
+     /* 
+     ȫ·ʽΪ:proxy_cache_path+'/'+levelɵ·+16ƱʾMD5룬path->name.len + 1 ʾproxy_cache_path+'/'
+     ȣpath->len ʾ levelɵ·ĳȣ2 * NGX_HTTP_CACHE_KEY_LEN ʾ16ƱʾMD5ĳȣ֮
+     2 * NGX_HTTP_CACHE_KEY_LEN MD516ֽڣһֽ8λһ16ֻҪ4λʾMD5ռλΪ     
+     16*8,ת16ƵʽʾֽڵĸΪ16*8/2=16*2 = NGX_HTTP_CACHE_KEY_LEN * 2
+     */
+    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+
+    name = ngx_alloc(len + 1, ngx_cycle->log);
+    if (name == NULL) {
+        return 10;
+    }
+
+    ngx_memcpy(name, path->name.data, path->name.len);
+
+    wait = 10;
+    tries = 20; //ɾڵ㳢Դ
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    for (q = ngx_queue_last(&cache->sh->queue);
+         q != ngx_queue_sentinel(&cache->sh->queue);
+         q = ngx_queue_prev(q))
+    {
+        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                  "http file cache forced expire: #%d %d %02xd%02xd%02xd%02xd",
+                  fcn->count, fcn->exists,
+                  fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
+
+        if (fcn->count == 0) {
+            //üΪ0ɾcache
+            ngx_http_file_cache_delete(cache, q, name);
+            wait = 0;
+
+        } else {
+            //20
+            if (--tries) {
+                continue;
+            }
+
+            wait = 1;
+        }
+
+        break;
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_free(name);
+
+    return wait;
+}
+
+//οnginx proxy cache http://blog.csdn.net/xiaolang85/article/details/38260041 ͼ
+/*
+ngx_http_file_cache_expireһngx_http_file_cache_forced_expireʲôأҪӣǰһֻйڵcache
+Żȥɾ(üΪ0)һûйڣֻҪüΪ0ͻȥϸʵ֡
+*/
+
+/*
+ngx_http_file_cache_expireעnginxʹLRUҲǶβ˱ʱûбʹõģصľ
+һwaitֵֵļ㲻֪ΪʲônginxΪ10msҾֵΪɵá
+*/
+
+/*
+ļstat״̬Ϣngx_cached_open_file_s(ngx_open_file_cache_t->rbtree(expire_queue)ĳԱ   )ngx_expire_old_cached_filesʧЧж, 
+ļϢ(ʵʵڵļϢ)ngx_http_file_cache_node_t(ngx_http_file_cache_s->shеĳԱ)ngx_http_file_cache_expireʧЧжϡ
+*/
+
+//ɾڻ ngx_http_file_cache_expire ڻĿ (ɾռõĹڴ ͶӦĴļ) 
+static time_t //ngx_http_file_cache_expirengx_http_file_cache_addӦ
+ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
+{ //ٷֵ10Ҳ̳ʱϻʱ10s,ʹƻнڵ㻹5s͹ˣǻ10sʱ
+//ȻĩβĻļڱɾ򷵻1
+    u_char                      *name, *p;
+    size_t                       len;
+    time_t                       now, wait;
+    ngx_path_t                  *path;
+    ngx_queue_t                 *q;
+    ngx_http_file_cache_node_t  *fcn;
+    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache expire");
+
+    path = cache->path;
+    
+    //lenʾļӦȫ·Ƶĳ
+    
+    /* 
+        ȫ·ʽΪ:proxy_cache_path+'/'+levelɵ·+16ƱʾMD5룬path->name.len + 1 ʾ
+        proxy_cache_path+'/'ĳȣpath->len ʾ levelɵ·ĳȣ2 * NGX_HTTP_CACHE_KEY_LEN ʾ16Ʊʾ
+        MD5ĳȣ֮2 * NGX_HTTP_CACHE_KEY_LEN MD516ֽڣһֽ8λһ16ֻҪ4λʾ
+        MD5ռλΪ16*8,ת16ƵʽʾֽڵĸΪ16*8/2=16*2 = NGX_HTTP_CACHE_KEY_LEN * 2
+    */
+    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+
+    name = ngx_alloc(len + 1, ngx_cycle->log);
+    if (name == NULL) {
+        return 10;
+    }
+
+    ngx_memcpy(name, path->name.data, path->name.len);
+
+    now = ngx_time();
+
+    ngx_shmtx_lock(&cache->shpool->mutex); //̻ͬʱԹڴ
+
+    for ( ;; ) {
+
+        if (ngx_quit || ngx_terminate) {
+            wait = 1;
+            break;
+        }
+
+        if (ngx_queue_empty(&cache->sh->queue)) {
+            //cacheΪգֱ˳
+            wait = 10;//ٷֵ10Ҳ̳ʱϻʱ10s,ʹƻнڵ㻹5s͹ˣǻ10sʱ
             break;
         }
+        
+        //ȡùڶеһڵ
+        q = ngx_queue_last(&cache->sh->queue);
+        
+        //ùڶнڵӦngx_http_file_cache_node_tڵĵַ
+        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+        wait = fcn->expire - now;
+        
+        //ʾǰcacheļûйڣֱѭΪڶԽµľԽǰţµĻڶͷ
+        if (wait > 0) {
+            //ûгʱ˳ѭ
+            wait = wait > 10 ? 10 : wait;//ٷֵ10Ҳ̳ʱϻʱ10s,ʹƻнڵ㻹5s͹ˣǻ10sʱ
+            break;
+        }
+
+        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache expire: #%d %d %02xd%02xd%02xd%02xd",
+                       fcn->count, fcn->exists,
+                       fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
+
+        if (fcn->count == 0) { 
+            //üΪ0ɾcacheڵ
+            //ɾлļ
+            ngx_http_file_cache_delete(cache, q, name);
+            continue;
+        }
+
+        if (fcn->deleting) { //ngx_http_file_cache_deleteĶ
+            //ǰڵɾ˳ѭ
+            wait = 1; //ĩβڵڱɾ򷵻1,1sִиú
+            break;
+        }
+
+        
+        //nodeַʾMD5룬keyתΪ16ƱʾMD5벢ת16Ʊʾʽ洢keyУִ
+        //תַһַ
+        p = ngx_hex_dump(key, (u_char *) &fcn->node.key, 
+                         sizeof(ngx_rbtree_key_t)); //ngx_http_file_cache_expirengx_http_file_cache_addӦ
+        len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
+        
+        //fcn->keyת16Ʊʾʽfcn->keyд洢urlMD5ĺ12ַ
+        (void) ngx_hex_dump(p, fcn->key, len);
+        
+        //ͨתͽURLMD5ת16ƱʾʽҴ洢key
+        
+        /*
+         * abnormally exited workers may leave locked cache entries,
+         * and although it may be safe to remove them completely,
+         * we prefer to just move them to the top of the inactive queue
+         */
+        //ǰڵǰ,ʱʱ䵽ǵǰͻʹøû棬ڰѻʱӳinactive 
+        ngx_queue_remove(q);
+        fcn->expire = ngx_time() + cache->inactive;
+        ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                      "ignore long locked inactive cache entry %*s, count:%d",
+                      2 * NGX_HTTP_CACHE_KEY_LEN, key, fcn->count);
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_free(name);
+
+    return wait;
+}
+
+/*
+ļ̾ngx_http_file_cache_delete ҵǰ 
+ǵǰѾcache->shpool->mutex ͬʱǰڵüΪ0
+*/
+//Ҫ2ܣһɾcacheļһɾcacheڵ㡣
+static void
+ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
+    u_char *name)
+{
+    u_char                      *p;
+    size_t                       len;
+    ngx_err_t                    err;
+    ngx_path_t                  *path;
+    ngx_http_file_cache_node_t  *fcn;
+
+    fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+    ngx_http_file_cache_ram_detach(cache, fcn);
+
+    if (fcn->exists) {
+        cache->sh->size -= fcn->fs_size; //鹲ڴͷˣܹռõĹڴҲô
+
+        path = cache->path;
+        p = name + path->name.len + 1 + path->len;
+        p = ngx_hex_dump(p, (u_char *) &fcn->node.key,
+                         sizeof(ngx_rbtree_key_t));
+        len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
+        p = ngx_hex_dump(p, fcn->key, len);
+        *p = '\0';
+
+        fcn->count++; //count  1 Աٴγ˽ڵ (ǰл) 
+        
+        fcn->deleting = 1; //deleting ʶ˻ڵڱɾΪЧڵ㡣 
+        
+
+        /*
+          ļɾ ( ngx_delete_file ) ܷԽڼ䣬ͷŵΪȴ 
+          */
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+        ngx_create_hashed_filename(path, name, len);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache expire: \"%s\"", name);
+
+        if (ngx_delete_file(name) == NGX_FILE_ERROR) {
+            err = ngx_errno;
+
+            /* the file of a node from the index snapshot may be gone */
+
+            if (err != NGX_ENOENT || cache->index.len == 0) {
+                ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, err,
+                              ngx_delete_file_n " \"%s\" failed", name);
+            }
+        }
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+        fcn->count--;
+        fcn->deleting = 0;
+    }
+
+    if (fcn->count == 0) {
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
+        ngx_slab_free_locked(cache->shpool, fcn);
+    }
+}
+
+/*
+NginxУproxy(fastcgi) cacheܣmaster processʱӽ(ڴӽ)
+ʹ̵Ļ塣һ̵ĹǶڼ黺棬ڵĻɾڶ̵ʱ򽫴Ѿĸ
+ӳ䵽ڴ(ĿǰNginx趨ΪԺ60)Ȼ˳
+
+ģ̵ngx_process_events_and_timers()Уngx_event_expire_timers()Nginxngx_event_timer_rbtree()
+水ִеʱȺһϵе¼ÿȡִʱ¼ǰʱѾӦִи¼ͻ¼handler
+̵handlerֱngx_cache_manager_process_handlerngx_cache_loader_process_handler
+*/
+
+//ngx_cache_manager_process_handlerִ
+static time_t //ʱִngx_cache_manager_process_handler->ngx_http_file_cache_managerӶгʱ(ͨʱʵ)
+ngx_http_file_cache_manager(void *data) //ÿnginx˳ʱkill nginxֻļڣɾ
+{
+    ngx_http_file_cache_t  *cache = data;
+
+    off_t   size;
+    time_t  next, wait;
+
+#if (NGX_THREADS)
+
+    if (cache->thread_pool) {
+        next = ngx_http_file_cache_delete_start(cache);
+        return ngx_http_file_cache_index_checkpoint(cache, next);
+    }
+
+#endif
+
+    next = ngx_http_file_cache_expire(cache); //ɾڵĻ  
+
+    next = ngx_http_file_cache_index_checkpoint(cache, next);
+
+    cache->last = ngx_current_msec; //ʱ
+    cache->files = 0;
+
+    for ( ;; ) {
+        ngx_shmtx_lock(&cache->shpool->mutex);
+        
+        //ȡµĻռĴС  
+        size = cache->sh->size; //ȡɾڻĻеĴС
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        //killall -9 nginxʱӡ:http file cache size: 16, max_size:0 Ժл
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache size: %O, max_size:%O", size, cache->max_size);
+
+        //黺Ŀ¼Ƿ񳬹趨С  proxy_cache_path xxx_cache_path  path max_size=size
+        if (size < cache->max_size) { //ռָΧڣɾˡreturn  
+            return next;
+        }
+
+       /*
+        ޣúngx_http_file_cache_forced_expire  inactive queue βʼɨ裬ֱҵ 
+        Աĵǰδʹýڵ ( fcn->count == 0 ҲǷ) ߲20 ڵδҵĽڵ㡣 
+        */
+        
+        //size̵ʹÿռ䣬size >= cache->max_size ǿưѲֻɾԱ֤ʹõĿռָΧ   
+        wait = ngx_http_file_cache_forced_expire(cache);
+
+        if (wait > 0) { //ϢһԺɾ
+            return wait;
+        }
+
+        if (ngx_quit || ngx_terminate) {
+            return next;
+        }
+    }
+}
+
+
+/*
+nginx1֮󣬻һΪcache loader processḶ̌ýһʱ֮󣬸ý̾ͻʧ
+
+ڸýڼҪ飺ļproxy_cache_pathָ·ееĻļԱĸļ
+MD5ȱӦngx_http_file_cache_node_tڵ㣬ھʹµngx_http_file_cache_node_töеrbnode
+queueֱ뵽͹ڶУڣӦԡ
+*/
+//ngx_cache_loader_process_handler->ngx_http_file_cache_loader
+static void
+ngx_http_file_cache_loader(void *data)
+{
+    ngx_http_file_cache_t  *cache = data;
+
+    ngx_int_t       rc;
+    ngx_tree_ctx_t  tree;
+#if (NGX_THREADS)
+    ngx_http_file_cache_loader_t  loader;
+#endif
+
+    if ((!cache->sh->cold && !cache->sh->index_time)
+        || cache->sh->loading)
+    {//ʾѾ
+        return;
+    }
+
+    if (!ngx_atomic_cmp_set(&cache->sh->loading, 0, ngx_pid)) {
+        return;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache loader");
+
+    tree.init_handler = NULL;
+    tree.file_handler = ngx_http_file_cache_manage_file;
+    tree.pre_tree_handler = ngx_http_file_cache_manage_directory;
+    tree.post_tree_handler = ngx_http_file_cache_noop;
+    tree.spec_handler = ngx_http_file_cache_delete_file;
+    //ע᷽ngx_walk_treeне
+    
+    tree.data = cache; //صݾcache
+    tree.alloc = 0;
+    tree.log = ngx_cycle->log;
+
+    cache->last = ngx_current_msec; //lastΪloadʱ
+    cache->files = 0;
+
+#if (NGX_THREADS)
+
+    if (cache->thread_pool) {
+        ngx_memzero(&loader, sizeof(ngx_http_file_cache_loader_t));
+
+        /* the directories are walked in this process if this fails */
+
+        if (ngx_thread_mutex_create(&loader.mutex, ngx_cycle->log) == NGX_OK) {
+
+            if (ngx_thread_cond_create(&loader.cond, ngx_cycle->log)
+                == NGX_OK)
+            {
+                cache->loader = &loader;
+
+            } else {
+                (void) ngx_thread_mutex_destroy(&loader.mutex, ngx_cycle->log);
+            }
+        }
+    }
+
+#endif
+
+    rc = ngx_walk_tree(&tree, &cache->path->name);
+
+#if (NGX_THREADS)
+
+    if (cache->loader) {
+        cache->loader = NULL;
+
+        if (ngx_http_file_cache_walk_wait(&loader) != NGX_OK
+            || loader.aborted)
+        {
+            rc = NGX_ABORT;
+        }
+
+        (void) ngx_thread_cond_destroy(&loader.cond, ngx_cycle->log);
+        (void) ngx_thread_mutex_destroy(&loader.mutex, ngx_cycle->log);
+    }
+
+#endif
+
+    if (rc == NGX_ABORT) { //ʼ
+        cache->sh->loading = 0;
+        return;
+    }
+
+    cache->sh->cold = 0;
+    cache->sh->index_time = 0;
+    cache->sh->loading = 0;
+
+    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                  "http file cache: %V %.3fM, bsize: %uz",
+                  &cache->path->name,
+                  ((double) cache->sh->size * cache->bsize) / (1024 * 1024),
+                  cache->bsize);
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    return NGX_OK;
+}
+
+//ngx_http_file_cache_manage_file ļϢ뻺С 
+static ngx_int_t
+ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    ngx_msec_t              elapsed;
+    ngx_http_file_cache_t  *cache;
+
+    cache = ctx->data;
+
+    if ((path->len == cache->index.len
+         && ngx_strncmp(path->data, cache->index.data, path->len) == 0)
+        || (path->len == cache->index_temp.len
+            && ngx_strncmp(path->data, cache->index_temp.data, path->len)
+               == 0))
+    {
+        return NGX_OK;
+    }
+
+    if (ngx_http_file_cache_add_file(ctx, path) != NGX_OK) {
+        //ļӽcache
+        (void) ngx_http_file_cache_delete_file(ctx, path);
+    }
+
+   /* 
+        ÿƻĶȡٶ ( loader_files  loader_threshold )Աڻļܶ½ͳʱϵͳԴġ 
+    */
+    if (++cache->files >= cache->loader_files) {
+        //ļ̫߲files
+        ngx_http_file_cache_loader_sleep(cache);
+
+    } else {
+        ngx_time_update();
+        //loaderʱǲǹֽ
+        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache loader time elapsed: %M", elapsed);
+
+      /* 
+        ÿƻĶȡٶ ( loader_files  loader_threshold )Աڻļܶ½ͳʱϵͳԴġ 
+        */
+        if (elapsed >= cache->loader_threshold) {
+            ngx_http_file_cache_loader_sleep(cache);
+        }
+    }
+
+    return (ngx_quit || ngx_terminate) ? NGX_ABORT : NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_manage_directory(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    u_char                 *p;
+    ngx_uint_t              depth, levels;
+    ngx_http_file_cache_t  *cache;
+
+    if (path->len >= 5
+        && ngx_strncmp(path->data + path->len - 5, "/temp", 5) == 0)
+    {
+        return NGX_DECLINED;
+    }
+
+    cache = ctx->data;
+
+    /*
+     * files are renamed into the last level directories, so the ones
+     * not modified since the index snapshot was taken are known already;
+     * a second is allowed for a node added just after its file was renamed
+     */
+
+    if (cache->sh->index_time && ctx->mtime < cache->sh->index_time - 1) {
+
+        for (levels = 0; levels < 3 && cache->path->level[levels]; levels++) {
+            /* void */
+        }
+
+        depth = 0;
+
+        for (p = path->data + cache->path->name.len;
+             p < path->data + path->len;
+             p++)
+        {
+            if (*p == '/') {
+                depth++;
+            }
+        }
+
+        if (depth == levels) {
+            return NGX_DECLINED;
+        }
+    }
+
+#if (NGX_THREADS)
+
+    if (cache->loader) {
+        return ngx_http_file_cache_walk_post(cache, path);
+    }
+
+#endif
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache)
+{
+    ngx_msleep(cache->loader_sleep);
+
+    ngx_time_update();
+
+    cache->last = ngx_current_msec;
+    cache->files = 0;
+}
+
+/*
+ngx_http_file_cache_add_fileҪͨļhashȻngx_http_file_cache_addļ뵽cache(ҲӺԼ),
+*/
+static ngx_int_t
+ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx, ngx_str_t *name)
+{
+    u_char                 *p;
+    ngx_int_t               n;
+    ngx_uint_t              i;
+    ngx_http_cache_t        c;
+    ngx_http_file_cache_t  *cache;
+
+    if (name->len < 2 * NGX_HTTP_CACHE_KEY_LEN) {
+        return NGX_ERROR;
+    }
+
+    if (ctx->size < (off_t) sizeof(ngx_http_file_cache_header_t)) {
+        ngx_log_error(NGX_LOG_CRIT, ctx->log, 0,
+                      "cache file \"%s\" is too small", name->data);
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(&c, sizeof(ngx_http_cache_t));
+    cache = ctx->data;
+
+    c.length = ctx->size;
+    c.fs_size = (ctx->fs_size + cache->bsize - 1) / cache->bsize;
+
+    p = &name->data[name->len - 2 * NGX_HTTP_CACHE_KEY_LEN];
+
+    for (i = 0; i < NGX_HTTP_CACHE_KEY_LEN; i++) {
+        n = ngx_hextoi(p, 2);
+
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
 
-        
-        //nodeַʾMD5룬keyתΪ16ƱʾMD5벢ת16Ʊʾʽ洢keyУִ
-        //תַһַ
-        p = ngx_hex_dump(key, (u_char *) &fcn->node.key, 
-                         sizeof(ngx_rbtree_key_t)); //ngx_http_file_cache_expirengx_http_file_cache_addӦ
-        len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
-        
-        //fcn->keyת16Ʊʾʽfcn->keyд洢urlMD5ĺ12ַ
-        (void) ngx_hex_dump(p, fcn->key, len);
-        
-        //ͨתͽURLMD5ת16ƱʾʽҴ洢key
-        
-        /*
-         * abnormally exited workers may leave locked cache entries,
-         * and although it may be safe to remove them completely,
-         * we prefer to just move them to the top of the inactive queue
-         */
-        //ǰڵǰ,ʱʱ䵽ǵǰͻʹøû棬ڰѻʱӳinactive 
-        ngx_queue_remove(q);
-        fcn->expire = ngx_time() + cache->inactive;
-        ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+        p += 2;
+
+        c.key[i] = (u_char) n;
+    }
+
+    return ngx_http_file_cache_add(cache, &c);
+}
+
+//ngx_http_file_cache_add ˽ڵ ngx_http_file_cache_sh_t ͵ĻС 
+
+//c->keyںвңûоʹnodeڵ㣬Ȼѽڵӵcache->sh->rbtreecache->sh->queueͷ
+static ngx_int_t //ngx_http_file_cache_expirengx_http_file_cache_addӦ
+ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
+{
+    ngx_http_file_cache_node_t  *fcn;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    fcn = ngx_http_file_cache_lookup(cache, c->key);//Ȳ
+
+    if (fcn == NULL) {
+        //ڣ½ṹ
+        fcn = ngx_slab_calloc_locked(cache->shpool,
+                                     sizeof(ngx_http_file_cache_node_t));
+        if (fcn == NULL) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+
+        ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
+                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node); //
+
+        fcn->uses = 1;
+        fcn->exists = 1;
+        fcn->fs_size = c->fs_size;
+
+        cache->sh->size += c->fs_size;
+
+    } else {
+        //ɾqueue²
+        ngx_queue_remove(&fcn->queue);
+    }
+
+    fcn->expire = ngx_time() + cache->inactive;
+
+    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue); //²
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->log, 0,
+                   "http file cache delete: \"%s\"", path->data);
+
+    if (ngx_delete_file(path->data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", path->data);
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * the index snapshot is a header followed by fixed size entries of
+ * the existing cache files in the order of keys, it is written by
+ * the cache manager and read on start before the workers are run;
+ * the loader then rescans only the directories changed since
+ * the snapshot was taken
+ */
+
+static void
+ngx_http_file_cache_index_save(ngx_http_file_cache_t *cache)
+{
+    off_t                                offset;
+    size_t                               size;
+    u_char                               key[NGX_HTTP_CACHE_KEY_LEN];
+    ngx_int_t                            rc;
+    ngx_uint_t                           n, first;
+    ngx_file_t                           file;
+    ngx_http_file_cache_index_entry_t   *entries;
+    ngx_http_file_cache_index_header_t   header;
+
+    entries = ngx_alloc(NGX_HTTP_FILE_CACHE_INDEX_BATCH
+                        * sizeof(ngx_http_file_cache_index_entry_t),
+                        ngx_cycle->log);
+    if (entries == NULL) {
+        return;
+    }
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.name = cache->index_temp;
+    file.log = ngx_cycle->log;
+
+    file.fd = ngx_open_file(file.name.data, NGX_FILE_WRONLY,
+                            NGX_FILE_TRUNCATE, NGX_FILE_DEFAULT_ACCESS);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", file.name.data);
+        ngx_free(entries);
+        return;
+    }
+
+    ngx_memzero(&header, sizeof(ngx_http_file_cache_index_header_t));
+
+    header.magic = NGX_HTTP_FILE_CACHE_INDEX_MAGIC;
+    header.version = NGX_HTTP_FILE_CACHE_INDEX_VERSION;
+    header.entry_size = sizeof(ngx_http_file_cache_index_entry_t);
+    header.bsize = (uint32_t) cache->bsize;
+    ngx_memcpy(header.level, cache->path->level, sizeof(header.level));
+
+    /* files renamed into the cache after this time may be missing */
+    header.time = ngx_time();
+
+    offset = sizeof(ngx_http_file_cache_index_header_t);
+    first = 1;
+
+    do {
+        ngx_memzero(entries, NGX_HTTP_FILE_CACHE_INDEX_BATCH
+                             * sizeof(ngx_http_file_cache_index_entry_t));
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        rc = ngx_http_file_cache_index_copy(cache, key, first, entries, &n);
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        first = 0;
+
+        if (n == 0) {
+            continue;
+        }
+
+        size = n * sizeof(ngx_http_file_cache_index_entry_t);
+
+        if (ngx_write_file(&file, (u_char *) entries, size, offset)
+            != (ssize_t) size)
+        {
+            goto failed;
+        }
+
+        offset += size;
+        header.entries += n;
+
+    } while (rc == NGX_AGAIN && !ngx_terminate);
+
+    if (rc == NGX_AGAIN) {
+        goto failed;
+    }
+
+    if (ngx_write_file(&file, (u_char *) &header, sizeof(header), 0)
+        != (ssize_t) sizeof(header))
+    {
+        goto failed;
+    }
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
+    }
+
+    ngx_free(entries);
+
+    if (ngx_rename_file(cache->index_temp.data, cache->index.data)
+        == NGX_FILE_ERROR)
+    {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                      cache->index_temp.data, cache->index.data);
+        return;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache index: \"%V\" %uL entries saved",
+                   &cache->index, header.entries);
+
+    return;
+
+failed:
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
+    }
+
+    if (ngx_delete_file(file.name.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", file.name.data);
+    }
+
+    ngx_free(entries);
+}
+
+
+/*
+ * copies a batch of the nodes following the key, the lock is held
+ * only for a batch and the tree may change between the batches
+ */
+
+static ngx_int_t
+ngx_http_file_cache_index_copy(ngx_http_file_cache_t *cache, u_char *key,
+    ngx_uint_t first, ngx_http_file_cache_index_entry_t *entries,
+    ngx_uint_t *n)
+{
+    ngx_uint_t                   i, visited;
+    ngx_rbtree_node_t           *node, *sentinel, *next;
+    ngx_http_file_cache_node_t  *fcn;
+
+    *n = 0;
+
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+
+    if (node == sentinel) {
+        return NGX_OK;
+    }
+
+    if (first) {
+        next = ngx_rbtree_min(node, sentinel);
+
+    } else {
+
+        /* the first node greater than the key */
+
+        next = NULL;
+
+        while (node != sentinel) {
+            fcn = (ngx_http_file_cache_node_t *) node;
+
+            if (ngx_http_file_cache_index_cmp(fcn, key) > 0) {
+                next = node;
+                node = node->left;
+
+            } else {
+                node = node->right;
+            }
+        }
+    }
+
+    i = 0;
+
+    for (visited = 0;
+         next && visited < NGX_HTTP_FILE_CACHE_INDEX_BATCH;
+         visited++)
+    {
+        fcn = (ngx_http_file_cache_node_t *) next;
+
+        ngx_http_file_cache_ram_node_key(fcn, key);
+
+        if (fcn->exists && !fcn->deleting) {
+            ngx_memcpy(entries[i].key, key, NGX_HTTP_CACHE_KEY_LEN);
+            entries[i].uniq = fcn->uniq;
+            entries[i].fs_size = fcn->fs_size;
+            entries[i].body_start = (u_short) fcn->body_start;
+            i++;
+        }
+
+        next = ngx_http_file_cache_index_next(&cache->sh->rbtree, next);
+    }
+
+    *n = i;
+
+    return next ? NGX_AGAIN : NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_index_cmp(ngx_http_file_cache_node_t *fcn, u_char *key)
+{
+    ngx_rbtree_key_t  node_key;
+
+    ngx_memcpy(&node_key, key, sizeof(ngx_rbtree_key_t));
+
+    if (fcn->node.key != node_key) {
+        return (fcn->node.key < node_key) ? -1 : 1;
+    }
+
+    return ngx_memcmp(fcn->key, &key[sizeof(ngx_rbtree_key_t)],
+                      NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+}
+
+
+static ngx_rbtree_node_t *
+ngx_http_file_cache_index_next(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
+{
+    ngx_rbtree_node_t  *sentinel, *parent;
+
+    sentinel = tree->sentinel;
+
+    if (node->right != sentinel) {
+        return ngx_rbtree_min(node->right, sentinel);
+    }
+
+    for ( ;; ) {
+
+        if (node == tree->root) {
+            return NULL;
+        }
+
+        parent = node->parent;
+
+        if (node == parent->left) {
+            return parent;
+        }
+
+        node = parent;
+    }
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_index_load(ngx_http_file_cache_t *cache, ngx_log_t *log)
+{
+    off_t                                offset, size;
+    ssize_t                              n;
+    uint64_t                             loaded;
+    ngx_int_t                            rc;
+    ngx_uint_t                           i, count;
+    ngx_file_t                           file;
+    ngx_err_t                            err;
+    ngx_file_info_t                      fi;
+    ngx_http_file_cache_index_entry_t   *entries;
+    ngx_http_file_cache_index_header_t   header;
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.name = cache->index;
+    file.log = log;
+
+    file.fd = ngx_open_file(file.name.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        err = ngx_errno;
+
+        if (err != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_CRIT, log, err,
+                          ngx_open_file_n " \"%s\" failed", file.name.data);
+        }
+
+        return NGX_DECLINED;
+    }
+
+    entries = NULL;
+    rc = NGX_DECLINED;
+
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", file.name.data);
+        goto done;
+    }
+
+    n = ngx_read_file(&file, (u_char *) &header, sizeof(header), 0);
+
+    if (n == NGX_ERROR) {
+        goto done;
+    }
+
+    size = ngx_file_size(&fi) - (off_t) sizeof(header);
+
+    if (n != (ssize_t) sizeof(header)
+        || header.magic != NGX_HTTP_FILE_CACHE_INDEX_MAGIC
+        || header.version != NGX_HTTP_FILE_CACHE_INDEX_VERSION
+        || header.entry_size != sizeof(ngx_http_file_cache_index_entry_t)
+        || header.bsize != cache->bsize
+        || ngx_memcmp(header.level, cache->path->level, sizeof(header.level))
+           != 0
+        || size < 0
+        || (uint64_t) size
+           != header.entries * sizeof(ngx_http_file_cache_index_entry_t))
+    {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "cache index \"%s\" is invalid, ignored",
+                      file.name.data);
+        goto done;
+    }
 
-        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
-                      "ignore long locked inactive cache entry %*s, count:%d",
-                      2 * NGX_HTTP_CACHE_KEY_LEN, key, fcn->count);
+    entries = ngx_alloc(NGX_HTTP_FILE_CACHE_INDEX_BATCH
+                        * sizeof(ngx_http_file_cache_index_entry_t), log);
+    if (entries == NULL) {
+        goto done;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    offset = sizeof(header);
 
-    ngx_free(name);
+    for (loaded = 0; loaded < header.entries; loaded += count) {
 
-    return wait;
+        count = (ngx_uint_t) ngx_min(header.entries - loaded,
+                                     NGX_HTTP_FILE_CACHE_INDEX_BATCH);
+
+        size = count * sizeof(ngx_http_file_cache_index_entry_t);
+
+        n = ngx_read_file(&file, (u_char *) entries, (size_t) size, offset);
+
+        if (n != (ssize_t) size) {
+            goto done;
+        }
+
+        offset += size;
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        for (i = 0; i < count; i++) {
+            if (ngx_http_file_cache_index_add(cache, &entries[i]) != NGX_OK) {
+                ngx_shmtx_unlock(&cache->shpool->mutex);
+                goto done;
+            }
+        }
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+    }
+
+    cache->sh->index_time = header.time;
+    cache->sh->cold = 0;
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "http file cache: %V %.3fM, bsize: %uz, "
+                  "%uL entries loaded from index",
+                  &cache->path->name,
+                  ((double) cache->sh->size * cache->bsize) / (1024 * 1024),
+                  cache->bsize, header.entries);
+
+    rc = NGX_OK;
+
+done:
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
+    }
+
+    if (entries) {
+        ngx_free(entries);
+    }
+
+    return rc;
 }
 
-/*
-ļ̾ngx_http_file_cache_delete ҵǰ 
-ǵǰѾcache->shpool->mutex ͬʱǰڵüΪ0
-*/
-//Ҫ2ܣһɾcacheļһɾcacheڵ㡣
-static void
-ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
-    u_char *name)
+
+static ngx_int_t
+ngx_http_file_cache_index_add(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_index_entry_t *entry)
 {
-    u_char                      *p;
-    size_t                       len;
-    ngx_path_t                  *path;
     ngx_http_file_cache_node_t  *fcn;
 
-    fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+    if (ngx_http_file_cache_lookup(cache, entry->key)) {
+        return NGX_OK;
+    }
 
-    if (fcn->exists) {
-        cache->sh->size -= fcn->fs_size; //鹲ڴͷˣܹռõĹڴҲô
+    fcn = ngx_slab_calloc_locked(cache->shpool,
+                                 sizeof(ngx_http_file_cache_node_t));
+    if (fcn == NULL) {
+        return NGX_ERROR;
+    }
 
-        path = cache->path;
-        p = name + path->name.len + 1 + path->len;
-        p = ngx_hex_dump(p, (u_char *) &fcn->node.key,
-                         sizeof(ngx_rbtree_key_t));
-        len = NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t);
-        p = ngx_hex_dump(p, fcn->key, len);
-        *p = '\0';
+    ngx_memcpy((u_char *) &fcn->node.key, entry->key,
+               sizeof(ngx_rbtree_key_t));
 
-        fcn->count++; //count  1 Աٴγ˽ڵ (ǰл) 
-        
-        fcn->deleting = 1; //deleting ʶ˻ڵڱɾΪЧڵ㡣 
-        
+    ngx_memcpy(fcn->key, &entry->key[sizeof(ngx_rbtree_key_t)],
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
 
-        /*
-          ļɾ ( ngx_delete_file ) ܷԽڼ䣬ͷŵΪȴ 
-          */
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
 
-        len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
-        ngx_create_hashed_filename(path, name, len);
+    fcn->uses = 1;
+    fcn->exists = 1;
+    fcn->uniq = entry->uniq;
+    fcn->body_start = entry->body_start;
+    fcn->fs_size = entry->fs_size;
 
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache expire: \"%s\"", name);
+    cache->sh->size += entry->fs_size;
 
-        if (ngx_delete_file(name) == NGX_FILE_ERROR) {
-            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
-                          ngx_delete_file_n " \"%s\" failed", name);
-        }
+    fcn->expire = ngx_time() + cache->inactive;
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
-        fcn->count--;
-        fcn->deleting = 0;
+    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+
+    return NGX_OK;
+}
+
+
+static time_t
+ngx_http_file_cache_index_checkpoint(ngx_http_file_cache_t *cache, time_t next)
+{
+    time_t  now;
+
+    if (cache->index_checkpoint == 0
+        || cache->sh->cold
+        || cache->sh->index_time)
+    {
+        return next;
     }
 
-    if (fcn->count == 0) {
-        ngx_queue_remove(q);
-        ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
-        ngx_slab_free_locked(cache->shpool, fcn);
+    now = ngx_time();
+
+    if (now >= cache->index_next) {
+        ngx_http_file_cache_index_save(cache);
+
+        now = ngx_time();
+        cache->index_next = now + cache->index_checkpoint;
     }
+
+    return ngx_min(next, cache->index_next - now);
 }
 
-/*
-NginxУproxy(fastcgi) cacheܣmaster processʱӽ(ڴӽ)
-ʹ̵Ļ塣һ̵ĹǶڼ黺棬ڵĻɾڶ̵ʱ򽫴Ѿĸ
-ӳ䵽ڴ(ĿǰNginx趨ΪԺ60)Ȼ˳
 
-ģ̵ngx_process_events_and_timers()Уngx_event_expire_timers()Nginxngx_event_timer_rbtree()
-水ִеʱȺһϵе¼ÿȡִʱ¼ǰʱѾӦִи¼ͻ¼handler
-̵handlerֱngx_cache_manager_process_handlerngx_cache_loader_process_handler
-*/
+#if (NGX_THREADS)
 
-//ngx_cache_manager_process_handlerִ
-static time_t //ʱִngx_cache_manager_process_handler->ngx_http_file_cache_managerӶгʱ(ͨʱʵ)
-ngx_http_file_cache_manager(void *data) //ÿnginx˳ʱkill nginxֻļڣɾ
+/*
+ * with a thread pool the manager collects nodes from the tail of the inactive
+ * queue in batches and unlinks their files in the pool, a completed task
+ * takes the next batch; the manager only starts the tasks.  As in
+ * ngx_http_file_cache_delete(), a node is kept in the tree with the deleting
+ * flag set until its file is unlinked, and is freed on task completion;
+ * the tasks in flight are counted in path->busy, so the manager process
+ * does not exit before the nodes are released
+ */
+
+static time_t
+ngx_http_file_cache_delete_start(ngx_http_file_cache_t *cache)
 {
-    ngx_http_file_cache_t  *cache = data;
+    time_t                         wait;
+    ngx_http_file_cache_delete_t  *d;
 
-    off_t   size;
-    time_t  next, wait;
+    for ( ;; ) {
 
-    next = ngx_http_file_cache_expire(cache); //ɾڵĻ  
+        if (ngx_quit || ngx_terminate) {
+            return 1;
+        }
 
-    cache->last = ngx_current_msec; //ʱ
-    cache->files = 0;
+        d = cache->free_deletes;
 
-    for ( ;; ) {
-        ngx_shmtx_lock(&cache->shpool->mutex);
-        
-        //ȡµĻռĴС  
-        size = cache->sh->size; //ȡɾڻĻеĴС
+        if (d) {
+            cache->free_deletes = d->next;
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        } else {
 
-        //killall -9 nginxʱӡ:http file cache size: 16, max_size:0 Ժл
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache size: %O, max_size:%O", size, cache->max_size);
+            if (cache->deletes == NGX_HTTP_FILE_CACHE_DELETE_TASKS) {
+                return 1;
+            }
 
-        //黺Ŀ¼Ƿ񳬹趨С  proxy_cache_path xxx_cache_path  path max_size=size
-        if (size < cache->max_size) { //ռָΧڣɾˡreturn  
-            return next;
+            d = ngx_http_file_cache_delete_alloc(cache);
+            if (d == NULL) {
+                return 10;
+            }
         }
 
-       /*
-        ޣúngx_http_file_cache_forced_expire  inactive queue βʼɨ裬ֱҵ 
-        Աĵǰδʹýڵ ( fcn->count == 0 ҲǷ) ߲20 ڵδҵĽڵ㡣 
-        */
-        
-        //size̵ʹÿռ䣬size >= cache->max_size ǿưѲֻɾԱ֤ʹõĿռָΧ   
-        wait = ngx_http_file_cache_forced_expire(cache);
+        wait = ngx_http_file_cache_delete_collect(cache, d);
+
+        if (d->nfiles == 0) {
+            d->next = cache->free_deletes;
+            cache->free_deletes = d;
 
-        if (wait > 0) { //ϢһԺɾ
             return wait;
         }
 
-        if (ngx_quit || ngx_terminate) {
-            return next;
+        if (ngx_thread_task_post(cache->thread_pool, d->task) != NGX_OK) {
+            ngx_http_file_cache_delete_thread(d, ngx_cycle->log);
+            ngx_http_file_cache_delete_done(d);
+
+            d->next = cache->free_deletes;
+            cache->free_deletes = d;
+
+            continue;
         }
+
+        cache->path->busy++;
     }
 }
 
 
-/*
-nginx1֮󣬻һΪcache loader processḶ̌ýһʱ֮󣬸ý̾ͻʧ
-
-ڸýڼҪ飺ļproxy_cache_pathָ·ееĻļԱĸļ
-MD5ȱӦngx_http_file_cache_node_tڵ㣬ھʹµngx_http_file_cache_node_töеrbnode
-queueֱ뵽͹ڶУڣӦԡ
-*/
-//ngx_cache_loader_process_handler->ngx_http_file_cache_loader
-static void
-ngx_http_file_cache_loader(void *data)
+static ngx_http_file_cache_delete_t *
+ngx_http_file_cache_delete_alloc(ngx_http_file_cache_t *cache)
 {
-    ngx_http_file_cache_t  *cache = data;
+    size_t                         len;
+    ngx_uint_t                     i;
+    ngx_path_t                    *path;
+    ngx_thread_task_t             *task;
+    ngx_http_file_cache_delete_t  *d;
 
-    ngx_tree_ctx_t  tree;
+    path = cache->path;
 
-    if (!cache->sh->cold || cache->sh->loading) {//ʾѾ
-        return;
+    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+
+    task = ngx_thread_task_alloc(ngx_cycle->pool,
+                                 sizeof(ngx_http_file_cache_delete_t)
+                                 + NGX_HTTP_FILE_CACHE_DELETE_BATCH
+                                   * (len + 1));
+    if (task == NULL) {
+        return NULL;
     }
 
-    if (!ngx_atomic_cmp_set(&cache->sh->loading, 0, ngx_pid)) {
-        return;
+    d = task->ctx;
+
+    d->cache = cache;
+    d->task = task;
+    d->names = (u_char *) d + sizeof(ngx_http_file_cache_delete_t);
+
+    for (i = 0; i < NGX_HTTP_FILE_CACHE_DELETE_BATCH; i++) {
+        ngx_memcpy(d->names + i * (len + 1), path->name.data, path->name.len);
     }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache loader");
+    task->handler = ngx_http_file_cache_delete_thread;
+    task->event.data = d;
+    task->event.handler = ngx_http_file_cache_delete_handler;
+    task->event.log = ngx_cycle->log;
 
-    tree.init_handler = NULL;
-    tree.file_handler = ngx_http_file_cache_manage_file;
-    tree.pre_tree_handler = ngx_http_file_cache_manage_directory;
-    tree.post_tree_handler = ngx_http_file_cache_noop;
-    tree.spec_handler = ngx_http_file_cache_delete_file;
-    //ע᷽ngx_walk_treeне
-    
-    tree.data = cache; //صݾcache
-    tree.alloc = 0;
-    tree.log = ngx_cycle->log;
+    cache->deletes++;
 
-    cache->last = ngx_current_msec; //lastΪloadʱ
-    cache->files = 0;
+    return d;
+}
 
-    if (ngx_walk_tree(&tree, &cache->path->name) == NGX_ABORT) { //ʼ
-        cache->sh->loading = 0;
-        return;
+
+static time_t
+ngx_http_file_cache_delete_collect(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_delete_t *d)
+{
+    u_char                      *p;
+    size_t                       len;
+    time_t                       now, wait;
+    ngx_uint_t                   tries;
+    ngx_path_t                  *path;
+    ngx_queue_t                 *q, *prev;
+    ngx_http_file_cache_node_t  *fcn;
+    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
+
+    path = cache->path;
+
+    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+
+    d->nfiles = 0;
+
+    now = ngx_time();
+    wait = 10;
+    tries = 20;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    for (q = ngx_queue_last(&cache->sh->queue);
+         q != ngx_queue_sentinel(&cache->sh->queue);
+         q = prev)
+    {
+        if (d->nfiles == NGX_HTTP_FILE_CACHE_DELETE_BATCH) {
+            wait = 0;
+            break;
+        }
+
+        prev = ngx_queue_prev(q);
+
+        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+        if (fcn->deleting) {
+            /* the file is being unlinked by another task */
+            continue;
+        }
+
+        if (fcn->expire > now && cache->sh->size < cache->max_size) {
+            wait = ngx_min(fcn->expire - now, 10);
+            break;
+        }
+
+        if (fcn->count) {
+
+            if (fcn->expire <= now) {
+
+                /* see ngx_http_file_cache_expire() */
+
+                ngx_queue_remove(q);
+                fcn->expire = now + cache->inactive;
+                ngx_queue_insert_head(&cache->sh->queue, q);
+
+                p = ngx_hex_dump(key, (u_char *) &fcn->node.key,
+                                 sizeof(ngx_rbtree_key_t));
+                (void) ngx_hex_dump(p, fcn->key, NGX_HTTP_CACHE_KEY_LEN
+                                                 - sizeof(ngx_rbtree_key_t));
+
+                ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                              "ignore long locked inactive cache entry %*s, "
+                              "count:%d",
+                              2 * NGX_HTTP_CACHE_KEY_LEN, key, fcn->count);
+                continue;
+            }
+
+            if (--tries == 0) {
+                wait = 1;
+                break;
+            }
+
+            continue;
+        }
+
+        ngx_http_file_cache_ram_detach(cache, fcn);
+
+        if (fcn->exists) {
+            cache->sh->size -= fcn->fs_size;
+
+            ngx_http_file_cache_ram_node_key(fcn, key);
+
+            p = d->names + d->nfiles * (len + 1);
+            d->name[d->nfiles] = p;
+
+            p = ngx_hex_dump(p + path->name.len + 1 + path->len,
+                             key, NGX_HTTP_CACHE_KEY_LEN);
+            *p = '\0';
+
+            ngx_create_hashed_filename(path, d->name[d->nfiles], len);
+
+            fcn->count++;
+            fcn->deleting = 1;
+
+            d->node[d->nfiles++] = fcn;
+
+            continue;
+        }
+
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
+        ngx_slab_free_locked(cache->shpool, fcn);
     }
 
-    cache->sh->cold = 0;
-    cache->sh->loading = 0;
+    ngx_shmtx_unlock(&cache->shpool->mutex);
 
-    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
-                  "http file cache: %V %.3fM, bsize: %uz",
-                  &cache->path->name,
-                  ((double) cache->sh->size * cache->bsize) / (1024 * 1024),
-                  cache->bsize);
+    return wait;
 }
 
 
-static ngx_int_t
-ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+static void
+ngx_http_file_cache_delete_thread(void *data, ngx_log_t *log)
 {
-    return NGX_OK;
-}
+    ngx_http_file_cache_delete_t  *d = data;
 
-//ngx_http_file_cache_manage_file ļϢ뻺С 
-static ngx_int_t
-ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
-{
-    ngx_msec_t              elapsed;
+    ngx_err_t               err;
+    ngx_uint_t              i;
     ngx_http_file_cache_t  *cache;
 
-    cache = ctx->data;
-
-    if (ngx_http_file_cache_add_file(ctx, path) != NGX_OK) {
-        //ļӽcache
-        (void) ngx_http_file_cache_delete_file(ctx, path);
-    }
+    cache = d->cache;
 
-   /* 
-        ÿƻĶȡٶ ( loader_files  loader_threshold )Աڻļܶ½ͳʱϵͳԴġ 
-    */
-    if (++cache->files >= cache->loader_files) {
-        //ļ̫߲files
-        ngx_http_file_cache_loader_sleep(cache);
+    for (i = 0; i < d->nfiles; i++) {
 
-    } else {
-        ngx_time_update();
-        //loaderʱǲǹֽ
-        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                       "http file cache expire: \"%s\"", d->name[i]);
 
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache loader time elapsed: %M", elapsed);
+        if (ngx_delete_file(d->name[i]) == NGX_FILE_ERROR) {
+            err = ngx_errno;
 
-      /* 
-        ÿƻĶȡٶ ( loader_files  loader_threshold )Աڻļܶ½ͳʱϵͳԴġ 
-        */
-        if (elapsed >= cache->loader_threshold) {
-            ngx_http_file_cache_loader_sleep(cache);
+            if (err != NGX_ENOENT || cache->index.len == 0) {
+                ngx_log_error(NGX_LOG_CRIT, log, err,
+                              ngx_delete_file_n " \"%s\" failed", d->name[i]);
+            }
         }
     }
-
-    return (ngx_quit || ngx_terminate) ? NGX_ABORT : NGX_OK;
 }
 
 
-static ngx_int_t
-ngx_http_file_cache_manage_directory(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+static void
+ngx_http_file_cache_delete_done(ngx_http_file_cache_delete_t *d)
 {
-    if (path->len >= 5
-        && ngx_strncmp(path->data + path->len - 5, "/temp", 5) == 0)
-    {
-        return NGX_DECLINED;
+    ngx_uint_t                   i;
+    ngx_http_file_cache_t       *cache;
+    ngx_http_file_cache_node_t  *fcn;
+
+    cache = d->cache;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    for (i = 0; i < d->nfiles; i++) {
+        fcn = d->node[i];
+
+        fcn->count--;
+        fcn->deleting = 0;
+
+        if (fcn->count == 0) {
+            ngx_queue_remove(&fcn->queue);
+            ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
+            ngx_slab_free_locked(cache->shpool, fcn);
+        }
     }
 
-    return NGX_OK;
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    d->nfiles = 0;
 }
 
 
 static void
-ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache)
+ngx_http_file_cache_delete_handler(ngx_event_t *ev)
 {
-    ngx_msleep(cache->loader_sleep);
+    ngx_http_file_cache_delete_t  *d = ev->data;
 
-    ngx_time_update();
+    ngx_http_file_cache_t  *cache;
 
-    cache->last = ngx_current_msec;
-    cache->files = 0;
+    cache = d->cache;
+
+    cache->path->busy--;
+
+    ngx_http_file_cache_delete_done(d);
+
+    if (!ngx_quit && !ngx_terminate) {
+
+        (void) ngx_http_file_cache_delete_collect(cache, d);
+
+        if (d->nfiles) {
+            if (ngx_thread_task_post(cache->thread_pool, d->task) == NGX_OK) {
+                cache->path->busy++;
+                return;
+            }
+
+            ngx_http_file_cache_delete_thread(d, ev->log);
+            ngx_http_file_cache_delete_done(d);
+        }
+    }
+
+    d->next = cache->free_deletes;
+    cache->free_deletes = d;
 }
 
+
 /*
-ngx_http_file_cache_add_fileҪͨļhashȻngx_http_file_cache_addļ뵽cache(ҲӺԼ),
-*/
+ * with a thread pool the loader walks the first level directories
+ * in the pool and waits for all of them
+ */
+
 static ngx_int_t
-ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx, ngx_str_t *name)
+ngx_http_file_cache_walk_post(ngx_http_file_cache_t *cache, ngx_str_t *path)
 {
-    u_char                 *p;
-    ngx_int_t               n;
-    ngx_uint_t              i;
-    ngx_http_cache_t        c;
-    ngx_http_file_cache_t  *cache;
+    ngx_thread_task_t             *task;
+    ngx_http_file_cache_walk_t    *walk;
+    ngx_http_file_cache_loader_t  *loader;
 
-    if (name->len < 2 * NGX_HTTP_CACHE_KEY_LEN) {
-        return NGX_ERROR;
-    }
+    loader = cache->loader;
 
-    if (ctx->size < (off_t) sizeof(ngx_http_file_cache_header_t)) {
-        ngx_log_error(NGX_LOG_CRIT, ctx->log, 0,
-                      "cache file \"%s\" is too small", name->data);
-        return NGX_ERROR;
+    task = ngx_thread_task_alloc(ngx_cycle->pool,
+                                 sizeof(ngx_http_file_cache_walk_t)
+                                 + path->len + 1);
+    if (task == NULL) {
+        return NGX_ABORT;
     }
 
-    ngx_memzero(&c, sizeof(ngx_http_cache_t));
-    cache = ctx->data;
-
-    c.length = ctx->size;
-    c.fs_size = (ctx->fs_size + cache->bsize - 1) / cache->bsize;
+    walk = task->ctx;
 
-    p = &name->data[name->len - 2 * NGX_HTTP_CACHE_KEY_LEN];
+    walk->cache = *cache;
+    walk->cache.loader = NULL;
+    walk->cache.files = 0;
+    walk->cache.last = ngx_current_msec;
 
-    for (i = 0; i < NGX_HTTP_CACHE_KEY_LEN; i++) {
-        n = ngx_hextoi(p, 2);
+    walk->loader = loader;
 
-        if (n == NGX_ERROR) {
-            return NGX_ERROR;
-        }
+    walk->path.len = path->len;
+    walk->path.data = (u_char *) walk + sizeof(ngx_http_file_cache_walk_t);
+    ngx_memcpy(walk->path.data, path->data, path->len + 1);
 
-        p += 2;
+    task->handler = ngx_http_file_cache_walk_thread;
+    task->event.data = walk;
+    task->event.handler = ngx_http_file_cache_walk_handler;
+    task->event.log = ngx_cycle->log;
 
-        c.key[i] = (u_char) n;
+    if (ngx_thread_mutex_lock(&loader->mutex, ngx_cycle->log) != NGX_OK) {
+        return NGX_ABORT;
     }
 
-    return ngx_http_file_cache_add(cache, &c);
-}
+    loader->pending++;
 
-//ngx_http_file_cache_add ˽ڵ ngx_http_file_cache_sh_t ͵ĻС 
+    (void) ngx_thread_mutex_unlock(&loader->mutex, ngx_cycle->log);
 
-//c->keyںвңûоʹnodeڵ㣬Ȼѽڵӵcache->sh->rbtreecache->sh->queueͷ
-static ngx_int_t //ngx_http_file_cache_expirengx_http_file_cache_addӦ
-ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
-{
-    ngx_http_file_cache_node_t  *fcn;
+    if (ngx_thread_task_post(cache->thread_pool, task) != NGX_OK) {
+        ngx_http_file_cache_walk_thread(walk, ngx_cycle->log);
+    }
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    return NGX_DECLINED;
+}
 
-    fcn = ngx_http_file_cache_lookup(cache, c->key);//Ȳ
 
-    if (fcn == NULL) {
-        //ڣ½ṹ
-        fcn = ngx_slab_calloc_locked(cache->shpool,
-                                     sizeof(ngx_http_file_cache_node_t));
-        if (fcn == NULL) {
-            ngx_shmtx_unlock(&cache->shpool->mutex);
-            return NGX_ERROR;
-        }
+static void
+ngx_http_file_cache_walk_thread(void *data, ngx_log_t *log)
+{
+    ngx_http_file_cache_walk_t  *walk = data;
 
-        ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+    ngx_int_t                      rc;
+    ngx_tree_ctx_t                 tree;
+    ngx_http_file_cache_loader_t  *loader;
 
-        ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
-                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+    tree.init_handler = NULL;
+    tree.file_handler = ngx_http_file_cache_manage_file;
+    tree.pre_tree_handler = ngx_http_file_cache_manage_directory;
+    tree.post_tree_handler = ngx_http_file_cache_noop;
+    tree.spec_handler = ngx_http_file_cache_delete_file;
+    tree.data = &walk->cache;
+    tree.alloc = 0;
+    tree.log = log;
 
-        ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node); //
+    rc = ngx_walk_tree(&tree, &walk->path);
 
-        fcn->uses = 1;
-        fcn->exists = 1;
-        fcn->fs_size = c->fs_size;
+    loader = walk->loader;
 
-        cache->sh->size += c->fs_size;
+    (void) ngx_thread_mutex_lock(&loader->mutex, log);
 
-    } else {
-        //ɾqueue²
-        ngx_queue_remove(&fcn->queue);
+    if (rc == NGX_ABORT) {
+        loader->aborted = 1;
     }
 
-    fcn->expire = ngx_time() + cache->inactive;
+    loader->pending--;
 
-    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue); //²
+    (void) ngx_thread_cond_signal(&loader->cond, log);
+    (void) ngx_thread_mutex_unlock(&loader->mutex, log);
+}
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
 
-    return NGX_OK;
+static void
+ngx_http_file_cache_walk_handler(ngx_event_t *ev)
+{
+    /* the loader process exits without returning to the event loop */
 }
 
 
 static ngx_int_t
-ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+ngx_http_file_cache_walk_wait(ngx_http_file_cache_loader_t *loader)
 {
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->log, 0,
-                   "http file cache delete: \"%s\"", path->data);
+    ngx_int_t  rc;
 
-    if (ngx_delete_file(path->data) == NGX_FILE_ERROR) {
-        ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
-                      ngx_delete_file_n " \"%s\" failed", path->data);
+    rc = NGX_OK;
+
+    if (ngx_thread_mutex_lock(&loader->mutex, ngx_cycle->log) != NGX_OK) {
+        return NGX_ERROR;
     }
 
-    return NGX_OK;
+    while (loader->pending) {
+        if (ngx_thread_cond_wait(&loader->cond, &loader->mutex, ngx_cycle->log)
+            != NGX_OK)
+        {
+            rc = NGX_ERROR;
+            break;
+        }
+    }
+
+    (void) ngx_thread_mutex_unlock(&loader->mutex, ngx_cycle->log);
+
+    return rc;
 }
 
+#endif
+
 //ȡ//proxy_cache_valid xxx 4m;е4mstatusҶӦʱ
 time_t
 ngx_http_file_cache_valid(ngx_array_t *cache_valid, ngx_uint_t status)
@@ -2529,7 +4126,8 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     u_char                 *last, *p;
     time_t                  inactive;
     size_t                  len;
-    ssize_t                 size;
+    time_t                  index_checkpoint;
+    ssize_t                 size, ram_size, ram_max_object;
     ngx_str_t               s, name, *value;
     ngx_int_t               loader_files;
     ngx_msec_t              loader_sleep, loader_threshold;
@@ -2559,6 +4157,11 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     size = 0;
     max_size = NGX_MAX_OFF_T_VALUE;
 
+    ram_size = 0;
+    ram_max_object = 64 * 1024;
+
+    index_checkpoint = 0;
+
     value = cf->args->elts;
 
     cache->path->name = value[1]; //ȡpath浽path->name
@@ -2742,6 +4345,70 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "ram_size=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            ram_size = ngx_parse_size(&s);
+            if (ram_size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid ram_size value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "ram_max_object=", 15) == 0) {
+
+            s.len = value[i].len - 15;
+            s.data = value[i].data + 15;
+
+            ram_max_object = ngx_parse_size(&s);
+            if (ram_max_object == NGX_ERROR || ram_max_object == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid ram_max_object value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "thread_pool=", 12) == 0) {
+#if (NGX_THREADS)
+            s.len = value[i].len - 12;
+            s.data = value[i].data + 12;
+
+            cache->thread_pool = ngx_thread_pool_add_helper(cf, &s);
+            if (cache->thread_pool == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"thread_pool\" is unsupported "
+                               "on this platform");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
+        if (ngx_strncmp(value[i].data, "index_checkpoint=", 17) == 0) {
+
+            s.len = value[i].len - 17;
+            s.data = value[i].data + 17;
+
+            index_checkpoint = ngx_parse_time(&s, 1);
+            if (index_checkpoint == (time_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                         "invalid index_checkpoint value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[i]);
         return NGX_CONF_ERROR;
@@ -2798,6 +4465,54 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         }
     }
 
+    if (ram_size) {
+
+        /*
+         * the ram tier lives in the keys zone, which is enlarged by
+         * the tier size, the frequency sketch, and the slab overhead
+         */
+
+        for (cache->ram_width = 1024;
+             cache->ram_width < (ngx_uint_t) ram_size / 1024;
+             cache->ram_width <<= 1)
+        { /* void */ }
+
+        cache->ram_size = ram_size;
+        cache->ram_max_object = ngx_min(ram_max_object, ram_size);
+
+        size += ram_size + cache->ram_width * 2 + ram_size / 64;
+    }
+
+    if (index_checkpoint) {
+        len = cache->path->name.len + sizeof("/index.tmp") - 1;
+
+        p = ngx_pnalloc(cf->pool, len + 1);
+        if (p == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        cache->index_temp.len = len;
+        cache->index_temp.data = p;
+
+        p = ngx_cpymem(p, cache->path->name.data, cache->path->name.len);
+        ngx_memcpy(p, "/index.tmp", sizeof("/index.tmp"));
+
+        len -= sizeof(".tmp") - 1;
+
+        p = ngx_pnalloc(cf->pool, len + 1);
+        if (p == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        cache->index.len = len;
+        cache->index.data = p;
+
+        ngx_memcpy(p, cache->index_temp.data, len);
+        p[len] = '\0';
+
+        cache->index_checkpoint = index_checkpoint;
+    }
+
     cache->shm_zone = ngx_shared_memory_add(cf, &name, size, cmd->post);
     if (cache->shm_zone == NULL) {
         return NGX_CONF_ERROR;
@@ -98,6 +98,125 @@ static uint32_t  usual[] = {
 #endif
 
 
+/*
+ * SIMD fast path: skip a run of bytes that cannot change the parser state.
+ * It is used for the header value and the URI states only, the state
+ * machine still handles every byte it returns to, a tail shorter than
+ * one vector and any partial buffer.  The implementation is selected
+ * by the CPU features detected in ngx_cpuinfo().
+ */
+
+#if (NGX_HAVE_SSE42 || NGX_HAVE_AVX2)
+
+#define NGX_HTTP_PARSE_SIMD  1
+
+/* zero padded to the vector size, '\0' is always a stop byte */
+
+static const char  ngx_http_parse_value_chars[16] = "\r\n";
+static const char  ngx_http_parse_uri_chars[16] = " \r\n#";
+
+#endif
+
+
+#if (NGX_HAVE_SSE42)
+
+#include <nmmintrin.h>
+
+static __attribute__((target("sse4.2"))) u_char *
+ngx_http_parse_scan_sse42(u_char *p, u_char *last, const char *set, int n)
+{
+    int      i;
+    __m128i  needle;
+
+    /* the set is zero padded, so n + 1 includes the '\0' */
+
+    needle = _mm_loadu_si128((const __m128i *) set);
+
+    while (last - p >= 16) {
+        i = _mm_cmpestri(needle, n + 1, _mm_loadu_si128((const __m128i *) p),
+                         16, _SIDD_UBYTE_OPS|_SIDD_CMP_EQUAL_ANY
+                             |_SIDD_LEAST_SIGNIFICANT);
+        if (i != 16) {
+            return p + i;
+        }
+
+        p += 16;
+    }
+
+    return p;
+}
+
+#endif
+
+
+#if (NGX_HAVE_AVX2)
+
+#include <immintrin.h>
+
+static __attribute__((target("avx2"))) u_char *
+ngx_http_parse_scan_avx2(u_char *p, u_char *last, const char *set, int n)
+{
+    int       i;
+    __m256i   v, m, c[5];
+    uint32_t  mask;
+
+    for (i = 0; i < n; i++) {
+        c[i] = _mm256_set1_epi8(set[i]);
+    }
+
+    c[n] = _mm256_setzero_si256();
+
+    while (last - p >= 32) {
+        v = _mm256_loadu_si256((const __m256i *) p);
+        m = _mm256_cmpeq_epi8(v, c[n]);
+
+        for (i = 0; i < n; i++) {
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, c[i]));
+        }
+
+        mask = (uint32_t) _mm256_movemask_epi8(m);
+
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 32;
+    }
+
+    return p;
+}
+
+#endif
+
+
+#if (NGX_HTTP_PARSE_SIMD)
+
+/*
+ * returns the first byte in [p, last) that is '\0' or in the set,
+ * or the end of the last complete vector scanned
+ */
+
+static ngx_inline u_char *
+ngx_http_parse_scan(u_char *p, u_char *last, const char *set, int n)
+{
+#if (NGX_HAVE_AVX2)
+    if (ngx_cpu_features & NGX_CPU_AVX2) {
+        return ngx_http_parse_scan_avx2(p, last, set, n);
+    }
+#endif
+
+#if (NGX_HAVE_SSE42)
+    if (ngx_cpu_features & NGX_CPU_SSE42) {
+        return ngx_http_parse_scan_sse42(p, last, set, n);
+    }
+#endif
+
+    return p;
+}
+
+#endif
+
+
 /* gcc, icc, msvc and others compile these switches as an jump table */
 /*
 GET /sample.jsp HTTP/1.1
@@ -650,6 +769,15 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         case sw_uri:
 
             if (usual[ch >> 5] & (1 << (ch & 0x1f))) {
+#if (NGX_HTTP_PARSE_SIMD)
+                /*
+                 * the bytes skipped are not ' ', CR, LF, '#' or '\0',
+                 * so none of them changes the state
+                 */
+                m = ngx_http_parse_scan(p + 1, b->last,
+                                        ngx_http_parse_uri_chars, 4);
+                p = m - 1;
+#endif
                 break;
             }
 
@@ -1045,6 +1173,28 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
 
         /* header value */
         case sw_value:
+#if (NGX_HTTP_PARSE_SIMD)
+            if (b->last - p > 16) {
+                u_char  *e;
+
+                /*
+                 * skip up to the line end, but stop before trailing spaces
+                 * to let the state machine set r->header_end for them
+                 */
+
+                e = ngx_http_parse_scan(p, b->last,
+                                        ngx_http_parse_value_chars, 2);
+
+                while (e > p && *(e - 1) == ' ') {
+                    e--;
+                }
+
+                if (e > p) {
+                    p = e - 1;
+                    break;
+                }
+            }
+#endif
             switch (ch) {
             case ' ':
                 r->header_end = p;
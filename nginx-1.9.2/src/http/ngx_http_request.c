@@ -618,7 +618,9 @@ ngx_http_create_request(ngx_connection_t *c)
     }
 
 #if (NGX_HTTP_SSL)
-    if (c->ssl) {
+    /* see also ngx_http_update_location_config() for "sendfile off" */
+
+    if (c->ssl && !c->ssl->sendfile) {
         r->main_filter_need_in_memory = 1;
     }
 #endif
@@ -2729,6 +2731,30 @@ ngx_http_finalize_request(ngx_http_request_t *r, ngx_int_t rc)
           sub11_r(data11)-----------sub12_r(data12)
 
      */
+        if (r->background) {
+
+            /* the reference to the main request is released below */
+
+            r->main->subrequests++;
+
+            if (!r->logged) {
+
+                clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+                if (clcf->log_subrequest) {
+                    ngx_http_log_request(r);
+                }
+
+                r->logged = 1;
+            }
+
+            r->done = 1;
+            r->write_event_handler = ngx_http_request_empty_handler;
+
+            ngx_http_finalize_connection(r);
+            return;
+        }
+
         if (r == c->data) { 
         //这个优先级最高的子请求数据发送完毕了，则直接从pr->postponed中摘除，例如这次摘除的是sub11_r，则下个优先级最高发送客户端数据的是sub12_r
 
@@ -2948,6 +2974,10 @@ discard_body为l，则表示正在丢弃包体，这时会再一次把请求的r
         return;
     }
 
+    /* the last reference may be held by a background subrequest */
+
+    r = r->main;
+
     if (r->reading_body) {
         r->keepalive = 0; //使用延迟关闭连接功能，就不需要再判断keepalive功能关连接了
         r->lingering_close = 1;
@@ -17,6 +17,8 @@ static ngx_int_t ngx_http_upstream_cache_get(ngx_http_request_t *r,
     ngx_http_upstream_t *u, ngx_http_file_cache_t **cache);
 static ngx_int_t ngx_http_upstream_cache_send(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_cache_background_update(
+    ngx_http_request_t *r, ngx_http_upstream_t *u);
 static ngx_int_t ngx_http_upstream_cache_status(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_upstream_cache_last_modified(ngx_http_request_t *r,
@@ -190,6 +192,11 @@ ngx_http_upstream_header_t  ngx_http_upstream_headers_in[] = { //后端应答的
                  ngx_http_upstream_process_content_length, 0,
                  ngx_http_upstream_ignore_header_line, 0, 0 },
 
+    { ngx_string("Content-Range"),
+                 ngx_http_upstream_ignore_header_line, 0,
+                 ngx_http_upstream_copy_header_line,
+                 offsetof(ngx_http_headers_out_t, content_range), 0 },
+
     { ngx_string("Date"),
                  ngx_http_upstream_process_header_line,
                  offsetof(ngx_http_upstream_headers_in_t, date),
@@ -873,7 +880,13 @@ ngx_http_upstream_init_request(ngx_http_request_t *r)
                 return;
             }
 
-            ngx_http_upstream_connect(r, u);//连接 
+            if (u->init_peer && u->init_peer(r, u) != NGX_OK) {
+                ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+                return;
+            }
+
+            ngx_http_upstream_connect(r, u);//连接
 
             return;
         }
@@ -967,6 +980,12 @@ found:
         return;
     }
 
+    if (u->init_peer && u->init_peer(r, u) != NGX_OK) {
+        ngx_http_upstream_finalize_request(r, u,
+                                           NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
+
     u->peer.start_time = ngx_current_msec;
 
     if (u->conf->next_upstream_tries
@@ -1074,9 +1093,32 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     switch (rc) {
 
+    case NGX_HTTP_CACHE_STALE:
+
+        /*
+         * with background updates the request expiring the entry is
+         * answered with the stale response as well, and the entry is
+         * refreshed by a background subrequest
+         */
+
+        if (((u->conf->cache_use_stale & NGX_HTTP_UPSTREAM_FT_UPDATING)
+             || c->stale_updating)
+            && !r->background
+            && u->conf->cache_background_update)
+        {
+            c->background = 1;
+            u->cache_status = rc;
+            rc = NGX_OK;
+        }
+
+        break;
+
     case NGX_HTTP_CACHE_UPDATING:
-        
-        if (u->conf->cache_use_stale & NGX_HTTP_UPSTREAM_FT_UPDATING) {
+
+        if (((u->conf->cache_use_stale & NGX_HTTP_UPSTREAM_FT_UPDATING)
+             || c->stale_updating)
+            && !r->background)
+        {
             //如果设置了fastcgi_cache_use_stale updating，表示说虽然该缓存文件失效了，已经有其他客户端请求在获取后端数据，但是现在还没有获取完整，
             //这时候就可以把以前过期的缓存发送给当前请求的客户端
             u->cache_status = rc;
@@ -1099,14 +1141,28 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
         rc = ngx_http_upstream_cache_send(r, u);
 
         if (rc != NGX_HTTP_UPSTREAM_INVALID_HEADER) {
+
+            if (c->background
+                && (rc == NGX_OK || rc == NGX_AGAIN)
+                && ngx_http_upstream_cache_background_update(r, u) != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
             return rc;
         }
 
+        /* the request updates the entry itself */
+
+        c->background = 0;
+
         break;
 
     case NGX_HTTP_CACHE_STALE: //表示缓存过期，见上面的ngx_http_file_cache_open->ngx_http_file_cache_read
 
         c->valid_sec = 0;
+        c->updating_sec = 0;
+        c->error_sec = 0;
         u->buffer.start = NULL;
         u->cache_status = NGX_HTTP_CACHE_EXPIRED;
 
@@ -1316,6 +1372,34 @@ ngx_http_upstream_cache_send(ngx_http_request_t *r, ngx_http_upstream_t *u)
     return rc;
 }
 
+
+static ngx_int_t
+ngx_http_upstream_cache_background_update(ngx_http_request_t *r,
+    ngx_http_upstream_t *u)
+{
+    ngx_http_request_t  *sr;
+
+    /*
+     * the subrequest is not linked into the output of the request,
+     * it only stores the response in the cache
+     */
+
+    if (ngx_http_subrequest(r, &r->uri, &r->args, &sr, NULL,
+                            NGX_HTTP_SUBREQUEST_BACKGROUND)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    sr->header_only = 1;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream cache background update: \"%V?%V\"",
+                   &r->uri, &r->args);
+
+    return NGX_OK;
+}
+
 #endif
 
 
@@ -1375,6 +1459,12 @@ ngx_http_upstream_resolve_handler(ngx_resolver_ctx_t *ctx)
         goto failed;
     }
 
+    if (u->init_peer && u->init_peer(r, u) != NGX_OK) {
+        ngx_http_upstream_finalize_request(r, u,
+                                           NGX_HTTP_INTERNAL_SERVER_ERROR);
+        goto failed;
+    }
+
     ngx_resolve_name_done(ctx);
     ur->ctx = NULL;
 
@@ -2726,7 +2816,8 @@ ngx_http_upstream_test_next(ngx_http_request_t *r, ngx_http_upstream_t *u)
 #if (NGX_HTTP_CACHE)
 
         if (u->cache_status == NGX_HTTP_CACHE_EXPIRED
-            && (u->conf->cache_use_stale & un->mask))
+            && ((u->conf->cache_use_stale & un->mask)
+                || r->cache->stale_error))
         {
             ngx_int_t  rc;
 
@@ -2877,6 +2968,16 @@ ngx_http_upstream_test_connect(ngx_connection_t *c)
     int        err;
     socklen_t  len;
 
+    if (c->multiplexed) {
+
+        /*
+         * the socket is shared with other streams, its pending error
+         * is handled by the owner of the real connection
+         */
+
+        return NGX_OK;
+    }
+
 #if (NGX_HAVE_KQUEUE)
 
     if (ngx_event_flags & NGX_USE_KQUEUE_EVENT)  {
@@ -4499,7 +4600,8 @@ ngx_http_upstream_next(ngx_http_request_t *r, ngx_http_upstream_t *u,
 #if (NGX_HTTP_CACHE)
 
             if (u->cache_status == NGX_HTTP_CACHE_EXPIRED
-                && (u->conf->cache_use_stale & ft_type))
+                && ((u->conf->cache_use_stale & ft_type)
+                    || r->cache->stale_error))
             {
                 ngx_int_t  rc;
 
@@ -4875,32 +4977,78 @@ ngx_http_upstream_process_cache_control(ngx_http_request_t *r,
         offset = 8;
     }
 
-    if (p == NULL) {
-        return NGX_OK;
-    }
+    if (p) {
+        n = 0;
+
+        for (p += offset; p < last; p++) {
+            if (*p == ',' || *p == ';' || *p == ' ') {
+                break;
+            }
 
-    n = 0;
+            if (*p >= '0' && *p <= '9') {
+                n = n * 10 + *p - '0';
+                continue;
+            }
 
-    for (p += offset; p < last; p++) {
-        if (*p == ',' || *p == ';' || *p == ' ') {
-            break;
+            u->cacheable = 0;
+            return NGX_OK;
         }
 
-        if (*p >= '0' && *p <= '9') {
-            n = n * 10 + *p - '0';
-            continue;
+        if (n == 0) {
+            u->cacheable = 0;
+            return NGX_OK;
         }
 
-        u->cacheable = 0;
-        return NGX_OK;
+        r->cache->valid_sec = ngx_time() + n;
     }
 
-    if (n == 0) {
-        u->cacheable = 0;
-        return NGX_OK;
+    /* RFC 5861: the time a stale response may be used after it expires */
+
+    p = ngx_strlcasestrn(start, last, (u_char *) "stale-while-revalidate=",
+                         23 - 1);
+
+    if (p) {
+        n = 0;
+
+        for (p += 23; p < last; p++) {
+            if (*p == ',' || *p == ';' || *p == ' ') {
+                break;
+            }
+
+            if (*p >= '0' && *p <= '9') {
+                n = n * 10 + *p - '0';
+                continue;
+            }
+
+            u->cacheable = 0;
+            return NGX_OK;
+        }
+
+        r->cache->updating_sec = n;
+        r->cache->error_sec = n;
     }
 
-    r->cache->valid_sec = ngx_time() + n;
+    p = ngx_strlcasestrn(start, last, (u_char *) "stale-if-error=", 15 - 1);
+
+    if (p) {
+        n = 0;
+
+        for (p += 15; p < last; p++) {
+            if (*p == ',' || *p == ';' || *p == ' ') {
+                break;
+            }
+
+            if (*p >= '0' && *p <= '9') {
+                n = n * 10 + *p - '0';
+                continue;
+            }
+
+            u->cacheable = 0;
+            return NGX_OK;
+        }
+
+        r->cache->error_sec = n;
+    }
     }
 #endif
 
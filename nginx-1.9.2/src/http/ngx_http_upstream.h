@@ -326,6 +326,7 @@ in the cache or the cache lock for this element to be released, up to the time s
     ngx_msec_t                       cache_lock_age;
 
     ngx_flag_t                       cache_revalidate;
+    ngx_flag_t                       cache_background_update;
 
     /*
 语法：proxy_cache_valid reply_code [reply_code ...] time;  proxy_cache_valid  200 302 10m; 
@@ -366,6 +367,7 @@ proxy_cache_valid  301 1h;  proxy_cache_valid  any 1m;
 游网速优先还是以下游网速优先
 */
     unsigned                         change_buffering:1;
+    unsigned                         http2:1;
 
 #if (NGX_HTTP_SSL)
     ngx_ssl_t                       *ssl;
@@ -656,6 +658,13 @@ Ngx_http_proxy_module.c (src\http\modules):    u->create_key = ngx_http_proxy_cr
     //ngx_http_xxx_create_request(例如ngx_http_fastcgi_create_request)
     ngx_int_t                      (*create_request)(ngx_http_request_t *r);//生成发送到上游服务器的请求缓冲（或者一条缓冲链）
 
+    /*
+     * called after the balancer has initialized u->peer, allows a module
+     * to wrap peer.get() and peer.free(), e.g. to multiplex requests
+     */
+    ngx_int_t                      (*init_peer)(ngx_http_request_t *r,
+                                         ngx_http_upstream_t *u);
+
 /*
 reinit_request可能会被多次回调。它被调用的原因只有一个，就是在第一次试图向上游服务器建立连接时，如果连接由于各种异常原因失败，
 那么会根据upstream中conf参数的策略要求再次重连上游服务器，而这时就会调用reinit_request方法了。图5-4描述了典型的reinit_request调用场景。
@@ -43,6 +43,10 @@ struct ngx_http_upstream_rr_peer_s {
     ngx_int_t                       effective_weight; //rr㷨Ȩ //ʼֵngx_http_upstream_init_round_robin
     ngx_int_t                       weight;//õȨ
 
+    /* peak EWMA of the response header time, "ewma" */
+    ngx_uint_t                      ewma_usec;
+    ngx_msec_t                      ewma_stamp;
+
     ngx_uint_t                      conns; //úpeerĳɹ
     /*
         failsﵽ޴max_failsfail_timeoutʱٴѡú˷
@@ -71,6 +75,11 @@ struct ngx_http_upstream_rr_peer_s {
     //ֻserver xxxx down;downã÷Ųᱻѯһ㶼Ϊָĳˣ޸ļdownȻreload nginx
     ngx_uint_t                      down;          /* unsigned  down:1; *///ָĳǷ
 
+    /* active health checks, see ngx_http_upstream_hc_module.c */
+    ngx_atomic_t                    hc_checked;
+    ngx_uint_t                      hc_fails;
+    ngx_uint_t                      hc_passes;
+
 #if (NGX_HTTP_SSL)
     void                           *ssl_session;
     int                             ssl_session_len;
@@ -86,6 +95,10 @@ struct ngx_http_upstream_rr_peer_s {
 };
 
 
+/* peer->down is also set by a failed active health check */
+#define NGX_HTTP_UPSTREAM_RR_HC_DOWN   0x02
+
+
 typedef struct ngx_http_upstream_rr_peers_s  ngx_http_upstream_rr_peers_t;
 
 //˺ᴴ˷бҽǺ󱸷󱸷ֿиԵÿһ˷һṹ
@@ -100,6 +113,9 @@ struct ngx_http_upstream_rr_peers_s { //ÿ
     ngx_atomic_t                    rwlock;
 #endif
 
+    /* connections selected by a bounded load balancer, see "hash maglev" */
+    ngx_uint_t                      conns;
+
     ngx_uint_t                      total_weight; //зȨغ
 
     unsigned                        single:1;//Ƿֻһupstrem xxx {server ip}¾һngx_http_upstream_init_round_robin
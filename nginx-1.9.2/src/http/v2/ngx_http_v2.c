@@ -26,49 +26,6 @@ CONNECT_ERROR (10) : 
 ENHANCE_YOUR_CALM (11) : ն˼Եȶڱֳܻ󸺺ɵΪ
 INADEQUATE_SECURITY (12)  ԲĵնСҪ
 */
-/* errors */
-#define NGX_HTTP_V2_NO_ERROR                     0x0
-#define NGX_HTTP_V2_PROTOCOL_ERROR               0x1
-#define NGX_HTTP_V2_INTERNAL_ERROR               0x2
-#define NGX_HTTP_V2_FLOW_CTRL_ERROR              0x3
-#define NGX_HTTP_V2_SETTINGS_TIMEOUT             0x4
-#define NGX_HTTP_V2_STREAM_CLOSED                0x5
-#define NGX_HTTP_V2_SIZE_ERROR                   0x6
-#define NGX_HTTP_V2_REFUSED_STREAM               0x7
-#define NGX_HTTP_V2_CANCEL                       0x8
-#define NGX_HTTP_V2_COMP_ERROR                   0x9
-#define NGX_HTTP_V2_CONNECT_ERROR                0xa
-#define NGX_HTTP_V2_ENHANCE_YOUR_CALM            0xb
-#define NGX_HTTP_V2_INADEQUATE_SECURITY          0xc
-#define NGX_HTTP_V2_HTTP_1_1_REQUIRED            0xd
-
-/* frame sizes */
-#define NGX_HTTP_V2_RST_STREAM_SIZE              4
-#define NGX_HTTP_V2_PRIORITY_SIZE                5
-#define NGX_HTTP_V2_PING_SIZE                    8
-#define NGX_HTTP_V2_GOAWAY_SIZE                  8
-#define NGX_HTTP_V2_WINDOW_UPDATE_SIZE           4
-
-#define NGX_HTTP_V2_STREAM_ID_SIZE               4
-
-#define NGX_HTTP_V2_SETTINGS_PARAM_SIZE          6
-
-/* settings fields */ /* setting֡ngx_http_v2_send_settings,Чжϼngx_http_v2_state_settings_params */
-#define NGX_HTTP_V2_HEADER_TABLE_SIZE_SETTING    0x1
-//ɴֵֵ100ĬϿɲã0ֵΪֹ 
-#define NGX_HTTP_V2_MAX_STREAMS_SETTING          0x3 
-/* ͶشڴСյͻsettingЯиͺҪشڵĬֵ2^16-1 (65,535)ֽڴСֵΪ2^31-1ֽڴСҪFLOW_CONTROL_ERROR */
-#define NGX_HTTP_V2_INIT_WINDOW_SIZE_SETTING     0x4
-/* ֵ֡ĬΪ2^1416384ֽڣ֡յ趨Ӱ죻ֵΪ2^1416384-2^24-1(16777215)  */
-#define NGX_HTTP_V2_MAX_FRAME_SIZE_SETTING       0x5
-
-//SETTING֡FRAME_SIZEȡֵ
-#define NGX_HTTP_V2_FRAME_BUFFER_SIZE            24
-#define NGX_HTTP_V2_DEFAULT_FRAME_SIZE           (1 << 14)
-
-#define NGX_HTTP_V2_MAX_WINDOW                   ((1U << 31) - 1)
-#define NGX_HTTP_V2_DEFAULT_WINDOW               65535
-
 
 /*
                      NGX_HTTP_V2_ROOT
@@ -197,6 +154,7 @@ static ngx_int_t ngx_http_v2_cookie(ngx_http_request_t *r,
     ngx_http_v2_header_t *header);
 static ngx_int_t ngx_http_v2_construct_cookie_header(ngx_http_request_t *r);
 static void ngx_http_v2_run_request(ngx_http_request_t *r);
+static void ngx_http_v2_push_request_handler(ngx_event_t *ev);
 static ngx_int_t ngx_http_v2_init_request_body(ngx_http_request_t *r);
 
 static ngx_int_t ngx_http_v2_terminate_stream(ngx_http_v2_connection_t *h2c,
@@ -283,6 +241,13 @@ ngx_http_v2_init(ngx_event_t *rev)
     /* ȡhttp2ģϢ */
     h2scf = ngx_http_get_module_srv_conf(hc->conf_ctx, ngx_http_v2_module);
 
+    h2c->hpack_enc.limit = h2scf->hpack_table_size;
+    h2c->hpack_enc.size = ngx_min(h2scf->hpack_table_size,
+                                  NGX_HTTP_V2_TABLE_SIZE);
+    h2c->hpack_enc.free = h2c->hpack_enc.size;
+
+    h2c->concurrent_pushes = h2scf->concurrent_pushes;
+
     h2c->pool = ngx_create_pool(h2scf->pool_size, h2c->connection->log);
     if (h2c->pool == NULL) {
         ngx_http_close_connection(c);
@@ -1242,9 +1207,11 @@ ngx_http_v2_state_headers(ngx_http_v2_connection_t *h2c, u_char *pos,
     h2c->state.header_limit = h2scf->max_header_size;
 
     /*  */
-    if (h2c->processing >= h2scf->concurrent_streams) {
+    /* ռÿͻ˿Դ򿪵 */
+    if (h2c->processing - h2c->pushing >= h2scf->concurrent_streams) {
         ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
-                      "concurrent streams exceeded %ui", h2c->processing);
+                      "concurrent streams exceeded %ui",
+                      h2c->processing - h2c->pushing);
 
         if (ngx_http_v2_send_rst_stream(h2c, h2c->state.sid,
                                         NGX_HTTP_V2_REFUSED_STREAM)
@@ -2126,7 +2093,8 @@ static u_char *
 ngx_http_v2_state_settings_params(ngx_http_v2_connection_t *h2c, u_char *pos,
     u_char *end)
 {
-    ngx_uint_t  id, value;
+    ngx_uint_t               id, value;
+    ngx_http_v2_srv_conf_t  *h2scf;
     /*
  Identifier(16) + Value (32) ѭidӦvalue
     */
@@ -2143,6 +2111,33 @@ ngx_http_v2_state_settings_params(ngx_http_v2_connection_t *h2c, u_char *pos,
 
         switch (id) {
 
+        case NGX_HTTP_V2_HEADER_TABLE_SIZE_SETTING:
+            ngx_http_v2_table_peer_size(h2c, value);
+            break;
+
+        case NGX_HTTP_V2_ENABLE_PUSH_SETTING:
+
+            if (value > 1) {
+                ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                              "client sent SETTINGS frame with incorrect "
+                              "ENABLE_PUSH value %ui", value);
+
+                return ngx_http_v2_connection_error(h2c,
+                                                    NGX_HTTP_V2_PROTOCOL_ERROR);
+            }
+
+            h2c->push_disabled = !value;
+            break;
+
+        case NGX_HTTP_V2_MAX_STREAMS_SETTING:
+            h2scf = ngx_http_get_module_srv_conf(
+                                            h2c->http_connection->conf_ctx,
+                                            ngx_http_v2_module);
+
+            /* ͻƵǷԴ򿪵Ҳ */
+            h2c->concurrent_pushes = ngx_min(value, h2scf->concurrent_pushes);
+            break;
+
         case NGX_HTTP_V2_INIT_WINDOW_SIZE_SETTING: /* شڵ */
 
             if (value > NGX_HTTP_V2_MAX_WINDOW) {
@@ -3679,6 +3674,203 @@ ngx_http_v2_run_request(ngx_http_request_t *r)
 }
 
 
+/*
+ * ΪparentһIDΪżͷparentƣ
+ * ڸúغPUSH_PROMISE֡ngx_http_v2_push_request_handlerпʼ
+ */
+ngx_http_v2_stream_t *
+ngx_http_v2_push_stream(ngx_http_v2_stream_t *parent, ngx_str_t *path)
+{
+    u_char                     *p;
+    ngx_uint_t                  i, n;
+    ngx_list_part_t            *part;
+    ngx_table_elt_t            *header, *h;
+    ngx_connection_t           *fc;
+    ngx_http_header_t          *hh;
+    ngx_http_request_t         *r, *pr;
+    ngx_http_v2_node_t         *node;
+    ngx_http_v2_header_t        authority;
+    ngx_http_v2_stream_t       *stream;
+    ngx_http_v2_connection_t   *h2c;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    /* request headers that may affect the representation being pushed */
+    static ngx_str_t  headers[] = {
+        ngx_string("accept-encoding"),
+        ngx_string("accept-language"),
+        ngx_string("user-agent")
+    };
+
+    h2c = parent->connection;
+    pr = parent->request;
+
+    node = ngx_http_v2_get_node_by_id(h2c, h2c->last_push + 2, 1);
+    if (node == NULL) {
+        return NULL;
+    }
+
+    if (node->parent) {
+        ngx_queue_remove(&node->reuse);
+        h2c->closed_nodes--;
+    }
+
+    stream = ngx_http_v2_create_stream(h2c);
+    if (stream == NULL) {
+        return NULL;
+    }
+
+    h2c->last_push = node->id;
+    h2c->pushing++;
+
+    stream->in_closed = 1;
+    stream->end_headers = 1;
+    stream->node = node;
+
+    node->stream = stream;
+    node->weight = 16;
+
+    ngx_http_v2_set_dependency(h2c, node, parent->node->id, 0);
+
+    r = stream->request;
+    fc = r->connection;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                   "http2 push stream sid:%ui: \"%V\"", node->id, path);
+
+    ngx_str_set(&r->method_name, "GET");
+    r->method = NGX_HTTP_GET;
+
+    p = ngx_pnalloc(r->pool, pr->schema_end - pr->schema_start + path->len
+                             + pr->headers_in.host->value.len);
+    if (p == NULL) {
+        goto error;
+    }
+
+    r->schema_start = p;
+    p = ngx_cpymem(p, pr->schema_start, pr->schema_end - pr->schema_start);
+    r->schema_end = p;
+
+    /* :path is parsed by ngx_http_v2_push_request_handler() */
+
+    r->uri_start = p;
+    p = ngx_cpymem(p, path->data, path->len);
+    r->uri_end = p;
+
+    authority.value.data = p;
+    authority.value.len = pr->headers_in.host->value.len;
+    ngx_memcpy(p, pr->headers_in.host->value.data, authority.value.len);
+
+    /*
+     * the authority was already accepted for the parent request,
+     * so ngx_http_process_host() does not finalize this one
+     */
+
+    if (ngx_http_v2_parse_authority(r, &authority) != NGX_OK) {
+        goto error;
+    }
+
+    cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
+
+    part = &pr->headers_in.headers.part;
+    header = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        for (n = 0; n < sizeof(headers) / sizeof(ngx_str_t); n++) {
+            if (header[i].key.len == headers[n].len
+                && ngx_strncasecmp(header[i].key.data, headers[n].data,
+                                   headers[n].len)
+                   == 0)
+            {
+                break;
+            }
+        }
+
+        if (n == sizeof(headers) / sizeof(ngx_str_t)) {
+            continue;
+        }
+
+        h = ngx_list_push(&r->headers_in.headers);
+        if (h == NULL) {
+            goto error;
+        }
+
+        h->key = headers[n];
+        h->lowcase_key = headers[n].data;
+        h->hash = header[i].hash;
+
+        h->value.len = header[i].value.len;
+        h->value.data = ngx_pstrdup(r->pool, &header[i].value);
+        if (h->value.data == NULL) {
+            goto error;
+        }
+
+        hh = ngx_hash_find(&cmcf->headers_in_hash, h->hash,
+                           h->lowcase_key, h->key.len);
+
+        if (hh && hh->handler(r, h, hh->offset) != NGX_OK) {
+            goto error;
+        }
+    }
+
+    fc->write->handler = ngx_http_v2_push_request_handler;
+    ngx_post_event(fc->write, &ngx_posted_events);
+
+    return stream;
+
+error:
+
+    /* nothing has been promised yet, so the stream is dropped silently */
+
+    r->logged = 1;
+    stream->out_closed = 1;
+
+    ngx_http_v2_close_stream(stream, NGX_HTTP_INTERNAL_SERVER_ERROR);
+
+    return NULL;
+}
+
+
+static void
+ngx_http_v2_push_request_handler(ngx_event_t *ev)
+{
+    ngx_int_t              rc;
+    ngx_connection_t      *fc;
+    ngx_http_request_t    *r;
+    ngx_http_v2_header_t   header;
+
+    fc = ev->data;
+    r = fc->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                   "http2 push request handler");
+
+    header.value.data = r->uri_start;
+    header.value.len = r->uri_end - r->uri_start;
+
+    rc = ngx_http_v2_parse_path(r, &header);
+
+    if (rc == NGX_OK) {
+        ngx_http_v2_run_request(r);
+
+    } else if (rc == NGX_DECLINED) {
+        ngx_http_finalize_request(r, NGX_HTTP_BAD_REQUEST);
+    }
+
+    ngx_http_run_posted_requests(fc);
+}
+
+
 static ngx_int_t
 ngx_http_v2_init_request_body(ngx_http_request_t *r)
 {
@@ -3911,6 +4103,10 @@ ngx_http_v2_close_stream(ngx_http_v2_stream_t *stream, ngx_int_t rc)
     fc->data = h2c->free_fake_connections;
     h2c->free_fake_connections = fc;
 
+    if (node->id % 2 == 0) {
+        h2c->pushing--;
+    }
+
     h2c->processing--;
 
     if (h2c->processing || h2c->blocked) {
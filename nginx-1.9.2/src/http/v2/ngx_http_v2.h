@@ -459,6 +459,7 @@ Stream Identifier
 #define NGX_HTTP_V2_MAX_FRAME_SIZE       ((1 << 24) - 1) /* http2ͷֵֶ */
 
 #define NGX_HTTP_V2_INT_OCTETS           4
+#define NGX_HTTP_V2_TABLE_SIZE           4096
 #define NGX_HTTP_V2_MAX_FIELD            ((1 << NGX_HTTP_V2_INT_OCTETS * 7) - 1)
 
 /* ǸֵV2ngx_http_v2_stream_t.skip_data */
@@ -502,6 +503,75 @@ Stream Identifier
 #define NGX_HTTP_V2_PADDED_FLAG          0x08 /* ˵HTTP2ݲִpad */
 #define NGX_HTTP_V2_PRIORITY_FLAG        0x20 /* flagиñʶʾݲִStream Dependencyweight */
 
+/* errors */
+#define NGX_HTTP_V2_NO_ERROR                     0x0
+#define NGX_HTTP_V2_PROTOCOL_ERROR               0x1
+#define NGX_HTTP_V2_INTERNAL_ERROR               0x2
+#define NGX_HTTP_V2_FLOW_CTRL_ERROR              0x3
+#define NGX_HTTP_V2_SETTINGS_TIMEOUT             0x4
+#define NGX_HTTP_V2_STREAM_CLOSED                0x5
+#define NGX_HTTP_V2_SIZE_ERROR                   0x6
+#define NGX_HTTP_V2_REFUSED_STREAM               0x7
+#define NGX_HTTP_V2_CANCEL                       0x8
+#define NGX_HTTP_V2_COMP_ERROR                   0x9
+#define NGX_HTTP_V2_CONNECT_ERROR                0xa
+#define NGX_HTTP_V2_ENHANCE_YOUR_CALM            0xb
+#define NGX_HTTP_V2_INADEQUATE_SECURITY          0xc
+#define NGX_HTTP_V2_HTTP_1_1_REQUIRED            0xd
+
+/* frame sizes */
+#define NGX_HTTP_V2_RST_STREAM_SIZE              4
+#define NGX_HTTP_V2_PRIORITY_SIZE                5
+#define NGX_HTTP_V2_PING_SIZE                    8
+#define NGX_HTTP_V2_GOAWAY_SIZE                  8
+#define NGX_HTTP_V2_WINDOW_UPDATE_SIZE           4
+
+#define NGX_HTTP_V2_STREAM_ID_SIZE               4
+
+#define NGX_HTTP_V2_SETTINGS_PARAM_SIZE          6
+
+/* settings fields */ /* setting֡ngx_http_v2_send_settings,Чжϼngx_http_v2_state_settings_params */
+#define NGX_HTTP_V2_HEADER_TABLE_SIZE_SETTING    0x1
+/* ͻǷͣ0ΪֹĬ1 */
+#define NGX_HTTP_V2_ENABLE_PUSH_SETTING          0x2
+//ɴֵֵ100ĬϿɲã0ֵΪֹ 
+#define NGX_HTTP_V2_MAX_STREAMS_SETTING          0x3 
+/* ͶشڴСյͻsettingЯиͺҪشڵĬֵ2^16-1 (65,535)ֽڴСֵΪ2^31-1ֽڴСҪFLOW_CONTROL_ERROR */
+#define NGX_HTTP_V2_INIT_WINDOW_SIZE_SETTING     0x4
+/* ֵ֡ĬΪ2^1416384ֽڣ֡յ趨Ӱ죻ֵΪ2^1416384-2^24-1(16777215)  */
+#define NGX_HTTP_V2_MAX_FRAME_SIZE_SETTING       0x5
+
+//SETTING֡FRAME_SIZEȡֵ
+#define NGX_HTTP_V2_FRAME_BUFFER_SIZE            24
+#define NGX_HTTP_V2_DEFAULT_FRAME_SIZE           (1 << 14)
+
+#define NGX_HTTP_V2_MAX_WINDOW                   ((1U << 31) - 1)
+#define NGX_HTTP_V2_DEFAULT_WINDOW               65535
+
+/* ngx_http_v2_static_table±Ӧ1 */
+#define NGX_HTTP_V2_AUTHORITY_INDEX       1
+#define NGX_HTTP_V2_METHOD_GET_INDEX      2
+#define NGX_HTTP_V2_PATH_INDEX            4
+#define NGX_HTTP_V2_SCHEME_HTTP_INDEX     6
+#define NGX_HTTP_V2_SCHEME_HTTPS_INDEX    7
+
+#define NGX_HTTP_V2_STATUS_INDEX          8
+#define NGX_HTTP_V2_STATUS_200_INDEX      8
+#define NGX_HTTP_V2_STATUS_204_INDEX      9
+#define NGX_HTTP_V2_STATUS_206_INDEX      10
+#define NGX_HTTP_V2_STATUS_304_INDEX      11
+#define NGX_HTTP_V2_STATUS_400_INDEX      12
+#define NGX_HTTP_V2_STATUS_404_INDEX      13
+#define NGX_HTTP_V2_STATUS_500_INDEX      14
+
+#define NGX_HTTP_V2_CONTENT_LENGTH_INDEX  28
+#define NGX_HTTP_V2_CONTENT_TYPE_INDEX    31
+#define NGX_HTTP_V2_DATE_INDEX            33
+#define NGX_HTTP_V2_LAST_MODIFIED_INDEX   44
+#define NGX_HTTP_V2_LOCATION_INDEX        46
+#define NGX_HTTP_V2_SERVER_INDEX          54
+#define NGX_HTTP_V2_VARY_INDEX            59
+
 
 typedef struct ngx_http_v2_connection_s   ngx_http_v2_connection_t;
 typedef struct ngx_http_v2_node_s         ngx_http_v2_node_t;
@@ -594,6 +664,43 @@ typedef struct {
     u_char                          *pos;
 } ngx_http_v2_hpack_t;
 
+
+/*
+ * an entry of the encoder dynamic table: the lowercased name immediately
+ * followed by the value, both stored contiguously in the hpack_enc storage
+ */
+typedef struct {
+    ngx_uint_t                       hash;
+    ngx_uint_t                       name_hash;
+    u_char                          *data;
+    size_t                           name_len;
+    size_t                           value_len;
+} ngx_http_v2_hpack_enc_entry_t;
+
+
+/* ngx_http_v2_connection_t.hpack_enc, see ngx_http_v2_table_encode() */
+typedef struct {
+    /* ring of limit / 32 + 1 entries, the newest one is entries[added - 1] */
+    ngx_http_v2_hpack_enc_entry_t   *entries;
+
+    ngx_uint_t                       added;
+    ngx_uint_t                       deleted;
+    ngx_uint_t                       allocated;
+
+    /* http2_hpack_table_size */
+    size_t                           limit;
+    /* min(limit, SETTINGS_HEADER_TABLE_SIZE of the peer) */
+    size_t                           size;
+    size_t                           free;
+
+    /* 2 * limit bytes, an entry never wraps around the end */
+    u_char                          *storage;
+    u_char                          *pos;
+
+    /* the next header block starts with a dynamic table size update */
+    unsigned                         size_update:1;
+} ngx_http_v2_hpack_enc_t;
+
 /* ngx_http_v2_initзռ */
 struct ngx_http_v2_connection_s {
     ngx_connection_t                *connection;//ӦĿͻӣֵngx_http_v2_init
@@ -626,6 +733,8 @@ struct ngx_http_v2_connection_s {
     ngx_http_v2_state_t              state;
     /* hpack̬ռ͸ֵngx_http_v2_add_header */
     ngx_http_v2_hpack_t              hpack;
+    /* encoder side dynamic table shared by responses of all streams */
+    ngx_http_v2_hpack_enc_t          hpack_enc;
 
     ngx_pool_t                      *pool;
     /* frameͨfreeʵظãԲοngx_http_v2_get_frame ngx_http_v2_frame_handler*/
@@ -660,9 +769,22 @@ struct ngx_http_v2_connection_s {
     ngx_queue_t                      closed;
     /* ĩβһID */
     ngx_uint_t                       last_sid;
+    /* һIDţIDΪżngx_http_v2_push_stream */
+    ngx_uint_t                       last_push;
+
+    /* ǰ򿪵Щͬʱprocessing */
+    ngx_uint_t                       pushing;
+    /* ޣȡhttp2_max_concurrent_pushesͿͻSETTINGS_MAX_CONCURRENT_STREAMSеĽСֵ */
+    ngx_uint_t                       concurrent_pushes;
+
+    /* Ѿ͹·crc32ͬһ·ظͣngx_http_v2_push_resource */
+    uint32_t                        *pushed;
+    ngx_uint_t                       npushed;
 
     unsigned                         closed_nodes:8;
     unsigned                         blocked:1;
+    /* ͻSETTINGS_ENABLE_PUSHΪ0 */
+    unsigned                         push_disabled:1;
 };
 
 /*
@@ -852,6 +974,11 @@ ngx_int_t ngx_http_v2_read_request_body(ngx_http_request_t *r,
 
 void ngx_http_v2_close_stream(ngx_http_v2_stream_t *stream, ngx_int_t rc);
 
+ngx_int_t ngx_http_v2_upstream_init_peer(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+ngx_http_v2_stream_t *ngx_http_v2_push_stream(ngx_http_v2_stream_t *parent,
+    ngx_str_t *path);
+
 ngx_int_t ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c);
 
 
@@ -860,11 +987,18 @@ ngx_int_t ngx_http_v2_get_indexed_header(ngx_http_v2_connection_t *h2c,
 ngx_int_t ngx_http_v2_add_header(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_header_t *header);
 ngx_int_t ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size);
+u_char *ngx_http_v2_table_encode(ngx_http_v2_connection_t *h2c, u_char *pos,
+    ngx_uint_t index, ngx_str_t *name, ngx_str_t *value, ngx_uint_t indexing);
+u_char *ngx_http_v2_table_size_update(ngx_http_v2_connection_t *h2c,
+    u_char *pos);
+void ngx_http_v2_table_peer_size(ngx_http_v2_connection_t *h2c, size_t size);
 
 
 ngx_int_t ngx_http_v2_huff_decode(u_char *state, u_char *src, size_t len,
     u_char **dst, ngx_uint_t last, ngx_log_t *log);
 
+u_char *ngx_http_v2_write_int(u_char *pos, ngx_uint_t prefix, ngx_uint_t value);
+
 /* bits - 1λȫΪ1  bitsΪ4Ϊbit:1111   bitsΪ5Ϊbit:1111*/
 #define ngx_http_v2_prefix(bits)  ((1 << (bits)) - 1)
 
@@ -19,29 +19,39 @@
 
 /* 128Ҳλ1000 0000,ҲǸindexУiΪ1ʾ0i=2Ӧ1i=3Ӧ2i=4Ӧ3 */
 #define ngx_http_v2_indexed(i)      (128 + (i))
-#define ngx_http_v2_inc_indexed(i)  (64 + (i))
-
-/* ngx_http_v2_static_table±Ӧ1 */
-#define NGX_HTTP_V2_STATUS_INDEX          8
-#define NGX_HTTP_V2_STATUS_200_INDEX      8
-#define NGX_HTTP_V2_STATUS_204_INDEX      9
-#define NGX_HTTP_V2_STATUS_206_INDEX      10
-#define NGX_HTTP_V2_STATUS_304_INDEX      11
-#define NGX_HTTP_V2_STATUS_400_INDEX      12
-#define NGX_HTTP_V2_STATUS_404_INDEX      13
-#define NGX_HTTP_V2_STATUS_500_INDEX      14
-
-#define NGX_HTTP_V2_CONTENT_LENGTH_INDEX  28
-#define NGX_HTTP_V2_CONTENT_TYPE_INDEX    31
-#define NGX_HTTP_V2_DATE_INDEX            33
-#define NGX_HTTP_V2_LAST_MODIFIED_INDEX   44
-#define NGX_HTTP_V2_LOCATION_INDEX        46
-#define NGX_HTTP_V2_SERVER_INDEX          54
-#define NGX_HTTP_V2_VARY_INDEX            59
-
-
-static u_char *ngx_http_v2_write_int(u_char *pos, ngx_uint_t prefix,
-    ngx_uint_t value);
+
+/* ÿӼ¼·󸲸ļ¼ */
+#define NGX_HTTP_V2_MAX_PUSHED            128
+
+
+static ngx_str_t  ngx_http_v2_status_name = ngx_string(":status");
+static ngx_str_t  ngx_http_v2_server_name = ngx_string("server");
+static ngx_str_t  ngx_http_v2_date_name = ngx_string("date");
+static ngx_str_t  ngx_http_v2_content_type_name = ngx_string("content-type");
+static ngx_str_t  ngx_http_v2_content_length_name =
+    ngx_string("content-length");
+static ngx_str_t  ngx_http_v2_last_modified_name =
+    ngx_string("last-modified");
+static ngx_str_t  ngx_http_v2_location_name = ngx_string("location");
+
+static ngx_str_t  ngx_http_v2_authority_name = ngx_string(":authority");
+static ngx_str_t  ngx_http_v2_path_name = ngx_string(":path");
+static ngx_str_t  ngx_http_v2_scheme_name = ngx_string(":scheme");
+
+static ngx_str_t  ngx_http_v2_server_full = ngx_string(NGINX_VER);
+static ngx_str_t  ngx_http_v2_server_short = ngx_string("nginx");
+
+#if (NGX_HTTP_GZIP)
+static ngx_str_t  ngx_http_v2_vary_name = ngx_string("vary");
+static ngx_str_t  ngx_http_v2_vary_accept_encoding =
+    ngx_string("Accept-Encoding");
+#endif
+
+
+static ngx_int_t ngx_http_v2_push_resources(ngx_http_request_t *r);
+static ngx_uint_t ngx_http_v2_link_rel_preload(ngx_str_t *rel);
+static ngx_int_t ngx_http_v2_push_resource(ngx_http_request_t *r,
+    ngx_str_t *path);
 static void ngx_http_v2_write_headers_head(u_char *pos, size_t length,
     ngx_uint_t sid, ngx_uint_t end_headers, ngx_uint_t end_stream);
 static void ngx_http_v2_write_continuation_head(u_char *pos, size_t length,
@@ -66,6 +76,8 @@ static ngx_inline ngx_int_t ngx_http_v2_filter_send(
 
 static ngx_int_t ngx_http_v2_headers_frame_handler(
     ngx_http_v2_connection_t *h2c, ngx_http_v2_out_frame_t *frame);
+static ngx_int_t ngx_http_v2_push_frame_handler(
+    ngx_http_v2_connection_t *h2c, ngx_http_v2_out_frame_t *frame);
 static ngx_int_t ngx_http_v2_data_frame_handler(
     ngx_http_v2_connection_t *h2c, ngx_http_v2_out_frame_t *frame);
 static ngx_inline void ngx_http_v2_handle_frame(
@@ -140,8 +152,8 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     u_char                     status, *p, *head;
     size_t                     len, rest;
     ngx_buf_t                 *b;
-    ngx_str_t                  host, location;
-    ngx_uint_t                 i, port, continuation;
+    ngx_str_t                  host, location, value;
+    ngx_uint_t                 i, port, continuation, indexing;
     ngx_chain_t               *cl;
     ngx_list_part_t           *part;
     ngx_table_elt_t           *header;
@@ -151,11 +163,14 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     ngx_http_v2_out_frame_t   *frame;
     ngx_http_core_loc_conf_t  *clcf;
     ngx_http_core_srv_conf_t  *cscf;
+    ngx_http_v2_connection_t  *h2c;
     struct sockaddr_in        *sin;
 #if (NGX_HAVE_INET6)
     struct sockaddr_in6       *sin6;
 #endif
     u_char                     addr[NGX_SOCKADDR_STRLEN];
+    u_char                     tmp[ngx_max(NGX_OFF_T_LEN,
+                                   sizeof("Wed, 31 Dec 1986 18:00:00 GMT"))];
 
 
     if (!r->stream) { /* ûдӦstreamֱһfilter */
@@ -231,12 +246,23 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         }
     }
 
+    /* pushed streams have even identifiers and cannot push themselves */
+
+    if (r->headers_out.status == NGX_HTTP_OK
+        && r->stream->node->id % 2
+        && !r->stream->connection->push_disabled)
+    {
+        if (ngx_http_v2_push_resources(r) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
     /* NGINXngx_http_v2_state_header_blockԽյͷ֡нngx_http_v2_header_filterжͷ֡б
        ̬ӳngx_http_v2_static_table
     */
 
     /* ͷ9ֽ + statusӦ(1ֽΪʲôԱʾstatusӦ룬ΪһֽھͿԱʾ̬ǸԱ,ngx_http_v2_static_table) */
-    len = NGX_HTTP_V2_FRAME_HEADER_SIZE
+    len = NGX_HTTP_V2_FRAME_HEADER_SIZE + NGX_HTTP_V2_INT_OCTETS
           + (status ? 1 : 1 + ngx_http_v2_literal_size("418"));
 
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
@@ -247,30 +273,52 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                                        : ngx_http_v2_literal_size("nginx");
     }
 
+    /* the fields that are never indexed need 2 octets for the name index */
+
     if (r->headers_out.date == NULL) {
-        len += 1 + ngx_http_v2_literal_size("Wed, 31 Dec 1986 18:00:00 GMT");
+        len += 2 + ngx_http_v2_literal_size("Wed, 31 Dec 1986 18:00:00 GMT");
     }
 
     if (r->headers_out.content_type.len) {
-        len += NGX_HTTP_V2_INT_OCTETS + r->headers_out.content_type.len;
 
         if (r->headers_out.content_type_len == r->headers_out.content_type.len
             && r->headers_out.charset.len)
         {
-            len += sizeof("; charset=") - 1 + r->headers_out.charset.len;
+            value.len = r->headers_out.content_type.len
+                        + sizeof("; charset=") - 1
+                        + r->headers_out.charset.len;
+
+            value.data = ngx_pnalloc(r->pool, value.len);
+            if (value.data == NULL) {
+                return NGX_ERROR;
+            }
+
+            p = ngx_cpymem(value.data, r->headers_out.content_type.data,
+                           r->headers_out.content_type.len);
+
+            p = ngx_cpymem(p, "; charset=", sizeof("; charset=") - 1);
+
+            ngx_memcpy(p, r->headers_out.charset.data,
+                       r->headers_out.charset.len);
+
+            /* update r->headers_out.content_type for possible logging */
+
+            r->headers_out.content_type = value;
         }
+
+        len += NGX_HTTP_V2_INT_OCTETS + r->headers_out.content_type.len;
     }
 
     if (r->headers_out.content_length == NULL
         && r->headers_out.content_length_n >= 0)
     {
-        len += 1 + ngx_http_v2_integer_octets(NGX_OFF_T_LEN) + NGX_OFF_T_LEN;
+        len += 2 + ngx_http_v2_integer_octets(NGX_OFF_T_LEN) + NGX_OFF_T_LEN;
     }
 
     if (r->headers_out.last_modified == NULL
         && r->headers_out.last_modified_time != -1)
     {
-        len += 1 + ngx_http_v2_literal_size("Wed, 31 Dec 1986 18:00:00 GMT");
+        len += 2 + ngx_http_v2_literal_size("Wed, 31 Dec 1986 18:00:00 GMT");
     }
 
     fc = r->connection;
@@ -365,7 +413,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 
         r->headers_out.location->hash = 0;
 
-        len += 1 + NGX_HTTP_V2_INT_OCTETS + r->headers_out.location->value.len;
+        len += 2 + NGX_HTTP_V2_INT_OCTETS + r->headers_out.location->value.len;
     }
 
 #if (NGX_HTTP_GZIP)
@@ -428,113 +476,108 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         return NGX_ERROR;
     }
 
+    /*
+     * the header block changes the dynamic table of the peer decoder,
+     * so nothing may fail once the encoding has been started
+     */
+
+    cl = ngx_alloc_chain_link(r->pool);
+    if (cl == NULL) {
+        return NGX_ERROR;
+    }
+
+    frame = ngx_palloc(r->pool, sizeof(ngx_http_v2_out_frame_t));
+    if (frame == NULL) {
+        return NGX_ERROR;
+    }
+
+    h2c = stream->connection;
+
     b->last_buf = r->header_only;
 
     b->last += NGX_HTTP_V2_FRAME_HEADER_SIZE;
 
+    b->last = ngx_http_v2_table_size_update(h2c, b->last);
+
     if (status) {
         *b->last++ = status;
+
     } else {
-        *b->last++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_STATUS_INDEX);
-        *b->last++ = 3;
-        b->last = ngx_sprintf(b->last, "%03ui", r->headers_out.status);
+        value.len = ngx_sprintf(tmp, "%03ui", r->headers_out.status) - tmp;
+        value.data = tmp;
+
+        b->last = ngx_http_v2_table_encode(h2c, b->last,
+                                           NGX_HTTP_V2_STATUS_INDEX,
+                                           &ngx_http_v2_status_name, &value,
+                                           1);
     }
 
     if (r->headers_out.server == NULL) {
-        *b->last++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_SERVER_INDEX);
-
-        if (clcf->server_tokens) {
-            *b->last++ = sizeof(NGINX_VER) - 1;
-            b->last = ngx_cpymem(b->last, NGINX_VER, sizeof(NGINX_VER) - 1);
-
-        } else {
-            *b->last++ = sizeof("nginx") - 1;
-            b->last = ngx_cpymem(b->last, "nginx", sizeof("nginx") - 1);
-        }
+        b->last = ngx_http_v2_table_encode(h2c, b->last,
+                                           NGX_HTTP_V2_SERVER_INDEX,
+                                           &ngx_http_v2_server_name,
+                                           clcf->server_tokens
+                                           ? &ngx_http_v2_server_full
+                                           : &ngx_http_v2_server_short,
+                                           1);
     }
 
     if (r->headers_out.date == NULL) {
-        *b->last++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_DATE_INDEX);
-        *b->last++ = (u_char) ngx_cached_http_time.len;
+        value = ngx_cached_http_time;
 
-        b->last = ngx_cpymem(b->last, ngx_cached_http_time.data,
-                             ngx_cached_http_time.len);
+        b->last = ngx_http_v2_table_encode(h2c, b->last,
+                                           NGX_HTTP_V2_DATE_INDEX,
+                                           &ngx_http_v2_date_name, &value, 0);
     }
 
     if (r->headers_out.content_type.len) {
-        *b->last++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_TYPE_INDEX);
-
-        if (r->headers_out.content_type_len == r->headers_out.content_type.len
-            && r->headers_out.charset.len)
-        {
-            *b->last = 0;
-            b->last = ngx_http_v2_write_int(b->last, ngx_http_v2_prefix(7),
-                                            r->headers_out.content_type.len
-                                            + sizeof("; charset=") - 1
-                                            + r->headers_out.charset.len);
-
-            p = b->last;
-
-            b->last = ngx_cpymem(p, r->headers_out.content_type.data,
-                                 r->headers_out.content_type.len);
-
-            b->last = ngx_cpymem(b->last, "; charset=",
-                                 sizeof("; charset=") - 1);
-
-            b->last = ngx_cpymem(b->last, r->headers_out.charset.data,
-                                 r->headers_out.charset.len);
-
-            /* update r->headers_out.content_type for possible logging */
-
-            r->headers_out.content_type.len = b->last - p;
-            r->headers_out.content_type.data = p;
-
-        } else {
-            *b->last = 0;
-            b->last = ngx_http_v2_write_int(b->last, ngx_http_v2_prefix(7),
-                                            r->headers_out.content_type.len);
-            b->last = ngx_cpymem(b->last, r->headers_out.content_type.data,
-                                 r->headers_out.content_type.len);
-        }
+        b->last = ngx_http_v2_table_encode(h2c, b->last,
+                                           NGX_HTTP_V2_CONTENT_TYPE_INDEX,
+                                           &ngx_http_v2_content_type_name,
+                                           &r->headers_out.content_type, 1);
     }
 
     if (r->headers_out.content_length == NULL
         && r->headers_out.content_length_n >= 0)
     {
-        *b->last++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_LENGTH_INDEX);
-
-        p = b->last;
-        b->last = ngx_sprintf(b->last + 1, "%O",
-                              r->headers_out.content_length_n);
-        *p = (u_char) (b->last - p - 1);
+        value.len = ngx_sprintf(tmp, "%O", r->headers_out.content_length_n)
+                    - tmp;
+        value.data = tmp;
+
+        b->last = ngx_http_v2_table_encode(h2c, b->last,
+                                           NGX_HTTP_V2_CONTENT_LENGTH_INDEX,
+                                           &ngx_http_v2_content_length_name,
+                                           &value, 0);
     }
 
     if (r->headers_out.last_modified == NULL
         && r->headers_out.last_modified_time != -1)
     {
-        *b->last++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LAST_MODIFIED_INDEX);
-
-        p = b->last;
-        b->last = ngx_http_time(b->last + 1, r->headers_out.last_modified_time);
-        *p = (u_char) (b->last - p - 1);
+        value.len = ngx_http_time(tmp, r->headers_out.last_modified_time)
+                    - tmp;
+        value.data = tmp;
+
+        b->last = ngx_http_v2_table_encode(h2c, b->last,
+                                           NGX_HTTP_V2_LAST_MODIFIED_INDEX,
+                                           &ngx_http_v2_last_modified_name,
+                                           &value, 0);
     }
 
     if (r->headers_out.location && r->headers_out.location->value.len) {
-        *b->last++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LOCATION_INDEX);
-
-        *b->last = 0;
-        b->last = ngx_http_v2_write_int(b->last, ngx_http_v2_prefix(7),
-                                        r->headers_out.location->value.len);
-        b->last = ngx_cpymem(b->last, r->headers_out.location->value.data,
-                                      r->headers_out.location->value.len);
+        b->last = ngx_http_v2_table_encode(h2c, b->last,
+                                           NGX_HTTP_V2_LOCATION_INDEX,
+                                           &ngx_http_v2_location_name,
+                                           &r->headers_out.location->value,
+                                           0);
     }
 
 #if (NGX_HTTP_GZIP)
     if (r->gzip_vary) {
-        *b->last++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_VARY_INDEX);
-        *b->last++ = sizeof("Accept-Encoding") - 1;
-        b->last = ngx_cpymem(b->last, "Accept-Encoding",
-                             sizeof("Accept-Encoding") - 1);
+        b->last = ngx_http_v2_table_encode(h2c, b->last,
+                                           NGX_HTTP_V2_VARY_INDEX,
+                                           &ngx_http_v2_vary_name,
+                                           &ngx_http_v2_vary_accept_encoding,
+                                           1);
     }
 #endif
 
@@ -585,19 +628,16 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
             b->last += NGX_HTTP_V2_FRAME_HEADER_SIZE;
         }
 
-        p = b->last;
-
-        *p++ = 0;
+        /* cookies are never added to the dynamic table */
 
-        *p = 0;
-        p = ngx_http_v2_write_int(p, ngx_http_v2_prefix(7), header[i].key.len);
-        ngx_strlow(p, header[i].key.data, header[i].key.len);
-        p += header[i].key.len;
+        indexing = (header[i].key.len != sizeof("set-cookie") - 1
+                    || ngx_strncasecmp(header[i].key.data,
+                                       (u_char *) "set-cookie",
+                                       sizeof("set-cookie") - 1)
+                       != 0);
 
-        *p = 0;
-        p = ngx_http_v2_write_int(p, ngx_http_v2_prefix(7),
-                                  header[i].value.len);
-        p = ngx_cpymem(p, header[i].value.data, header[i].value.len);
+        p = ngx_http_v2_table_encode(h2c, b->last, 0, &header[i].key,
+                                     &header[i].value, indexing);
 
         rest -= p - b->last;
         b->last = p;
@@ -613,20 +653,10 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                                        r->header_only);
     }
 
-    cl = ngx_alloc_chain_link(r->pool);
-    if (cl == NULL) {
-        return NGX_ERROR;
-    }
-
     cl->buf = b;
     cl->next = NULL;
 
     /* ǰheader֡һframeṹҵh2c->last_outУͨngx_http_v2_filter_sendͳȥ */
-    frame = ngx_palloc(r->pool, sizeof(ngx_http_v2_out_frame_t));
-    if (frame == NULL) {
-        return NGX_ERROR;
-    }
-
     frame->first = cl;
     frame->last = cl;
     //frame϶ӦݷϺ󣬻ngx_http_v2_headers_frame_handler
@@ -651,7 +681,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     cln->handler = ngx_http_v2_filter_cleanup;
     cln->data = stream;
 
-    stream->queued = 1;
+    stream->queued++;
 
     //ngx_http_v2_send_chain.send_chain=ngx_http_v2_header_filter,֡ͨúͣ
     //ڶȡݺʼout filteṛȻngx_http_output_filterִиngx_http_v2_send_chain
@@ -661,7 +691,469 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     return ngx_http_v2_filter_send(fc, stream);
 }
 
-static u_char *
+/*
+ * Ӧ200ʱhttp2_pushõԴԼLink: <uri>; rel=preloadָԴ
+ * PUSH_PROMISE֡HEADERS֮֡ǰ
+ */
+static ngx_int_t
+ngx_http_v2_push_resources(ngx_http_request_t *r)
+{
+    u_char                  *start, *end, *last;
+    ngx_int_t                rc;
+    ngx_str_t                path, name, value, *pushes;
+    ngx_uint_t               i, preload, nopush;
+    ngx_list_part_t         *part;
+    ngx_table_elt_t         *header;
+    ngx_http_v2_loc_conf_t  *h2lcf;
+
+    if (r->method != NGX_HTTP_GET && r->method != NGX_HTTP_HEAD) {
+        return NGX_OK;
+    }
+
+    if (r->headers_in.host == NULL) {
+        return NGX_OK;
+    }
+
+    h2lcf = ngx_http_get_module_loc_conf(r, ngx_http_v2_module);
+
+    if (h2lcf->pushes) {
+        pushes = h2lcf->pushes->elts;
+
+        for (i = 0; i < h2lcf->pushes->nelts; i++) {
+            rc = ngx_http_v2_push_resource(r, &pushes[i]);
+
+            if (rc == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+
+            if (rc == NGX_ABORT) {
+                return NGX_OK;
+            }
+        }
+    }
+
+    if (!h2lcf->push_preload) {
+        return NGX_OK;
+    }
+
+    part = &r->headers_out.headers.part;
+    header = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        if (header[i].hash == 0
+            || header[i].key.len != sizeof("link") - 1
+            || ngx_strncasecmp(header[i].key.data, (u_char *) "link",
+                               sizeof("link") - 1)
+               != 0)
+        {
+            continue;
+        }
+
+        start = header[i].value.data;
+        end = start + header[i].value.len;
+
+        /* Link: <uri>; rel=preload; as=style, <uri>; rel="preload"; nopush */
+
+        for ( ;; ) {
+
+            while (start < end
+                   && (*start == ' ' || *start == '\t' || *start == ','))
+            {
+                start++;
+            }
+
+            if (start == end || *start != '<') {
+                break;
+            }
+
+            last = ngx_strlchr(++start, end, '>');
+            if (last == NULL) {
+                break;
+            }
+
+            path.data = start;
+            path.len = last - start;
+
+            start = last + 1;
+
+            preload = 0;
+            nopush = 0;
+
+            for ( ;; ) {
+
+                while (start < end && (*start == ' ' || *start == '\t')) {
+                    start++;
+                }
+
+                if (start == end || *start != ';') {
+                    break;
+                }
+
+                start++;
+
+                while (start < end && (*start == ' ' || *start == '\t')) {
+                    start++;
+                }
+
+                for (last = start;
+                     last < end && *last != '=' && *last != ';'
+                     && *last != ',' && *last != ' ' && *last != '\t';
+                     last++)
+                {
+                    /* void */
+                }
+
+                name.data = start;
+                name.len = last - start;
+
+                start = last;
+
+                while (start < end && (*start == ' ' || *start == '\t')) {
+                    start++;
+                }
+
+                ngx_str_null(&value);
+
+                if (start < end && *start == '=') {
+                    start++;
+
+                    while (start < end && (*start == ' ' || *start == '\t')) {
+                        start++;
+                    }
+
+                    if (start < end && *start == '"') {
+                        last = ngx_strlchr(++start, end, '"');
+                        if (last == NULL) {
+                            last = end;
+                        }
+
+                        value.data = start;
+                        value.len = last - start;
+
+                        start = (last == end) ? end : last + 1;
+
+                    } else {
+                        for (last = start;
+                             last < end && *last != ';' && *last != ','
+                             && *last != ' ' && *last != '\t';
+                             last++)
+                        {
+                            /* void */
+                        }
+
+                        value.data = start;
+                        value.len = last - start;
+
+                        start = last;
+                    }
+                }
+
+                if (name.len == sizeof("nopush") - 1
+                    && ngx_strncasecmp(name.data, (u_char *) "nopush",
+                                       sizeof("nopush") - 1)
+                       == 0)
+                {
+                    nopush = 1;
+                    continue;
+                }
+
+                if (name.len == sizeof("rel") - 1
+                    && ngx_strncasecmp(name.data, (u_char *) "rel",
+                                       sizeof("rel") - 1)
+                       == 0)
+                {
+                    preload = ngx_http_v2_link_rel_preload(&value);
+                }
+            }
+
+            /* skip the rest of a malformed link-value */
+
+            while (start < end && *start != ',') {
+                start++;
+            }
+
+            if (!preload || nopush) {
+                continue;
+            }
+
+            rc = ngx_http_v2_push_resource(r, &path);
+
+            if (rc == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+
+            if (rc == NGX_ABORT) {
+                return NGX_OK;
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+/* relֵԿոָĹϵбrel="preload prefetch" */
+static ngx_uint_t
+ngx_http_v2_link_rel_preload(ngx_str_t *rel)
+{
+    u_char  *p, *end, *last;
+
+    p = rel->data;
+    end = p + rel->len;
+
+    while (p < end) {
+
+        for (last = p; last < end && *last != ' ' && *last != '\t'; last++) {
+            /* void */
+        }
+
+        if (last - p == sizeof("preload") - 1
+            && ngx_strncasecmp(p, (u_char *) "preload", sizeof("preload") - 1)
+               == 0)
+        {
+            return 1;
+        }
+
+        p = last + 1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * PUSH_PROMISE֡ﵽʱNGX_ABORT
+ * ԴͻѾ͹ʱNGX_DECLINED
+ */
+static ngx_int_t
+ngx_http_v2_push_resource(ngx_http_request_t *r, ngx_str_t *path)
+{
+    u_char                    *pos;
+    size_t                     len;
+    uint32_t                   hash;
+    ngx_int_t                  rc;
+    ngx_str_t                  scheme;
+    ngx_buf_t                 *b;
+    ngx_uint_t                 i;
+    ngx_chain_t               *cl;
+    ngx_list_part_t           *part;
+    ngx_table_elt_t           *header;
+    ngx_http_request_t        *pr;
+    ngx_http_v2_stream_t      *stream, *pushed;
+    ngx_http_v2_out_frame_t   *frame;
+    ngx_http_v2_connection_t  *h2c;
+
+    stream = r->stream;
+    h2c = stream->connection;
+
+    if (h2c->pushing >= h2c->concurrent_pushes) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http2 push limit reached: %ui", h2c->pushing);
+        return NGX_ABORT;
+    }
+
+    /* only paths of the same origin can be pushed */
+
+    if (path->len == 0
+        || path->data[0] != '/'
+        || (path->len > 1 && path->data[1] == '/'))
+    {
+        return NGX_DECLINED;
+    }
+
+    /*
+     * a resource pushed once on the connection is assumed to be
+     * in the client cache already, so it is never promised again
+     */
+
+    hash = ngx_crc32_short(path->data, path->len);
+
+    for (i = 0; i < ngx_min(h2c->npushed, NGX_HTTP_V2_MAX_PUSHED); i++) {
+        if (h2c->pushed[i] == hash) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http2 push \"%V\" skipped: already pushed", path);
+            return NGX_DECLINED;
+        }
+    }
+
+    if (h2c->pushed == NULL) {
+        h2c->pushed = ngx_palloc(h2c->connection->pool,
+                                 NGX_HTTP_V2_MAX_PUSHED * sizeof(uint32_t));
+        if (h2c->pushed == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    pushed = ngx_http_v2_push_stream(stream, path);
+    if (pushed == NULL) {
+        return NGX_ERROR;
+    }
+
+    pr = pushed->request;
+
+    len = NGX_HTTP_V2_FRAME_HEADER_SIZE + sizeof(uint32_t)
+          + NGX_HTTP_V2_INT_OCTETS + 1
+          + 1 + NGX_HTTP_V2_INT_OCTETS * 2 + sizeof(":scheme") - 1
+              + (pr->schema_end - pr->schema_start)
+          + 1 + NGX_HTTP_V2_INT_OCTETS + path->len;
+
+    part = &pr->headers_in.headers.part;
+    header = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        len += 1 + NGX_HTTP_V2_INT_OCTETS * 2
+               + header[i].key.len + header[i].value.len;
+    }
+
+    if (len - NGX_HTTP_V2_FRAME_HEADER_SIZE > h2c->frame_size) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "http2 push \"%V\" skipped: PUSH_PROMISE too large",
+                      path);
+        rc = NGX_DECLINED;
+        goto cancel;
+    }
+
+    rc = NGX_ERROR;
+
+    b = ngx_create_temp_buf(r->pool, len);
+    if (b == NULL) {
+        goto cancel;
+    }
+
+    cl = ngx_alloc_chain_link(r->pool);
+    if (cl == NULL) {
+        goto cancel;
+    }
+
+    frame = ngx_palloc(r->pool, sizeof(ngx_http_v2_out_frame_t));
+    if (frame == NULL) {
+        goto cancel;
+    }
+
+    b->last += NGX_HTTP_V2_FRAME_HEADER_SIZE;
+
+    b->last = ngx_http_v2_write_sid(b->last, pushed->node->id);
+
+    b->last = ngx_http_v2_table_size_update(h2c, b->last);
+
+    *b->last++ = ngx_http_v2_indexed(NGX_HTTP_V2_METHOD_GET_INDEX);
+
+    scheme.data = pr->schema_start;
+    scheme.len = pr->schema_end - pr->schema_start;
+
+    if (scheme.len == sizeof("https") - 1
+        && ngx_strncmp(scheme.data, "https", sizeof("https") - 1) == 0)
+    {
+        *b->last++ = ngx_http_v2_indexed(NGX_HTTP_V2_SCHEME_HTTPS_INDEX);
+
+    } else if (scheme.len == sizeof("http") - 1
+               && ngx_strncmp(scheme.data, "http", sizeof("http") - 1) == 0)
+    {
+        *b->last++ = ngx_http_v2_indexed(NGX_HTTP_V2_SCHEME_HTTP_INDEX);
+
+    } else {
+        b->last = ngx_http_v2_table_encode(h2c, b->last,
+                                           NGX_HTTP_V2_SCHEME_HTTP_INDEX,
+                                           &ngx_http_v2_scheme_name, &scheme,
+                                           0);
+    }
+
+    b->last = ngx_http_v2_table_encode(h2c, b->last, NGX_HTTP_V2_PATH_INDEX,
+                                       &ngx_http_v2_path_name, path, 0);
+
+    part = &pr->headers_in.headers.part;
+    header = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        if (&header[i] == pr->headers_in.host) {
+            b->last = ngx_http_v2_table_encode(h2c, b->last,
+                                               NGX_HTTP_V2_AUTHORITY_INDEX,
+                                               &ngx_http_v2_authority_name,
+                                               &header[i].value, 1);
+            continue;
+        }
+
+        b->last = ngx_http_v2_table_encode(h2c, b->last, 0, &header[i].key,
+                                           &header[i].value, 1);
+    }
+
+    len = b->last - b->pos - NGX_HTTP_V2_FRAME_HEADER_SIZE;
+
+    pos = ngx_http_v2_write_len_and_type(b->pos, len,
+                                         NGX_HTTP_V2_PUSH_PROMISE_FRAME);
+    *pos++ = NGX_HTTP_V2_END_HEADERS_FLAG;
+    (void) ngx_http_v2_write_sid(pos, stream->node->id);
+
+    cl->buf = b;
+    cl->next = NULL;
+
+    frame->first = cl;
+    frame->last = cl;
+    frame->handler = ngx_http_v2_push_frame_handler;
+    frame->stream = stream;
+    frame->length = len;
+    frame->blocked = 1;
+    frame->fin = 0;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http2:%ui create PUSH_PROMISE frame %p: promised:%ui",
+                   stream->node->id, frame, pushed->node->id);
+
+    ngx_http_v2_queue_blocked_frame(h2c, frame);
+
+    stream->queued++;
+
+    h2c->pushed[h2c->npushed++ % NGX_HTTP_V2_MAX_PUSHED] = hash;
+
+    return NGX_OK;
+
+cancel:
+
+    /* the stream has not been promised, so it is closed without RST_STREAM */
+
+    pr->logged = 1;
+    pushed->out_closed = 1;
+
+    ngx_http_v2_close_stream(pushed, NGX_HTTP_INTERNAL_SERVER_ERROR);
+
+    return rc;
+}
+
+
+u_char *
 ngx_http_v2_write_int(u_char *pos, ngx_uint_t prefix, ngx_uint_t value)
 {
     if (value < prefix) {
@@ -1149,6 +1641,34 @@ ngx_http_v2_headers_frame_handler(ngx_http_v2_connection_t *h2c,
     return NGX_OK;
 }
 
+static ngx_int_t
+ngx_http_v2_push_frame_handler(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_out_frame_t *frame)
+{
+    ngx_buf_t             *buf;
+    ngx_http_v2_stream_t  *stream;
+
+    buf = frame->first->buf;
+
+    if (buf->pos != buf->last) {
+        return NGX_AGAIN;
+    }
+
+    stream = frame->stream;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2:%ui PUSH_PROMISE frame %p was sent",
+                   stream->node->id, frame);
+
+    ngx_free_chain(stream->request->pool, frame->first);
+
+    ngx_http_v2_handle_frame(stream, frame);
+
+    ngx_http_v2_handle_stream(h2c, stream);
+
+    return NGX_OK;
+}
+
 //ÿһh2c->last_outеframeɶöӦhandler,data֡ɵhandler
 static ngx_int_t
 ngx_http_v2_data_frame_handler(ngx_http_v2_connection_t *h2c,
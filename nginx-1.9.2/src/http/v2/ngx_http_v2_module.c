@@ -33,6 +33,10 @@ static char *ngx_http_v2_pool_size(ngx_conf_t *cf, void *post, void *data);
 static char *ngx_http_v2_streams_index_mask(ngx_conf_t *cf, void *post,
     void *data);
 static char *ngx_http_v2_chunk_size(ngx_conf_t *cf, void *post, void *data);
+static char *ngx_http_v2_hpack_table_size(ngx_conf_t *cf, void *post,
+    void *data);
+static char *ngx_http_v2_push(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static char *ngx_http_v2_spdy_deprecated(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 
@@ -45,6 +49,8 @@ static ngx_conf_post_t  ngx_http_v2_streams_index_mask_post =
     { ngx_http_v2_streams_index_mask };
 static ngx_conf_post_t  ngx_http_v2_chunk_size_post =
     { ngx_http_v2_chunk_size };
+static ngx_conf_post_t  ngx_http_v2_hpack_table_size_post =
+    { ngx_http_v2_hpack_table_size };
 
 
 static ngx_command_t  ngx_http_v2_commands[] = {
@@ -101,6 +107,22 @@ static ngx_command_t  ngx_http_v2_commands[] = {
       offsetof(ngx_http_v2_srv_conf_t, recv_timeout),
       NULL },
 
+    /* ӦͷHPACK붯̬ĴСͬһϵñ */
+    { ngx_string("http2_hpack_table_size"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v2_srv_conf_t, hpack_table_size),
+      &ngx_http_v2_hpack_table_size_post },
+
+    /* һͬʱеķ */
+    { ngx_string("http2_max_concurrent_pushes"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_v2_srv_conf_t, concurrent_pushes),
+      NULL },
+
     /* ÿӹرյĳʱʱ䡣 */
     { ngx_string("http2_idle_timeout"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
@@ -118,6 +140,22 @@ static ngx_command_t  ngx_http_v2_commands[] = {
       offsetof(ngx_http_v2_loc_conf_t, chunk_size),
       &ngx_http_v2_chunk_size_post },
 
+    /* Ӧʱ͵Դhttp2_push /style.css; */
+    { ngx_string("http2_push"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_v2_push,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    /* ӦͷLink: <uri>; rel=preloadָԴ */
+    { ngx_string("http2_push_preload"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_v2_loc_conf_t, push_preload),
+      NULL },
+
     { ngx_string("spdy_recv_buffer_size"),
       NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
       ngx_http_v2_spdy_deprecated,
@@ -327,6 +365,10 @@ ngx_http_v2_create_srv_conf(ngx_conf_t *cf)
     h2scf->recv_timeout = NGX_CONF_UNSET_MSEC;
     h2scf->idle_timeout = NGX_CONF_UNSET_MSEC;
 
+    h2scf->hpack_table_size = NGX_CONF_UNSET_SIZE;
+
+    h2scf->concurrent_pushes = NGX_CONF_UNSET_UINT;
+
     return h2scf;
 }
 
@@ -355,6 +397,12 @@ ngx_http_v2_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_msec_value(conf->idle_timeout,
                               prev->idle_timeout, 180000);
 
+    ngx_conf_merge_size_value(conf->hpack_table_size, prev->hpack_table_size,
+                              NGX_HTTP_V2_TABLE_SIZE);
+
+    ngx_conf_merge_uint_value(conf->concurrent_pushes,
+                              prev->concurrent_pushes, 10);
+
     return NGX_CONF_OK;
 }
 
@@ -371,6 +419,9 @@ ngx_http_v2_create_loc_conf(ngx_conf_t *cf)
 
     h2lcf->chunk_size = NGX_CONF_UNSET_SIZE;
 
+    h2lcf->push_preload = NGX_CONF_UNSET;
+    h2lcf->push = NGX_CONF_UNSET;
+
     return h2lcf;
 }
 
@@ -383,6 +434,14 @@ ngx_http_v2_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_size_value(conf->chunk_size, prev->chunk_size, 8 * 1024);
 
+    ngx_conf_merge_value(conf->push_preload, prev->push_preload, 0);
+
+    ngx_conf_merge_value(conf->push, prev->push, 1);
+
+    if (conf->push && conf->pushes == NULL) {
+        conf->pushes = prev->pushes;
+    }
+
     return NGX_CONF_OK;
 }
 
@@ -464,6 +523,79 @@ ngx_http_v2_chunk_size(ngx_conf_t *cf, void *post, void *data)
 }
 
 
+static char *
+ngx_http_v2_hpack_table_size(ngx_conf_t *cf, void *post, void *data)
+{
+    size_t *sp = data;
+
+    /* a dynamic table size update must fit into NGX_HTTP_V2_INT_OCTETS */
+
+    if (*sp > (1 << (NGX_HTTP_V2_INT_OCTETS - 1) * 7)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "the http2 hpack table size must not exceed %uz",
+                           (size_t) (1 << (NGX_HTTP_V2_INT_OCTETS - 1) * 7));
+
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_v2_push(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_v2_loc_conf_t *h2lcf = conf;
+
+    ngx_str_t  *value, *path;
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+
+        if (h2lcf->pushes) {
+            return "\"off\" parameter cannot be used with URI";
+        }
+
+        if (h2lcf->push == 0) {
+            return "is duplicate";
+        }
+
+        h2lcf->push = 0;
+        return NGX_CONF_OK;
+    }
+
+    if (h2lcf->push == 0) {
+        return "URI cannot be used with \"off\" parameter";
+    }
+
+    if (value[1].data[0] != '/' || value[1].data[1] == '/') {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid URI \"%V\": only paths of the same "
+                           "origin can be pushed", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    h2lcf->push = 1;
+
+    if (h2lcf->pushes == NULL) {
+        h2lcf->pushes = ngx_array_create(cf->pool, 1, sizeof(ngx_str_t));
+        if (h2lcf->pushes == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    path = ngx_array_push(h2lcf->pushes);
+    if (path == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    *path = value[1];
+
+    return NGX_CONF_OK;
+}
+
+
 static char *
 ngx_http_v2_spdy_deprecated(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
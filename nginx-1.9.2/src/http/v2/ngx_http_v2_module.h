@@ -34,6 +34,10 @@ typedef struct {
     ngx_uint_t                      streams_index_mask; //http2_streams_index_sizeָ Ĭ32-1
     ngx_msec_t                      recv_timeout; //http2_recv_timeoutָ  Ĭ30000
     /* ÿӹرյĳʱʱ䡣 */
+    /* ӦͷHPACKʹõĶ̬С0ʾӦͷ붯̬Чngx_http_v2_table_encode */
+    size_t                          hpack_table_size; //http2_hpack_table_sizeָ Ĭ4096
+    /* һͬʱеķ0ʾֹͣЧngx_http_v2_push_resource */
+    ngx_uint_t                      concurrent_pushes; //http2_max_concurrent_pushesָ Ĭ10
     ngx_msec_t                      idle_timeout; //http2_idle_timeoutָ  Ĭ180000
 } ngx_http_v2_srv_conf_t;
 
@@ -41,6 +45,10 @@ typedef struct {
     /* Ӧݣresponse bodyƬ󳤶ȡֵСߵĿ
         ֵᵼͷ⡣ĬϴС8k */
     size_t                          chunk_size; //http2_chunk_sizeָ
+
+    ngx_flag_t                      push_preload; //http2_push_preloadָ Ĭoff
+    ngx_flag_t                      push; //http2_push offʱΪ0
+    ngx_array_t                    *pushes; //http2_pushõuriԱΪngx_str_t
 } ngx_http_v2_loc_conf_t;
 
 
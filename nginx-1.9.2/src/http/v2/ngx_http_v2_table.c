@@ -10,11 +10,12 @@
 #include <ngx_http.h>
 
 
-#define NGX_HTTP_V2_TABLE_SIZE  4096
-
-
 static ngx_int_t ngx_http_v2_table_account(ngx_http_v2_connection_t *h2c,
     size_t size);
+static ngx_int_t ngx_http_v2_table_encoder_init(
+    ngx_http_v2_connection_t *h2c);
+static void ngx_http_v2_table_encoder_evict(ngx_http_v2_connection_t *h2c,
+    size_t size);
 
 /**/
 //header֡ݲ֣ͨ1ֽȡӦname:valueͻ˷͹һֽڱתΪ2Ӧmethod:POSTͷ
@@ -381,3 +382,243 @@ ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size)
 
     return NGX_OK;
 }
+
+
+/*
+ * Encodes a response header field into pos using the encoder side dynamic
+ * table of the connection.  "index" is the static table index of the name
+ * or 0, "indexing" allows to add the field to the dynamic table.  The
+ * result never exceeds the size of a literal with a literal name, that is
+ * 1 + 2 * NGX_HTTP_V2_INT_OCTETS + name->len + value->len.
+ *
+ * Header blocks are queued as blocked frames and are thus sent in the same
+ * order they are encoded here, so the peer decoder always sees the table
+ * changes in this order.
+ */
+
+u_char *
+ngx_http_v2_table_encode(ngx_http_v2_connection_t *h2c, u_char *pos,
+    ngx_uint_t index, ngx_str_t *name, ngx_str_t *value, ngx_uint_t indexing)
+{
+    size_t                          size;
+    ngx_uint_t                      i, n, hash, name_hash;
+    ngx_http_v2_hpack_enc_t        *hpack;
+    ngx_http_v2_hpack_enc_entry_t  *entry;
+
+    hpack = &h2c->hpack_enc;
+
+    size = 32 + name->len + value->len;
+
+    if (size > hpack->size) {
+        indexing = 0;
+    }
+
+    if (!indexing && (index || hpack->added == hpack->deleted)) {
+        goto literal;
+    }
+
+    name_hash = 0;
+
+    for (i = 0; i < name->len; i++) {
+        name_hash = ngx_hash(name_hash, ngx_tolower(name->data[i]));
+    }
+
+    hash = name_hash;
+
+    for (i = 0; i < value->len; i++) {
+        hash = ngx_hash(hash, value->data[i]);
+    }
+
+    /* the newest entry has the index 62 */
+
+    for (n = hpack->added; n != hpack->deleted; n--) {
+        entry = &hpack->entries[(n - 1) % hpack->allocated];
+
+        if (entry->name_hash != name_hash
+            || entry->name_len != name->len
+            || ngx_strncasecmp(entry->data, name->data, name->len) != 0)
+        {
+            continue;
+        }
+
+        i = NGX_HTTP_V2_STATIC_TABLE_ENTRIES + 1 + hpack->added - n;
+
+        if (entry->hash == hash
+            && entry->value_len == value->len
+            && ngx_memcmp(entry->data + name->len, value->data, value->len)
+               == 0)
+        {
+            ngx_log_debug3(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                           "http2 hpack encode indexed %ui: \"%V: %V\"",
+                           i, name, value);
+
+            *pos = 0x80;
+            return ngx_http_v2_write_int(pos, ngx_http_v2_prefix(7), i);
+        }
+
+        if (index == 0) {
+            index = i;
+        }
+    }
+
+    if (indexing && hpack->entries == NULL
+        && ngx_http_v2_table_encoder_init(h2c) != NGX_OK)
+    {
+        indexing = 0;
+    }
+
+literal:
+
+    ngx_log_debug4(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 hpack encode literal %ui%s: \"%V: %V\"",
+                   index, indexing ? " indexed" : "", name, value);
+
+    if (indexing) {
+        *pos = 0x40;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(6), index);
+
+    } else {
+        *pos = 0;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(4), index);
+    }
+
+    if (index == 0) {
+        *pos = 0;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(7), name->len);
+        ngx_strlow(pos, name->data, name->len);
+        pos += name->len;
+    }
+
+    *pos = 0;
+    pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(7), value->len);
+    pos = ngx_cpymem(pos, value->data, value->len);
+
+    if (!indexing) {
+        return pos;
+    }
+
+    ngx_http_v2_table_encoder_evict(h2c, hpack->size - size);
+
+    hpack->free -= size;
+
+    if ((size_t) (hpack->storage + 2 * hpack->limit - hpack->pos)
+        < name->len + value->len)
+    {
+        /*
+         * the skipped tail is less than the entry itself, so the live
+         * entries and the gap always fit into 2 * limit bytes
+         */
+
+        hpack->pos = hpack->storage;
+    }
+
+    entry = &hpack->entries[hpack->added++ % hpack->allocated];
+
+    entry->hash = hash;
+    entry->name_hash = name_hash;
+    entry->data = hpack->pos;
+    entry->name_len = name->len;
+    entry->value_len = value->len;
+
+    ngx_strlow(hpack->pos, name->data, name->len);
+    hpack->pos = ngx_cpymem(hpack->pos + name->len, value->data, value->len);
+
+    return pos;
+}
+
+
+u_char *
+ngx_http_v2_table_size_update(ngx_http_v2_connection_t *h2c, u_char *pos)
+{
+    if (!h2c->hpack_enc.size_update) {
+        return pos;
+    }
+
+    h2c->hpack_enc.size_update = 0;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 hpack encode table size update: %uz",
+                   h2c->hpack_enc.size);
+
+    *pos = 0x20;
+    return ngx_http_v2_write_int(pos, ngx_http_v2_prefix(5),
+                                 h2c->hpack_enc.size);
+}
+
+
+/* SETTINGS_HEADER_TABLE_SIZE received from the peer */
+
+void
+ngx_http_v2_table_peer_size(ngx_http_v2_connection_t *h2c, size_t size)
+{
+    ngx_http_v2_hpack_enc_t  *hpack;
+
+    hpack = &h2c->hpack_enc;
+
+    size = ngx_min(size, hpack->limit);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 hpack encoder table size: %uz was:%uz",
+                   size, hpack->size);
+
+    /*
+     * the decoder expects an update after any change of its setting,
+     * even if the table size used by the encoder stays the same
+     */
+
+    hpack->size_update = 1;
+
+    if (size == hpack->size) {
+        return;
+    }
+
+    ngx_http_v2_table_encoder_evict(h2c, size);
+
+    hpack->free = size - (hpack->size - hpack->free);
+    hpack->size = size;
+}
+
+
+static ngx_int_t
+ngx_http_v2_table_encoder_init(ngx_http_v2_connection_t *h2c)
+{
+    ngx_http_v2_hpack_enc_t  *hpack;
+
+    hpack = &h2c->hpack_enc;
+
+    hpack->allocated = hpack->limit / 32 + 1;
+
+    hpack->entries = ngx_palloc(h2c->connection->pool,
+                                sizeof(ngx_http_v2_hpack_enc_entry_t)
+                                * hpack->allocated);
+    if (hpack->entries == NULL) {
+        return NGX_ERROR;
+    }
+
+    hpack->storage = ngx_palloc(h2c->connection->pool, 2 * hpack->limit);
+    if (hpack->storage == NULL) {
+        hpack->entries = NULL;
+        return NGX_ERROR;
+    }
+
+    hpack->pos = hpack->storage;
+
+    return NGX_OK;
+}
+
+
+/* removes the oldest entries until no more than size bytes are in use */
+
+static void
+ngx_http_v2_table_encoder_evict(ngx_http_v2_connection_t *h2c, size_t size)
+{
+    ngx_http_v2_hpack_enc_t        *hpack;
+    ngx_http_v2_hpack_enc_entry_t  *entry;
+
+    hpack = &h2c->hpack_enc;
+
+    while (hpack->size - hpack->free > size) {
+        entry = &hpack->entries[hpack->deleted++ % hpack->allocated];
+        hpack->free += 32 + entry->name_len + entry->value_len;
+    }
+}
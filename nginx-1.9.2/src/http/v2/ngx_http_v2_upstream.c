@@ -0,0 +1,2620 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * HTTP/2 to upstream servers, "proxy_http_version 2".
+ *
+ * The upstream module keeps talking HTTP/1.1 to a connection of its own:
+ * every request gets a fake connection, its send_chain() turns the request
+ * created by the proxy module into the HEADERS and DATA frames of a stream,
+ * and its recv() and recv_chain() return the response of the stream as an
+ * HTTP/1.1 message.  The streams of all requests to a server share the real
+ * connections of a worker, another connection is only opened when all of
+ * them have reached SETTINGS_MAX_CONCURRENT_STREAMS of the server.
+ *
+ * Both sides are flow controlled: request bodies are sent as the stream and
+ * connection windows of the server allow, and the stream window announced
+ * to the server is only reopened as the upstream module reads the response,
+ * so a slow client does not make the response pile up in memory.
+ *
+ * Only cleartext connections with prior knowledge are supported.
+ */
+
+
+#define NGX_HTTP_V2_UPSTREAM_BUFFER_SIZE                                      \
+    (2 * (NGX_HTTP_V2_FRAME_HEADER_SIZE + NGX_HTTP_V2_DEFAULT_FRAME_SIZE))
+
+/* SETTINGS_INITIAL_WINDOW_SIZE announced to the server */
+#define NGX_HTTP_V2_UPSTREAM_WINDOW          (256 * 1024)
+
+/* assumed until SETTINGS_MAX_CONCURRENT_STREAMS of the server arrives */
+#define NGX_HTTP_V2_UPSTREAM_STREAMS         100
+
+/* request bodies are not queued while the output exceeds this */
+#define NGX_HTTP_V2_UPSTREAM_OUTPUT_LIMIT    (64 * 1024)
+
+#define NGX_HTTP_V2_UPSTREAM_HEADERS_LIMIT   (64 * 1024)
+#define NGX_HTTP_V2_UPSTREAM_FREE_BUFS       8
+#define NGX_HTTP_V2_UPSTREAM_IDLE_TIMEOUT    60000
+#define NGX_HTTP_V2_UPSTREAM_MAX_SID         0x7fffffff
+
+
+static const u_char  ngx_http_v2_upstream_preface[] =
+    "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+
+typedef struct ngx_http_v2_upstream_buf_s  ngx_http_v2_upstream_buf_t;
+
+/* the data immediately follows the structure */
+
+struct ngx_http_v2_upstream_buf_s {
+    ngx_http_v2_upstream_buf_t       *next;
+    u_char                           *pos;
+    u_char                           *last;
+    u_char                           *end;
+};
+
+
+typedef struct {
+    /* HPACK contexts of the connection, nothing else is used */
+    ngx_http_v2_connection_t          h2c;
+
+    ngx_connection_t                 *connection;
+    ngx_queue_t                       queue;
+
+    ngx_queue_t                       streams;
+    ngx_uint_t                        nstreams;
+    ngx_uint_t                        max_streams;
+    ngx_uint_t                        next_sid;
+
+    size_t                            send_window;
+    size_t                            recv_window;
+    size_t                            init_window;
+
+    ngx_http_v2_upstream_buf_t       *out;
+    ngx_http_v2_upstream_buf_t       *last_out;
+    size_t                            out_size;
+
+    ngx_http_v2_upstream_buf_t       *free;
+    ngx_uint_t                        nfree;
+
+    u_char                           *start;
+    u_char                           *last;
+    u_char                           *end;
+
+    /* the header block being received, see ngx_http_v2_upstream_headers() */
+    u_char                           *header;
+    size_t                            header_len;
+    size_t                            header_size;
+    ngx_uint_t                        header_sid;
+    ngx_uint_t                        header_flags;
+
+    struct sockaddr                  *sockaddr;
+    socklen_t                         socklen;
+    ngx_str_t                         name;
+
+    unsigned                          connected:1;
+    unsigned                          goaway:1;
+} ngx_http_v2_upstream_conn_t;
+
+
+typedef struct {
+    /* the fake connection must be the first member */
+    ngx_connection_t                  c;
+    ngx_event_t                       read;
+    ngx_event_t                       write;
+
+    ngx_http_v2_upstream_conn_t      *hc;
+    ngx_queue_t                       queue;
+
+    ngx_uint_t                        sid;
+
+    ssize_t                           send_window;
+    size_t                            recv_window;
+    size_t                            recv_unacked;
+
+    off_t                             body_rest;
+
+    /* the response converted to HTTP/1.1 */
+    ngx_http_v2_upstream_buf_t       *in;
+    ngx_http_v2_upstream_buf_t       *last_in;
+
+    unsigned                          headers_sent:1;
+    unsigned                          out_closed:1;
+    unsigned                          in_closed:1;
+    unsigned                          response:1;
+    unsigned                          reset:1;
+    unsigned                          blocked:1;
+} ngx_http_v2_upstream_stream_t;
+
+
+typedef struct {
+    ngx_http_upstream_t              *upstream;
+
+    void                             *data;
+
+    ngx_event_get_peer_pt             original_get_peer;
+    ngx_event_free_peer_pt            original_free_peer;
+} ngx_http_v2_upstream_peer_data_t;
+
+
+typedef ngx_int_t (*ngx_http_v2_upstream_handler_pt)(
+    ngx_http_v2_upstream_conn_t *hc, u_char *pos, size_t len,
+    ngx_uint_t flags, ngx_uint_t sid);
+
+
+static ngx_int_t ngx_http_v2_upstream_get_peer(ngx_peer_connection_t *pc,
+    void *data);
+static void ngx_http_v2_upstream_free_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+
+static ngx_http_v2_upstream_conn_t *ngx_http_v2_upstream_connect(
+    ngx_peer_connection_t *pc, ngx_msec_t timeout);
+static ngx_int_t ngx_http_v2_upstream_test_connect(ngx_connection_t *c);
+static void ngx_http_v2_upstream_read_handler(ngx_event_t *rev);
+static void ngx_http_v2_upstream_write_handler(ngx_event_t *wev);
+static ngx_int_t ngx_http_v2_upstream_send(ngx_http_v2_upstream_conn_t *hc);
+static void ngx_http_v2_upstream_post(ngx_http_v2_upstream_conn_t *hc);
+static void ngx_http_v2_upstream_close(ngx_http_v2_upstream_conn_t *hc);
+static void ngx_http_v2_upstream_idle(ngx_http_v2_upstream_conn_t *hc);
+
+static ngx_int_t ngx_http_v2_upstream_process(ngx_http_v2_upstream_conn_t *hc);
+static ngx_int_t ngx_http_v2_upstream_data(ngx_http_v2_upstream_conn_t *hc,
+    u_char *pos, size_t len, ngx_uint_t flags, ngx_uint_t sid);
+static ngx_int_t ngx_http_v2_upstream_headers(ngx_http_v2_upstream_conn_t *hc,
+    u_char *pos, size_t len, ngx_uint_t flags, ngx_uint_t sid);
+static ngx_int_t ngx_http_v2_upstream_continuation(
+    ngx_http_v2_upstream_conn_t *hc, u_char *pos, size_t len,
+    ngx_uint_t flags, ngx_uint_t sid);
+static ngx_int_t ngx_http_v2_upstream_rst_stream(
+    ngx_http_v2_upstream_conn_t *hc, u_char *pos, size_t len,
+    ngx_uint_t flags, ngx_uint_t sid);
+static ngx_int_t ngx_http_v2_upstream_settings(ngx_http_v2_upstream_conn_t *hc,
+    u_char *pos, size_t len, ngx_uint_t flags, ngx_uint_t sid);
+static ngx_int_t ngx_http_v2_upstream_push_promise(
+    ngx_http_v2_upstream_conn_t *hc, u_char *pos, size_t len,
+    ngx_uint_t flags, ngx_uint_t sid);
+static ngx_int_t ngx_http_v2_upstream_ping(ngx_http_v2_upstream_conn_t *hc,
+    u_char *pos, size_t len, ngx_uint_t flags, ngx_uint_t sid);
+static ngx_int_t ngx_http_v2_upstream_goaway(ngx_http_v2_upstream_conn_t *hc,
+    u_char *pos, size_t len, ngx_uint_t flags, ngx_uint_t sid);
+static ngx_int_t ngx_http_v2_upstream_window_update(
+    ngx_http_v2_upstream_conn_t *hc, u_char *pos, size_t len,
+    ngx_uint_t flags, ngx_uint_t sid);
+static ngx_int_t ngx_http_v2_upstream_skip(ngx_http_v2_upstream_conn_t *hc,
+    u_char *pos, size_t len, ngx_uint_t flags, ngx_uint_t sid);
+
+static ngx_int_t ngx_http_v2_upstream_header_block(
+    ngx_http_v2_upstream_conn_t *hc, u_char *pos, size_t len);
+static ngx_int_t ngx_http_v2_upstream_decode(ngx_http_v2_upstream_conn_t *hc,
+    ngx_array_t *headers);
+static ngx_int_t ngx_http_v2_upstream_parse_int(u_char **pos, u_char *end,
+    ngx_uint_t prefix, ngx_uint_t *value);
+static ngx_int_t ngx_http_v2_upstream_parse_field(
+    ngx_http_v2_upstream_conn_t *hc, u_char **pos, u_char *end,
+    ngx_str_t *field);
+static ngx_int_t ngx_http_v2_upstream_response(
+    ngx_http_v2_upstream_stream_t *st, ngx_array_t *headers);
+
+static ssize_t ngx_http_v2_upstream_recv(ngx_connection_t *c, u_char *buf,
+    size_t size);
+static ssize_t ngx_http_v2_upstream_recv_chain(ngx_connection_t *c,
+    ngx_chain_t *cl, off_t limit);
+static ngx_chain_t *ngx_http_v2_upstream_send_chain(ngx_connection_t *c,
+    ngx_chain_t *in, off_t limit);
+static ngx_int_t ngx_http_v2_upstream_create_headers(
+    ngx_http_v2_upstream_stream_t *st, ngx_buf_t *b);
+static ngx_int_t ngx_http_v2_upstream_send_data(
+    ngx_http_v2_upstream_stream_t *st, ngx_buf_t *b);
+
+static ngx_http_v2_upstream_stream_t *ngx_http_v2_upstream_find_stream(
+    ngx_http_v2_upstream_conn_t *hc, ngx_uint_t sid);
+static void ngx_http_v2_upstream_reset_stream(ngx_http_v2_upstream_stream_t *st,
+    ngx_uint_t status);
+static void ngx_http_v2_upstream_close_stream(
+    ngx_http_v2_upstream_stream_t *st);
+static void ngx_http_v2_upstream_wake(ngx_event_t *ev);
+static void ngx_http_v2_upstream_wake_blocked(ngx_http_v2_upstream_conn_t *hc);
+
+static u_char *ngx_http_v2_upstream_frame(ngx_http_v2_upstream_conn_t *hc,
+    size_t len, ngx_uint_t type, ngx_uint_t flags, ngx_uint_t sid);
+static ngx_int_t ngx_http_v2_upstream_window_frame(
+    ngx_http_v2_upstream_conn_t *hc, ngx_uint_t sid, size_t window);
+static u_char *ngx_http_v2_upstream_reserve(ngx_http_v2_upstream_conn_t *hc,
+    ngx_http_v2_upstream_buf_t **first, ngx_http_v2_upstream_buf_t **last,
+    size_t size);
+static void ngx_http_v2_upstream_free_buf(ngx_http_v2_upstream_conn_t *hc,
+    ngx_http_v2_upstream_buf_t *b);
+
+
+static ngx_http_v2_upstream_handler_pt  ngx_http_v2_upstream_frame_handlers[] =
+{
+    ngx_http_v2_upstream_data,               /* DATA */
+    ngx_http_v2_upstream_headers,            /* HEADERS */
+    ngx_http_v2_upstream_skip,               /* PRIORITY */
+    ngx_http_v2_upstream_rst_stream,         /* RST_STREAM */
+    ngx_http_v2_upstream_settings,           /* SETTINGS */
+    ngx_http_v2_upstream_push_promise,       /* PUSH_PROMISE */
+    ngx_http_v2_upstream_ping,               /* PING */
+    ngx_http_v2_upstream_goaway,             /* GOAWAY */
+    ngx_http_v2_upstream_window_update,      /* WINDOW_UPDATE */
+    ngx_http_v2_upstream_continuation        /* CONTINUATION */
+};
+
+#define NGX_HTTP_V2_UPSTREAM_FRAME_STATES                                     \
+    (sizeof(ngx_http_v2_upstream_frame_handlers) / sizeof(ngx_http_v2_upstream_handler_pt))
+
+
+/* connections of the worker process */
+static ngx_queue_t  ngx_http_v2_upstream_conns;
+
+
+#define ngx_http_v2_upstream_buf_start(b)                                    \
+    ((u_char *) (b) + sizeof(ngx_http_v2_upstream_buf_t))
+
+
+ngx_int_t
+ngx_http_v2_upstream_init_peer(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_http_v2_upstream_peer_data_t  *hp;
+
+    if (u->ssl) {
+        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                      "http2 to upstream over ssl is not supported, "
+                      "using HTTP/1.1");
+        return NGX_OK;
+    }
+
+    if (!(ngx_event_flags & NGX_USE_CLEAR_EVENT)) {
+
+        /*
+         * the fake connections pretend to be always active,
+         * which only works with edge-triggered notification methods
+         */
+
+        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                      "http2 to upstream requires an edge-triggered "
+                      "event method, using HTTP/1.1");
+        return NGX_OK;
+    }
+
+    hp = ngx_palloc(r->pool, sizeof(ngx_http_v2_upstream_peer_data_t));
+    if (hp == NULL) {
+        return NGX_ERROR;
+    }
+
+    hp->upstream = u;
+    hp->data = u->peer.data;
+    hp->original_get_peer = u->peer.get;
+    hp->original_free_peer = u->peer.free;
+
+    u->peer.data = hp;
+    u->peer.get = ngx_http_v2_upstream_get_peer;
+    u->peer.free = ngx_http_v2_upstream_free_peer;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_get_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_v2_upstream_peer_data_t  *hp = data;
+
+    ngx_int_t                       rc;
+    ngx_queue_t                    *q;
+    ngx_connection_t               *c;
+    ngx_http_v2_upstream_conn_t    *hc, *found;
+    ngx_http_v2_upstream_stream_t  *st;
+
+    rc = hp->original_get_peer(pc, hp->data);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    if (ngx_http_v2_upstream_conns.next == NULL) {
+        ngx_queue_init(&ngx_http_v2_upstream_conns);
+    }
+
+    found = NULL;
+
+    for (q = ngx_queue_head(&ngx_http_v2_upstream_conns);
+         q != ngx_queue_sentinel(&ngx_http_v2_upstream_conns);
+         q = ngx_queue_next(q))
+    {
+        hc = ngx_queue_data(q, ngx_http_v2_upstream_conn_t, queue);
+
+        if (hc->goaway
+            || hc->nstreams >= hc->max_streams
+            || ngx_cmp_sockaddr(hc->sockaddr, hc->socklen,
+                                pc->sockaddr, pc->socklen, 1)
+               != NGX_OK)
+        {
+            continue;
+        }
+
+        /* the busiest connection that still has room */
+
+        if (found == NULL || hc->nstreams > found->nstreams) {
+            found = hc;
+        }
+    }
+
+    hc = found;
+
+    if (hc == NULL) {
+        hc = ngx_http_v2_upstream_connect(pc,
+                                          hp->upstream->conf->connect_timeout);
+        if (hc == NULL) {
+            return NGX_DECLINED;
+        }
+
+    } else {
+        pc->cached = hc->connected;
+    }
+
+    st = ngx_calloc(sizeof(ngx_http_v2_upstream_stream_t), pc->log);
+    if (st == NULL) {
+        if (hc->nstreams == 0) {
+            ngx_http_v2_upstream_idle(hc);
+        }
+
+        return NGX_ERROR;
+    }
+
+    c = &st->c;
+
+    c->read = &st->read;
+    c->write = &st->write;
+
+    c->fd = hc->connection->fd;
+    c->number = hc->connection->number;
+    c->multiplexed = 1;
+
+    c->recv = ngx_http_v2_upstream_recv;
+    c->recv_chain = ngx_http_v2_upstream_recv_chain;
+    c->send_chain = ngx_http_v2_upstream_send_chain;
+
+    c->log = pc->log;
+    c->sockaddr = hc->sockaddr;
+    c->socklen = hc->socklen;
+    c->addr_text = hc->name;
+
+    c->tcp_nopush = NGX_TCP_NOPUSH_DISABLED;
+    c->tcp_nodelay = NGX_TCP_NODELAY_DISABLED;
+
+    st->read.data = c;
+    st->read.log = pc->log;
+    st->read.active = 1;
+
+    st->write.data = c;
+    st->write.log = pc->log;
+    st->write.write = 1;
+    st->write.active = 1;
+    st->write.ready = 1;
+
+    st->hc = hc;
+    st->recv_window = NGX_HTTP_V2_UPSTREAM_WINDOW;
+
+    ngx_queue_insert_tail(&hc->streams, &st->queue);
+    hc->nstreams++;
+
+    if (hc->connection->idle) {
+        hc->connection->idle = 0;
+
+        if (hc->connection->read->timer_set) {
+            ngx_del_timer(hc->connection->read, NGX_FUNC_LINE);
+        }
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "http2 upstream stream %p on connection %p, streams:%ui",
+                   st, hc, hc->nstreams);
+
+    pc->connection = c;
+
+    return NGX_DONE;
+}
+
+
+static void
+ngx_http_v2_upstream_free_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t state)
+{
+    ngx_http_v2_upstream_peer_data_t  *hp = data;
+
+    ngx_connection_t  *c;
+
+    c = pc->connection;
+
+    if (c && c->send_chain == ngx_http_v2_upstream_send_chain) {
+        ngx_http_v2_upstream_close_stream((ngx_http_v2_upstream_stream_t *) c);
+        pc->connection = NULL;
+    }
+
+    hp->original_free_peer(pc, hp->data, state);
+}
+
+
+static ngx_http_v2_upstream_conn_t *
+ngx_http_v2_upstream_connect(ngx_peer_connection_t *pc, ngx_msec_t timeout)
+{
+    u_char                       *p;
+    ngx_int_t                     rc;
+    ngx_pool_t                   *pool;
+    ngx_connection_t             *c;
+    ngx_peer_connection_t         peer;
+    ngx_http_v2_upstream_conn_t  *hc;
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ngx_cycle->log);
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    hc = ngx_pcalloc(pool, sizeof(ngx_http_v2_upstream_conn_t));
+    if (hc == NULL) {
+        goto failed;
+    }
+
+    hc->sockaddr = ngx_palloc(pool, pc->socklen);
+    if (hc->sockaddr == NULL) {
+        goto failed;
+    }
+
+    ngx_memcpy(hc->sockaddr, pc->sockaddr, pc->socklen);
+    hc->socklen = pc->socklen;
+
+    hc->name.data = ngx_pnalloc(pool, pc->name->len);
+    if (hc->name.data == NULL) {
+        goto failed;
+    }
+
+    ngx_memcpy(hc->name.data, pc->name->data, pc->name->len);
+    hc->name.len = pc->name->len;
+
+    hc->start = ngx_palloc(pool, NGX_HTTP_V2_UPSTREAM_BUFFER_SIZE);
+    if (hc->start == NULL) {
+        goto failed;
+    }
+
+    hc->last = hc->start;
+    hc->end = hc->start + NGX_HTTP_V2_UPSTREAM_BUFFER_SIZE;
+
+    ngx_memzero(&peer, sizeof(ngx_peer_connection_t));
+
+    peer.sockaddr = hc->sockaddr;
+    peer.socklen = hc->socklen;
+    peer.name = &hc->name;
+    peer.get = ngx_event_get_peer;
+    peer.log = ngx_cycle->log;
+    peer.log_error = NGX_ERROR_ERR;
+
+    rc = ngx_event_connect_peer(&peer);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        if (peer.connection) {
+            ngx_close_connection(peer.connection);
+        }
+
+        goto failed;
+    }
+
+    c = peer.connection;
+
+    c->data = hc;
+    c->pool = pool;
+
+    c->read->handler = ngx_http_v2_upstream_read_handler;
+    c->write->handler = ngx_http_v2_upstream_write_handler;
+
+    hc->connection = c;
+
+    hc->h2c.connection = c;
+    hc->h2c.hpack_enc.limit = NGX_HTTP_V2_TABLE_SIZE;
+    hc->h2c.hpack_enc.size = NGX_HTTP_V2_TABLE_SIZE;
+    hc->h2c.hpack_enc.free = NGX_HTTP_V2_TABLE_SIZE;
+
+    ngx_queue_init(&hc->streams);
+
+    hc->max_streams = NGX_HTTP_V2_UPSTREAM_STREAMS;
+    hc->next_sid = 1;
+
+    hc->send_window = NGX_HTTP_V2_DEFAULT_WINDOW;
+    hc->recv_window = NGX_HTTP_V2_MAX_WINDOW;
+    hc->init_window = NGX_HTTP_V2_DEFAULT_WINDOW;
+
+    /* the preface, SETTINGS and the connection window go out first */
+
+    p = ngx_http_v2_upstream_reserve(hc, &hc->out, &hc->last_out,
+                                     sizeof(ngx_http_v2_upstream_preface) - 1);
+    if (p == NULL) {
+        goto close;
+    }
+
+    ngx_memcpy(p, ngx_http_v2_upstream_preface,
+               sizeof(ngx_http_v2_upstream_preface) - 1);
+
+    hc->out_size += sizeof(ngx_http_v2_upstream_preface) - 1;
+
+    p = ngx_http_v2_upstream_frame(hc, 2 * NGX_HTTP_V2_SETTINGS_PARAM_SIZE,
+                                   NGX_HTTP_V2_SETTINGS_FRAME,
+                                   NGX_HTTP_V2_NO_FLAG, 0);
+    if (p == NULL) {
+        goto close;
+    }
+
+    p = ngx_http_v2_write_uint16(p, NGX_HTTP_V2_ENABLE_PUSH_SETTING);
+    p = ngx_http_v2_write_uint32(p, 0);
+
+    p = ngx_http_v2_write_uint16(p, NGX_HTTP_V2_INIT_WINDOW_SIZE_SETTING);
+    (void) ngx_http_v2_write_uint32(p, NGX_HTTP_V2_UPSTREAM_WINDOW);
+
+    if (ngx_http_v2_upstream_window_frame(hc, 0, NGX_HTTP_V2_MAX_WINDOW
+                                                 - NGX_HTTP_V2_DEFAULT_WINDOW)
+        != NGX_OK)
+    {
+        goto close;
+    }
+
+    if (ngx_http_v2_upstream_conns.next == NULL) {
+        ngx_queue_init(&ngx_http_v2_upstream_conns);
+    }
+
+    ngx_queue_insert_tail(&ngx_http_v2_upstream_conns, &hc->queue);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "http2 upstream connection %p to %V", hc, &hc->name);
+
+    if (rc == NGX_AGAIN) {
+        ngx_add_timer(c->write, timeout, NGX_FUNC_LINE);
+        return hc;
+    }
+
+    hc->connected = 1;
+
+    ngx_http_v2_upstream_post(hc);
+
+    return hc;
+
+close:
+
+    c->pool = NULL;
+    ngx_close_connection(c);
+
+failed:
+
+    ngx_destroy_pool(pool);
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_test_connect(ngx_connection_t *c)
+{
+    int        err;
+    socklen_t  len;
+
+#if (NGX_HAVE_KQUEUE)
+
+    if (ngx_event_flags & NGX_USE_KQUEUE_EVENT)  {
+        if (c->write->pending_eof || c->read->pending_eof) {
+            if (c->write->pending_eof) {
+                err = c->write->kq_errno;
+
+            } else {
+                err = c->read->kq_errno;
+            }
+
+            c->log->action = "connecting to upstream";
+            (void) ngx_connection_error(c, err,
+                                    "kevent() reported that connect() failed");
+            return NGX_ERROR;
+        }
+
+    } else
+#endif
+    {
+        err = 0;
+        len = sizeof(int);
+
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len)
+            == -1)
+        {
+            err = ngx_socket_errno;
+        }
+
+        if (err) {
+            c->log->action = "connecting to upstream";
+            (void) ngx_connection_error(c, err, "connect() failed");
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_v2_upstream_read_handler(ngx_event_t *rev)
+{
+    ssize_t                       n;
+    ngx_connection_t             *c;
+    ngx_http_v2_upstream_conn_t  *hc;
+
+    c = rev->data;
+    hc = c->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "http2 upstream read");
+
+    if (rev->timedout || c->close) {
+        ngx_http_v2_upstream_close(hc);
+        return;
+    }
+
+    for ( ;; ) {
+        n = c->recv(c, hc->last, hc->end - hc->last);
+
+        if (n == NGX_AGAIN) {
+            break;
+        }
+
+        if (n == 0 || n == NGX_ERROR) {
+            if (n == 0 && hc->nstreams) {
+                ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                              "upstream \"%V\" closed http2 connection",
+                              &hc->name);
+            }
+
+            ngx_http_v2_upstream_close(hc);
+            return;
+        }
+
+        hc->last += n;
+
+        if (ngx_http_v2_upstream_process(hc) != NGX_OK) {
+            ngx_http_v2_upstream_close(hc);
+            return;
+        }
+    }
+
+    if (hc->goaway && hc->nstreams == 0) {
+        ngx_http_v2_upstream_close(hc);
+        return;
+    }
+
+    if (ngx_handle_read_event(rev, 0, NGX_FUNC_LINE) != NGX_OK) {
+        ngx_http_v2_upstream_close(hc);
+        return;
+    }
+
+    if (ngx_http_v2_upstream_send(hc) != NGX_OK) {
+        ngx_http_v2_upstream_close(hc);
+    }
+}
+
+
+static void
+ngx_http_v2_upstream_write_handler(ngx_event_t *wev)
+{
+    ngx_connection_t             *c;
+    ngx_http_v2_upstream_conn_t  *hc;
+
+    c = wev->data;
+    hc = c->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "http2 upstream write");
+
+    if (!hc->connected) {
+
+        if (wev->timedout) {
+            ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT,
+                          "upstream \"%V\" timed out while connecting",
+                          &hc->name);
+            ngx_http_v2_upstream_close(hc);
+            return;
+        }
+
+        if (ngx_http_v2_upstream_test_connect(c) != NGX_OK) {
+            ngx_http_v2_upstream_close(hc);
+            return;
+        }
+
+        if (wev->timer_set) {
+            ngx_del_timer(wev, NGX_FUNC_LINE);
+        }
+
+        hc->connected = 1;
+
+        ngx_http_v2_upstream_wake_blocked(hc);
+    }
+
+    if (ngx_http_v2_upstream_send(hc) != NGX_OK) {
+        ngx_http_v2_upstream_close(hc);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_send(ngx_http_v2_upstream_conn_t *hc)
+{
+    ssize_t                      n;
+    ngx_connection_t            *c;
+    ngx_http_v2_upstream_buf_t  *b;
+
+    if (!hc->connected) {
+        return NGX_OK;
+    }
+
+    c = hc->connection;
+
+    while (hc->out) {
+        b = hc->out;
+
+        n = c->send(c, b->pos, b->last - b->pos);
+
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (n == NGX_AGAIN) {
+            break;
+        }
+
+        b->pos += n;
+        hc->out_size -= n;
+
+        if (b->pos != b->last) {
+            break;
+        }
+
+        hc->out = b->next;
+
+        if (hc->out == NULL) {
+            hc->last_out = NULL;
+        }
+
+        ngx_http_v2_upstream_free_buf(hc, b);
+    }
+
+    if (ngx_handle_write_event(c->write, 0, NGX_FUNC_LINE) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (hc->out_size < NGX_HTTP_V2_UPSTREAM_OUTPUT_LIMIT) {
+        ngx_http_v2_upstream_wake_blocked(hc);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_v2_upstream_post(ngx_http_v2_upstream_conn_t *hc)
+{
+    ngx_event_t  *wev;
+
+    wev = hc->connection->write;
+
+    if (hc->connected && hc->out && !wev->posted) {
+        ngx_post_event(wev, &ngx_posted_events);
+    }
+}
+
+
+static void
+ngx_http_v2_upstream_close(ngx_http_v2_upstream_conn_t *hc)
+{
+    ngx_pool_t                     *pool;
+    ngx_queue_t                    *q;
+    ngx_http_v2_upstream_buf_t     *b, *next;
+    ngx_http_v2_upstream_stream_t  *st;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, hc->connection->log, 0,
+                   "close http2 upstream connection %p", hc);
+
+    while (!ngx_queue_empty(&hc->streams)) {
+        q = ngx_queue_head(&hc->streams);
+        ngx_queue_remove(q);
+
+        st = ngx_queue_data(q, ngx_http_v2_upstream_stream_t, queue);
+
+        /* the response buffers are freed by the stream itself */
+
+        st->hc = NULL;
+        st->c.fd = (ngx_socket_t) -1;
+
+        if (!st->in_closed) {
+            st->reset = 1;
+        }
+
+        ngx_http_v2_upstream_wake(&st->read);
+        ngx_http_v2_upstream_wake(&st->write);
+    }
+
+    ngx_queue_remove(&hc->queue);
+
+    for (b = hc->out; b; b = next) {
+        next = b->next;
+        ngx_free(b);
+    }
+
+    for (b = hc->free; b; b = next) {
+        next = b->next;
+        ngx_free(b);
+    }
+
+    if (hc->header) {
+        ngx_free(hc->header);
+    }
+
+    /* hc itself is allocated from the pool */
+
+    pool = hc->connection->pool;
+
+    ngx_close_connection(hc->connection);
+    ngx_destroy_pool(pool);
+}
+
+
+static void
+ngx_http_v2_upstream_idle(ngx_http_v2_upstream_conn_t *hc)
+{
+    ngx_connection_t  *c;
+
+    c = hc->connection;
+
+    if (hc->goaway) {
+        ngx_http_v2_upstream_close(hc);
+        return;
+    }
+
+    c->idle = 1;
+    c->log = ngx_cycle->log;
+    c->read->log = ngx_cycle->log;
+    c->write->log = ngx_cycle->log;
+    c->pool->log = ngx_cycle->log;
+
+    ngx_add_timer(c->read, NGX_HTTP_V2_UPSTREAM_IDLE_TIMEOUT, NGX_FUNC_LINE);
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_process(ngx_http_v2_upstream_conn_t *hc)
+{
+    u_char      *p;
+    size_t       len;
+    ngx_uint_t   head, type, flags, sid;
+
+    p = hc->start;
+
+    while (hc->last - p >= NGX_HTTP_V2_FRAME_HEADER_SIZE) {
+
+        head = ngx_http_v2_parse_uint32(p);
+
+        len = ngx_http_v2_parse_length(head);
+        type = ngx_http_v2_parse_type(head);
+        flags = p[4];
+        sid = ngx_http_v2_parse_sid(&p[5]);
+
+        /* SETTINGS_MAX_FRAME_SIZE is left at its default */
+
+        if (len > NGX_HTTP_V2_DEFAULT_FRAME_SIZE) {
+            ngx_log_error(NGX_LOG_ERR, hc->connection->log, 0,
+                          "upstream \"%V\" sent too large http2 frame: %uz",
+                          &hc->name, len);
+            return NGX_ERROR;
+        }
+
+        if ((size_t) (hc->last - p) < NGX_HTTP_V2_FRAME_HEADER_SIZE + len) {
+            break;
+        }
+
+        ngx_log_debug4(NGX_LOG_DEBUG_HTTP, hc->connection->log, 0,
+                       "http2 upstream frame type:%ui f:%Xd l:%uz sid:%ui",
+                       type, flags, len, sid);
+
+        p += NGX_HTTP_V2_FRAME_HEADER_SIZE;
+
+        if (hc->header_sid && type != NGX_HTTP_V2_CONTINUATION_FRAME) {
+            ngx_log_error(NGX_LOG_ERR, hc->connection->log, 0,
+                          "upstream \"%V\" sent http2 frame "
+                          "instead of CONTINUATION", &hc->name);
+            return NGX_ERROR;
+        }
+
+        if (type < NGX_HTTP_V2_UPSTREAM_FRAME_STATES) {
+            if (ngx_http_v2_upstream_frame_handlers[type](hc, p, len, flags,
+                                                          sid)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+        }
+
+        p += len;
+    }
+
+    len = hc->last - p;
+
+    if (p != hc->start) {
+        ngx_memmove(hc->start, p, len);
+        hc->last = hc->start + len;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_data(ngx_http_v2_upstream_conn_t *hc, u_char *pos,
+    size_t len, ngx_uint_t flags, ngx_uint_t sid)
+{
+    u_char                         *p;
+    size_t                          size, padding;
+    ngx_http_v2_upstream_stream_t  *st;
+
+    if (sid == 0) {
+        ngx_log_error(NGX_LOG_ERR, hc->connection->log, 0,
+                      "upstream \"%V\" sent http2 DATA frame "
+                      "with incorrect identifier", &hc->name);
+        return NGX_ERROR;
+    }
+
+    size = len;
+
+    if (size > hc->recv_window) {
+        ngx_log_error(NGX_LOG_ERR, hc->connection->log, 0,
+                      "upstream \"%V\" violated http2 connection "
+                      "flow control", &hc->name);
+        return NGX_ERROR;
+    }
+
+    hc->recv_window -= size;
+
+    if (hc->recv_window < NGX_HTTP_V2_MAX_WINDOW / 4) {
+        if (ngx_http_v2_upstream_window_frame(hc, 0, NGX_HTTP_V2_MAX_WINDOW
+                                                     - hc->recv_window)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        hc->recv_window = NGX_HTTP_V2_MAX_WINDOW;
+    }
+
+    if (flags & NGX_HTTP_V2_PADDED_FLAG) {
+        if (len == 0 || (size_t) pos[0] >= len) {
+            ngx_log_error(NGX_LOG_ERR, hc->connection->log, 0,
+                          "upstream \"%V\" sent http2 DATA frame "
+                          "with incorrect padding", &hc->name);
+            return NGX_ERROR;
+        }
+
+        padding = pos[0];
+        pos++;
+        len -= 1 + padding;
+    }
+
+    st = ngx_http_v2_upstream_find_stream(hc, sid);
+
+    if (st == NULL || st->reset || st->in_closed) {
+        /* the stream was closed by us, the frame only counts for the window */
+        return NGX_OK;
+    }
+
+    if (!st->response) {
+        ngx_log_error(NGX_LOG_ERR, st->c.log, 0,
+                      "upstream sent http2 DATA frame before HEADERS");
+        ngx_http_v2_upstream_reset_stream(st, NGX_HTTP_V2_PROTOCOL_ERROR);
+        return NGX_OK;
+    }
+
+    if (size > st->recv_window) {
+        ngx_log_error(NGX_LOG_ERR, st->c.log, 0,
+                      "upstream violated http2 stream flow control");
+        ngx_http_v2_upstream_reset_stream(st, NGX_HTTP_V2_FLOW_CTRL_ERROR);
+        return NGX_OK;
+    }
+
+    st->recv_window -= size;
+
+    /* the padding is never read, so it is consumed right away */
+    st->recv_unacked += size - len;
+
+    if (len) {
+        p = ngx_http_v2_upstream_reserve(hc, &st->in, &st->last_in, len);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(p, pos, len);
+    }
+
+    if (flags & NGX_HTTP_V2_END_STREAM_FLAG) {
+        st->in_closed = 1;
+    }
+
+    ngx_http_v2_upstream_wake(&st->read);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_headers(ngx_http_v2_upstream_conn_t *hc, u_char *pos,
+    size_t len, ngx_uint_t flags, ngx_uint_t sid)
+{
+    size_t  padding;
+
+    if (sid == 0) {
+        ngx_log_error(NGX_LOG_ERR, hc->connection->log, 0,
+                      "upstream \"%V\" sent http2 HEADERS frame "
+                      "with incorrect identifier", &hc->name);
+        return NGX_ERROR;
+    }
+
+    padding = 0;
+
+    if (flags & NGX_HTTP_V2_PADDED_FLAG) {
+        if (len == 0) {
+            goto invalid;
+        }
+
+        padding = *pos++;
+        len--;
+    }
+
+    if (flags & NGX_HTTP_V2_PRIORITY_FLAG) {
+        if (len < NGX_HTTP_V2_PRIORITY_SIZE) {
+            goto invalid;
+        }
+
+        pos += NGX_HTTP_V2_PRIORITY_SIZE;
+        len -= NGX_HTTP_V2_PRIORITY_SIZE;
+    }
+
+    if (padding > len) {
+        goto invalid;
+    }
+
+    len -= padding;
+
+    hc->header_sid = sid;
+    hc->header_flags = flags;
+    hc->header_len = 0;
+
+    return ngx_http_v2_upstream_header_block(hc, pos, len);
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ERR, hc->connection->log, 0,
+                  "upstream \"%V\" sent invalid http2 HEADERS frame",
+                  &hc->name);
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_continuation(ngx_http_v2_upstream_conn_t *hc,
+    u_char *pos, size_t len, ngx_uint_t flags, ngx_uint_t sid)
+{
+    if (hc->header_sid == 0 || sid != hc->header_sid) {
+        ngx_log_error(NGX_LOG_ERR, hc->connection->log, 0,
+                      "upstream \"%V\" sent unexpected http2 "
+                      "CONTINUATION frame", &hc->name);
+        return NGX_ERROR;
+    }
+
+    hc->header_flags = (hc->header_flags & ~NGX_HTTP_V2_END_HEADERS_FLAG)
+                       | (flags & NGX_HTTP_V2_END_HEADERS_FLAG);
+
+    return ngx_http_v2_upstream_header_block(hc, pos, len);
+}
+
+
+/*
+ * Collects the header block and decodes it as soon as it is complete: the
+ * block has to be decoded even for streams closed already to keep the HPACK
+ * decoder in sync with the server.
+ */
+
+static ngx_int_t
+ngx_http_v2_upstream_header_block(ngx_http_v2_upstream_conn_t *hc,
+    u_char *pos, size_t len)
+{
+    u_char                         *p;
+    size_t                          size;
+    ngx_int_t                       rc;
+    ngx_uint_t                      flags;
+    ngx_pool_t                     *pool;
+    ngx_array_t                    *headers;
+    ngx_http_v2_upstream_stream_t  *st;
+
+    if (hc->header_len + len > hc->header_size) {
+
+        if (hc->header_len + len > NGX_HTTP_V2_UPSTREAM_HEADERS_LIMIT) {
+            ngx_log_error(NGX_LOG_ERR, hc->connection->log, 0,
+                          "upstream \"%V\" sent too large http2 "
+                          "header block", &hc->name);
+            return NGX_ERROR;
+        }
+
+        size = ngx_max(2 * hc->header_size, hc->header_len + len);
+        size = ngx_max(size, 4096);
+
+        p = ngx_alloc(size, hc->connection->log);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (hc->header) {
+            ngx_memcpy(p, hc->header, hc->header_len);
+            ngx_free(hc->header);
+        }
+
+        hc->header = p;
+        hc->header_size = size;
+    }
+
+    ngx_memcpy(hc->header + hc->header_len, pos, len);
+    hc->header_len += len;
+
+    if (!(hc->header_flags & NGX_HTTP_V2_END_HEADERS_FLAG)) {
+        return NGX_OK;
+    }
+
+    flags = hc->header_flags;
+    st = ngx_http_v2_upstream_find_stream(hc, hc->header_sid);
+
+    hc->header_sid = 0;
+
+    pool = ngx_create_pool(1024, hc->connection->log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    hc->h2c.state.pool = pool;
+
+    headers = ngx_array_create(pool, 16, sizeof(ngx_http_v2_header_t));
+    if (headers == NULL) {
+        ngx_destroy_pool(pool);
+        return NGX_ERROR;
+    }
+
+    if (ngx_http_v2_upstream_decode(hc, headers) != NGX_OK) {
+        ngx_log_error(NGX_LOG_ERR, hc->connection->log, 0,
+                      "upstream \"%V\" sent invalid http2 header block",
+                      &hc->name);
+        ngx_destroy_pool(pool);
+        return NGX_ERROR;
+    }
+
+    rc = NGX_OK;
+
+    if (st && !st->reset && !st->in_closed) {
+
+        if (!st->response) {
+            rc = ngx_http_v2_upstream_response(st, headers);
+
+        } else if (!(flags & NGX_HTTP_V2_END_STREAM_FLAG)) {
+            ngx_log_error(NGX_LOG_ERR, st->c.log, 0,
+                          "upstream sent http2 trailers "
+                          "without END_STREAM flag");
+            ngx_http_v2_upstream_reset_stream(st, NGX_HTTP_V2_PROTOCOL_ERROR);
+        }
+
+        /* trailers are not passed to the client */
+
+        if (rc == NGX_OK && !st->reset
+            && (flags & NGX_HTTP_V2_END_STREAM_FLAG))
+        {
+            st->in_closed = 1;
+        }
+
+        ngx_http_v2_upstream_wake(&st->read);
+    }
+
+    ngx_destroy_pool(pool);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_decode(ngx_http_v2_upstream_conn_t *hc,
+    ngx_array_t *headers)
+{
+    u_char                *p, *end, ch;
+    ngx_uint_t             prefix, index, size_update;
+    ngx_http_v2_header_t  *h, header;
+
+    p = hc->header;
+    end = hc->header + hc->header_len;
+
+    size_update = 1;
+
+    while (p < end) {
+        ch = *p;
+
+        if (ch & 0x80) {
+            prefix = ngx_http_v2_prefix(7);
+
+        } else if (ch & 0x40) {
+            prefix = ngx_http_v2_prefix(6);
+
+        } else if (ch & 0x20) {
+
+            /* a dynamic table size update starts the block */
+
+            if (!size_update) {
+                return NGX_ERROR;
+            }
+
+            if (ngx_http_v2_upstream_parse_int(&p, end, ngx_http_v2_prefix(5),
+                                               &index)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            if (ngx_http_v2_table_size(&hc->h2c, index) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            continue;
+
+        } else {
+            prefix = ngx_http_v2_prefix(4);
+        }
+
+        size_update = 0;
+
+        if (ngx_http_v2_upstream_parse_int(&p, end, prefix, &index) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (ch & 0x80) {
+            if (ngx_http_v2_get_indexed_header(&hc->h2c, index, 0) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            header = hc->h2c.state.header;
+
+        } else {
+            if (index) {
+                if (ngx_http_v2_get_indexed_header(&hc->h2c, index, 1)
+                    != NGX_OK)
+                {
+                    return NGX_ERROR;
+                }
+
+                header.name = hc->h2c.state.header.name;
+
+            } else if (ngx_http_v2_upstream_parse_field(hc, &p, end,
+                                                        &header.name)
+                       != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            if (ngx_http_v2_upstream_parse_field(hc, &p, end, &header.value)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            if ((ch & 0x40) && ngx_http_v2_add_header(&hc->h2c, &header)
+                               != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, hc->connection->log, 0,
+                       "http2 upstream header: \"%V: %V\"",
+                       &header.name, &header.value);
+
+        h = ngx_array_push(headers);
+        if (h == NULL) {
+            return NGX_ERROR;
+        }
+
+        *h = header;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_parse_int(u_char **pos, u_char *end, ngx_uint_t prefix,
+    ngx_uint_t *value)
+{
+    u_char      *p;
+    ngx_uint_t   v, octet, shift;
+
+    p = *pos;
+
+    v = *p++ & prefix;
+
+    if (v == prefix) {
+        for (shift = 0; /* void */; shift += 7) {
+
+            if (p == end || p - *pos > NGX_HTTP_V2_INT_OCTETS) {
+                return NGX_ERROR;
+            }
+
+            octet = *p++;
+
+            v += (octet & 0x7f) << shift;
+
+            if (octet < 128) {
+                break;
+            }
+        }
+    }
+
+    *pos = p;
+    *value = v;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_parse_field(ngx_http_v2_upstream_conn_t *hc,
+    u_char **pos, u_char *end, ngx_str_t *field)
+{
+    u_char      *p, state;
+    ngx_uint_t   huff, len;
+
+    if (*pos == end) {
+        return NGX_ERROR;
+    }
+
+    huff = **pos & 0x80;
+
+    if (ngx_http_v2_upstream_parse_int(pos, end, ngx_http_v2_prefix(7), &len)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if ((size_t) (end - *pos) < len) {
+        return NGX_ERROR;
+    }
+
+    if (!huff) {
+        field->data = *pos;
+        field->len = len;
+
+        *pos += len;
+        return NGX_OK;
+    }
+
+    /* the shortest huffman code is 5 bits */
+
+    field->data = ngx_pnalloc(hc->h2c.state.pool, len * 8 / 5 + 1);
+    if (field->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = field->data;
+    state = 0;
+
+    if (ngx_http_v2_huff_decode(&state, *pos, len, &p, 1,
+                                hc->connection->log)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    field->len = p - field->data;
+
+    *pos += len;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_response(ngx_http_v2_upstream_stream_t *st,
+    ngx_array_t *headers)
+{
+    u_char                *p;
+    size_t                 len;
+    ngx_int_t              status;
+    ngx_uint_t             i, j;
+    ngx_http_v2_header_t  *h;
+
+    static const u_char  ending[] = CRLF;
+
+    status = NGX_ERROR;
+    len = sizeof("HTTP/1.1 000" CRLF CRLF) - 1;
+
+    h = headers->elts;
+
+    for (i = 0; i < headers->nelts; i++) {
+
+        for (j = 0; j < h[i].name.len + h[i].value.len; j++) {
+            p = (j < h[i].name.len) ? &h[i].name.data[j]
+                                    : &h[i].value.data[j - h[i].name.len];
+
+            if (*p == CR || *p == LF || *p == '\0') {
+                goto invalid;
+            }
+        }
+
+        if (h[i].name.len && h[i].name.data[0] == ':') {
+
+            if (h[i].name.len == sizeof(":status") - 1
+                && ngx_strncmp(h[i].name.data, ":status", h[i].name.len) == 0
+                && h[i].value.len == 3)
+            {
+                status = ngx_atoi(h[i].value.data, 3);
+            }
+
+            continue;
+        }
+
+        len += h[i].name.len + sizeof(": ") - 1 + h[i].value.len
+               + sizeof(CRLF) - 1;
+    }
+
+    if (status == NGX_ERROR || status < 100) {
+        goto invalid;
+    }
+
+    /* interim responses are not passed, 101 is not allowed in HTTP/2 */
+
+    if (status < 200) {
+        if (status == 101) {
+            goto invalid;
+        }
+
+        return NGX_OK;
+    }
+
+    p = ngx_http_v2_upstream_reserve(st->hc, &st->in, &st->last_in, len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_sprintf(p, "HTTP/1.1 %03i" CRLF, status);
+
+    for (i = 0; i < headers->nelts; i++) {
+
+        if (h[i].name.len && h[i].name.data[0] == ':') {
+            continue;
+        }
+
+        p = ngx_cpymem(p, h[i].name.data, h[i].name.len);
+        *p++ = ':'; *p++ = ' ';
+        p = ngx_cpymem(p, h[i].value.data, h[i].value.len);
+        *p++ = CR; *p++ = LF;
+    }
+
+    ngx_memcpy(p, ending, sizeof(CRLF) - 1);
+
+    st->response = 1;
+
+    return NGX_OK;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ERR, st->c.log, 0,
+                  "upstream sent invalid http2 response header");
+
+    ngx_http_v2_upstream_reset_stream(st, NGX_HTTP_V2_PROTOCOL_ERROR);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_rst_stream(ngx_http_v2_upstream_conn_t *hc, u_char *pos,
+    size_t len, ngx_uint_t flags, ngx_uint_t sid)
+{
+    ngx_uint_t                      status;
+    ngx_http_v2_upstream_stream_t  *st;
+
+    if (len != NGX_HTTP_V2_RST_STREAM_SIZE || sid == 0) {
+        ngx_log_error(NGX_LOG_ERR, hc->connection->log, 0,
+                      "upstream \"%V\" sent invalid http2 RST_STREAM frame",
+                      &hc->name);
+        return NGX_ERROR;
+    }
+
+    st = ngx_http_v2_upstream_find_stream(hc, sid);
+
+    if (st == NULL) {
+        return NGX_OK;
+    }
+
+    status = ngx_http_v2_parse_uint32(pos);
+
+    /* the stream is closed in both directions now */
+
+    st->out_closed = 1;
+
+    if (st->in_closed && status == NGX_HTTP_V2_NO_ERROR) {
+
+        /* the complete response was received, the request body is not needed */
+
+        ngx_http_v2_upstream_wake(&st->write);
+        return NGX_OK;
+    }
+
+    ngx_log_error(NGX_LOG_ERR, st->c.log, 0,
+                  "upstream reset http2 stream with code %ui", status);
+
+    st->reset = 1;
+
+    ngx_http_v2_upstream_wake(&st->read);
+    ngx_http_v2_upstream_wake(&st->write);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_settings(ngx_http_v2_upstream_conn_t *hc, u_char *pos,
+    size_t len, ngx_uint_t flags, ngx_uint_t sid)
+{
+    ssize_t                         delta;
+    ngx_uint_t                      id, value;
+    ngx_queue_t                    *q;
+    ngx_http_v2_upstream_stream_t  *st;
+
+    if (sid != 0) {
+        goto invalid;
+    }
+
+    if (flags & NGX_HTTP_V2_ACK_FLAG) {
+        if (len != 0) {
+            goto invalid;
+        }
+
+        return NGX_OK;
+    }
+
+    if (len % NGX_HTTP_V2_SETTINGS_PARAM_SIZE) {
+        goto invalid;
+    }
+
+    for ( /* void */ ; len; len -= NGX_HTTP_V2_SETTINGS_PARAM_SIZE) {
+
+        id = ngx_http_v2_parse_uint16(pos);
+        value = ngx_http_v2_parse_uint32(&pos[2]);
+
+        pos += NGX_HTTP_V2_SETTINGS_PARAM_SIZE;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, hc->connection->log, 0,
+                       "http2 upstream setting %ui:%ui", id, value);
+
+        switch (id) {
+
+        case NGX_HTTP_V2_HEADER_TABLE_SIZE_SETTING:
+            ngx_http_v2_table_peer_size(&hc->h2c, value);
+            break;
+
+        case NGX_HTTP_V2_MAX_STREAMS_SETTING:
+            hc->max_streams = value;
+            break;
+
+        case NGX_HTTP_V2_INIT_WINDOW_SIZE_SETTING:
+
+            if (value > NGX_HTTP_V2_MAX_WINDOW) {
+                goto invalid;
+            }
+
+            delta = value - hc->init_window;
+            hc->init_window = value;
+
+            for (q = ngx_queue_head(&hc->streams);
+                 q != ngx_queue_sentinel(&hc->streams);
+                 q = ngx_queue_next(q))
+            {
+                st = ngx_queue_data(q, ngx_http_v2_upstream_stream_t, queue);
+
+                if (st->headers_sent) {
+                    st->send_window += delta;
+                }
+            }
+
+            break;
+
+        case NGX_HTTP_V2_MAX_FRAME_SIZE_SETTING:
+
+            /* frames sent are never larger than the default */
+
+            if (value < NGX_HTTP_V2_DEFAULT_FRAME_SIZE
+                || value > NGX_HTTP_V2_MAX_FRAME_SIZE)
+            {
+                goto invalid;
+            }
+
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    if (ngx_http_v2_upstream_frame(hc, 0, NGX_HTTP_V2_SETTINGS_FRAME,
+                                   NGX_HTTP_V2_ACK_FLAG, 0)
+        == NULL)
+    {
+        return NGX_ERROR;
+    }
+
+    ngx_http_v2_upstream_wake_blocked(hc);
+
+    return NGX_OK;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ERR, hc->connection->log, 0,
+                  "upstream \"%V\" sent invalid http2 SETTINGS frame",
+                  &hc->name);
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_push_promise(ngx_http_v2_upstream_conn_t *hc,
+    u_char *pos, size_t len, ngx_uint_t flags, ngx_uint_t sid)
+{
+    ngx_log_error(NGX_LOG_ERR, hc->connection->log, 0,
+                  "upstream \"%V\" sent http2 PUSH_PROMISE frame "
+                  "although push is disabled", &hc->name);
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_ping(ngx_http_v2_upstream_conn_t *hc, u_char *pos,
+    size_t len, ngx_uint_t flags, ngx_uint_t sid)
+{
+    u_char  *p;
+
+    if (len != NGX_HTTP_V2_PING_SIZE || sid != 0) {
+        ngx_log_error(NGX_LOG_ERR, hc->connection->log, 0,
+                      "upstream \"%V\" sent invalid http2 PING frame",
+                      &hc->name);
+        return NGX_ERROR;
+    }
+
+    if (flags & NGX_HTTP_V2_ACK_FLAG) {
+        return NGX_OK;
+    }
+
+    p = ngx_http_v2_upstream_frame(hc, NGX_HTTP_V2_PING_SIZE,
+                                   NGX_HTTP_V2_PING_FRAME,
+                                   NGX_HTTP_V2_ACK_FLAG, 0);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(p, pos, NGX_HTTP_V2_PING_SIZE);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_goaway(ngx_http_v2_upstream_conn_t *hc, u_char *pos,
+    size_t len, ngx_uint_t flags, ngx_uint_t sid)
+{
+    ngx_uint_t                      last_sid, status, level;
+    ngx_queue_t                    *q;
+    ngx_http_v2_upstream_stream_t  *st;
+
+    if (len < NGX_HTTP_V2_GOAWAY_SIZE || sid != 0) {
+        ngx_log_error(NGX_LOG_ERR, hc->connection->log, 0,
+                      "upstream \"%V\" sent invalid http2 GOAWAY frame",
+                      &hc->name);
+        return NGX_ERROR;
+    }
+
+    last_sid = ngx_http_v2_parse_sid(pos);
+    status = ngx_http_v2_parse_uint32(&pos[4]);
+
+    level = (status == NGX_HTTP_V2_NO_ERROR) ? NGX_LOG_INFO : NGX_LOG_ERR;
+
+    ngx_log_error(level, hc->connection->log, 0,
+                  "upstream \"%V\" sent http2 GOAWAY with code %ui, "
+                  "last stream %ui", &hc->name, status, last_sid);
+
+    hc->goaway = 1;
+
+    /* streams not processed by the server may be safely retried */
+
+    for (q = ngx_queue_head(&hc->streams);
+         q != ngx_queue_sentinel(&hc->streams);
+         q = ngx_queue_next(q))
+    {
+        st = ngx_queue_data(q, ngx_http_v2_upstream_stream_t, queue);
+
+        if (st->sid == 0 || st->sid > last_sid) {
+            st->reset = 1;
+            st->out_closed = 1;
+
+            ngx_http_v2_upstream_wake(&st->read);
+            ngx_http_v2_upstream_wake(&st->write);
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_window_update(ngx_http_v2_upstream_conn_t *hc,
+    u_char *pos, size_t len, ngx_uint_t flags, ngx_uint_t sid)
+{
+    size_t                          window;
+    ngx_http_v2_upstream_stream_t  *st;
+
+    if (len != NGX_HTTP_V2_WINDOW_UPDATE_SIZE) {
+        ngx_log_error(NGX_LOG_ERR, hc->connection->log, 0,
+                      "upstream \"%V\" sent invalid http2 "
+                      "WINDOW_UPDATE frame", &hc->name);
+        return NGX_ERROR;
+    }
+
+    window = ngx_http_v2_parse_window(pos);
+
+    if (sid == 0) {
+        if (window == 0 || window > NGX_HTTP_V2_MAX_WINDOW - hc->send_window) {
+            ngx_log_error(NGX_LOG_ERR, hc->connection->log, 0,
+                          "upstream \"%V\" sent invalid http2 connection "
+                          "window update: %uz", &hc->name, window);
+            return NGX_ERROR;
+        }
+
+        hc->send_window += window;
+
+        ngx_http_v2_upstream_wake_blocked(hc);
+
+        return NGX_OK;
+    }
+
+    st = ngx_http_v2_upstream_find_stream(hc, sid);
+
+    if (st == NULL || st->reset) {
+        return NGX_OK;
+    }
+
+    if (window == 0
+        || window > (size_t) (NGX_HTTP_V2_MAX_WINDOW - st->send_window))
+    {
+        ngx_log_error(NGX_LOG_ERR, st->c.log, 0,
+                      "upstream sent invalid http2 stream "
+                      "window update: %uz", window);
+        ngx_http_v2_upstream_reset_stream(st, NGX_HTTP_V2_FLOW_CTRL_ERROR);
+        return NGX_OK;
+    }
+
+    st->send_window += window;
+
+    if (st->blocked) {
+        st->blocked = 0;
+        ngx_http_v2_upstream_wake(&st->write);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_skip(ngx_http_v2_upstream_conn_t *hc, u_char *pos,
+    size_t len, ngx_uint_t flags, ngx_uint_t sid)
+{
+    return NGX_OK;
+}
+
+
+static ssize_t
+ngx_http_v2_upstream_recv(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    size_t                          n, total;
+    ngx_event_t                    *rev;
+    ngx_http_v2_upstream_buf_t     *b;
+    ngx_http_v2_upstream_stream_t  *st;
+
+    st = (ngx_http_v2_upstream_stream_t *) c;
+    rev = c->read;
+
+    total = 0;
+
+    while (st->in && size) {
+        b = st->in;
+
+        n = ngx_min((size_t) (b->last - b->pos), size);
+
+        buf = ngx_cpymem(buf, b->pos, n);
+
+        b->pos += n;
+        size -= n;
+        total += n;
+
+        if (b->pos == b->last) {
+            st->in = b->next;
+
+            if (st->in == NULL) {
+                st->last_in = NULL;
+            }
+
+            ngx_http_v2_upstream_free_buf(st->hc, b);
+        }
+    }
+
+    if (total) {
+
+        if (st->response) {
+            st->recv_unacked += total;
+        }
+
+        if (st->hc && !st->in_closed && !st->reset
+            && st->recv_unacked >= NGX_HTTP_V2_UPSTREAM_WINDOW / 4)
+        {
+            if (ngx_http_v2_upstream_window_frame(st->hc, st->sid,
+                                                  st->recv_unacked)
+                != NGX_OK)
+            {
+                rev->error = 1;
+                return NGX_ERROR;
+            }
+
+            st->recv_window += st->recv_unacked;
+            st->recv_unacked = 0;
+
+            ngx_http_v2_upstream_post(st->hc);
+        }
+
+        rev->ready = (st->in || st->in_closed || st->reset);
+
+        return total;
+    }
+
+    if (st->reset || (st->hc == NULL && !st->in_closed)) {
+        rev->ready = 0;
+        rev->error = 1;
+        return NGX_ERROR;
+    }
+
+    if (st->in_closed) {
+        rev->ready = 0;
+        rev->eof = 1;
+        return 0;
+    }
+
+    rev->ready = 0;
+
+    return NGX_AGAIN;
+}
+
+
+static ssize_t
+ngx_http_v2_upstream_recv_chain(ngx_connection_t *c, ngx_chain_t *cl,
+    off_t limit)
+{
+    size_t     size;
+    ssize_t    n, total;
+    ngx_buf_t  *b;
+
+    total = 0;
+
+    for ( /* void */ ; cl; cl = cl->next) {
+        b = cl->buf;
+
+        size = b->end - b->last;
+
+        if (limit && (off_t) (total + size) > limit) {
+            size = limit - total;
+        }
+
+        /* like readv(), the buffers are filled but not advanced */
+
+        n = ngx_http_v2_upstream_recv(c, b->last, size);
+
+        if (n == NGX_AGAIN || n == NGX_ERROR || n == 0) {
+            return total ? total : n;
+        }
+
+        total += n;
+
+        if ((size_t) n < size || (limit && total >= limit)) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+
+static ngx_chain_t *
+ngx_http_v2_upstream_send_chain(ngx_connection_t *c, ngx_chain_t *in,
+    off_t limit)
+{
+    ngx_int_t                       rc;
+    ngx_buf_t                      *b;
+    ngx_http_v2_upstream_conn_t    *hc;
+    ngx_http_v2_upstream_stream_t  *st;
+
+    st = (ngx_http_v2_upstream_stream_t *) c;
+    hc = st->hc;
+
+    if (hc == NULL || st->reset) {
+        c->write->error = 1;
+        return NGX_CHAIN_ERROR;
+    }
+
+    if (!hc->connected) {
+        st->blocked = 1;
+        c->write->ready = 0;
+        return in;
+    }
+
+    for ( /* void */ ; in; in = in->next) {
+        b = in->buf;
+
+        if (ngx_buf_special(b)) {
+            continue;
+        }
+
+        if (!st->headers_sent) {
+            if (hc->goaway) {
+                st->reset = 1;
+                c->write->error = 1;
+                return NGX_CHAIN_ERROR;
+            }
+
+            if (ngx_http_v2_upstream_create_headers(st, b) != NGX_OK) {
+                c->write->error = 1;
+                return NGX_CHAIN_ERROR;
+            }
+        }
+
+        rc = ngx_http_v2_upstream_send_data(st, b);
+
+        if (rc == NGX_ERROR) {
+            c->write->error = 1;
+            return NGX_CHAIN_ERROR;
+        }
+
+        if (rc == NGX_AGAIN) {
+            break;
+        }
+    }
+
+    ngx_http_v2_upstream_post(hc);
+
+    if (in) {
+        st->blocked = 1;
+        c->write->ready = 0;
+    }
+
+    return in;
+}
+
+
+/*
+ * Converts the request header created by the proxy module into a HEADERS
+ * frame and, for a large header, CONTINUATION frames.  The header is always
+ * created in a single buffer, the body may follow it in the same buffer.
+ */
+
+static ngx_int_t
+ngx_http_v2_upstream_create_headers(ngx_http_v2_upstream_stream_t *st,
+    ngx_buf_t *b)
+{
+    u_char                       *p, *pos, *end, *last, *block, *colon, *frame;
+    size_t                        len, size;
+    ngx_str_t                     method, path, host, name, value;
+    ngx_uint_t                    flags, type, indexing;
+    ngx_http_v2_upstream_conn_t  *hc;
+
+    static ngx_str_t  method_name = ngx_string(":method");
+    static ngx_str_t  scheme_name = ngx_string(":scheme");
+    static ngx_str_t  scheme = ngx_string("http");
+    static ngx_str_t  authority_name = ngx_string(":authority");
+    static ngx_str_t  path_name = ngx_string(":path");
+
+    hc = st->hc;
+
+    if (!ngx_buf_in_memory(b)) {
+        goto invalid;
+    }
+
+    end = ngx_strlcasestrn(b->pos, b->last, (u_char *) CRLF CRLF, 4 - 1);
+    if (end == NULL) {
+        goto invalid;
+    }
+
+    /* the request line */
+
+    last = ngx_strlcasestrn(b->pos, end + 2, (u_char *) CRLF, 2 - 1);
+
+    method.data = b->pos;
+    p = ngx_strlchr(b->pos, last, ' ');
+    if (p == NULL) {
+        goto invalid;
+    }
+
+    method.len = p - method.data;
+
+    path.data = p + 1;
+
+    for (p = last; p > path.data && *(p - 1) != ' '; p--) { /* void */ }
+
+    if (p == path.data) {
+        goto invalid;
+    }
+
+    path.len = p - 1 - path.data;
+
+    ngx_str_null(&host);
+
+    /* 1 + 2 * NGX_HTTP_V2_INT_OCTETS for each field, see table_encode() */
+
+    size = 1 + NGX_HTTP_V2_INT_OCTETS
+           + 4 * (1 + 2 * NGX_HTTP_V2_INT_OCTETS)
+           + method_name.len + method.len + scheme_name.len + scheme.len
+           + authority_name.len + path_name.len + path.len;
+
+    for (pos = last + 2; pos < end + 2; pos = p + 2) {
+        p = ngx_strlcasestrn(pos, end + 2, (u_char *) CRLF, 2 - 1);
+        size += 1 + 2 * NGX_HTTP_V2_INT_OCTETS + (p - pos);
+
+        /* the host is needed in advance, ":authority" precedes the fields */
+
+        if (host.data == NULL
+            && p - pos >= (ssize_t) sizeof("host:") - 1
+            && ngx_strncasecmp(pos, (u_char *) "host:", 5) == 0)
+        {
+            for (host.data = pos + 5; host.data < p; host.data++) {
+                if (*host.data != ' ') {
+                    break;
+                }
+            }
+
+            host.len = p - host.data;
+        }
+    }
+
+    block = ngx_alloc(size, st->c.log);
+    if (block == NULL) {
+        return NGX_ERROR;
+    }
+
+    st->body_rest = 0;
+
+    /* only the table size update has to precede the fields */
+
+    p = ngx_http_v2_table_size_update(&hc->h2c, block);
+
+    p = ngx_http_v2_table_encode(&hc->h2c, p, NGX_HTTP_V2_METHOD_GET_INDEX,
+                                 &method_name, &method, 1);
+    p = ngx_http_v2_table_encode(&hc->h2c, p, NGX_HTTP_V2_SCHEME_HTTP_INDEX,
+                                 &scheme_name, &scheme, 1);
+
+    if (host.len) {
+        p = ngx_http_v2_table_encode(&hc->h2c, p, NGX_HTTP_V2_AUTHORITY_INDEX,
+                                     &authority_name, &host, 1);
+    }
+
+    p = ngx_http_v2_table_encode(&hc->h2c, p, NGX_HTTP_V2_PATH_INDEX,
+                                 &path_name, &path, 0);
+
+    for (pos = last + 2; pos < end + 2; pos += 2) {
+        last = ngx_strlcasestrn(pos, end + 2, (u_char *) CRLF, 2 - 1);
+
+        colon = ngx_strlchr(pos, last, ':');
+        if (colon == NULL) {
+            ngx_free(block);
+            goto invalid;
+        }
+
+        name.data = pos;
+        name.len = colon - pos;
+
+        for (colon++; colon < last && *colon == ' '; colon++) { /* void */ }
+
+        value.data = colon;
+        value.len = last - colon;
+
+        pos = last;
+
+        /* the connection specific header fields are not allowed in HTTP/2 */
+
+        indexing = 1;
+
+        switch (name.len) {
+
+        case sizeof("te") - 1:
+            if (ngx_strncasecmp(name.data, (u_char *) "te", 2) == 0
+                && (value.len != sizeof("trailers") - 1
+                    || ngx_strncasecmp(value.data, (u_char *) "trailers",
+                                       value.len) != 0))
+            {
+                continue;
+            }
+
+            break;
+
+        case sizeof("host") - 1:
+            if (ngx_strncasecmp(name.data, (u_char *) "host", 4) == 0) {
+                continue;
+            }
+
+            break;
+
+        case sizeof("upgrade") - 1:
+            if (ngx_strncasecmp(name.data, (u_char *) "upgrade", 7) == 0) {
+                continue;
+            }
+
+            break;
+
+        case sizeof("connection") - 1:  /* and "keep-alive" */
+            if (ngx_strncasecmp(name.data, (u_char *) "connection", 10) == 0
+                || ngx_strncasecmp(name.data, (u_char *) "keep-alive", 10)
+                   == 0)
+            {
+                continue;
+            }
+
+            break;
+
+        case sizeof("content-length") - 1:
+            if (ngx_strncasecmp(name.data, (u_char *) "content-length", 14)
+                == 0)
+            {
+                st->body_rest = ngx_atoof(value.data, value.len);
+
+                if (st->body_rest == NGX_ERROR) {
+                    ngx_free(block);
+                    goto invalid;
+                }
+
+                indexing = 0;
+            }
+
+            break;
+
+        case sizeof("proxy-connection") - 1:
+            if (ngx_strncasecmp(name.data, (u_char *) "proxy-connection", 16)
+                == 0)
+            {
+                continue;
+            }
+
+            break;
+
+        case sizeof("transfer-encoding") - 1:
+            if (ngx_strncasecmp(name.data, (u_char *) "transfer-encoding", 17)
+                == 0)
+            {
+                continue;
+            }
+
+            break;
+        }
+
+        p = ngx_http_v2_table_encode(&hc->h2c, p, 0, &name, &value, indexing);
+    }
+
+    /* the block is split into frames of the default size */
+
+    st->sid = hc->next_sid;
+    hc->next_sid += 2;
+
+    if (hc->next_sid > NGX_HTTP_V2_UPSTREAM_MAX_SID) {
+        hc->goaway = 1;
+    }
+
+    len = p - block;
+    pos = block;
+    type = NGX_HTTP_V2_HEADERS_FRAME;
+    flags = st->body_rest ? NGX_HTTP_V2_NO_FLAG : NGX_HTTP_V2_END_STREAM_FLAG;
+
+    do {
+        size = ngx_min(len, NGX_HTTP_V2_DEFAULT_FRAME_SIZE);
+
+        if (size == len) {
+            flags |= NGX_HTTP_V2_END_HEADERS_FLAG;
+        }
+
+        frame = ngx_http_v2_upstream_frame(hc, size, type, flags, st->sid);
+        if (frame == NULL) {
+            ngx_free(block);
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(frame, pos, size);
+
+        pos += size;
+        len -= size;
+
+        type = NGX_HTTP_V2_CONTINUATION_FRAME;
+        flags = NGX_HTTP_V2_NO_FLAG;
+
+    } while (len);
+
+    ngx_free(block);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, st->c.log, 0,
+                   "http2 upstream stream sid:%ui \"%V\" body:%O",
+                   st->sid, &path, st->body_rest);
+
+    st->headers_sent = 1;
+    st->send_window = hc->init_window;
+
+    if (st->body_rest == 0) {
+        st->out_closed = 1;
+    }
+
+    b->pos = end + 4;
+
+    return NGX_OK;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ALERT, st->c.log, 0,
+                  "cannot convert request header to http2");
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_send_data(ngx_http_v2_upstream_stream_t *st,
+    ngx_buf_t *b)
+{
+    u_char                       *p;
+    off_t                         size;
+    ssize_t                       n;
+    ngx_uint_t                    flags;
+    ngx_http_v2_upstream_conn_t  *hc;
+
+    hc = st->hc;
+
+    for ( ;; ) {
+        size = ngx_buf_size(b);
+
+        if (size == 0) {
+            return NGX_OK;
+        }
+
+        if (st->out_closed) {
+
+            /* the body is not needed anymore */
+
+            b->pos = b->last;
+            b->file_pos = b->file_last;
+
+            return NGX_OK;
+        }
+
+        if (st->send_window <= 0
+            || hc->send_window == 0
+            || hc->out_size >= NGX_HTTP_V2_UPSTREAM_OUTPUT_LIMIT)
+        {
+            return NGX_AGAIN;
+        }
+
+        size = ngx_min(size, st->body_rest);
+        size = ngx_min(size, st->send_window);
+        size = ngx_min(size, (off_t) hc->send_window);
+        size = ngx_min(size, NGX_HTTP_V2_DEFAULT_FRAME_SIZE);
+
+        flags = (size == st->body_rest) ? NGX_HTTP_V2_END_STREAM_FLAG
+                                        : NGX_HTTP_V2_NO_FLAG;
+
+        p = ngx_http_v2_upstream_frame(hc, (size_t) size,
+                                       NGX_HTTP_V2_DATA_FRAME, flags, st->sid);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (ngx_buf_in_memory(b)) {
+            ngx_memcpy(p, b->pos, (size_t) size);
+            b->pos += size;
+
+            if (b->in_file) {
+                b->file_pos += size;
+            }
+
+        } else {
+            n = ngx_read_file(b->file, p, (size_t) size, b->file_pos);
+
+            if (n != (ssize_t) size) {
+
+                /* the frame is queued already */
+
+                if (n != NGX_ERROR) {
+                    ngx_log_error(NGX_LOG_CRIT, st->c.log, 0,
+                                  ngx_read_file_n " read only %z of %O from "
+                                  "\"%s\"", n, size, b->file->name.data);
+                }
+
+                ngx_http_v2_upstream_close(hc);
+                return NGX_ERROR;
+            }
+
+            b->file_pos += size;
+        }
+
+        st->send_window -= size;
+        hc->send_window -= size;
+        st->body_rest -= size;
+
+        if (flags & NGX_HTTP_V2_END_STREAM_FLAG) {
+            st->out_closed = 1;
+        }
+    }
+}
+
+
+static ngx_http_v2_upstream_stream_t *
+ngx_http_v2_upstream_find_stream(ngx_http_v2_upstream_conn_t *hc,
+    ngx_uint_t sid)
+{
+    ngx_queue_t                    *q;
+    ngx_http_v2_upstream_stream_t  *st;
+
+    for (q = ngx_queue_head(&hc->streams);
+         q != ngx_queue_sentinel(&hc->streams);
+         q = ngx_queue_next(q))
+    {
+        st = ngx_queue_data(q, ngx_http_v2_upstream_stream_t, queue);
+
+        if (st->sid == sid) {
+            return st;
+        }
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_v2_upstream_reset_stream(ngx_http_v2_upstream_stream_t *st,
+    ngx_uint_t status)
+{
+    u_char  *p;
+
+    st->reset = 1;
+    st->out_closed = 1;
+
+    p = ngx_http_v2_upstream_frame(st->hc, NGX_HTTP_V2_RST_STREAM_SIZE,
+                                   NGX_HTTP_V2_RST_STREAM_FRAME,
+                                   NGX_HTTP_V2_NO_FLAG, st->sid);
+    if (p) {
+        (void) ngx_http_v2_write_uint32(p, status);
+    }
+
+    ngx_http_v2_upstream_wake(&st->read);
+    ngx_http_v2_upstream_wake(&st->write);
+}
+
+
+static void
+ngx_http_v2_upstream_close_stream(ngx_http_v2_upstream_stream_t *st)
+{
+    u_char                       *p;
+    ngx_connection_t             *c;
+    ngx_http_v2_upstream_buf_t   *b;
+    ngx_http_v2_upstream_conn_t  *hc;
+
+    c = &st->c;
+    hc = st->hc;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http2 upstream close stream %p sid:%ui", st, st->sid);
+
+    if (st->read.timer_set) {
+        ngx_del_timer(&st->read, NGX_FUNC_LINE);
+    }
+
+    if (st->write.timer_set) {
+        ngx_del_timer(&st->write, NGX_FUNC_LINE);
+    }
+
+    if (st->read.posted) {
+        ngx_delete_posted_event(&st->read);
+    }
+
+    if (st->write.posted) {
+        ngx_delete_posted_event(&st->write);
+    }
+
+    while (st->in) {
+        b = st->in;
+        st->in = b->next;
+        ngx_http_v2_upstream_free_buf(hc, b);
+    }
+
+    if (c->pool) {
+        ngx_destroy_pool(c->pool);
+    }
+
+    if (hc) {
+        if (st->sid && !st->reset && !(st->in_closed && st->out_closed)) {
+            p = ngx_http_v2_upstream_frame(hc, NGX_HTTP_V2_RST_STREAM_SIZE,
+                                           NGX_HTTP_V2_RST_STREAM_FRAME,
+                                           NGX_HTTP_V2_NO_FLAG, st->sid);
+            if (p) {
+                (void) ngx_http_v2_write_uint32(p, NGX_HTTP_V2_CANCEL);
+            }
+        }
+
+        ngx_queue_remove(&st->queue);
+        hc->nstreams--;
+
+        ngx_http_v2_upstream_post(hc);
+
+        if (hc->nstreams == 0) {
+            ngx_http_v2_upstream_idle(hc);
+        }
+    }
+
+    ngx_free(st);
+}
+
+
+static void
+ngx_http_v2_upstream_wake(ngx_event_t *ev)
+{
+    ev->ready = 1;
+
+    if (ev->handler && !ev->posted) {
+        ngx_post_event(ev, &ngx_posted_events);
+    }
+}
+
+
+static void
+ngx_http_v2_upstream_wake_blocked(ngx_http_v2_upstream_conn_t *hc)
+{
+    ngx_queue_t                    *q;
+    ngx_http_v2_upstream_stream_t  *st;
+
+    for (q = ngx_queue_head(&hc->streams);
+         q != ngx_queue_sentinel(&hc->streams);
+         q = ngx_queue_next(q))
+    {
+        st = ngx_queue_data(q, ngx_http_v2_upstream_stream_t, queue);
+
+        if (st->blocked) {
+            st->blocked = 0;
+            ngx_http_v2_upstream_wake(&st->write);
+        }
+    }
+}
+
+
+static u_char *
+ngx_http_v2_upstream_frame(ngx_http_v2_upstream_conn_t *hc, size_t len,
+    ngx_uint_t type, ngx_uint_t flags, ngx_uint_t sid)
+{
+    u_char  *p;
+
+    p = ngx_http_v2_upstream_reserve(hc, &hc->out, &hc->last_out,
+                                     NGX_HTTP_V2_FRAME_HEADER_SIZE + len);
+    if (p == NULL) {
+        return NULL;
+    }
+
+    hc->out_size += NGX_HTTP_V2_FRAME_HEADER_SIZE + len;
+
+    p = ngx_http_v2_write_uint32(p, len << 8 | type);
+    *p++ = (u_char) flags;
+
+    return ngx_http_v2_write_sid(p, sid);
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_window_frame(ngx_http_v2_upstream_conn_t *hc,
+    ngx_uint_t sid, size_t window)
+{
+    u_char  *p;
+
+    p = ngx_http_v2_upstream_frame(hc, NGX_HTTP_V2_WINDOW_UPDATE_SIZE,
+                                   NGX_HTTP_V2_WINDOW_UPDATE_FRAME,
+                                   NGX_HTTP_V2_NO_FLAG, sid);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    (void) ngx_http_v2_write_uint32(p, window);
+
+    return NGX_OK;
+}
+
+
+/* appends size bytes to a list of buffers, the bytes are never split */
+
+static u_char *
+ngx_http_v2_upstream_reserve(ngx_http_v2_upstream_conn_t *hc,
+    ngx_http_v2_upstream_buf_t **first, ngx_http_v2_upstream_buf_t **last,
+    size_t size)
+{
+    u_char                      *p;
+    ngx_http_v2_upstream_buf_t  *b;
+
+    b = *last;
+
+    if (b == NULL || (size_t) (b->end - b->last) < size) {
+
+        if (size <= NGX_HTTP_V2_UPSTREAM_BUFFER_SIZE && hc->free) {
+            b = hc->free;
+            hc->free = b->next;
+            hc->nfree--;
+
+        } else {
+            b = ngx_alloc(sizeof(ngx_http_v2_upstream_buf_t)
+                          + ngx_max(size, NGX_HTTP_V2_UPSTREAM_BUFFER_SIZE),
+                          hc->connection->log);
+            if (b == NULL) {
+                return NULL;
+            }
+
+            b->end = ngx_http_v2_upstream_buf_start(b)
+                     + ngx_max(size, NGX_HTTP_V2_UPSTREAM_BUFFER_SIZE);
+        }
+
+        b->pos = ngx_http_v2_upstream_buf_start(b);
+        b->last = b->pos;
+        b->next = NULL;
+
+        if (*last) {
+            (*last)->next = b;
+
+        } else {
+            *first = b;
+        }
+
+        *last = b;
+    }
+
+    p = b->last;
+    b->last += size;
+
+    return p;
+}
+
+
+static void
+ngx_http_v2_upstream_free_buf(ngx_http_v2_upstream_conn_t *hc,
+    ngx_http_v2_upstream_buf_t *b)
+{
+    if (hc == NULL
+        || hc->nfree >= NGX_HTTP_V2_UPSTREAM_FREE_BUFS
+        || b->end - ngx_http_v2_upstream_buf_start(b)
+           != NGX_HTTP_V2_UPSTREAM_BUFFER_SIZE)
+    {
+        ngx_free(b);
+        return;
+    }
+
+    b->next = hc->free;
+    hc->free = b;
+    hc->nfree++;
+}
@@ -276,6 +276,24 @@ ngx_file_aio_read(ngx_file_t *file, u_char *buf, size_t size, off_t offset,
         return NGX_ERROR;
     }
 
+#if (NGX_HAVE_IO_URING)
+
+    if (ngx_event_flags & NGX_USE_IO_URING_EVENT) {
+        ev->handler = ngx_file_aio_event_handler;
+
+        if (ngx_io_uring_aio_read(ev, file->fd, buf, size, offset) != NGX_OK) {
+            return ngx_read_file(file, buf, size, offset);
+        }
+
+        ev->active = 1;
+        ev->ready = 0;
+        ev->complete = 0;
+
+        return NGX_AGAIN;
+    }
+
+#endif
+
     ngx_memzero(&aio->aiocb, sizeof(struct iocb));
     /*
     ע⣬aio_dataѾΪngx_event_t¼ָ룬io_geteventsȡio_eventеdataҲָ
@@ -90,6 +90,12 @@ extern ssize_t sendfile(int s, int fd, int32_t *offset, size_t size);
 #if (NGX_HAVE_SYS_EVENTFD_H)
 #include <sys/eventfd.h>
 #endif
+
+
+#if (NGX_HAVE_IO_URING)
+#include <poll.h>
+#include <linux/io_uring.h>
+#endif
 #include <sys/syscall.h>
 #if (NGX_HAVE_FILE_AIO)
 #include <linux/aio_abi.h>
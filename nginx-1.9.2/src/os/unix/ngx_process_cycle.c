@@ -25,6 +25,7 @@ static void ngx_worker_process_exit(ngx_cycle_t *cycle);
 static void ngx_channel_handler(ngx_event_t *ev);
 static void ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data);
 static void ngx_cache_manager_process_handler(ngx_event_t *ev);
+static ngx_uint_t ngx_cache_manager_busy(ngx_cycle_t *cycle);
 static void ngx_cache_loader_process_handler(ngx_event_t *ev);
 
 //如果是第一次加载，则满足ngx_is_init_cycle。如果是reload热启动，则原来的nginx进程的ngx_process == NGX_PROCESS_MASTER
@@ -1133,8 +1134,7 @@ ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data) //data表示这是第
 
             ngx_event_cancel_timers();
 
-            if (ngx_event_timer_rbtree.root == ngx_event_timer_rbtree.sentinel)
-            {
+            if (ngx_event_timers_empty()) {
                 ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, "exiting");
 
                 ngx_worker_process_exit(cycle); 
@@ -1305,6 +1305,10 @@ ngx_worker_process_init(ngx_cycle_t *cycle, ngx_int_t worker)
         ls[i].previous = NULL;
     }
 
+    if (worker >= 0 && ccf->slab_magazine_size > 0) {
+        ngx_slab_magazines_init((ngx_uint_t) ccf->slab_magazine_size);
+    }
+
     for (i = 0; ngx_modules[i]; i++) {
         if (ngx_modules[i]->init_process) {
             if (ngx_modules[i]->init_process(cycle) == NGX_ERROR) { //ngx_event_process_init等
@@ -1408,6 +1412,8 @@ ngx_worker_process_exit(ngx_cycle_t *cycle)
         }
     }
 
+    ngx_slab_magazines_flush();
+
     if (ngx_exiting) {
         c = cycle->connections;
         for (i = 0; i < cycle->connection_n; i++) {
@@ -1596,6 +1602,16 @@ ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data)
 
         if (ngx_terminate || ngx_quit) {
             ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, "exiting");
+
+            /*
+             * the tasks of a manager hold references to cache nodes
+             * in shared memory, which are released on task completion
+             */
+
+            while (ngx_cache_manager_busy(cycle)) {
+                ngx_process_events_and_timers(cycle);
+            }
+
             exit(0);
         }
 
@@ -1609,6 +1625,23 @@ ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data)
     }
 }
 
+
+static ngx_uint_t
+ngx_cache_manager_busy(ngx_cycle_t *cycle)
+{
+    ngx_uint_t    i;
+    ngx_path_t  **path;
+
+    path = cycle->paths.elts;
+    for (i = 0; i < cycle->paths.nelts; i++) {
+        if (path[i]->busy) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
 /*
 在Nginx中，如果启用了proxy(fastcgi) cache功能，master process会在启动的时候启动管理缓存的两个子进程(区别于处理请求的子进程)来管理内
 存和磁盘的缓存个体。第一个进程的功能是定期检查缓存，并将过期的缓存删除；第二个进程的作用是在启动的时候将磁盘中已经缓存的个
@@ -24,6 +24,10 @@ typedef struct {
     ngx_flag_t                       proxy_protocol;
     ngx_addr_t                      *local;
 
+#if (NGX_HAVE_SPLICE)
+    ngx_flag_t                       splice;
+#endif
+
 #if (NGX_STREAM_SSL)
     ngx_flag_t                       ssl_enable;
     ngx_flag_t                       ssl_session_reuse;
@@ -56,6 +60,13 @@ static void ngx_stream_proxy_connect_handler(ngx_event_t *ev);
 static ngx_int_t ngx_stream_proxy_test_connect(ngx_connection_t *c);
 static ngx_int_t ngx_stream_proxy_process(ngx_stream_session_t *s,
     ngx_uint_t from_upstream, ngx_uint_t do_write);
+#if (NGX_HAVE_SPLICE)
+static ngx_stream_upstream_pipe_t *ngx_stream_proxy_create_pipe(
+    ngx_stream_session_t *s, size_t size);
+static void ngx_stream_proxy_close_pipe(void *data);
+static ngx_int_t ngx_stream_proxy_splice(ngx_stream_session_t *s,
+    ngx_uint_t from_upstream, ngx_uint_t do_write);
+#endif
 static void ngx_stream_proxy_next_upstream(ngx_stream_session_t *s);
 static void ngx_stream_proxy_finalize(ngx_stream_session_t *s, ngx_int_t rc);
 static u_char *ngx_stream_proxy_log_error(ngx_log_t *log, u_char *buf,
@@ -192,6 +203,17 @@ proxy_set_header Host $host;
       offsetof(ngx_stream_proxy_srv_conf_t, proxy_protocol),
       NULL },
 
+#if (NGX_HAVE_SPLICE)
+
+    { ngx_string("proxy_splice"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      offsetof(ngx_stream_proxy_srv_conf_t, splice),
+      NULL },
+
+#endif
+
 #if (NGX_STREAM_SSL)
 
     { ngx_string("proxy_ssl"),
@@ -532,6 +554,30 @@ ngx_stream_proxy_init_upstream(ngx_stream_session_t *s)
     u->upstream_buf.pos = p;
     u->upstream_buf.last = p;
 
+#if (NGX_HAVE_SPLICE)
+
+    /* SSL data has to pass through user space, so buffers are used */
+
+    if (pscf->splice
+#if (NGX_STREAM_SSL)
+        && c->ssl == NULL
+        && pc->ssl == NULL
+#endif
+       )
+    {
+        u->downstream_pipe = ngx_stream_proxy_create_pipe(s,
+                                                  pscf->downstream_buf_size);
+        u->upstream_pipe = ngx_stream_proxy_create_pipe(s,
+                                                  pscf->upstream_buf_size);
+
+        if (u->downstream_pipe == NULL || u->upstream_pipe == NULL) {
+            u->downstream_pipe = NULL;
+            u->upstream_pipe = NULL;
+        }
+    }
+
+#endif
+
     pc->read->handler = ngx_stream_proxy_upstream_handler;
     pc->write->handler = ngx_stream_proxy_upstream_handler;
 
@@ -964,7 +1010,7 @@ static ngx_int_t
 ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
     ngx_uint_t do_write)
 {
-    size_t                        size;
+    size_t                        size, pending;
     ssize_t                       n;
     ngx_buf_t                    *b;
     ngx_uint_t                    flags;
@@ -972,6 +1018,9 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
     ngx_log_handler_pt            handler;
     ngx_stream_upstream_t        *u;
     ngx_stream_proxy_srv_conf_t  *pscf;
+#if (NGX_HAVE_SPLICE)
+    ngx_stream_upstream_pipe_t   *pp;
+#endif
 
     u = s->upstream;
 
@@ -989,6 +1038,10 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
         b = &u->downstream_buf;
     }
 
+#if (NGX_HAVE_SPLICE)
+    pp = from_upstream ? u->upstream_pipe : u->downstream_pipe;
+#endif
+
     for ( ;; ) {
 
         if (do_write) {
@@ -1017,8 +1070,12 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
 
         size = b->end - b->last;
 
-        if (size && src->read->ready) {
-
+        if (size && src->read->ready
+#if (NGX_HAVE_SPLICE)
+            && pp == NULL
+#endif
+           )
+        {
             n = src->recv(src, b->last, size);
 
             if (n == NGX_AGAIN || n == 0) {
@@ -1046,9 +1103,26 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
         break;
     }
 
+    pending = b->last - b->pos;
+
+#if (NGX_HAVE_SPLICE)
+
+    /* data read before the upstream was connected is sent first */
+
+    if (pp && pending == 0) {
+        if (ngx_stream_proxy_splice(s, from_upstream, do_write) != NGX_OK) {
+            ngx_stream_proxy_finalize(s, NGX_DECLINED);
+            return NGX_ERROR;
+        }
+
+        pending = pp->size;
+    }
+
+#endif
+
     pscf = ngx_stream_get_module_srv_conf(s, ngx_stream_proxy_module);
 
-    if (src->read->eof && (b->pos == b->last || (dst && dst->read->eof))) {
+    if (src->read->eof && (pending == 0 || (dst && dst->read->eof))) {
         handler = c->log->handler;
         c->log->handler = NULL;
 
@@ -1085,6 +1159,208 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
 }
 
 
+#if (NGX_HAVE_SPLICE)
+
+static ngx_stream_upstream_pipe_t *
+ngx_stream_proxy_create_pipe(ngx_stream_session_t *s, size_t size)
+{
+    int                          n;
+    ngx_connection_t            *c;
+    ngx_pool_cleanup_t          *cln;
+    ngx_stream_upstream_pipe_t  *pp;
+
+    c = s->connection;
+
+    cln = ngx_pool_cleanup_add(c->pool, sizeof(ngx_stream_upstream_pipe_t));
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    pp = cln->data;
+
+    if (pipe(pp->fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, c->log, ngx_errno, "pipe() failed");
+        return NULL;
+    }
+
+    cln->handler = ngx_stream_proxy_close_pipe;
+
+    if (ngx_nonblocking(pp->fd[0]) == -1
+        || ngx_nonblocking(pp->fd[1]) == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, c->log, ngx_errno,
+                      ngx_nonblocking_n " failed");
+        return NULL;
+    }
+
+    /* the pipe is sized like the buffer it replaces */
+
+    n = fcntl(pp->fd[1], F_SETPIPE_SZ, (int) size);
+
+    if (n == -1) {
+        n = fcntl(pp->fd[1], F_GETPIPE_SZ);
+
+        if (n == -1) {
+            ngx_log_error(NGX_LOG_ALERT, c->log, ngx_errno,
+                          "fcntl(F_GETPIPE_SZ) failed");
+            return NULL;
+        }
+    }
+
+    pp->size = 0;
+    pp->capacity = n;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_STREAM, c->log, 0,
+                   "stream proxy pipe: %d:%d, capacity:%uz",
+                   pp->fd[0], pp->fd[1], pp->capacity);
+
+    return pp;
+}
+
+
+static void
+ngx_stream_proxy_close_pipe(void *data)
+{
+    ngx_stream_upstream_pipe_t  *pp = data;
+
+    if (close(pp->fd[0]) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "close() pipe failed");
+    }
+
+    if (close(pp->fd[1]) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "close() pipe failed");
+    }
+}
+
+
+static ngx_int_t
+ngx_stream_proxy_splice(ngx_stream_session_t *s, ngx_uint_t from_upstream,
+    ngx_uint_t do_write)
+{
+    size_t                       size;
+    ssize_t                      n;
+    ngx_err_t                    err;
+    ngx_connection_t            *src, *dst;
+    ngx_stream_upstream_t       *u;
+    ngx_stream_upstream_pipe_t  *pp;
+
+    u = s->upstream;
+
+    if (from_upstream) {
+        src = u->peer.connection;
+        dst = s->connection;
+        pp = u->upstream_pipe;
+
+    } else {
+        src = s->connection;
+        dst = u->peer.connection;
+        pp = u->downstream_pipe;
+    }
+
+    for ( ;; ) {
+
+        if (do_write && pp->size && dst->write->ready) {
+
+            n = splice(pp->fd[0], NULL, dst->fd, NULL, pp->size,
+                       SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_STREAM, dst->log, 0,
+                           "splice to %d: %z", dst->fd, n);
+
+            if (n == -1) {
+                err = ngx_socket_errno;
+
+                if (err != NGX_EAGAIN && err != NGX_EINTR) {
+                    dst->write->error = 1;
+                    ngx_connection_error(dst, err, "splice() failed");
+                    return NGX_ERROR;
+                }
+
+                if (err == NGX_EAGAIN) {
+                    dst->write->ready = 0;
+                }
+
+            } else {
+                pp->size -= n;
+                dst->sent += n;
+            }
+        }
+
+        size = pp->capacity - pp->size;
+
+        if (size == 0 || !src->read->ready) {
+            break;
+        }
+
+        n = splice(src->fd, NULL, pp->fd[1], NULL, size,
+                   SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+        ngx_log_debug3(NGX_LOG_DEBUG_STREAM, src->log, 0,
+                       "splice from %d: %z of %uz", src->fd, n, size);
+
+        if (n > 0) {
+            if (from_upstream) {
+                u->received += n;
+
+            } else {
+                s->received += n;
+            }
+
+            pp->size += n;
+            do_write = 1;
+            continue;
+        }
+
+        if (n == 0) {
+            src->read->ready = 0;
+            src->read->eof = 1;
+            break;
+        }
+
+        err = ngx_socket_errno;
+
+        if (err == NGX_EINTR) {
+            continue;
+        }
+
+        if (err == NGX_EAGAIN) {
+
+            /*
+             * the pipe capacity is counted in pages, so a non-empty pipe
+             * may have no free slots left while the socket still has data;
+             * only an empty pipe means that the socket was drained
+             */
+
+            if (pp->size == 0) {
+                src->read->ready = 0;
+                break;
+            }
+
+            if (dst->write->ready) {
+                do_write = 1;
+                continue;
+            }
+
+            break;
+        }
+
+        src->read->ready = 0;
+        src->read->error = 1;
+        src->read->eof = 1;
+
+        ngx_connection_error(src, err, "splice() failed");
+
+        break;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
 static void
 ngx_stream_proxy_next_upstream(ngx_stream_session_t *s)
 {
@@ -1247,6 +1523,10 @@ ngx_stream_proxy_create_srv_conf(ngx_conf_t *cf)
     conf->proxy_protocol = NGX_CONF_UNSET;
     conf->local = NGX_CONF_UNSET_PTR;
 
+#if (NGX_HAVE_SPLICE)
+    conf->splice = NGX_CONF_UNSET;
+#endif
+
 #if (NGX_STREAM_SSL)
     conf->ssl_enable = NGX_CONF_UNSET;
     conf->ssl_session_reuse = NGX_CONF_UNSET;
@@ -1290,6 +1570,10 @@ ngx_stream_proxy_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_ptr_value(conf->local, prev->local, NULL);
 
+#if (NGX_HAVE_SPLICE)
+    ngx_conf_merge_value(conf->splice, prev->splice, 0);
+#endif
+
 #if (NGX_STREAM_SSL)
 
     ngx_conf_merge_value(conf->ssl_enable, prev->ssl_enable, 0);
@@ -78,10 +78,25 @@ struct ngx_stream_upstream_srv_conf_s {
 };
 
 
+#if (NGX_HAVE_SPLICE)
+
+typedef struct {
+    ngx_fd_t                           fd[2];
+    size_t                             size;      /* bytes in the pipe */
+    size_t                             capacity;
+} ngx_stream_upstream_pipe_t;
+
+#endif
+
+
 typedef struct {
     ngx_peer_connection_t              peer;
     ngx_buf_t                          downstream_buf;
     ngx_buf_t                          upstream_buf;
+#if (NGX_HAVE_SPLICE)
+    ngx_stream_upstream_pipe_t        *downstream_pipe;
+    ngx_stream_upstream_pipe_t        *upstream_pipe;
+#endif
     off_t                              received;
 #if (NGX_STREAM_SSL)
     ngx_str_t                          ssl_name;
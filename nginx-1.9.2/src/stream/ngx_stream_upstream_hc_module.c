@@ -0,0 +1,496 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_stream.h>
+
+
+/*
+ * Active TCP connect checks of stream upstream peers, see
+ * ngx_http_upstream_hc_module.c: a probe is made by the worker that
+ * first moves the peer's "hc_checked" stamp forward, so with the "zone"
+ * directive each peer is probed once per interval.
+ */
+
+
+typedef struct {
+    ngx_msec_t                          interval;
+    ngx_msec_t                          timeout;
+    ngx_uint_t                          fails;
+    ngx_uint_t                          passes;
+} ngx_stream_upstream_hc_srv_conf_t;
+
+
+typedef struct ngx_stream_upstream_hc_s  ngx_stream_upstream_hc_t;
+
+typedef struct {
+    ngx_stream_upstream_hc_t           *hc;
+    ngx_stream_upstream_rr_peers_t     *peers;
+    ngx_stream_upstream_rr_peer_t      *peer;
+    ngx_peer_connection_t               pc;
+    ngx_uint_t                          busy;   /* unsigned  busy:1; */
+} ngx_stream_upstream_hc_peer_t;
+
+
+struct ngx_stream_upstream_hc_s {
+    ngx_stream_upstream_hc_srv_conf_t  *conf;
+    ngx_event_t                         event;
+    ngx_uint_t                          npeers;
+    ngx_stream_upstream_hc_peer_t      *peer;
+};
+
+
+static ngx_int_t ngx_stream_upstream_hc_init_process(ngx_cycle_t *cycle);
+static ngx_int_t ngx_stream_upstream_hc_init_upstream(ngx_cycle_t *cycle,
+    ngx_stream_upstream_srv_conf_t *uscf);
+static void ngx_stream_upstream_hc_timer_handler(ngx_event_t *ev);
+static void ngx_stream_upstream_hc_probe(ngx_stream_upstream_hc_peer_t *hp);
+static void ngx_stream_upstream_hc_handler(ngx_event_t *ev);
+static void ngx_stream_upstream_hc_done(ngx_stream_upstream_hc_peer_t *hp,
+    ngx_uint_t ok);
+
+static void *ngx_stream_upstream_hc_create_conf(ngx_conf_t *cf);
+static char *ngx_stream_upstream_health_check(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+
+
+static ngx_command_t  ngx_stream_upstream_hc_commands[] = {
+
+    { ngx_string("health_check"),
+      NGX_STREAM_UPS_CONF|NGX_CONF_ANY,
+      ngx_stream_upstream_health_check,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_stream_module_t  ngx_stream_upstream_hc_module_ctx = {
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_stream_upstream_hc_create_conf,    /* create server configuration */
+    NULL,                                  /* merge server configuration */
+};
+
+
+ngx_module_t  ngx_stream_upstream_hc_module = {
+    NGX_MODULE_V1,
+    &ngx_stream_upstream_hc_module_ctx,    /* module context */
+    ngx_stream_upstream_hc_commands,       /* module directives */
+    NGX_STREAM_MODULE,                     /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    ngx_stream_upstream_hc_init_process,   /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_stream_upstream_hc_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                          i;
+    ngx_stream_upstream_srv_conf_t    **uscfp;
+    ngx_stream_upstream_main_conf_t    *umcf;
+    ngx_stream_upstream_hc_srv_conf_t  *hcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    umcf = ngx_stream_cycle_get_module_main_conf(cycle,
+                                                 ngx_stream_upstream_module);
+
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL || uscfp[i]->peer.data == NULL) {
+            continue;
+        }
+
+        hcf = ngx_stream_conf_upstream_srv_conf(uscfp[i],
+                                                ngx_stream_upstream_hc_module);
+
+        if (hcf->interval == NGX_CONF_UNSET_MSEC) {
+            continue;
+        }
+
+        if (ngx_stream_upstream_hc_init_upstream(cycle, uscfp[i]) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_upstream_hc_init_upstream(ngx_cycle_t *cycle,
+    ngx_stream_upstream_srv_conf_t *uscf)
+{
+    ngx_uint_t                          n;
+    ngx_stream_upstream_hc_t           *hc;
+    ngx_stream_upstream_rr_peer_t      *peer;
+    ngx_stream_upstream_rr_peers_t     *peers;
+    ngx_stream_upstream_hc_peer_t      *hp;
+    ngx_stream_upstream_hc_srv_conf_t  *hcf;
+
+    hcf = ngx_stream_conf_upstream_srv_conf(uscf,
+                                            ngx_stream_upstream_hc_module);
+
+    n = 0;
+
+    for (peers = uscf->peer.data; peers; peers = peers->next) {
+        n += peers->number;
+    }
+
+    hc = ngx_pcalloc(cycle->pool, sizeof(ngx_stream_upstream_hc_t));
+    if (hc == NULL) {
+        return NGX_ERROR;
+    }
+
+    hc->peer = ngx_pcalloc(cycle->pool,
+                           n * sizeof(ngx_stream_upstream_hc_peer_t));
+    if (hc->peer == NULL) {
+        return NGX_ERROR;
+    }
+
+    hc->conf = hcf;
+
+    for (peers = uscf->peer.data; peers; peers = peers->next) {
+        for (peer = peers->peer; peer; peer = peer->next) {
+            hp = &hc->peer[hc->npeers++];
+
+            hp->hc = hc;
+            hp->peers = peers;
+            hp->peer = peer;
+        }
+    }
+
+    hc->event.handler = ngx_stream_upstream_hc_timer_handler;
+    hc->event.data = hc;
+    hc->event.log = cycle->log;
+    hc->event.cancelable = 1;
+
+    ngx_add_timer(&hc->event, (ngx_msec_t) ngx_random() % hcf->interval + 1,
+                  NGX_FUNC_LINE);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_stream_upstream_hc_timer_handler(ngx_event_t *ev)
+{
+    ngx_stream_upstream_hc_t *hc = ev->data;
+
+    ngx_uint_t                      i;
+    ngx_msec_t                      now, checked, min;
+    ngx_stream_upstream_rr_peer_t  *peer;
+    ngx_stream_upstream_hc_peer_t  *hp;
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    now = ngx_current_msec;
+    min = hc->conf->interval - hc->conf->interval / 8;
+
+    for (i = 0; i < hc->npeers; i++) {
+        hp = &hc->peer[i];
+        peer = hp->peer;
+
+        if (hp->busy || (peer->down & ~NGX_STREAM_UPSTREAM_RR_HC_DOWN)) {
+            continue;
+        }
+
+        checked = peer->hc_checked;
+
+        if (now - checked < min) {
+            continue;
+        }
+
+        if (!ngx_atomic_cmp_set(&peer->hc_checked, checked, now)) {
+            continue;
+        }
+
+        ngx_stream_upstream_hc_probe(hp);
+    }
+
+    ngx_add_timer(ev, hc->conf->interval, NGX_FUNC_LINE);
+}
+
+
+static void
+ngx_stream_upstream_hc_probe(ngx_stream_upstream_hc_peer_t *hp)
+{
+    ngx_int_t          rc;
+    ngx_connection_t  *c;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_STREAM, ngx_cycle->log, 0,
+                   "health check \"%V\"", &hp->peer->name);
+
+    ngx_memzero(&hp->pc, sizeof(ngx_peer_connection_t));
+
+    hp->pc.sockaddr = hp->peer->sockaddr;
+    hp->pc.socklen = hp->peer->socklen;
+    hp->pc.name = &hp->peer->name;
+    hp->pc.get = ngx_event_get_peer;
+    hp->pc.log = ngx_cycle->log;
+    hp->pc.log_error = NGX_ERROR_INFO;
+
+    rc = ngx_event_connect_peer(&hp->pc);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        ngx_stream_upstream_hc_done(hp, 0);
+        return;
+    }
+
+    hp->busy = 1;
+
+    c = hp->pc.connection;
+
+    c->data = hp;
+    c->log_error = NGX_ERROR_INFO;
+
+    c->write->handler = ngx_stream_upstream_hc_handler;
+    c->read->handler = ngx_stream_upstream_hc_handler;
+
+    if (rc == NGX_OK) {
+        ngx_stream_upstream_hc_done(hp, 1);
+        return;
+    }
+
+    ngx_add_timer(c->write, hp->hc->conf->timeout, NGX_FUNC_LINE);
+}
+
+
+static void
+ngx_stream_upstream_hc_handler(ngx_event_t *ev)
+{
+    int                             err;
+    socklen_t                       len;
+    ngx_connection_t               *c;
+    ngx_stream_upstream_hc_peer_t  *hp;
+
+    c = ev->data;
+    hp = c->data;
+
+    if (ev->timedout) {
+        ngx_log_error(NGX_LOG_INFO, c->log, NGX_ETIMEDOUT,
+                      "health check of \"%V\" timed out", &hp->peer->name);
+        ngx_stream_upstream_hc_done(hp, 0);
+        return;
+    }
+
+#if (NGX_HAVE_KQUEUE)
+
+    if (ngx_event_flags & NGX_USE_KQUEUE_EVENT)  {
+        if (c->write->pending_eof || c->read->pending_eof) {
+            err = c->write->pending_eof ? c->write->kq_errno
+                                        : c->read->kq_errno;
+
+            (void) ngx_connection_error(c, err,
+                                    "kevent() reported that connect() failed");
+            ngx_stream_upstream_hc_done(hp, 0);
+            return;
+        }
+
+    } else
+#endif
+    {
+        err = 0;
+        len = sizeof(int);
+
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len)
+            == -1)
+        {
+            err = ngx_socket_errno;
+        }
+
+        if (err) {
+            (void) ngx_connection_error(c, err, "connect() failed");
+            ngx_stream_upstream_hc_done(hp, 0);
+            return;
+        }
+    }
+
+    if (!c->write->ready) {
+        return;
+    }
+
+    ngx_stream_upstream_hc_done(hp, 1);
+}
+
+
+static void
+ngx_stream_upstream_hc_done(ngx_stream_upstream_hc_peer_t *hp, ngx_uint_t ok)
+{
+    ngx_stream_upstream_rr_peer_t      *peer;
+    ngx_stream_upstream_hc_srv_conf_t  *hcf;
+
+    if (hp->pc.connection) {
+        ngx_close_connection(hp->pc.connection);
+        hp->pc.connection = NULL;
+    }
+
+    hp->busy = 0;
+
+    hcf = hp->hc->conf;
+    peer = hp->peer;
+
+    ngx_stream_upstream_rr_peers_wlock(hp->peers);
+
+    if (ok) {
+        peer->hc_fails = 0;
+
+        if ((peer->down & NGX_STREAM_UPSTREAM_RR_HC_DOWN)
+            && ++peer->hc_passes >= hcf->passes)
+        {
+            peer->down &= ~NGX_STREAM_UPSTREAM_RR_HC_DOWN;
+            peer->hc_passes = 0;
+            peer->fails = 0;
+
+            ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                          "upstream server \"%V\" passed health check",
+                          &peer->name);
+        }
+
+    } else {
+        peer->hc_passes = 0;
+
+        if (!(peer->down & NGX_STREAM_UPSTREAM_RR_HC_DOWN)
+            && ++peer->hc_fails >= hcf->fails)
+        {
+            peer->down |= NGX_STREAM_UPSTREAM_RR_HC_DOWN;
+            peer->hc_fails = 0;
+
+            ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                          "upstream server \"%V\" failed health check",
+                          &peer->name);
+        }
+    }
+
+    ngx_stream_upstream_rr_peers_unlock(hp->peers);
+}
+
+
+static void *
+ngx_stream_upstream_hc_create_conf(ngx_conf_t *cf)
+{
+    ngx_stream_upstream_hc_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_stream_upstream_hc_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    conf->interval = NGX_CONF_UNSET_MSEC;
+
+    return conf;
+}
+
+
+static char *
+ngx_stream_upstream_health_check(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_stream_upstream_hc_srv_conf_t  *hcf = conf;
+
+    ngx_str_t   *value, s;
+    ngx_int_t    n;
+    ngx_uint_t   i;
+
+    if (hcf->interval != NGX_CONF_UNSET_MSEC) {
+        return "is duplicate";
+    }
+
+    hcf->interval = 5000;
+    hcf->timeout = 1000;
+    hcf->fails = 1;
+    hcf->passes = 1;
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "interval=", 9) == 0) {
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            hcf->interval = ngx_parse_time(&s, 0);
+            if (hcf->interval == (ngx_msec_t) NGX_ERROR
+                || hcf->interval == 0)
+            {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "timeout=", 8) == 0) {
+            s.len = value[i].len - 8;
+            s.data = value[i].data + 8;
+
+            hcf->timeout = ngx_parse_time(&s, 0);
+            if (hcf->timeout == (ngx_msec_t) NGX_ERROR || hcf->timeout == 0) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "fails=", 6) == 0) {
+            n = ngx_atoi(&value[i].data[6], value[i].len - 6);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            hcf->fails = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "passes=", 7) == 0) {
+            n = ngx_atoi(&value[i].data[7], value[i].len - 7);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            hcf->passes = n;
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
@@ -37,6 +37,11 @@ struct ngx_stream_upstream_rr_peer_s {
 
     ngx_uint_t                       down;         /* unsigned  down:1; */
 
+    /* active health checks, see ngx_stream_upstream_hc_module.c */
+    ngx_atomic_t                     hc_checked;
+    ngx_uint_t                       hc_fails;
+    ngx_uint_t                       hc_passes;
+
 #if (NGX_STREAM_SSL)
     void                            *ssl_session;
     int                              ssl_session_len;
@@ -50,6 +55,10 @@ struct ngx_stream_upstream_rr_peer_s {
 };
 
 
+/* peer->down is also set by a failed active health check */
+#define NGX_STREAM_UPSTREAM_RR_HC_DOWN  0x02
+
+
 typedef struct ngx_stream_upstream_rr_peers_s  ngx_stream_upstream_rr_peers_t;
 
 struct ngx_stream_upstream_rr_peers_s {